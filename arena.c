@@ -0,0 +1,123 @@
+/*
+ * Arena for the large buffers that are only needed for a while
+ *
+ * Blocks are taken from a single area of XMEM, each for a lifetime such
+ * as an upload or a command from the web-interface. The lifetime is ended
+ * with arena_free(), which returns all its blocks. Blocks are few, they
+ * are kept sorted by their offset and the first gap that is large enough
+ * is used. The highest use since boot is kept, so that ARENA_SIZE can be
+ * checked against what the switch actually needs.
+ */
+
+#include <stdint.h>
+#include "rtl837x_common.h"
+#include "arena.h"
+
+#pragma codeseg BANK2
+#pragma constseg BANK2
+
+__code char * __code arena_lifetimes[ARENA_LIFETIMES] = {
+	"upload", "cmd", "txn"
+};
+
+__xdata uint8_t arena[ARENA_SIZE];
+__xdata struct arena_block arena_blocks[ARENA_BLOCKS];	// Sorted by start
+__xdata uint8_t arena_n;	// Blocks taken
+
+__xdata uint16_t arena_used;
+__xdata uint16_t arena_high;	// Highest arena_used since boot
+__xdata uint16_t arena_fails;	// Blocks refused for lack of room
+
+
+// Returns all blocks, XMEM is not cleared by a reset
+void arena_init(void) __banked
+{
+	arena_n = 0;
+	arena_used = 0;
+	arena_high = 0;
+	arena_fails = 0;
+	for (uint8_t i = 0; i < ARENA_BLOCKS; i++) {
+		arena_blocks[i].start = 0;
+		arena_blocks[i].size = 0;
+		arena_blocks[i].lifetime = 0;
+	}
+}
+
+
+/*
+ * Takes a block of size bytes for the lifetime
+ * Returns the block, 0 if there is no room for it
+ */
+__xdata uint8_t *arena_alloc(uint8_t lifetime, uint16_t size) __banked
+{
+	uint16_t start = 0;
+	uint16_t end;
+	uint8_t i, j;
+
+	if (arena_n == ARENA_BLOCKS)
+		goto full;
+	for (i = 0; ; i++) {
+		end = i < arena_n ? arena_blocks[i].start : ARENA_SIZE;
+		if (end - start >= size)
+			break;
+		if (i == arena_n)
+			goto full;
+		start = arena_blocks[i].start + arena_blocks[i].size;
+	}
+
+	for (j = arena_n; j > i; j--) {
+		arena_blocks[j].start = arena_blocks[j - 1].start;
+		arena_blocks[j].size = arena_blocks[j - 1].size;
+		arena_blocks[j].lifetime = arena_blocks[j - 1].lifetime;
+	}
+	arena_blocks[i].start = start;
+	arena_blocks[i].size = size;
+	arena_blocks[i].lifetime = lifetime;
+	arena_n++;
+
+	arena_used += size;
+	if (arena_used > arena_high)
+		arena_high = arena_used;
+	return arena + start;
+
+full:
+	arena_fails++;
+	return 0;
+}
+
+
+// Ends the lifetime, its blocks are returned to the arena
+void arena_free(uint8_t lifetime) __banked
+{
+	uint8_t i, j = 0;
+
+	for (i = 0; i < arena_n; i++) {
+		if (arena_blocks[i].lifetime == lifetime) {
+			arena_used -= arena_blocks[i].size;
+			continue;
+		}
+		if (i != j) {
+			arena_blocks[j].start = arena_blocks[i].start;
+			arena_blocks[j].size = arena_blocks[i].size;
+			arena_blocks[j].lifetime = arena_blocks[i].lifetime;
+		}
+		j++;
+	}
+	arena_n = j;
+}
+
+
+void arena_print(void) __banked
+{
+	print_string("Arena: "); print_short(ARENA_SIZE);
+	print_string(" used: "); print_short(arena_used);
+	print_string(" high: "); print_short(arena_high);
+	print_string(" refused: "); print_short(arena_fails);
+	write_char('\n');
+	for (uint8_t i = 0; i < arena_n; i++) {
+		print_string("  "); print_short(arena_blocks[i].start);
+		print_string(" "); print_short(arena_blocks[i].size);
+		print_string(" "); print_string(arena_lifetimes[arena_blocks[i].lifetime]);
+		write_char('\n');
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdint.h>
+
+/*
+ * Lifetimes of the blocks taken from the arena. A lifetime ends when what
+ * its blocks serve is over, arena_free() then returns all of them at once
+ */
+#define ARENA_UPLOAD	0	// Upload through /upload or /config
+#define ARENA_CMD	1	// Command from /cmd until its output is sent
+#define ARENA_TXN	2	// Transaction from begin until commit or abort
+#define ARENA_LIFETIMES	3
+
+/*
+ * Size of the arena in XMEM. It is smaller than the buffers of all
+ * lifetimes together, a request that finds no room is refused
+ */
+#define ARENA_SIZE	0x1800
+// Blocks that can be taken at the same time
+#define ARENA_BLOCKS	8
+
+struct arena_block {
+	uint16_t start;		// Offset into the arena
+	uint16_t size;
+	uint8_t lifetime;
+};
+
+extern __xdata uint16_t arena_used;
+extern __xdata uint16_t arena_high;
+extern __xdata uint16_t arena_fails;
+
+void arena_init(void) __banked;
+__xdata uint8_t *arena_alloc(uint8_t lifetime, uint16_t size) __banked;
+void arena_free(uint8_t lifetime) __banked;
+void arena_print(void) __banked;
+
+#endif
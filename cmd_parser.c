@@ -14,6 +14,11 @@
 #include "rtl837x_stp.h"
 #include "rtl837x_igmp.h"
 #include "dhcp.h"
+#include "config_store.h"
+#include "config_format.h"
+#include "log.h"
+#include "arena.h"
+#include "cmd_parser.h"
 #include "uip/uip.h"
 #include "version.h"
 
@@ -39,6 +44,18 @@ extern __xdata struct flash_region_t flash_region;
 extern __xdata char passwd[21];
 
 extern __xdata struct dhcp_state dhcp_state;
+extern __xdata struct timer dhcp_timer;
+
+extern __code struct task tasks[N_TASKS];
+extern __xdata struct task_stat task_stat[N_TASKS];
+extern __xdata uint32_t cpu_missed;
+extern __xdata uint32_t cpu_latency;
+extern __xdata uint32_t cpu_latency_max;
+extern __xdata uint16_t wait_timeouts[WAIT_SITES];
+extern __xdata uint8_t wait_last_site;
+extern __xdata uint16_t wait_last_reg;
+extern __xdata uint32_t wait_last_tick;
+extern __code char * __code wait_sites[WAIT_SITES];
 
 __xdata uint8_t vlan_names[VLAN_NAMES_SIZE];
 __xdata uint16_t vlan_ptr;
@@ -54,6 +71,12 @@ __xdata uint8_t hexvalue[4] = { 0 };
 __xdata uint8_t cmd_buffer[SBUF_SIZE];
 __xdata uint8_t cmd_available;
 
+// Output of the command being run for /cmd, collected by write_char()
+// into CMD_OUT_SIZE bytes of the arena
+__xdata uint8_t cmd_capture;
+__xdata uint8_t * __xdata cmd_out;
+__xdata uint16_t cmd_out_len;
+
 __xdata	uint8_t l;
 __xdata uint8_t line_ptr;
 __xdata	char is_white;
@@ -67,6 +90,33 @@ __xdata signed char cmd_words_b[N_WORDS];
 __xdata uint8_t cmd_history[CMD_HISTORY_SIZE];
 __xdata uint16_t cmd_history_ptr;
 
+// The command changes the switch configuration
+#define CMD_CONFIG 0x01
+// The command is staged while a transaction is open
+#define CMD_STAGE 0x02
+
+// Commands staged by a transaction, one per line, see txn_run()
+// TXN_SIZE bytes of the arena while a transaction is open
+__xdata uint8_t * __xdata txn_buf;
+__xdata uint16_t txn_len;
+__xdata uint8_t txn_state;
+__xdata uint8_t txn_src;	// Source of the commands that opened it, see cmd_source
+__xdata uint8_t txn_failed;	// A command could not be staged, commit is refused
+
+// Source of the command being run, a CMD_ value of cmd_available, 0 for the configuration
+__xdata uint8_t cmd_source;
+
+// Entry of the command tables, see cmd_table[]
+struct cmd {
+	__code char *name;
+	void (*handler)(void);		// Called without sub-command, may be 0
+	__code struct cmd *sub;		// Sorted table of sub-commands
+	uint8_t n_sub;
+	uint8_t args;			// Words needed after the name
+	uint8_t flags;
+	__code char *help;
+};
+
 
 inline uint8_t isletter(uint8_t l)
 {
@@ -704,9 +754,761 @@ void print_sw_version(void) __banked {
 }
 
 
+/*
+ * Compares the read paths of the flash by reading FLASH_BENCH_SIZE bytes
+ * of the image into flash_buf, through the controller and through
+ * the memory mapped window
+ */
+#define FLASH_BENCH_SIZE 0x10000
+void flash_bench(void)
+{
+	__xdata uint32_t t;
+
+	for (uint8_t mmio = 0; mmio < 2; mmio++) {
+		print_string(mmio ? "\nMMIO: " : "\nController: ");
+		t = ticks;
+		for (__xdata uint32_t a = 0; a < FLASH_BENCH_SIZE; a += sizeof(flash_buf)) {
+			flash_region.addr = a;
+			flash_region.len = sizeof(flash_buf);
+			if (mmio)
+				flash_read_mmio(flash_buf);
+			else
+				flash_read_spi(flash_buf);
+		}
+		t = ticks - t;
+		print_long(t); print_string(" ticks, ");
+		print_long(FLASH_BENCH_SIZE * SYS_TICK_HZ / 1024 / (t ? t : 1));
+		print_string(" KB/s");
+	}
+	write_char('\n');
+}
+
+
+void cmd_reset(void)
+{
+	print_string("\nRESET\n\n");
+	reset_chip();
+}
+
+
+void cmd_sfp(void)
+{
+	for (uint8_t sfp = 0; sfp < machine.n_sfp; sfp++) {
+		print_string("\nSlot "); write_char('1' + sfp);
+		print_string(" - Rate: "); print_byte(sfp_read_reg(sfp, 12));
+		print_string("  Encoding: "); print_byte(sfp_read_reg(sfp, 11));
+		print_string("\n");
+		sfp_print_info(sfp);
+		sfp_print_measurements(sfp);
+	}
+}
+
+
+void cmd_stat(void)
+{
+	port_stats_print();
+}
+
+
+void cmd_flash_regs(void)
+{
+	print_string("\nPRINT SECURITY REGISTERS\n");
+	// The following will only show something else than 0xff if it was programmed for a managed switch
+	flash_region.addr = 0x0001000;
+	flash_region.len = 40;
+	flash_read_security();
+	flash_region.addr = 0x0002000;
+	flash_region.len = 40;
+	flash_read_security();
+	flash_region.addr = 0x0003000;
+	flash_region.len = 40;
+	flash_read_security();
+}
+
+
+void cmd_flash_dump(void)
+{
+	print_string("\nDUMPING FLASH\n");
+	flash_region.addr = 0;
+	flash_region.len = 255;
+	flash_dump(255);
+}
+
+
+void cmd_flash_jedec(void)
+{
+	print_string("\nJEDEC ID\n");
+	flash_read_jedecid();
+}
+
+
+void cmd_flash_uid(void)
+{
+	print_string("\nUNIQUE ID\n");
+	flash_read_uid();
+}
+
+
+void cmd_flash_speed(void)
+{
+	print_string("\nFLASH FAST MODE\n"); // Switch to flash 62.5 MHz mode
+	flash_init(1);
+	print_string("\nNow dumping flash\n");
+	flash_region.addr = 0;
+	flash_region.len = 255;
+	flash_dump(255);
+}
+
+
+void cmd_flash_erase(void)
+{
+	print_string("\nFLASH erase\n");
+	flash_region.addr = 0x20000;
+	if (flash_sector_erase())
+		print_string("Erase timed out\n");
+}
+
+
+void cmd_flash_write(void)
+{
+	print_string("\nFLASH write\n");
+	for (uint8_t i = 0; i < 20; i++)
+		flash_buf[i] = greeting[i];
+	flash_region.addr = 0x200000;
+	flash_region.len = 20;
+	flash_write_bytes(flash_buf);
+}
+
+
+void cmd_ip(void)
+{
+	if (cmd_words_b[2] > 0 && cmd_compare(1, "dhcp")) {
+		dhcp_start();
+	} else if (cmd_words_b[2] < 0) {
+		print_string("Current IP: ");
+		itoa(uip_hostaddr[0]); write_char('.'); itoa(uip_hostaddr[0] >> 8); write_char('.');
+		itoa(uip_hostaddr[1]); write_char('.'); itoa(uip_hostaddr[1] >> 8);
+		if (dhcp_state.state == DHCP_LEASING) {
+			print_string(" (dhcp, renewal in sec: ");
+			print_short(timer_left(&dhcp_timer) / SYS_TICK_HZ);
+			write_char(')');
+		} else {
+			print_string(" (static)");
+		}
+		write_char('\n');
+	} else {
+		if (dhcp_state.state)
+			dhcp_stop();
+		if (!parse_ip(cmd_words_b[1])) {
+			uip_ipaddr(&uip_hostaddr, ip[0], ip[1], ip[2], ip[3]);
+			print_string("Setting ip: ");
+			itoa(ip[0]); write_char('.'); itoa(ip[1]); write_char('.');
+			itoa(ip[2]); write_char('.'); itoa(ip[3]); write_char('\n');
+		} else {
+			print_string("Invalid IP address\n");
+			print_string("Error: ip [<ip-address>|dhcp]\n");
+			print_string("  The dhcp option enables the dhcp client, calling ip without options prints the current IP\n");
+			print_string("  Calling with a valid IP address will stop any ongoing dhcp client and set the IP address\n");
+		}
+	}
+}
+
+
+void cmd_gw(void)
+{
+	if (cmd_words_b[2] < 0) {
+		print_string("Current gw: ");
+		itoa(uip_draddr[0]); write_char('.'); itoa(uip_draddr[0] >> 8); write_char('.');
+		itoa(uip_draddr[1]); write_char('.'); itoa(uip_draddr[1] >> 8);
+	} else {
+		if (!parse_ip(cmd_words_b[1]))
+			uip_ipaddr(&uip_draddr, ip[0], ip[1], ip[2], ip[3]);
+		else
+			print_string("Invalid IP address\n");
+		print_string("Setting gw: ");
+		itoa(ip[0]); write_char('.'); itoa(ip[1]); write_char('.');
+		itoa(ip[2]); write_char('.'); itoa(ip[3]);
+	}
+	write_char('\n');
+}
+
+
+void cmd_netmask(void)
+{
+	if (cmd_words_b[2] < 0) {
+		print_string("Current netmask: ");
+		itoa(uip_netmask[0]); write_char('.'); itoa(uip_netmask[0] >> 8); write_char('.');
+		itoa(uip_netmask[1]); write_char('.'); itoa(uip_netmask[1] >> 8);
+	} else {
+		if (!parse_ip(cmd_words_b[1]))
+			uip_ipaddr(&uip_netmask, ip[0], ip[1], ip[2], ip[3]);
+		else
+			print_string("Invalid IP address\n");
+		print_string("Setting netmask: ");
+		itoa(ip[0]); write_char('.'); itoa(ip[1]); write_char('.');
+		itoa(ip[2]); write_char('.'); itoa(ip[3]);
+	}
+	write_char('\n');
+}
+
+
+void cmd_l2_forget(void)
+{
+	if (port_l2_forget())
+		print_string("Flush timed out\n");
+}
+
+
+void cmd_l2(void)
+{
+	port_l2_learned();
+}
+
+
+void cmd_igmp_on(void)
+{
+	igmp_enable();
+}
+
+
+void cmd_igmp_show(void)
+{
+	igmp_show();
+}
+
+
+void cmd_igmp(void)
+{
+	igmp_setup();  // Reverts to default with IP-MC being flooded
+}
+
+
+void cmd_stp(void)
+{
+	if (cmd_words_b[1] > 0 && cmd_compare(1, "on")) {
+		print_string("STP enabled\n");
+		stpEnabled = 1;
+		stp_setup();
+	} else {
+		print_string("STP disabled\n");
+		stp_off();
+		stpEnabled = 0;
+	}
+}
+
+
+void cmd_pvid(void)
+{
+	__xdata uint16_t pvid;
+	uint8_t port;
+	port = cmd_buffer[cmd_words_b[1]] - '1';
+	port = machine.phys_to_log_port[port];
+	if (!atoi_short(&pvid, cmd_words_b[2])) {
+		port_pvid_set(port, pvid);
+		state_changed(STATE_CONFIG);
+	}
+}
+
+
+void cmd_sds(void)
+{
+	print_reg(RTL837X_REG_SDS_MODES);
+}
+
+
+void cmd_eee(void)
+{
+	int8_t port = -1;
+	if (cmd_words_b[3] > 0) {
+		port = cmd_buffer[cmd_words_b[2]] - '1';
+		port = machine.phys_to_log_port[port];
+	}
+	if (cmd_compare(1, "on")) {
+		if (port >= 0)
+			port_eee_enable(port);
+		else
+			port_eee_enable_all();
+	} else if (cmd_compare(1, "off")) {
+		if (port >= 0)
+			port_eee_disable(port);
+		else
+			port_eee_disable_all();
+	} else if (cmd_compare(1, "status")) {
+		if (port >= 0)
+			port_eee_status(port);
+		else
+			port_eee_status_all();
+	}
+}
+
+
+// Prints the run counts and times in microseconds of the tasks of idle()
+void cmd_tasks(void)
+{
+	print_string("task      runs        avg us      max us      over   deferred\n");
+	for (uint8_t i = 0; i < N_TASKS; i++) {
+		__xdata struct task_stat *s = &task_stat[i];
+		print_string(tasks[i].name);
+		for (uint8_t l = strlen(tasks[i].name); l < 10; l++)
+			write_char(' ');
+		print_long(s->runs); write_char(' ');
+		print_long(s->runs ? sched_us(s->total / s->runs) : 0); write_char(' ');
+		print_long(sched_us(s->max)); write_char(' ');
+		print_short(s->over); write_char(' ');
+		print_short(s->deferred); write_char('\n');
+	}
+}
+
+
+void cmd_tasks_clear(void)
+{
+	for (uint8_t i = 0; i < N_TASKS; i++) {
+		__xdata struct task_stat *s = &task_stat[i];
+		s->runs = s->total = s->max = 0;
+		s->over = s->deferred = 0;
+	}
+}
+
+
+// Prints the busy percentage of the CPU and the latency of idle() in microseconds
+void cmd_cpu(void)
+{
+	print_string("Load 1s: "); itoa(cpu_load_avg(1));
+	print_string("%  10s: "); itoa(cpu_load_avg(10));
+	print_string("%  60s: "); itoa(cpu_load_avg(60));
+	print_string("%\nLongest pass, last second: "); print_long(sched_us(cpu_latency));
+	print_string("  since boot: "); print_long(sched_us(cpu_latency_max));
+	print_string("\nMissed ticks: "); print_long(cpu_missed);
+	write_char('\n');
+}
+
+
+// Prints the time-outs of the busy waits for the hardware by site
+void cmd_waits(void)
+{
+	uint16_t total = 0;
+
+	for (uint8_t i = 0; i < WAIT_SITES; i++) {
+		print_string(wait_sites[i]);
+		for (uint8_t l = strlen(wait_sites[i]); l < 10; l++)
+			write_char(' ');
+		print_short(wait_timeouts[i]); write_char('\n');
+		total += wait_timeouts[i];
+	}
+	if (total) {
+		print_string("Last: "); print_string(wait_sites[wait_last_site]);
+		print_string(" at "); print_short(wait_last_reg);
+		print_string(", tick "); print_long(wait_last_tick);
+		write_char('\n');
+	}
+}
+
+
+void cmd_waits_clear(void)
+{
+	for (uint8_t i = 0; i < WAIT_SITES; i++)
+		wait_timeouts[i] = 0;
+}
+
+
+void cmd_version(void)
+{
+	print_sw_version();
+}
+
+
+void cmd_time(void)
+{
+	print_string("  Tick counter: "); print_long(ticks); print_string("   Sec Counter: ");
+	reg_read_m(RTL837X_REG_SEC_COUNTER);
+	print_sfr_data();
+	write_char('\n');
+}
+
+
+void cmd_history_print(void)
+{
+	__xdata uint16_t p = (cmd_history_ptr + 1) & CMD_HISTORY_MASK;
+	__xdata uint8_t found_begin = 0;
+
+	while (p != cmd_history_ptr) {
+		if (!cmd_history[p] || cmd_history[p] == '\n')
+			found_begin = 1;
+		if (found_begin && cmd_history[p])
+			write_char(cmd_history[p]);
+		p = (p + 1) & CMD_HISTORY_MASK;
+	}
+}
+
+
+void cmd_log(void)
+{
+	log_print();
+}
+
+
+void cmd_log_clear(void)
+{
+	log_clear();
+}
+
+
+void cmd_mem(void)
+{
+	arena_print();
+}
+
+
+void cmd_log_level(void)
+{
+	if (cmd_words_b[3] <= 0 || cmd_words_b[4] <= 0) {
+		log_print_levels();
+		return;
+	}
+	uint8_t m = cmd_compare(2, "all") ? LOG_MODULES : log_lookup((__xdata char *)cmd_buffer + cmd_words_b[2], 0);
+	uint8_t l = log_lookup((__xdata char *)cmd_buffer + cmd_words_b[3], 1);
+	if (m == 0xff || l == 0xff) {
+		print_string("Error: log level [<module>|all <off|err|warn|info|debug>]\n");
+	} else if (m == LOG_MODULES) {
+		for (m = 0; m < LOG_MODULES; m++)
+			log_level[m] = l;
+	} else {
+		log_level[m] = l;
+	}
+}
+
+
+// Appends the line in cmd_buffer to the open transaction
+static void txn_stage(void)
+{
+	uint8_t i = 0, n;
+
+	// The end of the line is the last entry of cmd_words_b
+	while (cmd_words_b[i + 1] >= 0)
+		i++;
+	n = cmd_words_b[i];
+	if (txn_len + n + 1 > TXN_SIZE) {
+		print_string("Error: transaction full, it will not be committed\n");
+		txn_failed = 1;
+		return;
+	}
+	memcpy(txn_buf + txn_len, cmd_buffer, n);
+	txn_len += n;
+	txn_buf[txn_len++] = '\n';
+}
+
+
+void cmd_begin(void)
+{
+	if (txn_state) {
+		print_string("Error: transaction already open\n");
+		return;
+	}
+	txn_buf = arena_alloc(ARENA_TXN, TXN_SIZE);
+	if (!txn_buf) {
+		print_string("Error: no memory for a transaction\n");
+		return;
+	}
+	txn_len = 0;
+	txn_failed = 0;
+	txn_src = cmd_source;
+	txn_state = TXN_OPEN;
+}
+
+
+void cmd_commit(void)
+{
+	if (txn_state != TXN_OPEN) {
+		print_string("Error: no transaction open\n");
+		return;
+	}
+	// A partial set of the commands is not applied
+	if (txn_failed) {
+		print_string("Error: transaction incomplete, aborted\n");
+		txn_cancel();
+		return;
+	}
+	// Run by cmd_parser() once this command is done, see txn_run()
+	txn_state = TXN_COMMIT;
+}
+
+
+// Drops the open transaction and what it staged
+void txn_cancel(void) __banked
+{
+	txn_state = TXN_OFF;
+	txn_len = 0;
+	txn_failed = 0;
+	arena_free(ARENA_TXN);
+}
+
+
+void cmd_abort(void)
+{
+	txn_cancel();
+}
+
+
+// Returns the output buffer of /cmd to the arena
+void cmd_out_free(void) __banked
+{
+	arena_free(ARENA_CMD);
+	cmd_out = 0;
+}
+
+
+void cmd_help(void);
+
+/*
+ * The command tables. Each table must be sorted by name, it is searched
+ * for the word of the command line at its level. An entry with sub-commands
+ * continues the search with the next word in its table, if the word is
+ * not found there, the handler of the entry is called.
+ * args gives the number of words the command needs after its name.
+ */
+__code struct cmd cmd_flash[] = {
+	{ "bench",	flash_bench,	0, 0, 0, 0, "Compare flash read speeds" },
+	{ "dump",	cmd_flash_dump,	0, 0, 0, 0, "Dump the start of the flash" },
+	{ "erase",	cmd_flash_erase, 0, 0, 0, 0, "Erase the test sector at 0x20000" },
+	{ "jedec",	cmd_flash_jedec, 0, 0, 0, 0, "Print the JEDEC ID" },
+	{ "regs",	cmd_flash_regs,	0, 0, 0, 0, "Print the security registers" },
+	{ "speed",	cmd_flash_speed, 0, 0, 0, 0, "Switch to fast mode and dump" },
+	{ "uid",	cmd_flash_uid,	0, 0, 0, 0, "Print the unique ID" },
+	{ "write",	cmd_flash_write, 0, 0, 0, 0, "Write a test pattern to 0x200000" },
+};
+
+__code struct cmd cmd_igmp_sub[] = {
+	{ "on",		cmd_igmp_on,	0, 0, 0, CMD_CONFIG, "Enable IGMP snooping" },
+	{ "show",	cmd_igmp_show,	0, 0, 0, 0, "Show the IGMP configuration" },
+};
+
+__code struct cmd cmd_l2_sub[] = {
+	{ "forget",	cmd_l2_forget,	0, 0, 0, 0, "Flush the learned entries" },
+};
+
+__code struct cmd cmd_log_sub[] = {
+	{ "clear",	cmd_log_clear,	0, 0, 0, 0, "Drop all records" },
+	{ "level",	cmd_log_level,	0, 0, 0, 0, "level [<module>|all <off|err|warn|info|debug>]" },
+};
+
+__code struct cmd cmd_tasks_sub[] = {
+	{ "clear",	cmd_tasks_clear, 0, 0, 0, 0, "Reset the accounting" },
+};
+
+__code struct cmd cmd_waits_sub[] = {
+	{ "clear",	cmd_waits_clear, 0, 0, 0, 0, "Reset the counters" },
+};
+
+#define CMD_SUB(t) t, sizeof(t) / sizeof(struct cmd)
+
+__code struct cmd cmd_table[] = {
+	{ "abort",	cmd_abort,	0, 0, 0, 0, "Drop the commands of the open transaction" },
+	{ "begin",	cmd_begin,	0, 0, 0, 0, "Stage switch configuration commands until commit" },
+	{ "commit",	cmd_commit,	0, 0, 0, 0, "Apply the commands of the open transaction" },
+	{ "cpu",	cmd_cpu,	0, 0, 0, 0, "Print the CPU load and the latency of the main loop" },
+	{ "eee",	cmd_eee,	0, 0, 1, CMD_CONFIG | CMD_STAGE, "eee [on|off|status] [port]" },
+	{ "flash",	0,		CMD_SUB(cmd_flash), 1, 0, "flash <sub-command>" },
+	{ "gpio",	print_gpio_status, 0, 0, 0, 0, "Print the GPIO inputs and changes" },
+	{ "gw",		cmd_gw,		0, 0, 0, CMD_CONFIG, "gw [<ip-address>]" },
+	{ "help",	cmd_help,	0, 0, 0, 0, "help [<command>]" },
+	{ "history",	cmd_history_print, 0, 0, 0, 0, "Print the commands entered" },
+	{ "igmp",	cmd_igmp,	CMD_SUB(cmd_igmp_sub), 0, CMD_CONFIG, "igmp [on|show], without argument IP-MC is flooded" },
+	{ "ip",		cmd_ip,		0, 0, 0, CMD_CONFIG, "ip [<ip-address>|dhcp]" },
+	{ "l2",		cmd_l2,		CMD_SUB(cmd_l2_sub), 0, 0, "l2 [forget]" },
+	{ "lag",	parse_lag,	0, 0, 1, CMD_CONFIG | CMD_STAGE, "lag <lag> [port]... | lag show" },
+	{ "laghash",	parse_lag_hash,	0, 0, 1, CMD_CONFIG | CMD_STAGE, "laghash <lag> [spa|smac|dmac|sip|dip|sport|dport]..." },
+	{ "log",	cmd_log,	CMD_SUB(cmd_log_sub), 0, 0, "log [clear|level]" },
+	{ "mem",	cmd_mem,	0, 0, 0, 0, "Print the use of the arena" },
+	{ "mirror",	parse_mirror,	0, 0, 1, CMD_CONFIG | CMD_STAGE, "mirror <mirroring port> [port][t|r]... | mirror [status|off]" },
+	{ "mtu",	parse_mtu,	0, 0, 1, CMD_CONFIG | CMD_STAGE, "mtu <port> <size> | mtu show" },
+	{ "netmask",	cmd_netmask,	0, 0, 0, CMD_CONFIG, "netmask [<netmask>]" },
+	{ "passwd",	parse_passwd,	0, 0, 1, 0, "passwd <password>" },
+	{ "port",	parse_port,	0, 0, 1, CMD_CONFIG | CMD_STAGE, "port <port> [show|on|off|auto|10m|100m|1g|2g5|duplex] [half|full]" },
+	{ "pvid",	cmd_pvid,	0, 0, 2, CMD_STAGE, "pvid <port> <vid>" },
+	{ "regget",	parse_regget,	0, 0, 1, 0, "regget <register>" },
+	{ "regset",	parse_regset,	0, 0, 2, 0, "regset <register> <value>" },
+	{ "reset",	cmd_reset,	0, 0, 0, 0, "Reset the switch" },
+	{ "rnd",	parse_rnd,	0, 0, 0, 0, "Print a random number" },
+	{ "sds",	cmd_sds,	0, 0, 0, 0, "Print the SerDes modes" },
+	{ "sfp",	cmd_sfp,	0, 0, 0, 0, "Print the SFP module information" },
+	{ "stat",	cmd_stat,	0, 0, 0, 0, "Print the port statistics" },
+	{ "stp",	cmd_stp,	0, 0, 0, CMD_CONFIG | CMD_STAGE, "stp [on|off]" },
+	{ "tasks",	cmd_tasks,	CMD_SUB(cmd_tasks_sub), 0, 0, "tasks [clear], run counts and times of the tasks" },
+	{ "time",	cmd_time,	0, 0, 0, 0, "Print the tick and seconds counters" },
+	{ "version",	cmd_version, 0, 0, 0, 0, "Print the software version" },
+	{ "vlan",	parse_vlan,	0, 0, 1, CMD_CONFIG | CMD_STAGE, "vlan <vid> [name] [port][t|u]... | vlan <vid> [mgmt|d]" },
+	{ "waits",	cmd_waits,	CMD_SUB(cmd_waits_sub), 0, 0, "waits [clear], time-outs of the waits for the hardware" },
+};
+
+
+/*
+ * Compares word w of the command line with a name, with prefix set
+ * the word may also be an abbreviation of the name
+ * Returns 0 if they match, < 0 if the word sorts before the name, > 0 after
+ */
+static int8_t cmd_word_cmp(uint8_t w, __code char *name, uint8_t prefix)
+{
+	register uint8_t i = cmd_words_b[w];
+
+	while (*name && cmd_buffer[i] == *name) {
+		i++;
+		name++;
+	}
+	if (cmd_buffer[i] <= ' ')
+		return (!*name || prefix) ? 0 : -1;
+	if (!*name)
+		return 1;
+	return cmd_buffer[i] < *name ? -1 : 1;
+}
+
+
+/*
+ * Looks up word w in a sorted table of n commands. If there is no
+ * command of that name and abbrev is set, a unique abbreviation is
+ * accepted. Sub-commands may be abbreviated, commands must be given in full
+ * Returns the command or 0 if not found
+ */
+static __code struct cmd *cmd_lookup(uint8_t w, __code struct cmd *t, uint8_t n, uint8_t abbrev)
+{
+	__code struct cmd *found = 0;
+	uint8_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		uint8_t mid = (lo + hi) >> 1;
+		int8_t r = cmd_word_cmp(w, t[mid].name, 0);
+		if (!r)
+			return &t[mid];
+		if (r < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	if (!abbrev)
+		return 0;
+	for (uint8_t i = 0; i < n; i++) {
+		if (!cmd_word_cmp(w, t[i].name, 1)) {
+			if (found)
+				return 0;
+			found = &t[i];
+		}
+	}
+	return found;
+}
+
+
+static void cmd_help_print(__code struct cmd *c, uint8_t indent)
+{
+	for (uint8_t i = 0; i < indent; i++)
+		write_char(' ');
+	print_string(c->name);
+	for (uint8_t l = strlen(c->name) + indent; l < 10; l++)
+		write_char(' ');
+	print_string(c->help);
+	write_char('\n');
+}
+
+
+void cmd_help(void)
+{
+	__code struct cmd *c;
+
+	if (cmd_words_b[2] > 0) {
+		c = cmd_lookup(1, cmd_table, sizeof(cmd_table) / sizeof(struct cmd), 0);
+		if (!c) {
+			print_string("Unknown command\n");
+			return;
+		}
+		cmd_help_print(c, 0);
+		for (uint8_t i = 0; i < c->n_sub; i++)
+			cmd_help_print(&c->sub[i], 2);
+		return;
+	}
+	for (uint8_t i = 0; i < sizeof(cmd_table) / sizeof(struct cmd); i++)
+		cmd_help_print(&cmd_table[i], 0);
+}
+
+
+// Looks up the command in cmd_buffer and runs or stages it
+static void cmd_dispatch(void)
+{
+	__code struct cmd *c, *s;
+	uint8_t w = 1;
+
+	c = cmd_lookup(0, cmd_table, sizeof(cmd_table) / sizeof(struct cmd), 0);
+	// Word w exists if the next word, or the end of the line, follows
+	while (c && c->n_sub && cmd_words_b[w + 1] > 0) {
+		s = cmd_lookup(w, c->sub, c->n_sub, 1);
+		if (!s)
+			break;
+		c = s;
+		w++;
+	}
+	if (!c) {
+		print_string("Unknown command, try help\n");
+	} else if (!c->handler || (c->args && cmd_words_b[w + c->args] <= 0)) {
+		print_string("Usage: ");
+		print_string(c->help);
+		write_char('\n');
+	} else if (txn_state == TXN_OPEN && txn_src != cmd_source
+		   && ((c->flags & CMD_STAGE) || c->handler == cmd_commit || c->handler == cmd_abort)) {
+		// Only the console that opened the transaction adds to it or ends it
+		print_string("Error: transaction open on another console\n");
+	} else if (txn_state == TXN_OPEN && (c->flags & CMD_STAGE)) {
+		txn_stage();
+	} else {
+		c->handler();
+		if (c->flags & CMD_CONFIG)
+			state_changed(STATE_CONFIG);
+	}
+}
+
+
+/*
+ * Returns the pass of txn_run() in which the command in cmd_buffer runs.
+ * VLANs are set up before ports are moved into them with pvid, VLANs
+ * are deleted after ports have been moved out, so that no port is left
+ * without a VLAN in between
+ */
+static uint8_t txn_pass(void)
+{
+	__code struct cmd *c = cmd_lookup(0, cmd_table, sizeof(cmd_table) / sizeof(struct cmd), 0);
+
+	if (c && c->handler == parse_vlan)
+		return cmd_words_b[2] > 0 && cmd_buffer[cmd_words_b[2]] == 'd' && cmd_words_b[4] < 0 ? 3 : 0;
+	if (c && c->handler == cmd_pvid)
+		return 1;
+	return 2;
+}
+
+
+// Runs the staged commands in the order given by txn_pass()
+static void txn_run(void)
+{
+	for (uint8_t pass = 0; pass < TXN_PASSES; pass++) {
+		uint16_t i = 0;
+		while (i < txn_len) {
+			uint8_t n = 0;
+			while (i < txn_len && txn_buf[i] != '\n') {
+				if (n < SBUF_SIZE - 1)
+					cmd_buffer[n++] = txn_buf[i];
+				i++;
+			}
+			i++;
+			cmd_buffer[n] = '\0';
+			if (n && !cmd_tokenize() && cmd_words_b[1] >= 0 && txn_pass() == pass)
+				cmd_dispatch();
+		}
+	}
+	txn_len = 0;
+	txn_state = TXN_OFF;
+	arena_free(ARENA_TXN);
+}
+
+
 // Identify command
 void cmd_parser(void) __banked
 {
+
 #ifdef DEBUG
 	print_long(ticks);
 	print_string("Parsing command\n");
@@ -721,281 +1523,208 @@ void cmd_parser(void) __banked
 	print_byte(cmd_words_b[5]); write_char(' ');
 	print_byte(cmd_words_b[6]); write_char('\n');
 #endif
-	if (cmd_words_b[0] >= 0 && cmd_words_b[1] >= 0) {
-		if (cmd_compare(0, "reset")) {
-			print_string("\nRESET\n\n");
-			reset_chip();
-		} else if (cmd_compare(0, "sfp")) {
-			print_string("\nSlot 1 - Rate: "); print_byte(sfp_read_reg(0, 12));
-			print_string("  Encoding: "); print_byte(sfp_read_reg(0, 11));
-			print_string("\n");
-			sfp_print_info(0);
-			sfp_print_measurements(0);
-			if (machine.n_sfp == 2) {
-				print_string("\nSlot 2 - Rate: "); print_byte(sfp_read_reg(1, 12));
-				print_string("  Encoding: "); print_byte(sfp_read_reg(1, 11));
-				print_string("\n");
-				sfp_print_info(1);
-				sfp_print_measurements(1);
-			}
-		} else if (cmd_compare(0, "stat")) {
-			port_stats_print();
-		} else if (cmd_compare(0, "flash") && cmd_words_b[1] > 0 && cmd_buffer[cmd_words_b[1]] == 'r') {
-			print_string("\nPRINT SECURITY REGISTERS\n");
-			// The following will only show something else than 0xff if it was programmed for a managed switch
-			flash_region.addr = 0x0001000;
-			flash_region.len = 40;
-			flash_read_security();
-			flash_region.addr = 0x0002000;
-			flash_region.len = 40;
-			flash_read_security();
-			flash_region.addr = 0x0003000;
-			flash_region.len = 40;
-			flash_read_security();
-		} else if (cmd_compare(0, "flash") && cmd_words_b[1] > 0 && cmd_buffer[cmd_words_b[1]] == 'd') {
-			print_string("\nDUMPING FLASH\n");
-			flash_region.addr = 0;
-			flash_region.len = 255;
-			flash_dump(255);
-		} else if (cmd_compare(0, "flash") && cmd_words_b[1] > 0 && cmd_buffer[cmd_words_b[1]] == 'j') {
-			print_string("\nJEDEC ID\n");
-			flash_read_jedecid();
-		} else if (cmd_compare(0, "flash") && cmd_words_b[1] > 0 && cmd_buffer[cmd_words_b[1]] == 'u') {
-			print_string("\nUNIQUE ID\n");
-			flash_read_uid();
-		} else if (cmd_compare(0, "flash") && cmd_words_b[1] > 0 && cmd_buffer[cmd_words_b[1]] == 's') {
-			print_string("\nFLASH FAST MODE\n"); // Switch to flash 62.5 MHz mode
-			flash_init(1);
-			print_string("\nNow dumping flash\n");
-			flash_region.addr = 0;
-			flash_region.len = 255;
-			flash_dump(255);
-		} else if (cmd_compare(0, "flash") && cmd_words_b[1] > 0 && cmd_buffer[cmd_words_b[1]] == 'e') {
-			print_string("\nFLASH erase\n");
-			flash_region.addr = 0x20000;
-			flash_sector_erase();
-		} else if (cmd_compare(0, "flash") && cmd_words_b[1] > 0 && cmd_buffer[cmd_words_b[1]] == 'w') {
-			print_string("\nFLASH write\n");
-			for (uint8_t i = 0; i < 20; i++)
-				flash_buf[i] = greeting[i];
-			flash_region.addr = 0x200000;
-			flash_region.len = 20;
-			flash_write_bytes(flash_buf);
-		} else if (cmd_compare(0, "port") && cmd_words_b[1] > 0) {
-			parse_port();
-		} else if (cmd_compare(0, "mtu") && cmd_words_b[1] > 0) {
-			parse_mtu();
-		} else if (cmd_compare(0, "ip")) {
-			if (cmd_words_b[2] > 0 && cmd_compare(1, "dhcp")) {
-				dhcp_start();
-			} else if (cmd_words_b[2] < 0) {
-				print_string("Current IP: ");
-				itoa(uip_hostaddr[0]); write_char('.'); itoa(uip_hostaddr[0] >> 8); write_char('.');
-				itoa(uip_hostaddr[1]); write_char('.'); itoa(uip_hostaddr[1] >> 8);
-				if (dhcp_state.state == DHCP_LEASING) {
-					print_string(" (dhcp, renewal in sec: ");
-					print_short(dhcp_state.dhcp_timer);
-					write_char(')');
-				} else {
-					print_string(" (static)");
-				}
-				write_char('\n');
-			} else {
-				if (dhcp_state.state)
-					dhcp_stop();
-				if (!parse_ip(cmd_words_b[1])) {
-					uip_ipaddr(&uip_hostaddr, ip[0], ip[1], ip[2], ip[3]);
-					print_string("Setting ip: ");
-					itoa(ip[0]); write_char('.'); itoa(ip[1]); write_char('.');
-					itoa(ip[2]); write_char('.'); itoa(ip[3]); write_char('\n');
-				} else {
-					print_string("Invalid IP address\n");
-					print_string("Error: ip [<ip-address>|dhcp]\n");
-					print_string("  The dhcp option enables the dhcp client, calling ip without options prints the current IP\n");
-					print_string("  Calling with a valid IP address will stop any ongoing dhcp client and set the IP address\n");
-				}
-			}
-		} else if (cmd_compare(0, "gw")) {
-			if (cmd_words_b[2] < 0) {
-				print_string("Current gw: ");
-				itoa(uip_draddr[0]); write_char('.'); itoa(uip_draddr[0] >> 8); write_char('.');
-				itoa(uip_draddr[1]); write_char('.'); itoa(uip_draddr[1] >> 8);
-			} else {
-				if (!parse_ip(cmd_words_b[1]))
-					uip_ipaddr(&uip_draddr, ip[0], ip[1], ip[2], ip[3]);
-				else
-					print_string("Invalid IP address\n");
-				print_string("Setting gw: ");
-				itoa(ip[0]); write_char('.'); itoa(ip[1]); write_char('.');
-				itoa(ip[2]); write_char('.'); itoa(ip[3]);
-			}
-			write_char('\n');
-		} else if (cmd_compare(0, "netmask")) {
-			if (cmd_words_b[2] < 0) {
-				print_string("Current netmask: ");
-				itoa(uip_netmask[0]); write_char('.'); itoa(uip_netmask[0] >> 8); write_char('.');
-				itoa(uip_netmask[1]); write_char('.'); itoa(uip_netmask[1] >> 8);
-			} else {
-				if (!parse_ip(cmd_words_b[1]))
-					uip_ipaddr(&uip_netmask, ip[0], ip[1], ip[2], ip[3]);
-				else
-					print_string("Invalid IP address\n");
-				print_string("Setting netmask: ");
-				itoa(ip[0]); write_char('.'); itoa(ip[1]); write_char('.');
-				itoa(ip[2]); write_char('.'); itoa(ip[3]);
-			}
-			write_char('\n');
-		} else if (cmd_compare(0, "l2")) {
-			if (cmd_words_b[1] > 0 && cmd_compare(1, "forget"))
-				port_l2_forget();
-			else
-				port_l2_learned();
-		} else if (cmd_compare(0, "igmp")) {
-			if (cmd_words_b[1] > 0 && cmd_compare(1, "on"))
-				igmp_enable();
-			else if (cmd_words_b[1] > 0 && cmd_compare(1, "show"))
-				igmp_show();
-			else
-				igmp_setup();  // Reverts to default with IP-MC being flooded
-		} else if (cmd_compare(0, "stp")) {
-			if (cmd_words_b[1] > 0 && cmd_compare(1, "on")) {
-				print_string("STP enabled\n");
-				stpEnabled = 1;
-				stp_setup();
-			} else {
-				print_string("STP disabled\n");
-				stp_off();
-				stpEnabled = 0;
-			}
-		} else if (cmd_compare(0, "pvid") && cmd_words_b[1] > 0 && cmd_words_b[2] > 0) {
-			__xdata uint16_t pvid;
-			uint8_t port;
-			port = cmd_buffer[cmd_words_b[1]] - '1';
-			port = machine.phys_to_log_port[port];
-			if (!atoi_short(&pvid, cmd_words_b[2]))
-				port_pvid_set(port, pvid);
-		} else if (cmd_compare(0, "vlan")) {
-			parse_vlan();
-		} else if (cmd_compare(0, "mirror")) {
-			parse_mirror();
-		} else if (cmd_compare(0, "lag")) {
-			parse_lag();
-		} else if (cmd_compare(0, "laghash")) {
-			parse_lag_hash();
-		} else if (cmd_compare(0, "sds")) {
-			print_reg(RTL837X_REG_SDS_MODES);
-		} else if (cmd_compare(0, "gpio")) {
-			print_gpio_status();
-		} else if (cmd_compare(0, "regget")) {
-			parse_regget();
-		} else if (cmd_compare(0, "regset")) {
-			parse_regset();
-		} else if (cmd_compare(0, "rnd")) {
-			parse_rnd();
-		} else if (cmd_compare(0, "passwd")) {
-			parse_passwd();
-		} else if (cmd_compare(0, "eee")) {
-			int8_t port = -1;
-			if (cmd_words_b[3] > 0) {
-				port = cmd_buffer[cmd_words_b[2]] - '1';
-				port = machine.phys_to_log_port[port];
-			}
-			if (cmd_words_b[1] > 0 && cmd_compare(1, "on")) {
-				if (port >= 0)
-					port_eee_enable(port);
-				else
-					port_eee_enable_all();
-			} else if (cmd_words_b[1] > 0 && cmd_compare(1, "off")) {
-				if (port >= 0)
-					port_eee_disable(port);
-				else
-					port_eee_disable_all();
-			} else if (cmd_words_b[1] > 0 && cmd_compare(1, "status")) {
-				if (port >= 0)
-					port_eee_status(port);
-				else
-					port_eee_status_all();
-			}
-		} else if (cmd_compare(0, "version")) {
-			print_sw_version();
-		} else if (cmd_compare(0, "time")) {
-			print_string("  Tick counter: "); print_long(ticks); print_string("   Sec Counter: ");
-			reg_read_m(RTL837X_REG_SEC_COUNTER);
-			print_sfr_data();
-			write_char('\n');
-		} else if (cmd_compare(0, "history")) {
-			__xdata uint16_t p = (cmd_history_ptr + 1) & CMD_HISTORY_MASK;
-			__xdata uint8_t found_begin = 0;
-//			print_string("History ptr: ");
-//			print_short(cmd_history_ptr); write_char('\n');
-			while (p != cmd_history_ptr) {
-//				print_short(p); write_char(' ');
-				if (!cmd_history[p] || cmd_history[p] == '\n')
-					found_begin = 1;
-				if (found_begin && cmd_history[p])
-					write_char(cmd_history[p]);
-				p = (p + 1) & CMD_HISTORY_MASK;
-			}
+	if (cmd_words_b[0] < 0 || cmd_words_b[1] < 0)
+		return;
+
+	cmd_dispatch();
+
+	if (save_cmd) {
+		uint8_t i;
+		for (i = 0; i < N_WORDS; i++) {
+			if (cmd_words_b[i] < 0)
+				break;
 		}
-		if (save_cmd) {
-			uint8_t i;
-			for (i = 0; i < N_WORDS; i++) {
-				if (cmd_words_b[i] < 0)
-					break;
-			}
-			if (i < N_WORDS) {
-				i = cmd_words_b[--i];
-				cmd_history_ptr = (cmd_history_ptr + i) & CMD_HISTORY_MASK;
-				__xdata uint16_t p = cmd_history_ptr;
-				cmd_history[cmd_history_ptr++] = '\n';
-				do {
-					i--;
-					cmd_history[--p & CMD_HISTORY_MASK] = cmd_buffer[i];
-				} while (i);
-			}
+		if (i < N_WORDS) {
+			i = cmd_words_b[--i];
+			cmd_history_ptr = (cmd_history_ptr + i) & CMD_HISTORY_MASK;
+			__xdata uint16_t p = cmd_history_ptr;
+			cmd_history[cmd_history_ptr++] = '\n';
+			do {
+				i--;
+				cmd_history[--p & CMD_HISTORY_MASK] = cmd_buffer[i];
+			} while (i);
 		}
 	}
+	// The staged commands replace the line in cmd_buffer
+	if (txn_state == TXN_COMMIT)
+		txn_run();
 }
 
 #define FLASH_READ_BURST_SIZE 0x100
 #define PASSWORD "admin"
+
+/*
+ * Maps a port as numbered in the configuration to the logical port, the
+ * same way the vlan command does
+ */
+static uint8_t config_port(uint8_t p)
+{
+	return p < 10 ? machine.phys_to_log_port[p - 1] : p - 1;
+}
+
+
+static uint16_t config_pmask(__xdata uint8_t *m)
+{
+	__xdata uint16_t phys = m[0] | ((uint16_t)m[1]) << 8;
+	__xdata uint16_t log = 0;
+
+	for (uint8_t p = 1; phys; p++, phys >>= 1) {
+		if (phys & 1)
+			log |= ((uint16_t)1) << config_port(p);
+	}
+	return log;
+}
+
+
+/*
+ * Applies an entry of the compiled configuration
+ */
+static void config_op(__xdata uint8_t *e)
+{
+	__xdata uint16_t v = e[2] | ((uint16_t)e[3]) << 8;
+	uint8_t i;
+
+	switch (e[0]) {
+	case CFG_OP_IP:
+		if (dhcp_state.state)
+			dhcp_stop();
+		uip_ipaddr(&uip_hostaddr, e[2], e[3], e[4], e[5]);
+		break;
+	case CFG_OP_GW:
+		uip_ipaddr(&uip_draddr, e[2], e[3], e[4], e[5]);
+		break;
+	case CFG_OP_NETMASK:
+		uip_ipaddr(&uip_netmask, e[2], e[3], e[4], e[5]);
+		break;
+	case CFG_OP_DHCP:
+		dhcp_start();
+		break;
+	case CFG_OP_VLAN:
+		// Like the vlan command, ports that do not exist fail the entry
+		for (i = 0; i < 16; i++) {
+			if ((e[4 + (i >> 3)] >> (i & 7)) & 1 && config_port(i + 1) > machine.max_port)
+				return;
+		}
+		vlan_create(v, config_pmask(e + 4), config_pmask(e + 6));
+		break;
+	case CFG_OP_VLAN_MGMT:
+		management_vlan = v;
+		break;
+	case CFG_OP_PVID:
+		port_pvid_set(config_port(e[2]), e[3] | ((uint16_t)e[4]) << 8);
+		break;
+	case CFG_OP_MIRROR:
+		port_mirror_set(config_port(e[2]), config_pmask(e + 3), config_pmask(e + 5));
+		break;
+	case CFG_OP_MIRROR_OFF:
+		port_mirror_del();
+		break;
+	case CFG_OP_EEE:
+		if (e[2] && e[3])
+			port_eee_enable(config_port(e[2]));
+		else if (e[2])
+			port_eee_disable(config_port(e[2]));
+		else if (e[3])
+			port_eee_enable_all();
+		else
+			port_eee_disable_all();
+		break;
+	case CFG_OP_PASSWD:
+		for (i = 0; i < e[1]; i++)
+			passwd[i] = e[i + 2];
+		passwd[i] = '\0';
+		break;
+	case CFG_OP_TEXT:
+		for (i = 0; i < e[1]; i++)
+			cmd_buffer[i] = e[i + 2];
+		cmd_buffer[i] = '\0';
+		if (!cmd_tokenize())
+			cmd_parser();
+		break;
+	}
+}
+
+
+/*
+ * Applies the compiled configuration, entries are taken from bursts of the
+ * record read into flash_buf, an entry cut off at the end is read again
+ * with the next burst
+ */
+static void config_apply(void)
+{
+	__xdata uint32_t pos = cfg_bin_addr;
+	__xdata uint16_t len_left = cfg_bin_len;
+	__xdata uint16_t n, i;
+
+	while (len_left) {
+		n = len_left > FLASH_READ_BURST_SIZE ? FLASH_READ_BURST_SIZE : len_left;
+		flash_region.addr = pos;
+		flash_region.len = n;
+		flash_read_bulk(flash_buf);
+		i = 0;
+		while (i + 2 <= n && i + 2 + flash_buf[i + 1] <= n) {
+			config_op(flash_buf + i);
+			i += 2 + flash_buf[i + 1];
+		}
+		if (!i)
+			break;
+		pos += i;
+		len_left -= i;
+	}
+}
+
+
 void execute_config(void) __banked
 {
-	__xdata uint32_t pos = CONFIG_START;
-	__xdata uint16_t len_left = CONFIG_LEN;
+	__xdata uint32_t pos;
+	__xdata uint16_t len_left;
+	__xdata uint16_t n;
+	uint8_t cmd_idx = 0;
+	uint8_t c;
 
 	// Set default password, it can be overwritten in the configuration file
 	strtox(passwd, PASSWORD);
 	save_cmd = 0;
+	cmd_source = 0;
 
-	do {
+	config_init();
+	if (cfg_bin_addr) {
+		config_apply();
+		goto config_done;
+	}
+	pos = cfg_addr;
+	len_left = cfg_len;
+	while (len_left) {
+		n = len_left > FLASH_READ_BURST_SIZE ? FLASH_READ_BURST_SIZE : len_left;
 		flash_region.addr = pos;
-		flash_region.len = FLASH_READ_BURST_SIZE;
+		flash_region.len = n;
 		flash_read_bulk(flash_buf);
-
-		uint8_t cfg_idx = 0;
-		uint8_t c = 0;
-		do {
-			for (uint8_t cmd_idx = 0; cmd_idx < (SBUF_SIZE - 1); cmd_idx++) {
-				c = flash_buf[cfg_idx++];
-				if (c == 0 || c == '\n') {
-					cmd_buffer[cmd_idx] = '\0';
-					if (cmd_idx && !cmd_tokenize())
-						cmd_parser();
-					if (c == 0)
-						goto config_done;
-					break;
-				}
-
-				cmd_buffer[cmd_idx] = c;
+		pos += n;
+		len_left -= n;
+
+		// Lines may continue in the next burst
+		for (uint16_t i = 0; i < n; i++) {
+			c = flash_buf[i];
+			if (c == 0)
+				goto config_done;
+			if (c == '\n') {
+				cmd_buffer[cmd_idx] = '\0';
+				if (cmd_idx && !cmd_tokenize())
+					cmd_parser();
+				cmd_idx = 0;
+			} else if (cmd_idx < (SBUF_SIZE - 1)) {
+				cmd_buffer[cmd_idx++] = c;
 			}
-		} while(cfg_idx);
-
-		len_left -= FLASH_READ_BURST_SIZE;
-		pos += FLASH_READ_BURST_SIZE;
-	} while(len_left);
+		}
+	}
 
 config_done:
+	// The last line may lack its newline
+	if (cmd_idx) {
+		cmd_buffer[cmd_idx] = '\0';
+		if (!cmd_tokenize())
+			cmd_parser();
+	}
 	// Start saving commands to cmd_history
 	save_cmd = 1;
 	for (cmd_history_ptr = 0; cmd_history_ptr < CMD_HISTORY_SIZE; cmd_history_ptr++)
@@ -7,9 +7,30 @@
 
 extern __xdata uint8_t cmd_buffer[SBUF_SIZE];
 extern __xdata uint8_t cmd_available;
+extern __xdata uint8_t cmd_capture;
+extern __xdata uint8_t * __xdata cmd_out;
+extern __xdata uint16_t cmd_out_len;
+
+extern __xdata uint8_t * __xdata txn_buf;
+extern __xdata uint16_t txn_len;
+extern __xdata uint8_t txn_state;
+extern __xdata uint8_t txn_src;
+extern __xdata uint8_t cmd_source;
+
+// States of a transaction opened by begin
+#define TXN_OFF		0
+#define TXN_OPEN	1
+#define TXN_COMMIT	2
+#define TXN_PASSES	4
+
+// Values of cmd_available, the output of a command from /cmd is captured
+#define CMD_SERIAL	1
+#define CMD_HTTP	2
 
 uint8_t cmd_tokenize(void) __banked;
 void cmd_parser(void) __banked;
 void execute_config(void) __banked;
 void print_sw_version(void) __banked;
+void cmd_out_free(void) __banked;
+void txn_cancel(void) __banked;
 #endif
@@ -0,0 +1,54 @@
+#ifndef _CONFIG_FORMAT_H_
+#define _CONFIG_FORMAT_H_
+
+/*
+ * Layout of the configuration journal in flash and of the compiled
+ * configuration, shared with the host tools
+ */
+
+#include <stdint.h>
+
+#define CFG_SECTOR_MAGIC	"CFGJ"
+
+// Types of records
+#define CFG_RECORD_TEXT		0xc5	// Configuration as command lines
+#define CFG_RECORD_BINARY	0xc6	// Compiled from the text record with CRC src
+#define CFG_COMMITTED		0x00
+
+struct cfg_sector {
+	uint8_t magic[4];
+	uint32_t seq;
+};
+
+// Record header, the data follows, padded to 4 bytes
+struct cfg_record {
+	uint8_t magic;
+	uint8_t state;		// Programmed to CFG_COMMITTED last
+	uint16_t len;
+	uint16_t crc;
+	uint16_t src;
+};
+
+/*
+ * The compiled configuration is a sequence of entries of an opcode, the
+ * length of the arguments and the arguments. 16 bit values are little
+ * endian, ports are numbered as in the text, port masks have bit 0 for
+ * port 1. Lines without an opcode of their own are kept as CFG_OP_TEXT
+ */
+#define CFG_OP_IP		0x01	// a b c d
+#define CFG_OP_GW		0x02	// a b c d
+#define CFG_OP_NETMASK		0x03	// a b c d
+#define CFG_OP_DHCP		0x04
+#define CFG_OP_VLAN		0x05	// vlan members tagged
+#define CFG_OP_VLAN_MGMT	0x06	// vlan
+#define CFG_OP_PVID		0x07	// port vlan
+#define CFG_OP_MIRROR		0x08	// port rx-mask tx-mask
+#define CFG_OP_MIRROR_OFF	0x09
+#define CFG_OP_EEE		0x0a	// port (0 for all) on
+#define CFG_OP_PASSWD		0x0b	// password
+#define CFG_OP_TEXT		0x7f	// command line
+
+// Longest arguments of an entry, a command line
+#define CFG_OP_MAX		127
+
+#endif
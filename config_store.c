@@ -0,0 +1,585 @@
+/*
+ * Journal of the configuration in flash
+ *
+ * The CONFIG_SECTORS sectors at CONFIG_START are used as a ring. Each sector
+ * begins with a header carrying a sequence number, the one with the highest
+ * number is the sector being appended to. A saved configuration is appended
+ * as a record with its length and CRC16 and only becomes valid when a single
+ * byte of its header is programmed after the text, so that a save interrupted
+ * by a reset leaves the previous configuration in place. The oldest sector is
+ * erased only when a record does not fit into the current one.
+ * A saved configuration is followed by a binary record compiled from it,
+ * which is applied at boot instead of parsing the text.
+ * Until the first save, the plain text configuration at CONFIG_START, as it
+ * comes with the image, is used.
+ */
+
+#include <stdint.h>
+#include "rtl837x_common.h"
+#include "rtl837x_flash.h"
+#include "config_format.h"
+#include "config_store.h"
+
+#pragma codeseg BANK2
+#pragma constseg BANK2
+
+#define CFG_END (CONFIG_START + CONFIG_SECTORS * FLASH_SECTOR_SIZE)
+
+// Records found by cfg_scan()
+#define CFG_FOUND_TEXT		0x01
+#define CFG_FOUND_BINARY	0x02
+
+// Entries are compiled into the second half of flash_buf, it is programmed
+// once the entry of another line might not fit
+#define CFG_PAGE_SIZE		0x100
+#define CFG_PAGE_FILL		(CFG_PAGE_SIZE - 2 - CFG_OP_MAX)
+
+__code uint8_t cfg_magic[4] = CFG_SECTOR_MAGIC;
+
+extern __xdata struct flash_region_t flash_region;
+extern __xdata uint8_t flash_buf[512];
+extern __xdata uint16_t crc_value;
+void crc16_block(__xdata uint8_t *v, uint16_t len);
+
+__xdata uint32_t cfg_addr;
+__xdata uint16_t cfg_len;
+__xdata uint16_t cfg_crc;
+__xdata uint32_t cfg_bin_addr;
+__xdata uint16_t cfg_bin_len;
+__xdata uint16_t cfg_bin_src;	// CRC of the text the binary record was compiled from
+__xdata uint32_t cfg_seq;	// Sequence number of the current sector
+__xdata uint32_t cfg_head;	// Where the next record goes, 0 if no sector is in use yet
+__xdata uint32_t cfg_end;	// End of the current sector
+__xdata uint32_t cfg_open;	// Record reserved but not yet committed
+__xdata uint8_t cfg_open_type;
+__xdata uint8_t cfg_found;
+__xdata struct cfg_sector cfg_sec;
+__xdata struct cfg_record cfg_rec;
+__xdata uint8_t cfg_line[SBUF_SIZE];
+__xdata uint32_t cfg_out;	// Where the compiled entries are programmed
+__xdata uint16_t cfg_fill;	// Bytes of entries in the page
+
+
+static void cfg_read(__xdata uint32_t addr, __xdata uint8_t *dst, uint16_t len)
+{
+	flash_region.addr = addr;
+	flash_region.len = len;
+	flash_read_bulk(dst);
+}
+
+
+static uint8_t cfg_sector_valid(void)
+{
+	for (uint8_t i = 0; i < sizeof(cfg_magic); i++) {
+		if (cfg_sec.magic[i] != cfg_magic[i])
+			return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * Checks the CRC of the text of the record in cfg_rec found at addr
+ */
+static uint8_t cfg_crc_ok(__xdata uint32_t addr)
+{
+	__xdata uint16_t len_left = cfg_rec.len;
+	__xdata uint16_t n;
+
+	crc_value = 0;
+	while (len_left) {
+		n = len_left > sizeof(flash_buf) ? sizeof(flash_buf) : len_left;
+		cfg_read(addr, flash_buf, n);
+		crc16_block(flash_buf, n);
+		addr += n;
+		len_left -= n;
+	}
+	return crc_value == cfg_rec.crc;
+}
+
+
+/*
+ * Walks the records of the sector at s, the last valid ones become the
+ * configuration in use unless found in a newer sector already
+ * Returns where the next record can be appended
+ */
+static uint32_t cfg_scan(__xdata uint32_t s)
+{
+	__xdata uint32_t p = s + sizeof(struct cfg_sector);
+	__xdata uint32_t end = s + FLASH_SECTOR_SIZE;
+	__xdata uint8_t found = cfg_found;
+
+	while (p + sizeof(struct cfg_record) <= end) {
+		cfg_read(p, (__xdata uint8_t *)&cfg_rec, sizeof(cfg_rec));
+		if (cfg_rec.magic == 0xff)
+			return p;
+		// The length of a save that did not finish is unknown, nothing can follow it
+		if ((cfg_rec.magic != CFG_RECORD_TEXT && cfg_rec.magic != CFG_RECORD_BINARY)
+		    || cfg_rec.len == 0xffff || p + sizeof(struct cfg_record) + cfg_rec.len > end)
+			break;
+		if (cfg_rec.state == CFG_COMMITTED && cfg_crc_ok(p + sizeof(struct cfg_record))) {
+			if (cfg_rec.magic == CFG_RECORD_TEXT && !(found & CFG_FOUND_TEXT)) {
+				cfg_addr = p + sizeof(struct cfg_record);
+				cfg_len = cfg_rec.len;
+				cfg_crc = cfg_rec.crc;
+				cfg_found |= CFG_FOUND_TEXT;
+			} else if (cfg_rec.magic == CFG_RECORD_BINARY && !(found & CFG_FOUND_BINARY)) {
+				cfg_bin_addr = p + sizeof(struct cfg_record);
+				cfg_bin_len = cfg_rec.len;
+				cfg_bin_src = cfg_rec.src;
+				cfg_found |= CFG_FOUND_BINARY;
+			}
+		}
+		p += sizeof(struct cfg_record) + ((cfg_rec.len + 3) & ~3);
+	}
+	return end;
+}
+
+
+/*
+ * Finds the length of the plain text configuration at CONFIG_START
+ */
+static void cfg_legacy(void)
+{
+	__xdata uint16_t i;
+
+	cfg_addr = CONFIG_START;
+	for (cfg_len = 0; cfg_len < CONFIG_LEN; cfg_len += sizeof(flash_buf)) {
+		cfg_read(CONFIG_START + cfg_len, flash_buf, sizeof(flash_buf));
+		for (i = 0; i < sizeof(flash_buf); i++) {
+			if (!flash_buf[i] || flash_buf[i] == 0xff) {
+				cfg_len += i;
+				return;
+			}
+		}
+	}
+}
+
+
+/*
+ * Selects the newest configuration saved, called once at boot
+ */
+void config_init(void) __banked
+{
+	__xdata uint32_t s, cur;
+	__xdata uint32_t seq, best;
+
+	cfg_seq = 0;
+	cfg_head = cfg_end = cfg_open = 0;
+	cfg_bin_addr = 0;
+	cfg_found = 0;
+	for (s = CONFIG_START; s < CFG_END; s += FLASH_SECTOR_SIZE) {
+		cfg_read(s, (__xdata uint8_t *)&cfg_sec, sizeof(cfg_sec));
+		if (cfg_sector_valid() && cfg_sec.seq != 0xffffffff && cfg_sec.seq > cfg_seq) {
+			cfg_seq = cfg_sec.seq;
+			cfg_head = s;
+		}
+	}
+	if (!cfg_head) {
+		cfg_legacy();
+		return;
+	}
+	cfg_end = cfg_head + FLASH_SECTOR_SIZE;
+	cfg_head = cfg_scan(cfg_head);
+
+	// Go back through older sectors if saves to the current one failed
+	seq = cfg_seq;
+	while (!(cfg_found & CFG_FOUND_TEXT)) {
+		cur = 0;
+		best = 0;
+		for (s = CONFIG_START; s < CFG_END; s += FLASH_SECTOR_SIZE) {
+			cfg_read(s, (__xdata uint8_t *)&cfg_sec, sizeof(cfg_sec));
+			if (cfg_sector_valid() && cfg_sec.seq < seq && cfg_sec.seq > best) {
+				best = cfg_sec.seq;
+				cur = s;
+			}
+		}
+		if (!cur)
+			break;
+		seq = best;
+		cfg_scan(cur);
+	}
+	if (!(cfg_found & CFG_FOUND_TEXT)) {
+		cfg_legacy();
+		cfg_bin_addr = 0;
+	}
+	// A binary record is only of use if compiled from the text found
+	if (cfg_bin_src != cfg_crc)
+		cfg_bin_addr = 0;
+}
+
+
+/*
+ * Erases the oldest sector and makes it the current one. The sector with the
+ * configuration in use is skipped, it may be older if the last saves failed
+ * Returns 1 if the sector could not be erased
+ */
+static uint8_t cfg_next_sector(void)
+{
+	__xdata uint32_t s = cfg_end;
+
+	do {
+		if (s < CONFIG_START || s >= CFG_END)
+			s = CONFIG_START;
+		if (cfg_addr < s || cfg_addr >= s + FLASH_SECTOR_SIZE)
+			break;
+		s += FLASH_SECTOR_SIZE;
+	} while (1);
+
+	flash_region.addr = s;
+	if (flash_sector_erase())
+		return 1;
+	for (uint8_t i = 0; i < sizeof(cfg_magic); i++)
+		cfg_sec.magic[i] = cfg_magic[i];
+	cfg_sec.seq = ++cfg_seq;
+	flash_region.addr = s;
+	flash_region.len = sizeof(cfg_sec);
+	flash_write_bytes((__xdata uint8_t *)&cfg_sec);
+	cfg_head = s + sizeof(cfg_sec);
+	cfg_end = s + FLASH_SECTOR_SIZE;
+	return 0;
+}
+
+
+/*
+ * Opens a record of the given type for up to max bytes
+ * Returns the flash address where the data is to be programmed, 0 if the
+ * sector for the record could not be erased
+ */
+uint32_t config_reserve(uint8_t type, uint16_t max) __banked
+{
+	// Nothing may follow a record left open, its length is not known
+	if (cfg_open)
+		cfg_head = cfg_end;
+	if (!cfg_head || cfg_head + sizeof(struct cfg_record) + max > cfg_end) {
+		if (cfg_next_sector())
+			return 0;
+	}
+
+	cfg_open = cfg_head;
+	cfg_open_type = type;
+	cfg_rec.magic = type;
+	cfg_rec.state = 0xff;
+	cfg_rec.len = 0xffff;
+	cfg_rec.crc = 0xffff;
+	cfg_rec.src = type == CFG_RECORD_BINARY ? cfg_crc : 0xffff;
+	flash_region.addr = cfg_open;
+	flash_region.len = sizeof(cfg_rec);
+	flash_write_bytes((__xdata uint8_t *)&cfg_rec);
+	return cfg_open + sizeof(struct cfg_record);
+}
+
+
+/*
+ * Closes the open record with the length and CRC16 of the data programmed,
+ * it then becomes the configuration in use
+ * Returns 0 if the header could not be programmed
+ */
+uint8_t config_commit(uint16_t len, uint16_t crc) __banked
+{
+	__xdata uint32_t rec = cfg_open;
+
+	cfg_open = 0;
+	cfg_head = cfg_end;
+	cfg_rec.len = len;
+	cfg_rec.crc = crc;
+	flash_region.addr = rec + 2;
+	flash_region.len = 4;
+	if (!flash_write_verify((__xdata uint8_t *)&cfg_rec.len))
+		return 0;
+
+	// A single byte makes the record valid
+	cfg_rec.state = CFG_COMMITTED;
+	flash_region.addr = rec + 1;
+	flash_region.len = 1;
+	if (!flash_write_verify(&cfg_rec.state))
+		return 0;
+
+	rec += sizeof(struct cfg_record);
+	if (cfg_open_type == CFG_RECORD_TEXT) {
+		cfg_addr = rec;
+		cfg_len = len;
+		cfg_crc = crc;
+		cfg_bin_addr = 0;
+	} else {
+		cfg_bin_addr = rec;
+		cfg_bin_len = len;
+	}
+	cfg_head = rec + ((len + 3) & ~3);
+	return 1;
+}
+
+
+static uint8_t cfg_is(__xdata uint8_t *w, __code char *s)
+{
+	while (*s) {
+		if (*w++ != *s++)
+			return 0;
+	}
+	return *w == ' ' || !*w;
+}
+
+
+static uint8_t cfg_isdigit(uint8_t c)
+{
+	return c >= '0' && c <= '9';
+}
+
+
+/*
+ * Parses a decimal number at *w, advances w behind it
+ * Returns 0 if there was none
+ */
+static uint8_t cfg_number(__xdata uint8_t **w, __xdata uint16_t *v)
+{
+	if (!cfg_isdigit(**w))
+		return 0;
+	*v = 0;
+	while (cfg_isdigit(**w))
+		*v = *v * 10 + *(*w)++ - '0';
+	return 1;
+}
+
+
+static uint8_t cfg_end_of_word(__xdata uint8_t *w)
+{
+	return *w == ' ' || !*w;
+}
+
+
+static __xdata uint8_t *cfg_next_word(__xdata uint8_t *w)
+{
+	while (*w && *w != ' ')
+		w++;
+	while (*w == ' ')
+		w++;
+	return w;
+}
+
+
+static uint8_t cfg_ip(__xdata uint8_t *w, __xdata uint8_t *e)
+{
+	__xdata uint16_t v;
+
+	for (uint8_t b = 0; b < 4; b++) {
+		if (!cfg_number(&w, &v) || v > 255)
+			return 0;
+		e[b] = v;
+		if (b < 3 && *w++ != '.')
+			return 0;
+	}
+	return cfg_end_of_word(w) && !*cfg_next_word(w);
+}
+
+
+/*
+ * Parses the port words of a vlan or mirror command into two masks, the
+ * suffix a selects the first, b the second mask. Without a suffix, the
+ * port goes into the first mask, into both if both is set
+ */
+static uint8_t cfg_ports(__xdata uint8_t *w, __xdata uint8_t *e, uint8_t a, uint8_t b, uint8_t both)
+{
+	__xdata uint16_t p, m1 = 0, m2 = 0;
+
+	while (*w) {
+		if (!cfg_number(&w, &p) || !p || p > 16)
+			return 0;
+		p = ((uint16_t)1) << (p - 1);
+		if (*w == a) {
+			m1 |= p;
+			w++;
+		} else if (*w == b) {
+			m2 |= p;
+			w++;
+		} else {
+			m1 |= p;
+			if (both)
+				m2 |= p;
+		}
+		if (!cfg_end_of_word(w))
+			return 0;
+		w = cfg_next_word(w);
+	}
+	e[0] = m1; e[1] = m1 >> 8;
+	e[2] = m2; e[3] = m2 >> 8;
+	return 1;
+}
+
+
+/*
+ * Compiles the command line in cfg_line into an entry at e
+ * Returns the length of the entry
+ */
+static uint8_t cfg_compile_line(__xdata uint8_t *e, uint8_t n)
+{
+	__xdata uint8_t *w = cfg_line;
+	__xdata uint8_t *w1, *w2;
+	__xdata uint16_t v;
+	uint8_t i;
+
+	while (*w == ' ')
+		w++;
+	w1 = cfg_next_word(w);
+	w2 = cfg_next_word(w1);
+	e[1] = 0;
+
+	if (cfg_is(w, "ip") && cfg_is(w1, "dhcp") && !*w2) {
+		e[0] = CFG_OP_DHCP;
+		return 2;
+	}
+	if ((cfg_is(w, "ip") || cfg_is(w, "gw") || cfg_is(w, "netmask")) && cfg_ip(w1, e + 2)) {
+		e[0] = w[0] == 'i' ? CFG_OP_IP : (w[0] == 'g' ? CFG_OP_GW : CFG_OP_NETMASK);
+		e[1] = 4;
+		return 6;
+	}
+	if (cfg_is(w, "vlan") && cfg_number(&w1, &v) && cfg_end_of_word(w1) && *w2) {
+		e[2] = v; e[3] = v >> 8;
+		if (cfg_is(w2, "mgmt") && !*cfg_next_word(w2)) {
+			e[0] = CFG_OP_VLAN_MGMT;
+			e[1] = 2;
+			return 4;
+		}
+		if (cfg_ports(w2, e + 4, 'u', 't', 0)) {
+			// Tagged ports are members as well
+			e[4] |= e[6];
+			e[5] |= e[7];
+			e[0] = CFG_OP_VLAN;
+			e[1] = 6;
+			return 8;
+		}
+	}
+	// Port numbers of pvid and eee are a single digit
+	if (cfg_is(w, "pvid") && cfg_isdigit(w1[0]) && w1[0] != '0' && w1[1] == ' '
+	    && cfg_number(&w2, &v) && !*cfg_next_word(w2)) {
+		e[0] = CFG_OP_PVID;
+		e[1] = 3;
+		e[2] = w1[0] - '0';
+		e[3] = v; e[4] = v >> 8;
+		return 5;
+	}
+	if (cfg_is(w, "mirror") && cfg_is(w1, "off") && !*w2) {
+		e[0] = CFG_OP_MIRROR_OFF;
+		return 2;
+	}
+	if (cfg_is(w, "mirror") && cfg_number(&w1, &v) && v && v <= 16 && cfg_end_of_word(w1)
+	    && cfg_ports(w2, e + 3, 'r', 't', 1)) {
+		e[0] = CFG_OP_MIRROR;
+		e[1] = 5;
+		e[2] = v;
+		return 7;
+	}
+	if (cfg_is(w, "eee") && (cfg_is(w1, "on") || cfg_is(w1, "off"))) {
+		e[3] = w1[1] == 'n';
+		if (!*w2) {
+			e[2] = 0;
+		} else if (cfg_isdigit(w2[0]) && w2[0] != '0' && cfg_end_of_word(w2 + 1) && !*cfg_next_word(w2)) {
+			e[2] = w2[0] - '0';
+		} else {
+			goto text;
+		}
+		e[0] = CFG_OP_EEE;
+		e[1] = 2;
+		return 4;
+	}
+	if (cfg_is(w, "passwd") && *w1 && !*cfg_next_word(w1)) {
+		for (i = 0; !cfg_end_of_word(w1 + i); i++)
+			e[i + 2] = w1[i];
+		if (i <= 20) {
+			e[0] = CFG_OP_PASSWD;
+			e[1] = i;
+			return i + 2;
+		}
+	}
+text:
+	// Everything else is run through the command parser
+	e[0] = CFG_OP_TEXT;
+	e[1] = n;
+	for (i = 0; i < n; i++)
+		e[i + 2] = cfg_line[i];
+	return n + 2;
+}
+
+
+/*
+ * Programs the entries compiled into the page so far
+ */
+static uint8_t cfg_flush(void)
+{
+	__xdata uint8_t *page = flash_buf + CFG_PAGE_SIZE;
+
+	if (!cfg_fill)
+		return 1;
+	crc16_block(page, cfg_fill);
+	flash_region.addr = cfg_out;
+	flash_region.len = cfg_fill;
+	cfg_out += cfg_fill;
+	cfg_fill = 0;
+	return flash_write_verify(page);
+}
+
+
+/*
+ * Compiles the line of l bytes in cfg_line into the page
+ */
+static uint8_t cfg_emit(uint8_t l)
+{
+	uint8_t i = 0;
+
+	while (i < l && cfg_line[i] == ' ')
+		i++;
+	if (i == l)
+		return 1;
+	cfg_line[l] = 0;
+	cfg_fill += cfg_compile_line(flash_buf + CFG_PAGE_SIZE + cfg_fill, l);
+	if (cfg_fill > CFG_PAGE_FILL)
+		return cfg_flush();
+	return 1;
+}
+
+
+/*
+ * Compiles the configuration in use into a binary record, the first half
+ * of flash_buf takes the text, the second the entries compiled
+ * Returns 0 if the record could not be written
+ */
+uint8_t config_compile(void) __banked
+{
+	__xdata uint32_t pos = cfg_addr;
+	__xdata uint16_t len_left = cfg_len;
+	__xdata uint32_t start;
+	__xdata uint16_t n, i;
+	uint8_t l = 0;
+	uint8_t c;
+
+	// An entry takes at most 2 bytes more than its line, a line at least 2 bytes
+	start = cfg_out = config_reserve(CFG_RECORD_BINARY, cfg_len + cfg_len / 2 + 2);
+	if (!start)
+		return 0;
+	cfg_fill = 0;
+	crc_value = 0;
+	while (len_left) {
+		n = len_left > CFG_PAGE_SIZE ? CFG_PAGE_SIZE : len_left;
+		cfg_read(pos, flash_buf, n);
+		pos += n;
+		len_left -= n;
+		for (i = 0; i < n; i++) {
+			c = flash_buf[i];
+			if (c && c != '\n' && c != '\r') {
+				if (l < SBUF_SIZE - 1)
+					cfg_line[l++] = c;
+				continue;
+			}
+			if (!cfg_emit(l))
+				return 0;
+			l = 0;
+			if (!c) {
+				len_left = 0;
+				break;
+			}
+		}
+	}
+	// The last line may lack its newline
+	if (!cfg_emit(l) || !cfg_flush())
+		return 0;
+	return config_commit(cfg_out - start, crc_value);
+}
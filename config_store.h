@@ -0,0 +1,23 @@
+#ifndef _CONFIG_STORE_H_
+#define _CONFIG_STORE_H_
+
+#include <stdint.h>
+
+// Sectors at CONFIG_START used as journal of saved configurations
+#define CONFIG_SECTORS		8
+// Largest configuration that can be saved
+#define CONFIG_RECORD_MAX	2048
+
+// The configuration currently in use, a text of cfg_len bytes
+extern __xdata uint32_t cfg_addr;
+extern __xdata uint16_t cfg_len;
+// Its compiled form, cfg_bin_addr is 0 if there is none
+extern __xdata uint32_t cfg_bin_addr;
+extern __xdata uint16_t cfg_bin_len;
+
+void config_init(void) __banked;
+uint32_t config_reserve(uint8_t type, uint16_t max) __banked;
+uint8_t config_commit(uint16_t len, uint16_t crc) __banked;
+uint8_t config_compile(void) __banked;
+
+#endif
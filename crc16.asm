@@ -3,8 +3,12 @@
 ;
 	.globl 	_crc_value
 	.globl 	_crc16
+	.globl	_crc16_block
+	.globl	_crc16_block_PARM_2
 	.equ	BANK, 0x96
-;	.equ	DPS, 0x86
+	.equ	DPS, 0x86
+; Set to 1 if the core has a second DPTR selected by bit 0 of DPS
+	.equ	DUAL_DPTR, 0
 ; Variable in XMEM holding current CRC16 value, being updated
 	.area XSEG    (XDATA)
 _crc_value::
@@ -50,6 +54,108 @@ _crc16:
 ;	clr	DPS
 	ret
 
+;-------------------------------------------------------
+; CRC16 over a block, C prototype:
+; void crc16_block(__xdata uint8_t *v, uint16_t len)
+; - dptr points to the first byte in xmem, the length is
+;   passed in _crc16_block_PARM_2
+; - the CRC is kept in r6 (low) and r7 (high) for the
+;   whole block and updates _crc_value at the end
+; - the loop handles 2 bytes per round, an odd byte first
+;-------------------------------------------------------
+	.area DSEG    (DATA)
+_crc16_block_PARM_2:
+	.ds 2
+
+; Update r6/r7 by the next byte of the block. With DUAL_DPTR the data
+; pointer is DPTR0 and the table pointer DPTR1, otherwise the data
+; pointer is kept in r0/r1
+	.macro	CRC_BYTE
+	.if DUAL_DPTR
+	xrl	DPS, #1			; data pointer
+	movx	a, @dptr
+	inc	dptr
+	xrl	DPS, #1			; table pointer
+	.else
+	mov	dpl, r0
+	mov	dph, r1
+	movx	a, @dptr
+	inc	dptr
+	mov	r0, dpl
+	mov	r1, dph
+	mov	dptr, #crc16_table_l
+	.endif
+	xrl	a, r6			; create index into tables
+	mov	r5, a
+	movc	a, @a+dptr		; get low byte
+	xrl	a, r7
+	mov	r6, a			; new low byte
+	mov	a, r5
+	inc	dph			; crc16_table_h follows crc16_table_l
+	movc	a, @a+dptr
+	mov	r7, a			; new high byte
+	.if DUAL_DPTR
+	dec	dph
+	.endif
+	.endm
+
+	.area CSEG    (CODE)
+_crc16_block:
+	mov	a, _crc16_block_PARM_2
+	orl	a, (_crc16_block_PARM_2 + 1)
+	jz	00004$
+	push	BANK
+	mov	BANK, #1
+	.if DUAL_DPTR
+	mov	DPS, #1
+	.else
+	mov	r0, dpl
+	mov	r1, dph
+	.endif
+	mov	dptr, #_crc_value
+	movx	a, @dptr
+	mov	r6, a
+	inc	dptr
+	movx	a, @dptr
+	mov	r7, a
+	mov	dptr, #crc16_table_l
+	; r3:r2 = number of pairs, carry set for an odd byte
+	mov	a, (_crc16_block_PARM_2 + 1)
+	clr	c
+	rrc	a
+	mov	r3, a
+	mov	a, _crc16_block_PARM_2
+	rrc	a
+	mov	r2, a
+	jnc	00001$
+	CRC_BYTE
+00001$:
+	mov	a, r2
+	orl	a, r3
+	jz	00003$
+	; With djnz on both bytes the high byte counts the rounds of the low byte
+	mov	a, r2
+	jz	00002$
+	inc	r3
+00002$:
+	CRC_BYTE
+	CRC_BYTE
+	djnz	r2, 00002$
+	djnz	r3, 00002$
+00003$:
+	.if DUAL_DPTR
+	mov	DPS, #0
+	.endif
+	mov	dptr, #_crc_value
+	mov	a, r6
+	movx	@dptr, a
+	inc	dptr
+	mov	a, r7
+	movx	@dptr, a
+	pop	BANK
+00004$:
+	ret
+
 	.area BANK1   (CODE)
 
 crc16_table_l:
@@ -9,11 +9,13 @@
 #include "rtl837x_sfr.h"
 #include "rtl837x_common.h"
 #include "dhcp.h"
+#include "log.h"
 #include "uip.h"
 #include "uip/uip.h"
 
 extern __code struct uip_eth_addr uip_ethaddr;
 __xdata struct dhcp_state dhcp_state;
+__xdata struct timer dhcp_timer;	// Time-out of the current state
 __xdata uip_ipaddr_t server;
 
 #define DHCP_HW_TYPE_ETH	1
@@ -83,15 +85,6 @@ struct dhcp_pkt {
 __xdata uint32_t long_value;
 
 
-void dhcp_print_ip(uint8_t *a)
-{
-	itoa(a[0]); write_char('.');
-	itoa(a[1]); write_char('.');
-	itoa(a[2]); write_char('.');
-	itoa(a[3]);
-}
-
-
 void dhcp_prepare_request(void)
 {
 	DHCP_P->type = 1;
@@ -148,7 +141,7 @@ void dhcp_addopt_server_id(void)
 
 void dhcp_send_discover(void)
 {
-	print_string("dhcp_send_discover called\n");
+	LOG(LOG_DHCP, LOG_DEBUG, LOG_MSG_DHCP_DISCOVER, 0, 0);
 	dhcp_prepare_request();
 
 	dhcp_state.opt_ptr = 0;
@@ -176,14 +169,13 @@ void dhcp_send_discover(void)
 
 	uip_udp_send(sizeof(struct dhcp_pkt) + dhcp_state.opt_ptr);
 	dhcp_state.state = DHCP_DISCOVER_SENT;
-	dhcp_state.ticks = SYS_TICK_HZ;
-	dhcp_state.dhcp_timer = 30; // Timeout for discover
+	timer_arm(&dhcp_timer, 30 * SYS_TICK_HZ); // Timeout for discover
 }
 
 
 void dhcp_send_request(void)
 {
-	print_string("dhcp_send_request called\n");
+	LOG(LOG_DHCP, LOG_DEBUG, LOG_MSG_DHCP_REQUEST, 0, 0);
 	dhcp_prepare_request();
 
 	dhcp_state.opt_ptr = 0;
@@ -212,8 +204,7 @@ void dhcp_send_request(void)
 
 	uip_udp_send(sizeof(struct dhcp_pkt) + dhcp_state.opt_ptr);
 	dhcp_state.state = DHCP_REQUEST_SENT;
-	dhcp_state.ticks = SYS_TICK_HZ;
-	dhcp_state.dhcp_timer = 30; // Timeout for request
+	timer_arm(&dhcp_timer, 30 * SYS_TICK_HZ); // Timeout for request
 }
 
 
@@ -278,7 +269,7 @@ void parse_opts(void)
 		case DHCP_END:
 			break;
 		default:
-			print_string("Unknown DHCP option: "); print_byte(DHCP_OPT[dhcp_state.opt_ptr]); write_char('\n');
+			LOG(LOG_DHCP, LOG_DEBUG, LOG_MSG_DHCP_OPTION, DHCP_OPT[dhcp_state.opt_ptr], 0);
 			dhcp_state.opt_ptr++;
 			dhcp_state.opt_ptr += DHCP_OPT[dhcp_state.opt_ptr];
 			dhcp_state.opt_ptr++;
@@ -304,26 +295,19 @@ void parse_dhcp(void)
 		dhcp_state.current_ip[2] = DHCP_P->your_ip[2];
 		dhcp_state.current_ip[3] = DHCP_P->your_ip[3];
 		parse_opts();
-		print_string("DHCP offer received for IP "); dhcp_print_ip(dhcp_state.current_ip);
-		write_char('\n');
+		LOG(LOG_DHCP, LOG_INFO, LOG_MSG_DHCP_OFFER, LOG_IP(dhcp_state.current_ip), 0);
 		dhcp_send_request();
 	} else if (DHCP_OPT[dhcp_state.opt_ptr++] == DHCP_MESSAGE_ACK) {
 		parse_opts();
-		print_string("DHCP ACK, our IP is "); dhcp_print_ip(dhcp_state.current_ip);
-		write_char('\n');
-		print_string("DHCP netmask "); dhcp_print_ip(dhcp_state.subnet);
-		write_char('\n');
-		print_string("DHCP gateway "); dhcp_print_ip(dhcp_state.router);
-		write_char('\n');
-		print_string("DHCP lease-time ");
-		print_long(dhcp_state.lease);
-		write_char('\n');
+		LOG(LOG_DHCP, LOG_INFO, LOG_MSG_DHCP_ACK, LOG_IP(dhcp_state.current_ip), 0);
+		LOG(LOG_DHCP, LOG_INFO, LOG_MSG_DHCP_NETMASK, LOG_IP(dhcp_state.subnet), 0);
+		LOG(LOG_DHCP, LOG_INFO, LOG_MSG_DHCP_GATEWAY, LOG_IP(dhcp_state.router), 0);
+		LOG(LOG_DHCP, LOG_INFO, LOG_MSG_DHCP_LEASE, dhcp_state.lease, 0);
 		uip_ipaddr(&uip_hostaddr, dhcp_state.current_ip[0], dhcp_state.current_ip[1], dhcp_state.current_ip[2], dhcp_state.current_ip[3]);
 		uip_ipaddr(&uip_draddr, dhcp_state.router[0], dhcp_state.router[1], dhcp_state.router[2], dhcp_state.router[3]);
 		uip_ipaddr(&uip_netmask, dhcp_state.subnet[0], dhcp_state.subnet[1], dhcp_state.subnet[2], dhcp_state.subnet[3]);
 		dhcp_state.state = DHCP_LEASING;
-		dhcp_state.ticks = SYS_TICK_HZ;
-		dhcp_state.dhcp_timer = dhcp_state.renewal > 0xffff ? 0xffff : dhcp_state.renewal;
+		timer_arm(&dhcp_timer, (dhcp_state.renewal > 0xffff ? 0xffff : dhcp_state.renewal) * SYS_TICK_HZ);
 	}
 }
 
@@ -336,20 +320,21 @@ void dhcp_start(void) __banked
 	if(dhcp_state.conn) {
 		uip_udp_bind(dhcp_state.conn, HTONS(DHCPC_CLIENT_PORT));
 	} else {
-		print_string("dhcp_start failed to set up socket\n");
+		LOG(LOG_DHCP, LOG_ERR, LOG_MSG_DHCP_SOCKET, 0, 0);
 		return;
 	}
 	get_random_32();
 	dhcp_state.transaction_id = SFR_DATA_U32;
 	dhcp_state.state = DHCP_START;
-	print_string("dhcp_start done\n");
+	LOG(LOG_DHCP, LOG_INFO, LOG_MSG_DHCP_START, 0, 0);
 }
 
 
 void dhcp_stop(void) __banked
 {
-	print_string("dhcp_stop called\n");
+	LOG(LOG_DHCP, LOG_INFO, LOG_MSG_DHCP_STOP, 0, 0);
 	uip_udp_remove(dhcp_state.conn);
+	timer_cancel(&dhcp_timer);
 	dhcp_state.state = DHCP_OFF;
 }
 
@@ -359,19 +344,15 @@ void dhcp_callback(void) __banked
 	if (!dhcp_state.state)
 		return;
 	if (uip_closed()) {
-		print_string("Closed\n");
+		LOG(LOG_DHCP, LOG_INFO, LOG_MSG_DHCP_CLOSED, 0, 0);
 		return;
 	} else if (uip_newdata()) {
 		parse_dhcp();
 	} else {
 		if (dhcp_state.state == DHCP_START) {
 			dhcp_send_discover();
-		} else if (!--dhcp_state.ticks) {
-//			print_string("Timer: "); print_short(dhcp_state.ticks); write_char(' '); print_short(dhcp_state.dhcp_timer);
-			dhcp_state.dhcp_timer--;
-			dhcp_state.ticks = SYS_TICK_HZ;
-		}
-		if (!dhcp_state.dhcp_timer) {
+		} else if (dhcp_timer.fired) {
+			dhcp_timer.fired = 0;
 			switch (dhcp_state.state) {
 			case DHCP_DISCOVER_SENT:
 				dhcp_send_discover();
@@ -381,7 +362,7 @@ void dhcp_callback(void) __banked
 				dhcp_send_request();
 				break;
 			default:
-				print_string("UNKNOWN STATE\n");
+				LOG(LOG_DHCP, LOG_WARN, LOG_MSG_DHCP_STATE, dhcp_state.state, 0);
 			}
 		}
 	}
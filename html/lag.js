@@ -1,9 +1,4 @@
-var lagInterval = Number();
-
 function lagForm() {
-  if (!numPorts)
-    return;
-  clearInterval(lagInterval);
   for (let j=0; j < 4; j++) {
     var lag = "mLAG" + j
     console.log("Adding LAG " + lag)
@@ -28,38 +23,29 @@ function lagForm() {
       m.appendChild(d);
     }
   }
-  fetchLag();
 }
 
 function setL(p, c){
   console.log("LAG setting: ", p, " to ", c);
   document.getElementById(p).checked=c;
 }
-window.addEventListener("load", function() {
-  lagInterval = setInterval(lagForm, 200);
-});
-
-function fetchLag() {
-  var xhttp = new XMLHttpRequest();
-  xhttp.onreadystatechange = function() {
-    if (this.readyState == 4 && this.status == 200) {
-      const s = JSON.parse(xhttp.responseText);
-      console.log("LAG: ", JSON.stringify(s));
-      for (let l = 0; l < 4; l++) {
-        let members = parseInt(s[l].members, 2);
-        let hash = parseInt(s[l].hash, 16);
-        for (let i = 1; i <= numPorts; i++) {
-          let p = i - 1;
-          if (numPorts < 9)
-            p = physToLogPort[p];            
-          setL("p_mLAG"+l+"_"+i, members & (1<<p));
-        }
-      }
+function showLag(s) {
+  console.log("LAG: ", JSON.stringify(s));
+  for (let l = 0; l < 4; l++) {
+    let members = parseInt(s[l].members, 2);
+    let hash = parseInt(s[l].hash, 16);
+    for (let i = 1; i <= numPorts; i++) {
+      let p = i - 1;
+      if (numPorts < 9)
+        p = physToLogPort[p];            
+      setL("p_mLAG"+l+"_"+i, members & (1<<p));
     }
-  };
-  xhttp.open("GET", `/lag.json`, true);
-  xhttp.send();
+  }
 }
+
+// The form is filled once with the current settings, it is then up to the user
+onPortsKnown(lagForm);
+onceDashboard("lag", showLag);
 async function lagSub(l) {
   var cmd = "lag " + l;
   for (let i = 1; i <= numPorts; i++) {
@@ -9,6 +9,32 @@ var pAdvertised = new Int8Array(10);
 var numPorts = 0;
 var logToPhysPort = new Int8Array(10);
 var physToLogPort = new Int8Array(10);
+
+// Shared poller: each page fetches /dashboard.json once per interval, asking for the
+// port status plus the sections its scripts registered for. Changes of the switch
+// state are pushed through a long-poll on /events.json
+var dashSubs = {};
+var dashOnce = {};
+var dashReady = [];
+var eventGen = -1;
+// Generation of the port status, the switch only sends what changed after it
+var statusGen = 0;
+var portCache = [];
+// Calls cb with the data of a section on every update
+function onDashboard(section, cb) {
+  dashSubs[section] = cb;
+}
+// Calls cb only with the next update of a section
+function onceDashboard(section, cb) {
+  dashOnce[section] = cb;
+}
+// Calls cb as soon as the number of ports is known
+function onPortsKnown(cb) {
+  if (numPorts)
+    cb();
+  else
+    dashReady.push(cb);
+}
 function drawPorts() {
   var f = document.getElementById('ports');
   console.log("DRAWING PORTS: ", numPorts);
@@ -44,74 +70,152 @@ function update() {
     if (this.readyState == 4 && this.status == 401)
 	    document.location = "/login.html"
     if (this.readyState == 4 && this.status == 200) {
-      const s = JSON.parse(xhttp.responseText);
-      if (!numPorts) {
-	numPorts = s.length;
-	for (let i = 0; i < s.length; i++)
-	  pIsSFP[s[i].portNum-1] = s[i].isSFP;
-	drawPorts();
-      }
-      console.log("RES:", JSON.stringify(s));
-      for (let i = 0; i < s.length; i++) {
-	p = s[i];
-	let n = p.portNum;
-	logToPhysPort[p.logPort] = n;
-	physToLogPort[n-1] = p.logPort;
-	let pid = "port" + n;
-	let ttid = "tt_" + n;
-	n--;
-	txG[n] = BigInt(p.txG); txB[n] = BigInt(p.txB); rxG[n] = BigInt(p.rxG); rxB[n] = BigInt(p.rxB);
-	var psvg = document.getElementById(pid);
-	var tt = document.getElementById(ttid);
-	if (psvg == null || !psvg.contentDocument)
-	  continue;
-	var bgs = psvg.contentDocument.getElementsByClassName("bg");
-	var leds = psvg.contentDocument.getElementsByClassName("led");
-	if (p.enabled == 0) {
-	  pState[n] = -1;
-	  bgs[0].style.fill = "red";
-	  leds[0].style.fill = "black"; leds[1].style.fill = "black";
-	  psvg.style.opacity = 0.4;
-	  tt.innerHTML = "Not enabled.";
-	} else {
-	  psvg.style.opacity = 1.0;
-	  pState[n] = p.link;
-	  if (p.link == 4 || p.link == 5 || p.link == 6) {
-	    leds[0].style.fill = "green"; leds[1].style.fill = "orange";
-	  } else if (p.link == 1 || p.link == 2 || p.link == 3) {
-	    leds[0].style.fill = "green"; leds[1].style.fill = "green";
-	  } else {
-	    leds[0].style.fill = "black"; leds[1].style.fill = "black";
-	    psvg.style.opacity = 0.4
-	  }
-	  var iHTML = "<table border=\"0\" class=\"tt_table\">";
-	  iHTML += "<tr><td align=\"left\">Link speed</td><td>:</td><td>" + linkS[p.link + 1] + "</td></tr>";
-	  if (p.isSFP) {
-            pAdvertised[n] = 0;
-	    iHTML += "<tr><td>Vendor</td><td>:</td><td>" + p.sfp_vendor + "</td></tr>";
-	    iHTML += "<tr><td>Model</td><td>:</td><td>" + p.sfp_model + "</td></tr>";
-	    iHTML += "<tr><td>Serial</td><td>:</td><td>" + p.sfp_serial + "</td></tr>";
-	    if (p.sfp_options & 0x40) {
-	      iHTML += "<tr><td>Temp</td><td>:</td><td>" + (Number(p.sfp_temp) >> 8) + "." + ((Number(p.sfp_temp) & 0xff)/256.0 * 100).toFixed(0) + "&#8239;&#8451;</td></tr>";
-	      iHTML += "<tr><td>Vcc</td><td>:</td><td>" + (Number(p.sfp_vcc) / 10000.0).toFixed(2) + "&#8239;V</td></tr>";
-	      iHTML += "<tr><td>TX-Bias</td><td>:</td><td>" + (Number(p.sfp_txbias) / 500.0).toFixed(1) + "&#8239;mA</td></tr>";
-	      iHTML += "<tr><td>TX-Power</td><td>:</td><td>" + (Number(p.sfp_txpower) / 10.0).toFixed(0) + "&#8239;mW</td></tr>";
-	      iHTML += "<tr><td>RX-Power</td><td>:</td><td>" + (Number(p.sfp_rxpower) / 10.0).toFixed(0) + "&#8239;mW</td></tr>";
-	    }
-	  } else {
-	    pAdvertised[n] = parseInt(p.adv, 2);
-	  }
-	  iHTML += "</table>";
-	  tt.innerHTML = iHTML;
-	}
-      }
+      const d = JSON.parse(xhttp.responseText);
+      if (d.gen !== undefined)
+        statusGen = d.gen;
+      dispatch(d, sections);
     }
   };
-  xhttp.open("GET", "/status.json", true);
+  // Once the long-poll runs, the subscribed sections only need to be fetched when they change
+  const sections = [...new Set(["status"].concat(eventGen < 0 ? Object.keys(dashSubs) : [], Object.keys(dashOnce)))];
+  xhttp.open("GET", "/dashboard.json?since=" + statusGen + "&s=" + sections.join(","), true);
   xhttp.timeout = 5000; xhttp.send();
 }
 
+// Hands the sections of a dashboard or events response to the subscribers,
+// only those that were requested and are part of the response
+function dispatch(d, sections) {
+  if (d.ports)
+    updateStatus(d.ports);
+  for (const sec in dashSubs)
+    if (sections.includes(sec) && dashData(d, sec))
+      dashSubs[sec](dashData(d, sec));
+  for (const sec in dashOnce) {
+    if (!sections.includes(sec) || !dashData(d, sec))
+      continue;
+    const cb = dashOnce[sec];
+    delete dashOnce[sec];
+    cb(dashData(d, sec));
+  }
+}
+
+// Long-poll: the switch answers when its state changes or after t seconds
+function watch() {
+  var xhttp = new XMLHttpRequest();
+  xhttp.onreadystatechange = function() {
+    if (this.readyState != 4)
+      return;
+    if (this.status == 401) {
+      document.location = "/login.html";
+    } else if (this.status == 200) {
+      const d = JSON.parse(xhttp.responseText);
+      if (eventGen >= 0 && d.gen != eventGen)
+        dispatch(d, sections);
+      // Nothing changed: the request timed out or the switch had no
+      // connection to spare for it, do not poll again right away
+      const idle = d.gen == eventGen;
+      eventGen = d.gen;
+      if (idle)
+        setTimeout(watch, 2000);
+      else
+        watch();
+    } else {
+      setTimeout(watch, 2000);
+    }
+  };
+  // The first request only learns the current generation
+  var url = "/events.json";
+  const sections = [...new Set(["status"].concat(Object.keys(dashSubs)))];
+  if (eventGen >= 0)
+    url += "?since=" + eventGen + "&t=20&s=" + sections.join(",");
+  xhttp.open("GET", url, true);
+  xhttp.timeout = 30000; xhttp.send();
+}
+
+// Status, MTU and EEE are merged into the per-port objects of the dashboard,
+// MTU and EEE are only part of a response if the ports carry their fields
+const portFields = { mtu: "mtu", eee: "eee" };
+function dashData(d, sec) {
+  if (sec == "status")
+    return d.ports ? cachedPorts() : undefined;
+  if (portFields[sec])
+    return d.ports && d.ports.some(p => p[portFields[sec]] !== undefined) ? cachedPorts() : undefined;
+  return d[sec];
+}
+
+// All ports with their last values, a status update only carries what changed
+function cachedPorts() {
+  return portCache.filter(p => p);
+}
+
+function updateStatus(s) {
+  if (!numPorts) {
+    numPorts = s.length;
+    for (let i = 0; i < s.length; i++)
+      pIsSFP[s[i].portNum-1] = s[i].isSFP;
+    drawPorts();
+  }
+  console.log("RES:", JSON.stringify(s));
+  for (let i = 0; i < s.length; i++) {
+    // Ports and fields without changes are not sent, keep the last values
+    let n = s[i].portNum;
+    let p = portCache[n] = Object.assign(portCache[n] || {}, s[i]);
+    logToPhysPort[p.logPort] = n;
+    physToLogPort[n-1] = p.logPort;
+    let pid = "port" + n;
+    let ttid = "tt_" + n;
+    n--;
+    txG[n] = BigInt(p.txG); txB[n] = BigInt(p.txB); rxG[n] = BigInt(p.rxG); rxB[n] = BigInt(p.rxB);
+    var psvg = document.getElementById(pid);
+    var tt = document.getElementById(ttid);
+    if (psvg == null || !psvg.contentDocument)
+      continue;
+    var bgs = psvg.contentDocument.getElementsByClassName("bg");
+    var leds = psvg.contentDocument.getElementsByClassName("led");
+    if (p.enabled == 0) {
+      pState[n] = -1;
+      bgs[0].style.fill = "red";
+      leds[0].style.fill = "black"; leds[1].style.fill = "black";
+      psvg.style.opacity = 0.4;
+      tt.innerHTML = "Not enabled.";
+    } else {
+      psvg.style.opacity = 1.0;
+      pState[n] = p.link;
+      if (p.link == 4 || p.link == 5 || p.link == 6) {
+        leds[0].style.fill = "green"; leds[1].style.fill = "orange";
+      } else if (p.link == 1 || p.link == 2 || p.link == 3) {
+        leds[0].style.fill = "green"; leds[1].style.fill = "green";
+      } else {
+        leds[0].style.fill = "black"; leds[1].style.fill = "black";
+        psvg.style.opacity = 0.4
+      }
+      var iHTML = "<table border=\"0\" class=\"tt_table\">";
+      iHTML += "<tr><td align=\"left\">Link speed</td><td>:</td><td>" + linkS[p.link + 1] + "</td></tr>";
+      if (p.isSFP) {
+        pAdvertised[n] = 0;
+        iHTML += "<tr><td>Vendor</td><td>:</td><td>" + p.sfp_vendor + "</td></tr>";
+        iHTML += "<tr><td>Model</td><td>:</td><td>" + p.sfp_model + "</td></tr>";
+        iHTML += "<tr><td>Serial</td><td>:</td><td>" + p.sfp_serial + "</td></tr>";
+        if (p.sfp_options & 0x40) {
+          iHTML += "<tr><td>Temp</td><td>:</td><td>" + (Number(p.sfp_temp) >> 8) + "." + ((Number(p.sfp_temp) & 0xff)/256.0 * 100).toFixed(0) + "&#8239;&#8451;</td></tr>";
+          iHTML += "<tr><td>Vcc</td><td>:</td><td>" + (Number(p.sfp_vcc) / 10000.0).toFixed(2) + "&#8239;V</td></tr>";
+          iHTML += "<tr><td>TX-Bias</td><td>:</td><td>" + (Number(p.sfp_txbias) / 500.0).toFixed(1) + "&#8239;mA</td></tr>";
+          iHTML += "<tr><td>TX-Power</td><td>:</td><td>" + (Number(p.sfp_txpower) / 10.0).toFixed(0) + "&#8239;mW</td></tr>";
+          iHTML += "<tr><td>RX-Power</td><td>:</td><td>" + (Number(p.sfp_rxpower) / 10.0).toFixed(0) + "&#8239;mW</td></tr>";
+        }
+      } else {
+        pAdvertised[n] = parseInt(p.adv, 2);
+      }
+      iHTML += "</table>";
+      tt.innerHTML = iHTML;
+    }
+  }
+  while (dashReady.length)
+    dashReady.shift()();
+}
+
 window.addEventListener("load", function() {
   update();
   const interval = setInterval(update, 2000);
+  watch();
 });
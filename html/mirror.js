@@ -1,10 +1,6 @@
-var mirrorInterval = Number();
 const mirrors = ["mPortsTX", "mPortsRX"];
 
 function mirrorForm() {
-  if (!numPorts)
-    return;
-  clearInterval(mirrorInterval);
   for (let j=0; j < mirrors.length; j++) {
     console.log("Adding Mirror " + j)
     var m = document.getElementById(mirrors[j]);
@@ -28,34 +24,25 @@ function mirrorForm() {
       m.appendChild(d);
     }
   }
-  fetchMirror();
 }
 
 function setM(p, c){
   document.getElementById(p).checked=c;
 }
-window.addEventListener("load", function() {
-  mirrorInterval = setInterval(mirrorForm, 200);
-});
-
-function fetchMirror() {
-  var xhttp = new XMLHttpRequest();
-  xhttp.onreadystatechange = function() {
-    if (this.readyState == 4 && this.status == 200) {
-      const s = JSON.parse(xhttp.responseText);
-      console.log("MIRROR: ", JSON.stringify(s));
-      document.getElementById('me').checked = s.enabled;
-      document.getElementById('mp').value = s.mPort;
-      let m_tx = parseInt(s.mirror_tx, 2);
-      let m_rx = parseInt(s.mirror_rx, 2);
-      for (let i = 1; i <= numPorts; i++) {
-        let p = i - 1;
-        if (numPorts < 9)
-          p = physToLogPort[p];members & (1<<p)
-        setM("mPortsTX"+i, m_tx&(1<<p)); setM("mPortsRX"+i, m_rx&(1<<p));
-      }
-    }
-  };
-  xhttp.open("GET", `/mirror.json`, true);
-  xhttp.send();
+function showMirror(s) {
+  console.log("MIRROR: ", JSON.stringify(s));
+  document.getElementById('me').checked = s.enabled;
+  document.getElementById('mp').value = s.mPort;
+  let m_tx = parseInt(s.mirror_tx, 2);
+  let m_rx = parseInt(s.mirror_rx, 2);
+  for (let i = 1; i <= numPorts; i++) {
+    let p = i - 1;
+    if (numPorts < 9)
+      p = physToLogPort[p];
+    setM("mPortsTX"+i, m_tx&(1<<p)); setM("mPortsRX"+i, m_rx&(1<<p));
+  }
 }
+
+// The form is filled once with the current settings, it is then up to the user
+onPortsKnown(mirrorForm);
+onceDashboard("mirror", showMirror);
@@ -3,7 +3,6 @@ var clicked = new Int8Array(10);
 function createPortTable() {
   var tbl = document.getElementById('speedtable');
    if (tbl.rows.length <= 2 && numPorts) {
-     clearInterval(pTableInterval);
      const sSelect = '<select name="speed_sel" id="speed_sel">'
       + '<option value="auto">Auto</option>'
       + '<option value="2g5">2500MBit/Full</option>'
@@ -110,37 +109,26 @@ async function applyMTU(port) {
       body: cmd
     });
     console.log('MTU Completed!', response);
-    getMTUs();
+    onceDashboard("mtu", showMTUs);
   } catch(err) {
     console.error(`Error: ${err}`);
   }
 }
 
-function getMTUs() {
-  var xhttp = new XMLHttpRequest();
-  xhttp.onreadystatechange = function() {
-    if (this.readyState == 4 && this.status == 200) {
-      const s = JSON.parse(xhttp.responseText);
-      console.log("MTUS: ", JSON.stringify(s));
-      for (let i = 0; i < s.length; i++) {
-        p = s[i];
-	let n = p.portNum;
-        mtus[n] = parseInt(p.mtu, 16);
-        var mtu = document.getElementById('mtu_sel_' + n);
-        if (!mtu)
-          continue;
-        mtu.value = mtus[n];
-        clearInterval(pMTUInterval);
-      }
-    }
-  };
-  xhttp.open("GET", "/mtu.json", true);
-  xhttp.timeout = 1500; xhttp.send();
+function showMTUs(s) {
+  console.log("MTUS: ", JSON.stringify(s));
+  for (let i = 0; i < s.length; i++) {
+    let p = s[i];
+    let n = p.portNum;
+    mtus[n] = parseInt(p.mtu, 16);
+    var mtu = document.getElementById('mtu_sel_' + n);
+    if (!mtu)
+      continue;
+    mtu.value = mtus[n];
+  }
 }
 
-window.addEventListener("load", function() {
-  const updatePortTableInterval = setInterval(updatePortTable, 1000);
-});
-
-const pTableInterval = setInterval(createPortTable, 1000);
-const pMTUInterval = setInterval(getMTUs, 1200);
+// The MTUs are only shown once, so that a user's selection is not overwritten
+onPortsKnown(createPortTable);
+onDashboard("status", updatePortTable);
+onceDashboard("mtu", showMTUs);
@@ -0,0 +1,25 @@
+var uploadInterval = Number();
+
+async function showProgress() {
+  try {
+    const response = await fetch('/upload.json');
+    const u = await response.json();
+    const p = document.getElementById('progress');
+    if (u.state == "idle")
+      return;
+    var text = `${Math.round(u.received / 1024)} of ${Math.round(u.length / 1024)} KB received, `
+      + `${Math.round(u.written / 1024)} KB written, ${u.rate} KB/s`;
+    if (u.state != "running") {
+      text = `Upload ${u.state}: ` + text;
+      clearInterval(uploadInterval);
+    }
+    p.textContent = text;
+  } catch(err) {
+    console.error(`Error: ${err}`);
+  }
+}
+
+document.getElementById('upload').addEventListener('submit', function () {
+  document.getElementById('progress').textContent = "Starting upload...";
+  uploadInterval = setInterval(showProgress, 1000);
+});
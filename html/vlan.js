@@ -1,9 +1,4 @@
-var vlanInterval = Number();
-
 function vlanForm() {
-  if (!numPorts)
-    return;
-  clearInterval(vlanInterval);
   var t = document.getElementById('tPorts');
   var u = document.getElementById('uPorts');
   var p = document.getElementById('pPorts');
@@ -58,9 +53,7 @@ function pvClicked(p){
   }
 }
 
-window.addEventListener("load", function() {
-  vlanInterval = setInterval(vlanForm, 100);
-});
+onPortsKnown(vlanForm);
 
 function fetchVLAN() {
   var xhttp = new XMLHttpRequest();
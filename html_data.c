@@ -0,0 +1,88 @@
+// This file is automatically generated, do not edit!
+
+#include "html_data.h"
+
+#pragma codeseg BANK1
+#pragma constseg BANK1
+
+ __code char * __code mime_strings[] = {
+  "text/html",
+  "image/svg+xml",
+  "image/svg+xml",
+  "image/png",
+  "text/javascript",
+  "text/css",
+  "text/plain"};
+
+void send_config(void);
+void send_status(void);
+void send_basic_info(void);
+void send_vlan(void);
+void send_counters(void);
+void send_eee(void);
+void send_l2(void);
+void l2_delete(void);
+void send_mirror(void);
+void send_mtu(void);
+void send_lag(void);
+void send_cmd_log(void);
+void send_log(void);
+void send_dashboard(void);
+void send_events(void);
+void send_upload(void);
+void send_tasks(void);
+
+__code struct f_data f_data[FDATA_ENTRIES] = {
+  {"/l2.html", FDATA_START_l2_html, FDATA_SIZE_l2_html, mime_HTML, FDATA_ETAG_l2_html, 0},
+  {"/lag.html", FDATA_START_lag_html, FDATA_SIZE_lag_html, mime_HTML, FDATA_ETAG_lag_html, 0},
+  {"/system.html", FDATA_START_system_html, FDATA_SIZE_system_html, mime_HTML, FDATA_ETAG_system_html, 0},
+  {"/config", 0, 0, mime_TXT, 0, send_config},
+  {"/eee.html", FDATA_START_eee_html, FDATA_SIZE_eee_html, mime_HTML, FDATA_ETAG_eee_html, 0},
+  {"/favicon.ico", FDATA_START_favicon_ico, FDATA_SIZE_favicon_ico, mime_SVG, FDATA_ETAG_favicon_ico, 0},
+  {"/l2.json", 0, 0, mime_TXT, 0, send_l2},
+  {"/log", 0, 0, mime_TXT, 0, send_log},
+  {"/eee.json", 0, 0, mime_TXT, 0, send_eee},
+  {"/upload.json", 0, 0, mime_TXT, 0, send_upload},
+  {"/information.json", 0, 0, mime_TXT, 0, send_basic_info},
+  {"/main_info.js", FDATA_START_main_info_js, FDATA_SIZE_main_info_js, mime_JS, FDATA_ETAG_main_info_js, 0},
+  {"/vlan.html", FDATA_START_vlan_html, FDATA_SIZE_vlan_html, mime_HTML, FDATA_ETAG_vlan_html, 0},
+  {"/vlan.json", 0, 0, mime_TXT, 0, send_vlan},
+  {"/port.svg", FDATA_START_port_svg, FDATA_SIZE_port_svg, mime_SVG, FDATA_ETAG_port_svg, 0},
+  {"/update.html", FDATA_START_update_html, FDATA_SIZE_update_html, mime_HTML, FDATA_ETAG_update_html, 0},
+  {"/mtu.json", 0, 0, mime_TXT, 0, send_mtu},
+  {"/", FDATA_START_index_html, FDATA_SIZE_index_html, mime_HTML, FDATA_ETAG_index_html, 0},
+  {"/navigation.js", FDATA_START_navigation_js, FDATA_SIZE_navigation_js, mime_JS, FDATA_ETAG_navigation_js, 0},
+  {"/ports.html", FDATA_START_ports_html, FDATA_SIZE_ports_html, mime_HTML, FDATA_ETAG_ports_html, 0},
+  {"/login.html", FDATA_START_login_html, FDATA_SIZE_login_html, mime_HTML, FDATA_ETAG_login_html, 0},
+  {"/main.js", FDATA_START_main_js, FDATA_SIZE_main_js, mime_JS, FDATA_ETAG_main_js, 0},
+  {"/dashboard.json", 0, 0, mime_TXT, 0, send_dashboard},
+  {"/lag.js", FDATA_START_lag_js, FDATA_SIZE_lag_js, mime_JS, FDATA_ETAG_lag_js, 0},
+  {"/events.json", 0, 0, mime_TXT, 0, send_events},
+  {"/mirror.html", FDATA_START_mirror_html, FDATA_SIZE_mirror_html, mime_HTML, FDATA_ETAG_mirror_html, 0},
+  {"/switch.svg", FDATA_START_switch_svg, FDATA_SIZE_switch_svg, mime_SVG, FDATA_ETAG_switch_svg, 0},
+  {"/cmd_log", 0, 0, mime_TXT, 0, send_cmd_log},
+  {"/eee_sub.js", FDATA_START_eee_sub_js, FDATA_SIZE_eee_sub_js, mime_JS, FDATA_ETAG_eee_sub_js, 0},
+  {"/config.js", FDATA_START_config_js, FDATA_SIZE_config_js, mime_JS, FDATA_ETAG_config_js, 0},
+  {"/stat.html", FDATA_START_stat_html, FDATA_SIZE_stat_html, mime_HTML, FDATA_ETAG_stat_html, 0},
+  {"/index.html", FDATA_START_index_html, FDATA_SIZE_index_html, mime_HTML, FDATA_ETAG_index_html, 0},
+  {"/ports.js", FDATA_START_ports_js, FDATA_SIZE_ports_js, mime_JS, FDATA_ETAG_ports_js, 0},
+  {"/vlan_sub.js", FDATA_START_vlan_sub_js, FDATA_SIZE_vlan_sub_js, mime_JS, FDATA_ETAG_vlan_sub_js, 0},
+  {"/mirror.json", 0, 0, mime_TXT, 0, send_mirror},
+  {"/style.css", FDATA_START_style_css, FDATA_SIZE_style_css, mime_CSS, FDATA_ETAG_style_css, 0},
+  {"/status.json", 0, 0, mime_TXT, 0, send_status},
+  {"/vlan.js", FDATA_START_vlan_js, FDATA_SIZE_vlan_js, mime_JS, FDATA_ETAG_vlan_js, 0},
+  {"/tasks.json", 0, 0, mime_TXT, 0, send_tasks},
+  {"/sfp.svg", FDATA_START_sfp_svg, FDATA_SIZE_sfp_svg, mime_SVG, FDATA_ETAG_sfp_svg, 0},
+  {"/update.js", FDATA_START_update_js, FDATA_SIZE_update_js, mime_JS, FDATA_ETAG_update_js, 0},
+  {"/counters.json", 0, 0, mime_TXT, 0, send_counters},
+  {"/l2.js", FDATA_START_l2_js, FDATA_SIZE_l2_js, mime_JS, FDATA_ETAG_l2_js, 0},
+  {"/lag.json", 0, 0, mime_TXT, 0, send_lag},
+  {"/l2_del.json", 0, 0, mime_TXT, 0, l2_delete},
+  {"/mirror_sub.js", FDATA_START_mirror_sub_js, FDATA_SIZE_mirror_sub_js, mime_JS, FDATA_ETAG_mirror_sub_js, 0},
+  {"/eee.js", FDATA_START_eee_js, FDATA_SIZE_eee_js, mime_JS, FDATA_ETAG_eee_js, 0},
+  {"/system.js", FDATA_START_system_js, FDATA_SIZE_system_js, mime_JS, FDATA_ETAG_system_js, 0},
+  {"/stat.js", FDATA_START_stat_js, FDATA_SIZE_stat_js, mime_JS, FDATA_ETAG_stat_js, 0},
+  {"/mirror.js", FDATA_START_mirror_js, FDATA_SIZE_mirror_js, mime_JS, FDATA_ETAG_mirror_js, 0},
+};
+
+__code uint8_t f_disp[FDATA_BUCKETS] = {3, 21, 0, 0, 9, 8, 0, 4, 0, 0, 12, 0, 0, 0, 9, 1, 12, 0, 3, 11, 7, 12, 48, 33, 5, 29};
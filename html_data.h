@@ -0,0 +1,130 @@
+// This file is automatically generated, do not edit!
+
+#ifndef FDATA_DEFS_H
+#define FDATA_DEFS_H
+
+#include <stdint.h>
+
+typedef enum mime_type_e {
+  mime_HTML = 0,
+  mime_SVG,
+  mime_ICO,
+  mime_PNG,
+  mime_JS,
+  mime_CSS,
+  mime_TXT
+} mime_type_t;
+
+struct f_data {
+  __code char *file;
+  uint32_t start;
+  uint16_t len;
+  mime_type_t mime;
+  __code char *etag;
+  void (*handler)(void);
+};
+
+#define FDATA_START_mirror_js 0x40000
+#define FDATA_SIZE_mirror_js 1541
+#define FDATA_ETAG_mirror_js "f8d16551"
+#define FDATA_START_eee_html 0x40605
+#define FDATA_SIZE_eee_html 998
+#define FDATA_ETAG_eee_html "dd0297ab"
+#define FDATA_START_eee_js 0x409eb
+#define FDATA_SIZE_eee_js 1543
+#define FDATA_ETAG_eee_js "45a79619"
+#define FDATA_START_mirror_html 0x40ff2
+#define FDATA_SIZE_mirror_html 1041
+#define FDATA_ETAG_mirror_html "b398f905"
+#define FDATA_START_navigation_js 0x41403
+#define FDATA_SIZE_navigation_js 568
+#define FDATA_ETAG_navigation_js "9f378114"
+#define FDATA_START_config 0x4163b
+#define FDATA_SIZE_config 53
+#define FDATA_ETAG_config "87cbfe13"
+#define FDATA_START_style_css 0x41670
+#define FDATA_SIZE_style_css 3662
+#define FDATA_ETAG_style_css "df2f9f26"
+#define FDATA_START_vlan_js 0x424be
+#define FDATA_SIZE_vlan_js 2442
+#define FDATA_ETAG_vlan_js "07dc5ad8"
+#define FDATA_START_vlan_html 0x42e48
+#define FDATA_SIZE_vlan_html 1614
+#define FDATA_ETAG_vlan_html "962f9c3e"
+#define FDATA_START_ports_html 0x43496
+#define FDATA_SIZE_ports_html 780
+#define FDATA_ETAG_ports_html "ecf91c4e"
+#define FDATA_START_favicon_ico 0x437a2
+#define FDATA_SIZE_favicon_ico 1906
+#define FDATA_ETAG_favicon_ico "010ce0a4"
+#define FDATA_START_port_svg 0x43f14
+#define FDATA_SIZE_port_svg 1765
+#define FDATA_ETAG_port_svg "af658fa7"
+#define FDATA_START_login_html 0x445f9
+#define FDATA_SIZE_login_html 777
+#define FDATA_ETAG_login_html "38c14623"
+#define FDATA_START_index_html 0x44902
+#define FDATA_SIZE_index_html 529
+#define FDATA_ETAG_index_html "805f0502"
+#define FDATA_START_l2_js 0x44b13
+#define FDATA_SIZE_l2_js 4334
+#define FDATA_ETAG_l2_js "07172f48"
+#define FDATA_START_switch_svg 0x45c01
+#define FDATA_SIZE_switch_svg 1906
+#define FDATA_ETAG_switch_svg "010ce0a4"
+#define FDATA_START_mirror_sub_js 0x46373
+#define FDATA_SIZE_mirror_sub_js 1157
+#define FDATA_ETAG_mirror_sub_js "182078f1"
+#define FDATA_START_system_js 0x467f8
+#define FDATA_SIZE_system_js 1982
+#define FDATA_ETAG_system_js "e625fc83"
+#define FDATA_START_l2_html 0x46fb6
+#define FDATA_SIZE_l2_html 551
+#define FDATA_ETAG_l2_html "4d49aeb2"
+#define FDATA_START_stat_html 0x471dd
+#define FDATA_SIZE_stat_html 1285
+#define FDATA_ETAG_stat_html "a5e846d1"
+#define FDATA_START_ports_js 0x476e2
+#define FDATA_SIZE_ports_js 4722
+#define FDATA_ETAG_ports_js "1e291ff1"
+#define FDATA_START_sfp_svg 0x48954
+#define FDATA_SIZE_sfp_svg 1828
+#define FDATA_ETAG_sfp_svg "ea067f59"
+#define FDATA_START_update_html 0x49078
+#define FDATA_SIZE_update_html 750
+#define FDATA_ETAG_update_html "07fadd06"
+#define FDATA_START_main_info_js 0x49366
+#define FDATA_SIZE_main_info_js 856
+#define FDATA_ETAG_main_info_js "a9092803"
+#define FDATA_START_lag_html 0x496be
+#define FDATA_SIZE_lag_html 1186
+#define FDATA_ETAG_lag_html "e3530ed3"
+#define FDATA_START_system_html 0x49b60
+#define FDATA_SIZE_system_html 1489
+#define FDATA_ETAG_system_html "1a3c8abb"
+#define FDATA_START_update_js 0x4a131
+#define FDATA_SIZE_update_js 828
+#define FDATA_ETAG_update_js "dbaed759"
+#define FDATA_START_main_js 0x4a46d
+#define FDATA_SIZE_main_js 8022
+#define FDATA_ETAG_main_js "95df5e89"
+#define FDATA_START_eee_sub_js 0x4c3c3
+#define FDATA_SIZE_eee_sub_js 381
+#define FDATA_ETAG_eee_sub_js "6fa88492"
+#define FDATA_START_stat_js 0x4c540
+#define FDATA_SIZE_stat_js 6748
+#define FDATA_ETAG_stat_js "e1118185"
+#define FDATA_START_vlan_sub_js 0x4df9c
+#define FDATA_SIZE_vlan_sub_js 912
+#define FDATA_ETAG_vlan_sub_js "6ef90050"
+#define FDATA_START_lag_js 0x4e32c
+#define FDATA_SIZE_lag_js 1853
+#define FDATA_ETAG_lag_js "c753f321"
+#define FDATA_START_config_js 0x4ea69
+#define FDATA_SIZE_config_js 1625
+#define FDATA_ETAG_config_js "11c28892"
+
+#define FDATA_ENTRIES 50
+#define FDATA_BUCKETS 26
+#define FDATA_SEED 0x0001
+#endif
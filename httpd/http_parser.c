@@ -0,0 +1,313 @@
+/*
+ * Incremental parser for HTTP requests. Bytes are fed one at a time,
+ * all state is kept in struct http_req of the connection, so that
+ * headers may be split across any number of TCP segments.
+ * The request line and the headers of interest are parsed into buf:
+ * the path, the query string, Content-Type and If-None-Match as 0
+ * terminated strings, the Content-Length as number and whether the
+ * session cookie is valid as a flag. Small bodies are collected into
+ * buf as well, multipart bodies are scanned for the octet-stream part.
+ */
+
+#include "http_parser.h"
+#include "rtl837x_common.h"
+
+#pragma codeseg BANK1
+#pragma constseg BANK1
+
+// Parser states
+#define HS_METHOD	0
+#define HS_PATH		1
+#define HS_VERSION	2
+#define HS_LINE		3	// Start of a header line
+#define HS_NAME		4
+#define HS_VALUE	5
+#define HS_SKIP		6	// Rest of a line that is not of interest
+#define HS_END		7	// '\r' of the empty line ending the header
+#define HS_COLLECT	8	// Collecting the body into buf
+#define HS_BOUNDARY	9	// Searching the boundary of the next part
+#define HS_BLINE	10	// Rest of the boundary line
+#define HS_DONE		11
+
+// Headers of interest, the index + 1 is stored in hdr
+#define H_NONE		0
+#define H_CTYPE		1
+#define H_CLEN		2
+#define H_COOKIE	3
+#define H_INM		4
+__code char * __code http_headers[] = {"content-type", "content-length", "cookie", "if-none-match", 0};
+
+// Position of the cookie matcher when the value is not our session cookie
+#define COOKIE_SKIP	0xff
+#define COOKIE_OK	(8 + SESSION_ID_LENGTH)
+__code char * __code cookie_name = "session=";
+
+extern __xdata char session_id[SESSION_ID_LENGTH + 1];
+extern __xdata uint8_t * __xdata boundary;
+
+
+void http_init(__xdata struct http_req *r)
+{
+	r->state = HS_METHOD;
+	r->method = HTTP_OTHER;
+	r->flags = 0;
+	r->idx = 0;
+	r->len = 0;
+	r->query = r->ctype = r->inm = r->body = 0;
+	r->content_length = 0;
+}
+
+
+/*
+ * Starts collecting Content-Length bytes of body into buf
+ * Returns HP_BODY if there is no body, otherwise HP_MORE
+ */
+uint8_t http_collect(__xdata struct http_req *r)
+{
+	// buf[len] must take the terminating 0 of the body
+	if (r->len > HTTP_BUF_SIZE - 1) {
+		r->len = HTTP_BUF_SIZE - 1;
+		r->flags |= HF_TRUNCATED;
+	}
+	r->body = r->len;
+	r->buf[r->len] = 0;
+	if (!r->content_length) {
+		r->state = HS_DONE;
+		return HP_BODY;
+	}
+	r->state = HS_COLLECT;
+	return HP_MORE;
+}
+
+
+/*
+ * Starts scanning a multipart body for the part with the octet-stream.
+ * The boundary must have been set up from the Content-Type. The first
+ * boundary is not preceded by "\r\n"
+ */
+void http_multipart(__xdata struct http_req *r)
+{
+	r->mark = r->len;
+	r->state = HS_BOUNDARY;
+	r->idx = 2;
+}
+
+
+static uint8_t find_header(__xdata struct http_req *r)
+{
+	__xdata uint8_t *n = r->buf + r->len;
+
+	for (uint8_t h = 0; http_headers[h]; h++) {
+		register uint8_t i = 0;
+		while (i < r->idx && http_headers[h][i] == n[i])
+			i++;
+		if (i == r->idx && !http_headers[h][i])
+			return h + 1;
+	}
+	return H_NONE;
+}
+
+
+static void cookie_char(__xdata struct http_req *r, uint8_t c)
+{
+	if (c == ';') {
+		if (r->idx == COOKIE_OK)
+			r->flags |= HF_SESSION;
+		r->idx = 0;
+	} else if (r->idx == COOKIE_SKIP) {
+		return;
+	} else if (r->idx < 8) {
+		if (c == ' ' && !r->idx)
+			return;
+		r->idx = c == cookie_name[r->idx] ? r->idx + 1 : COOKIE_SKIP;
+	} else if (r->idx < COOKIE_OK) {
+		r->idx = c == session_id[r->idx - 8] ? r->idx + 1 : COOKIE_SKIP;
+	} else {
+		r->idx = COOKIE_SKIP;
+	}
+}
+
+
+static uint8_t starts_with(__xdata uint8_t *p, __code char *s)
+{
+	while (*s) {
+		if (*p++ != *s++)
+			return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * Feeds one byte of the request to the parser
+ * Returns one of the HP_ results
+ */
+uint8_t http_parse(__xdata struct http_req *r, register uint8_t c)
+{
+	switch (r->state) {
+	case HS_METHOD:
+		if (c == ' ') {
+			r->buf[r->idx] = 0;
+			if (starts_with(r->buf, "GET") && r->idx == 3)
+				r->method = HTTP_GET;
+			else if (starts_with(r->buf, "POST") && r->idx == 4)
+				r->method = HTTP_POST;
+			r->state = HS_PATH;
+		} else if (r->idx < 7) {
+			r->buf[r->idx++] = c;
+		} else {
+			return HP_ERROR;
+		}
+		break;
+
+	case HS_PATH:
+		if (c == ' ' || c == '\r' || c == '\n') {
+			r->buf[r->len++] = 0;
+			r->state = c == ' ' ? HS_VERSION : HS_LINE;
+		} else if (r->len >= HTTP_BUF_SIZE - 2) {
+			return HP_ERROR;
+		} else if (c == '?' && !r->query) {
+			r->buf[r->len++] = 0;
+			r->query = r->len;
+		} else {
+			r->buf[r->len++] = c;
+		}
+		break;
+
+	case HS_VERSION:
+	case HS_SKIP:
+		if (c == '\n')
+			r->state = HS_LINE;
+		break;
+
+	case HS_LINE:
+		if (c == '\r') {
+			r->state = HS_END;
+			break;
+		}
+		if (c == '\n')
+			goto header_end;
+		r->idx = 0;
+		r->state = HS_NAME;
+		// fall through
+	case HS_NAME:
+		if (c == ':') {
+			r->hdr = find_header(r);
+			r->idx = 0;
+			// Only the type matters for the parts of a multipart body
+			if ((r->flags & HF_PART) && r->hdr != H_CTYPE)
+				r->hdr = H_NONE;
+			if (r->hdr == H_NONE) {
+				r->state = HS_SKIP;
+				break;
+			}
+			if (r->hdr == H_CTYPE)
+				r->ctype = r->len;
+			else if (r->hdr == H_INM)
+				r->inm = r->len;
+			else if (r->hdr == H_CLEN)
+				r->content_length = 0;
+			r->state = HS_VALUE;
+		} else if (c == '\n') {
+			r->state = HS_LINE;
+		} else if (r->idx >= HTTP_NAME_MAX || r->len + r->idx >= HTTP_BUF_SIZE) {
+			r->state = HS_SKIP;
+		} else {
+			// Header names are case-insensitive
+			r->buf[r->len + r->idx++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+		}
+		break;
+
+	case HS_VALUE:
+		if (c == '\n') {
+			if (r->hdr == H_COOKIE) {
+				if (r->idx == COOKIE_OK)
+					r->flags |= HF_SESSION;
+			} else if (r->hdr == H_CTYPE || r->hdr == H_INM) {
+				if (r->len < HTTP_BUF_SIZE - 1) {
+					r->buf[r->len++] = 0;
+				} else {
+					r->buf[r->len] = 0;
+					r->flags |= HF_TRUNCATED;
+				}
+			}
+			r->state = HS_LINE;
+			break;
+		}
+		if (c == '\r')
+			break;
+		if (r->hdr == H_COOKIE) {
+			cookie_char(r, c);
+		} else if (r->hdr == H_CLEN) {
+			if (c >= '0' && c <= '9')
+				r->content_length = r->content_length * 10 + (c - '0');
+		} else {
+			// Skip white space in front of the value, keep room for the
+			// terminating 0 and for the one of a body, see http_collect()
+			if ((c == ' ' || c == '\t') && r->len == (r->hdr == H_CTYPE ? r->ctype : r->inm))
+				break;
+			if (r->len < HTTP_BUF_SIZE - 2)
+				r->buf[r->len++] = c;
+			else
+				r->flags |= HF_TRUNCATED;
+		}
+		break;
+
+	case HS_END:
+		if (c != '\n')
+			return HP_ERROR;
+header_end:
+		if (r->flags & HF_PART) {
+			if (r->ctype && starts_with(r->buf + r->ctype, "application/octet-stream")) {
+				r->state = HS_DONE;
+				return HP_DATA;
+			}
+			// Not the part we are looking for
+			r->state = HS_BOUNDARY;
+			r->idx = 0;
+			break;
+		}
+		r->state = HS_DONE;
+		return HP_HEADER;
+
+	case HS_COLLECT:
+		if (r->len < HTTP_BUF_SIZE - 1)
+			r->buf[r->len++] = c;
+		else
+			r->flags |= HF_TRUNCATED;
+		if (!--r->content_length) {
+			r->buf[r->len] = 0;
+			r->state = HS_DONE;
+			return HP_BODY;
+		}
+		break;
+
+	case HS_BOUNDARY:
+		if (c == boundary[r->idx]) {
+			if (!boundary[++r->idx]) {
+				r->idx = 0;
+				r->state = HS_BLINE;
+			}
+		} else {
+			r->idx = c == boundary[0] ? 1 : 0;
+		}
+		break;
+
+	case HS_BLINE:
+		// "--" after the boundary ends the body, the octet-stream part was not found
+		if (!r->idx && c == '-')
+			return HP_ERROR;
+		r->idx = 1;
+		if (c == '\n') {
+			r->flags |= HF_PART;
+			r->ctype = 0;
+			r->len = r->mark;
+			r->state = HS_LINE;
+		}
+		break;
+
+	default:
+		break;
+	}
+	return HP_MORE;
+}
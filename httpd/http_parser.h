@@ -0,0 +1,57 @@
+#ifndef __HTTP_PARSER_H__
+#define __HTTP_PARSER_H__
+
+#include <stdint.h>
+
+// Space per connection for path, query string, header values and small bodies
+#define HTTP_BUF_SIZE		160
+// Longest header name of interest, others are skipped
+#define HTTP_NAME_MAX		16
+// Length of the session id in the cookie
+#define SESSION_ID_LENGTH	12
+// Space for the boundary of a multipart body with the "\r\n--" in front
+#define BOUNDARY_SIZE		72
+
+// Request methods
+#define HTTP_OTHER	0
+#define HTTP_GET	1
+#define HTTP_POST	2
+
+// Flags of a request
+#define HF_SESSION	0x01	// Cookie carries the current session id
+#define HF_PART		0x02	// Parsing the headers of a part of a multipart body
+#define HF_TRUNCATED	0x04	// A value did not fit into buf
+
+// Results of http_parse()
+#define HP_MORE		0	// Need more bytes
+#define HP_HEADER	1	// Request header complete
+#define HP_BODY		2	// Body collected by http_collect() complete
+#define HP_DATA		3	// Octet-stream part of a multipart body starts after this byte
+#define HP_ERROR	4	// Malformed request
+
+/*
+ * State of the incremental request parser. It is kept with each TCP
+ * connection, so that a request may arrive in any number of segments
+ */
+struct http_req {
+	uint8_t state;
+	uint8_t method;
+	uint8_t flags;
+	uint8_t hdr;		// Header whose value is being parsed
+	uint8_t idx;		// Position within a name, a value or the boundary
+	uint8_t len;		// Used bytes of buf
+	uint8_t mark;		// Start of the part header values in buf
+	uint8_t query;		// Offsets into buf of the values, 0 if absent
+	uint8_t ctype;
+	uint8_t inm;
+	uint8_t body;
+	uint32_t content_length;
+	uint8_t buf[HTTP_BUF_SIZE];
+};
+
+void http_init(__xdata struct http_req *r);
+uint8_t http_parse(__xdata struct http_req *r, register uint8_t c);
+uint8_t http_collect(__xdata struct http_req *r);
+void http_multipart(__xdata struct http_req *r);
+
+#endif
@@ -5,21 +5,40 @@
 #include "rtl837x_regs.h"
 #include "cmd_parser.h"
 #include "rtl837x_flash.h"
+#include "config_store.h"
+#include "config_format.h"
+#include "log.h"
+#include "arena.h"
 #include "uip.h"
 #include "html_data.h"
 
 // #define DEBUG
 #include "debug.h"
 
-#define SESSION_ID_LENGTH 12
 #define SESSION_TIMEOUT 200
 
+// Time-out in ticks for the next segment of a request or an upload
+#define REQUEST_TIMEOUT (5 * SYS_TICK_HZ)
+
 // Upload Firmware to 1M
 #define FIRMWARE_UPLOAD_START 0x100000
 
 // SPI FLASH MEMORY PAGE SIZE.
 #define FLASHMEM_PAGE_SIZE 0x100
 
+/*
+ * Uploads are received into a ring of flash pages large enough for two
+ * receive windows: the network fills one window's worth of pages while
+ * the poll of the connection programs the other, after the ACK has gone out
+ */
+#define UPLOAD_WINDOW_PAGES ((UIP_RECEIVE_WINDOW + FLASHMEM_PAGE_SIZE - 1) / FLASHMEM_PAGE_SIZE)
+#define UPLOAD_PAGES (2 * UPLOAD_WINDOW_PAGES + 1)
+// The ring and the boundary are taken from the arena for the upload
+#define UPLOAD_MEM_SIZE (UPLOAD_PAGES * FLASHMEM_PAGE_SIZE + BOUNDARY_SIZE)
+#define UPLOAD_PAGE(n) (upload_buf + (uint16_t)(n) * FLASHMEM_PAGE_SIZE)
+
+_Static_assert(UPLOAD_MEM_SIZE <= ARENA_SIZE, "The arena cannot hold an upload");
+
 #define CMARK_S 6
 
 #pragma codeseg BANK1
@@ -28,13 +47,31 @@
 extern volatile __xdata uint8_t sfr_data[4];
 extern __code uint8_t * __code hex;
 extern __code struct f_data f_data[];
+extern __code uint8_t f_disp[];
 extern __code char * __code mime_strings[];
 extern __xdata struct flash_region_t flash_region;
 
-// Flash buffer to optimize flash writing speed, write_len is the current filling position
 extern __xdata uint8_t flash_buf[512];
-__xdata uint32_t uptr; // Current flash write position
+
+// Ring of pages of an upload, write_len is the filling position in the page at up_head
+__xdata uint8_t * __xdata upload_buf;
+__xdata struct uip_conn *up_conn;	// Connection holding the ring, 0 if none
+__xdata uint8_t up_head;
+__xdata uint8_t up_tail;	// Oldest page not yet programmed
+__xdata uint8_t up_full;	// Pages waiting to be programmed
 __xdata uint16_t write_len;
+__xdata uint32_t uptr;		// Flash address of the page at up_tail
+__xdata uint32_t up_erased;	// Flash below this address is erased
+__xdata uint32_t up_end;	// End of the flash area of the upload
+__xdata uint32_t up_room;	// Bytes that may still be written before up_end
+
+// Progress of the current or last upload, see send_upload()
+__xdata uint8_t up_state;
+__xdata uint32_t up_length;	// Content-Length of the request
+__xdata uint32_t up_received;	// Bytes of the body received
+__xdata uint32_t up_written;	// Bytes programmed to flash
+__xdata uint32_t up_start;
+__xdata uint32_t up_time;	// Ticks from the start to the last segment
 
 __xdata uint8_t outbuf[TCP_OUTBUF_SIZE];
 __xdata uint8_t entry;
@@ -43,11 +80,12 @@ __xdata uint16_t o_idx;
 __xdata uint16_t len_left;
 __xdata uint16_t cont_len;
 __xdata uint32_t cont_addr;
+__xdata uint8_t cont_cached;	// Read the continuation through the flash cache
 
-// HTTP header properties
-__xdata uint8_t boundary[72];
-__xdata uint8_t *content_type = 0;
-__xdata uint8_t *session = 0;
+// HTTP header properties of the request being handled, they point into its http_req
+__xdata uint8_t * __xdata boundary;
+__xdata uint8_t *if_none_match = 0;
+__xdata uint8_t *query = 0;
 
 // Global variables holding POST state
 __xdata uint16_t bindex; // Current index into the boundary
@@ -62,46 +100,136 @@ __xdata uint32_t now;
 __xdata uint8_t *timeptr;
 __xdata uint32_t last_session_use;
 
+// The connection being served from outbuf, requests on other connections are held back
+__xdata struct uip_conn *tx_conn;
+
+// The connection waiting for the output of its command from /cmd
+__xdata struct uip_conn *cmd_conn;
+// Its body of several lines was staged as a transaction
+__xdata uint8_t cmd_conn_txn;
+
+// Throughput of the last response of at least TX_RATE_MIN bytes in bytes/s
+#define TX_RATE_MIN 4096
+__xdata uint32_t tx_start;
+__xdata uint32_t tx_bytes;
+__xdata uint32_t tx_rate;
+
 #define TSTATE_NONE	0
 #define TSTATE_TX	1
 #define TSTATE_ACKED 	2
 #define TSTATE_CLOSED 	3
 #define TSTATE_POST 	4
+#define TSTATE_WAIT 	5
+#define TSTATE_BUSY 	6
+#define TSTATE_REQ 	7
+#define TSTATE_DONE 	8
+#define TSTATE_CMD 	9
+#define TSTATE_FORM 	10
 
+// Time-out in ticks for a command from /cmd to be run by idle()
+#define CMD_TIMEOUT (5 * SYS_TICK_HZ)
+
+// Upper limit of the time-out of a waiting /events.json request in seconds
+#define EVENTS_TIMEOUT_MAX	60
+
+extern volatile __xdata uint32_t ticks;
+extern __xdata uint16_t state_gen;
 extern __xdata uint16_t crc_value;
 __xdata uint16_t crc_final;
-void crc16(__xdata uint8_t *v) __naked;
+void crc16_block(__xdata uint8_t *v, uint16_t len);
 
 
-inline uint8_t is_separator(uint8_t c)
+void httpd_init(void) __banked
 {
-	return c == ' ' || c == '\t' || c == '?' || c == '=';
+	// Start listening to port 80
+	uip_listen(HTONS(80));
+	for (uint8_t c = 0; c < UIP_CONNS; c++)
+		uip_conns[c].appstate.tstate = TSTATE_CLOSED;
+	tx_conn = 0;
+	cmd_conn = 0;
+	cmd_conn_txn = 0;
+	cmd_out = 0;
+	up_conn = 0;
+	upload_buf = 0;
+	boundary = 0;
 }
 
 
-void httpd_init(void) __banked
+/*
+ * Parks the current request until the switch state moves past generation
+ * since or timeout seconds have passed, see send_events()
+ * One connection is never parked, so that other clients are still served.
+ * A request that would park it is answered at once with nothing changed
+ */
+void httpd_wait(uint16_t since, uint8_t sel, uint8_t timeout)
 {
 	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
-	// Start listening to port 80
-	uip_listen(HTONS(80));
-	s->tstate = TSTATE_CLOSED;
+	uint8_t parked = 0;
+
+	for (uint8_t c = 0; c < UIP_CONNS; c++) {
+		if (&uip_conns[c] != uip_conn && uip_conns[c].appstate.tstate == TSTATE_WAIT)
+			parked++;
+	}
+	if (parked >= UIP_CONNS - 1) {
+		dbg_string("No connection left to park\n");
+		events_to_html(state_changed_since(since), sel);
+		return;
+	}
+	if (timeout > EVENTS_TIMEOUT_MAX)
+		timeout = EVENTS_TIMEOUT_MAX;
+	s->tstate = TSTATE_WAIT;
+	s->since = since;
+	s->sel = sel;
+	s->deadline = ((uint16_t)ticks) + ((uint16_t)timeout) * SYS_TICK_HZ;
 }
 
 
-uint8_t find_entry(__xdata uint8_t *e)
+/*
+ * Gives outbuf to the current connection. All other connections that are
+ * still waiting for a request stop receiving, their requests are taken in
+ * once the response has been sent
+ */
+void tx_take(void)
 {
-	uint8_t i, j;
-
-	for (i = 0; f_data[i].len; i++) {
-		j = 0;
-		while (f_data[i].file[j] && (f_data[i].file[j] == e[j])) {
-			j++;
-		}
-		if ((!f_data[i].file[j]) && (!e[j])) {
-			return i;
-		}
+	tx_conn = uip_conn;
+	for (uint8_t c = 0; c < UIP_CONNS; c++) {
+		if (&uip_conns[c] != uip_conn && uip_conns[c].appstate.tstate == TSTATE_NONE)
+			uip_conns[c].tcpstateflags |= UIP_STOPPED;
 	}
-	return 0xff;
+}
+
+
+/*
+ * Answers a request that arrived while outbuf is in use. The response is
+ * written directly to the uIP buffer so that it can be resent on rexmit
+ */
+void send_busy(void)
+{
+	uip_send(uip_appdata, strtox(uip_appdata, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n\r\n"));
+}
+
+
+char strcmp(__xdata uint8_t *c, __code uint8_t * __xdata d);
+
+/*
+ * Looks up a request path in the routing table generated by fileadder.
+ * The table is ordered by a minimal perfect hash over all paths, so a
+ * single compare tells whether the path is known. The hash must be kept
+ * identical to route_hash() in tools/fileadder.c
+ */
+uint8_t find_entry(__xdata uint8_t *e)
+{
+	register uint16_t h = FDATA_SEED;
+	__xdata uint8_t *p = e;
+	uint8_t i;
+
+	while (*p)
+		h = ((h << 5) + h) ^ *p++;
+	i = f_disp[((uint8_t)(h >> 8)) % FDATA_BUCKETS];
+	i = ((uint8_t)(((uint8_t)h) + i)) % FDATA_ENTRIES;
+	if (strcmp(e, f_data[i].file))
+		return 0xff;
+	return i;
 }
 
 
@@ -166,6 +294,48 @@ uint8_t parse_short(__xdata uint8_t *p)
 }
 
 
+/*
+ * Returns a pointer to the value of a parameter in the query string of
+ * the current request, or 0 if the parameter is not present
+ */
+__xdata uint8_t *query_get(__code char *name)
+{
+	__xdata uint8_t *p = query;
+	register uint8_t i;
+
+	if (!p)
+		return 0;
+	while (*p) {
+		i = 0;
+		while (name[i] && name[i] == p[i])
+			i++;
+		if (!name[i] && p[i] == '=')
+			return p + i + 1;
+		while (*p && *p != '&')
+			p++;
+		if (*p)
+			p++;
+	}
+	return 0;
+}
+
+
+/*
+ * Parses a numerical parameter of the query string into short_parsed
+ * Returns 0 on success, 1 if the parameter is missing or not a number
+ */
+uint8_t query_short(__code char *name)
+{
+	__xdata uint8_t *p = query_get(name);
+
+	if (!p) {
+		short_parsed = 0;
+		return 1;
+	}
+	return parse_short(p);
+}
+
+
 void send_not_found(void)
 {
 	slen = strtox(outbuf, "HTTP/1.1 404 Not found\r\nContent-Type: text/html\r\n\r\n" \
@@ -193,61 +363,72 @@ void send_unauthorized(void)
 }
 
 
-__xdata uint8_t *skip_boundary(__xdata uint8_t *p)
+/*
+ * Sets authenticated if the request carried the session cookie and the session is still valid
+ */
+void check_session(__xdata struct http_req *r)
 {
-	while (*p) {
-		if (is_word_x(p, boundary))
-			return p + strlen_x(boundary);
-		p++;
-	}
-	return p;
+	authenticated = 0;
+	read_reg_timer(&now);
+	if (!(r->flags & HF_SESSION))
+		return;
+	if (now - last_session_use > SESSION_TIMEOUT)
+		dbg_string("Session expired\n");
+	else
+		authenticated = 1;
 }
 
 
-__xdata uint8_t *scan_header(__xdata uint8_t *p)
+/*
+ * Sets up the boundary between the parts of a multipart body from the Content-Type
+ * Returns 0 if the content is not multipart
+ */
+uint8_t set_boundary(__xdata uint8_t *content_type)
 {
-	content_type = 0;
-	session = 0;
-	authenticated = 0;
+	register uint8_t i = 0;
 
-	while (*p != '\r' || *(p + 1) != '\n' || *(p + 2) != '\r' || *(p + 3) != '\n') {
-		dbg_char(*p);
-		if (!*p++)
-			break;
-		if (is_word(p, "\nContent-Type:"))
-			content_type = p + 15;
-		else if (is_word(p, "\nCookie:"))
-			session = p + 17;
-	}
-	if (content_type && is_word(content_type, "multipart/form-data; boundary")) {
-		dbg_string("\nFound multipart\n");
-		content_type += 30;
-		uint8_t i = 0;
-		while (content_type[i] != '\r' && content_type[i] != '\n') {
-			boundary[i + 4] = content_type[i];
-			i++;
-		}
-		// The boundary between parts is "\r\n--" + the boundary given in the header
-		boundary[0] = '\r';
-		boundary[1] = '\n';
-		boundary[2] = '-';
-		boundary[3] = '-';
-		boundary[i + 4] = 0;
+	if (!is_word(content_type, "multipart/form-data; boundary"))
+		return 0;
+	content_type += 30;
+	while (content_type[i] && i < BOUNDARY_SIZE - 5) {
+		boundary[i + 4] = content_type[i];
+		i++;
 	}
+	// The boundary between parts is "\r\n--" + the boundary given in the header
+	boundary[0] = '\r';
+	boundary[1] = '\n';
+	boundary[2] = '-';
+	boundary[3] = '-';
+	boundary[i + 4] = 0;
+	return i;
+}
 
-	read_reg_timer(&now);
 
-	if (session) {
-		if (now - last_session_use > SESSION_TIMEOUT) {
-			dbg_string("Session expired\n");
-		} else {
-			if (is_word_x(session, session_id))
-				authenticated = 1;
-			else
-				dbg_string("Invalid session cookie!\n");
-		}
+/*
+ * Checks whether the entity tag of a file is listed in the If-None-Match header
+ * The header holds a comma separated list of quoted tags, or "*"
+ */
+uint8_t etag_matches(__xdata uint8_t *p, __code char *etag)
+{
+	register uint8_t i;
+
+	while (*p && *p != '\r' && *p != '\n') {
+		if (*p == '*')
+			return 1;
+		if (*p++ != '"')
+			continue;
+		i = 0;
+		while (etag[i] && etag[i] == p[i])
+			i++;
+		if (!etag[i] && p[i] == '"')
+			return 1;
+		// Skip to the closing quote of this tag
+		while (*p && *p != '"' && *p != '\r' && *p != '\n')
+			p++;
+		if (*p == '"')
+			p++;
 	}
-	return p;
+	return 0;
 }
 
 
@@ -266,7 +447,173 @@ void gen_random_bytes(__xdata uint8_t *b, uint8_t bytes)
 
 
 /*
- * Reads post data from the http stream and writes it into flash memory
+ * Checks whether the flash sector at addr is erased already
+ */
+uint8_t sector_blank(__xdata uint32_t addr)
+{
+	for (uint8_t i = 0; i < FLASH_SECTOR_SIZE / sizeof(flash_buf); i++) {
+		flash_region.addr = addr;
+		flash_region.len = sizeof(flash_buf);
+		flash_read_spi(flash_buf);
+		for (uint16_t j = 0; j < sizeof(flash_buf); j++) {
+			if (flash_buf[j] != 0xff)
+				return 0;
+		}
+		addr += sizeof(flash_buf);
+	}
+	return 1;
+}
+
+
+/*
+ * Takes the ring and the boundary of an upload on this connection from the arena
+ * Returns 0 if there is no room for them
+ */
+uint8_t upload_alloc(void)
+{
+	upload_buf = arena_alloc(ARENA_UPLOAD, UPLOAD_MEM_SIZE);
+	if (!upload_buf)
+		return 0;
+	boundary = upload_buf + UPLOAD_PAGES * FLASHMEM_PAGE_SIZE;
+	up_conn = uip_conn;
+	return 1;
+}
+
+
+void upload_release(void)
+{
+	arena_free(ARENA_UPLOAD);
+	up_conn = 0;
+}
+
+
+/*
+ * Erases the next sector of the upload area, the boot code usually left it blank
+ */
+void upload_erase_sector(void)
+{
+	if (!sector_blank(up_erased)) {
+		flash_region.addr = up_erased;
+		if (flash_sector_erase())
+			up_state = UPLOAD_FAILED;
+	}
+	up_erased += FLASH_SECTOR_SIZE;
+}
+
+
+/*
+ * Programs the oldest full page of the ring to flash
+ */
+void upload_program(void)
+{
+	if (uptr >= up_erased)
+		upload_erase_sector();
+	flash_region.addr = uptr;
+	flash_region.len = FLASHMEM_PAGE_SIZE;
+	if (!flash_write_verify(UPLOAD_PAGE(up_tail)))
+		up_state = UPLOAD_FAILED;
+	uptr += FLASHMEM_PAGE_SIZE;
+	up_written += FLASHMEM_PAGE_SIZE;
+	if (++up_tail == UPLOAD_PAGES)
+		up_tail = 0;
+	up_full--;
+}
+
+
+/*
+ * Appends a byte of the octet stream to the page being filled. A byte
+ * beyond up_end fails the upload, a configuration would run into the
+ * records following its own
+ */
+void upload_byte(uint8_t c)
+{
+	if (!up_room) {
+		up_state = UPLOAD_FAILED;
+		return;
+	}
+	up_room--;
+	UPLOAD_PAGE(up_head)[write_len++] = c;
+	if (write_len < FLASHMEM_PAGE_SIZE)
+		return;
+	write_len = 0;
+	if (++up_head == UPLOAD_PAGES)
+		up_head = 0;
+	// Only if the window was not closed in time
+	if (++up_full == UPLOAD_PAGES)
+		upload_program();
+}
+
+
+/*
+ * Programs the pages received and erases the sector following the write
+ * position. This runs from the poll of the uploading connection, so that
+ * the peer sends the next segment while the flash is busy
+ */
+void upload_pump(void)
+{
+	while (up_full)
+		upload_program();
+	if (up_erased < up_end && up_erased - uptr < FLASH_SECTOR_SIZE)
+		upload_erase_sector();
+	if (uip_stopped(uip_conn))
+		uip_restart();
+}
+
+
+/*
+ * Writes the rest of the upload to flash once the closing boundary has been found
+ */
+void upload_finish(void)
+{
+	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
+
+	while (up_full)
+		upload_program();
+	dbg_string("len 2: "); dbg_short(write_len); dbg_char(' ');
+	if (write_len) {
+		if (uptr >= up_erased)
+			upload_erase_sector();
+		flash_region.addr = uptr;
+		flash_region.len = write_len;
+		if (!flash_write_verify(UPLOAD_PAGE(up_head)))
+			up_state = UPLOAD_FAILED;
+		uptr += write_len;
+		up_written += write_len;
+		write_len = 0;
+	}
+	upload_release();
+	// The connection is aborted by the caller
+	if (up_state == UPLOAD_FAILED) {
+		LOG(LOG_HTTPD, LOG_ERR, LOG_MSG_HTTPD_VERIFY, up_written, 0);
+		return;
+	}
+	// TODO: This is a bit premature, what about a nice web-page saying the device will reset???
+	if (verify_crc) {
+		dbg_string("CRC16: "); dbg_short(crc_final); dbg_char('\n');
+		if (crc_final == 0xb001) {
+			print_string("Checksum OK.");
+		} else {
+			print_string("Checksum incorrect!");
+		}
+		print_string("\nUpload to flash done, will reset!\n");
+		reset_chip();
+	}
+	if (!config_commit(up_written, crc_final)) {
+		up_state = UPLOAD_FAILED;
+		LOG(LOG_HTTPD, LOG_ERR, LOG_MSG_HTTPD_SAVE, 0, 0);
+		return;
+	}
+	// Without the compiled form, the text is parsed at boot
+	if (!config_compile())
+		LOG(LOG_HTTPD, LOG_ERR, LOG_MSG_HTTPD_COMPILE, 0, 0);
+	up_state = UPLOAD_DONE;
+	// The response is sent from the poll once outbuf is free
+	s->tstate = TSTATE_DONE;
+}
+
+
+/*
+ * Reads post data from the http stream and passes it to the upload ring
  * Input: the current position in the TCP buffer (uip_appdata)
  * Returns 1: More data to read, 0: Upload complete, all parts reads
  */
@@ -274,188 +621,501 @@ uint8_t stream_upload(uint16_t bptr)
 {
 	__xdata uint8_t *p = uip_appdata;
 	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
+	__xdata uint16_t crc_from = bptr; // Start of the bytes not yet in crc_value
 
 	dbg_string("Stream_upload called: ");
 	dbg_short(bptr); dbg_char('\n');
+	up_received += uip_len - bptr;
+	up_time = ticks - up_start;
 
 	do {
 		if (bptr >= uip_len) {
+			crc16_block(p + crc_from, bptr - crc_from);
 			s->tstate = TSTATE_POST;
 			return 1;
 		}
 		// Have we reached the end of the part?
 		if (!boundary[bindex]) {
-			s->tstate = TSTATE_NONE;
-			dbg_string("len 2: "); dbg_short(write_len); dbg_char(' ');
-			flash_region.addr = uptr;
-			flash_region.len = write_len;
-			flash_write_bytes(flash_buf);
-			uptr += write_len;
-			write_len = 0;
-			// TODO: This is a bit premature, what about a nice web-page saying the device will reset???
-			if (verify_crc) {
-				dbg_string("CRC16: "); dbg_short(crc_final); dbg_char('\n');
-				if (crc_final == 0xb001) {
-					print_string("Checksum OK.");
-				} else {
-					print_string("Checksum incorrect!");
-				}
-				print_string("\nUpload to flash done, will reset!\n");
-				reset_chip();
-			}
-			// Make sure there is a 0 at the end of the uploaded data
-			flash_buf[0] = 0;
-			flash_region.addr = uptr;
-			flash_region.len = 1;
-			flash_write_bytes(flash_buf);
+			upload_finish();
 			if (bptr >= uip_len)
 				return 0;
 			return 1;
 		}
 		if (p[bptr] == boundary[bindex]) {
-			if (!bindex)
+			// The CRC of the image is the one in front of the closing boundary
+			if (!bindex) {
+				crc16_block(p + crc_from, bptr - crc_from);
+				crc_from = bptr;
 				crc_final = crc_value;
-			crc16(p + bptr);
+			}
 			bptr++;
 			bindex++;
 		} else {
-			if (bindex) {
-				memcpy(flash_buf + write_len, boundary, bindex);
-				write_len += bindex;
-				bindex = 0;
-			}
-			crc16(p + bptr);
-			flash_buf[write_len++] = p[bptr++];
-			if (write_len >= FLASHMEM_PAGE_SIZE) {
-				dbg_string("len: "); dbg_short(write_len); dbg_char(' ');
-				dbg_string("CRC16: "); dbg_short(crc_value); dbg_char('\n');
-				flash_region.addr = uptr;
-				flash_region.len = FLASHMEM_PAGE_SIZE;
-				flash_write_bytes(flash_buf);
-				uptr += FLASHMEM_PAGE_SIZE;
-				write_len -= FLASHMEM_PAGE_SIZE;
-
-				// Copy the remaining byte for the next page to the beginning of the buffer.
-				if (write_len > 0) {
-					memcpy(flash_buf, flash_buf + FLASHMEM_PAGE_SIZE, write_len);
-				}
-			}
+			// What matched the boundary so far was data
+			for (uint16_t i = 0; i < bindex; i++)
+				upload_byte(boundary[i]);
 			bindex = 0;
+			upload_byte(p[bptr++]);
 		}
 	} while(1);
 }
 
 
-void handle_post(void)
+/*
+ * Drops the request waiting on cmd_conn. Its output buffer goes back to
+ * the arena, unless the command is running, see task_cmd()
+ */
+void cmd_release(void)
+{
+	cmd_conn = 0;
+	if (!cmd_capture)
+		cmd_out_free();
+}
+
+
+/*
+ * Starts a POST request to /cmd. Its body is not collected in buf, but
+ * streamed into txn_buf by stream_form(), so that it may span segments
+ * Returns 1 if the response is ready, 0 if the body needs to be read
+ */
+uint8_t start_form(__xdata struct http_req *r)
+{
+	// cmd_buffer or txn_buf is still in use by another command
+	if (cmd_available || cmd_capture || cmd_conn || txn_state) {
+		slen = strtox(outbuf, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n\r\n");
+		return 1;
+	}
+	// With the '\n' ending the last line the body must fit into txn_buf
+	if (r->content_length > TXN_SIZE - 1) {
+		slen = strtox(outbuf, "HTTP/1.1 413 Payload Too Large\r\n\r\n");
+		return 1;
+	}
+	if (!r->content_length) {
+		slen = strtox(outbuf, "HTTP/1.1 200 OK\r\n\r\n");
+		return 1;
+	}
+	// The output is kept in the arena until it is sent
+	cmd_out = arena_alloc(ARENA_CMD, CMD_OUT_SIZE);
+	if (!cmd_out) {
+		slen = strtox(outbuf, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n\r\n");
+		return 1;
+	}
+	txn_buf = arena_alloc(ARENA_TXN, TXN_SIZE);
+	if (!txn_buf) {
+		cmd_out_free();
+		slen = strtox(outbuf, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n\r\n");
+		return 1;
+	}
+	txn_len = 0;
+	txn_src = CMD_HTTP;
+	txn_state = TXN_OPEN;
+	cmd_conn = uip_conn;
+	uip_conn->appstate.tstate = TSTATE_FORM;
+	return 0;
+}
+
+
+/*
+ * Drops a POST request to /cmd whose body has not been run yet
+ */
+void form_release(void)
+{
+	txn_cancel();
+	cmd_release();
+}
+
+
+/*
+ * Runs the body of a POST request to /cmd once it is complete and
+ * cmd_buffer is free. A single line is run as it is, a body of several
+ * lines is committed as one transaction
+ */
+void form_run(void)
+{
+	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
+	uint16_t n = 0;
+	register uint8_t i;
+
+	// A command from the console is waiting, it is run first
+	if (cmd_available || cmd_capture)
+		return;
+	if (!txn_len) {
+		form_release();
+		s->tstate = TSTATE_DONE;
+		return;
+	}
+	while (txn_buf[n] != '\n')
+		n++;
+	cmd_conn_txn = n + 1 < txn_len;
+	if (cmd_conn_txn) {
+		strtox(cmd_buffer, "commit");
+	} else {
+		for (i = 0; i < n && i < SBUF_SIZE - 1; i++)
+			cmd_buffer[i] = txn_buf[i];
+		cmd_buffer[i] = '\0';
+		txn_cancel();
+	}
+	// Park the request until idle() has run the command, see send_cmd_output()
+	cmd_available = CMD_HTTP;
+	s->tstate = TSTATE_CMD;
+	s->deadline = ((uint16_t)ticks) + CMD_TIMEOUT;
+}
+
+
+/*
+ * Appends the body of a POST request to /cmd in the current segment from
+ * position i to txn_buf, one command per line. Empty lines are dropped.
+ * Once Content-Length bytes have arrived, the commands are run
+ */
+void stream_form(uint16_t i)
 {
 	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
 	__xdata uint8_t *p = uip_appdata;
-	__xdata uint8_t *request_path = p + 6;
 
-	dbg_string("Is POST\n");
-	p += 5;  // Skip post
-	// Find end of request path
-	while (*p && !is_separator(*p))
-		p++;
-	*p++ = '\0';
-
-	// Find end of request header
-	boundary[0] ='\0';
-	p = scan_header(p);
-	dbg_string("Boundary: >"); dbg_string_x(boundary); dbg_string("<\n");
-	if (!*p || !content_type) {
-		dbg_string("Bad Request!\n");
-		send_not_found();
+	while (i < uip_len && s->req.content_length) {
+		register uint8_t c = p[i++];
+		s->req.content_length--;
+		if (c == '\n' || c == '\r') {
+			if (txn_len && txn_buf[txn_len - 1] != '\n')
+				txn_buf[txn_len++] = '\n';
+		} else if (c) {
+			txn_buf[txn_len++] = c;
+		}
+	}
+	if (s->req.content_length)
 		return;
+	if (txn_len && txn_buf[txn_len - 1] != '\n')
+		txn_buf[txn_len++] = '\n';
+	s->deadline = ((uint16_t)ticks) + CMD_TIMEOUT;
+	form_run();
+}
+
+
+/*
+ * Handles the body of a POST request to /login collected in buf
+ */
+void handle_form(__xdata struct http_req *r)
+{
+	__xdata uint8_t *p = r->buf + r->body;
+
+	dbg_string("POST login\n");
+	p += 4; // Read over "pwd="
+	if (is_word_x(p, passwd)) {
+		dbg_string("Password accepted!\n");
+		read_reg_timer(&last_session_use);
+		gen_random_bytes(session_id, SESSION_ID_LENGTH);
+		session_id[SESSION_ID_LENGTH] = '\0';
+		slen = strtox(outbuf, "HTTP/1.1 302 Found\r\nLocation: index.html\r\n" \
+				      "Set-Cookie: session=");
+		for (register uint8_t i = 0; i < SESSION_ID_LENGTH; i++)
+			outbuf[slen++] = session_id[i];
+		slen += strtox(outbuf + slen, "; SameSite=Strict\r\n\r\n");
+	} else {
+		slen = strtox(outbuf, "HTTP/1.1 302 Found\r\nLocation: login.html\r\n\r\n");
 	}
+}
 
-	if (is_word(request_path, "cmd")) {
-		register uint8_t i = 0;
-		p += 4;
-		if (!authenticated) {
+
+/*
+ * Handles the header of a POST request
+ * Returns 1 if the response is ready, 0 if the body needs to be read
+ */
+uint8_t handle_post(__xdata struct http_req *r)
+{
+	__xdata uint8_t *request_path = r->buf + 1;
+
+	dbg_string("Is POST\n");
+	check_session(r);
+
+	if (is_word(request_path, "login") || is_word(request_path, "cmd")) {
+		if (!authenticated && !is_word(request_path, "login")) {
 			send_unauthorized();
-			return;
-		}
-		while (*p && *p != '\n' && *p != '\r')
-			cmd_buffer[i++] = *p++;
-		cmd_buffer[i] = '\0';
-		if (i)
-			cmd_available = 1;
-	} else if (is_word(request_path, "login")) {
-		dbg_string("POST login\n");
-		p += 8; // Read also over "pwd="
-		if (is_word_x(p, passwd)) {
-			dbg_string("Password accepted!\n");
-			read_reg_timer(&last_session_use);
-			gen_random_bytes(session_id, SESSION_ID_LENGTH);
-			session_id[SESSION_ID_LENGTH] = '\0';
-			slen = strtox(outbuf, "HTTP/1.1 302 Found\r\nLocation: index.html\r\n" \
-					      "Set-Cookie: session=");
-			for (register uint8_t i = 0; i < SESSION_ID_LENGTH; i++)
-				outbuf[slen++] = session_id[i];
-			slen += strtox(outbuf + slen, "; SameSite=Strict\r\n\r\n");
-		} else {
-			slen = strtox(outbuf, "HTTP/1.1 302 Found\r\nLocation: login.html\r\n\r\n");
+			return 1;
 		}
-		return;
+		if (is_word(request_path, "cmd"))
+			return start_form(r);
+		if (http_collect(r) == HP_MORE)
+			return 0;
+		handle_form(r);
+		return 1;
 	} else if (is_word(request_path, "upload") || is_word(request_path, "config")) {
 		dbg_string("POST upload/config request\n");
 		if (!authenticated) {
 			send_unauthorized();
-			return;
+			return 1;
 		}
-		if (!boundary[0]) {
+		// The boundary and the ring are shared
+		if (up_conn || up_state == UPLOAD_RUNNING || !upload_alloc()) {
+			slen = strtox(outbuf, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n\r\n");
+			return 1;
+		}
+		if (!r->ctype || (r->flags & HF_TRUNCATED) || !set_boundary(r->buf + r->ctype)) {
 			dbg_string("Bad request, no boundary!\n");
 			send_bad_request();
+			return 1;
+		}
+		dbg_string("Boundary: >"); dbg_string_x(boundary); dbg_string("<\n");
+		// Skip the initial parts up to the one holding the octet stream
+		http_multipart(r);
+		return 0;
+	}
+	send_not_found();
+	return 1;
+}
+
+
+/*
+ * Prepares writing the octet stream of an upload to flash
+ */
+void start_upload(__xdata struct http_req *r)
+{
+	dbg_string("Have content octets\n");
+	if (is_word(r->buf + 1, "upload")) {
+		LOG(LOG_HTTPD, LOG_INFO, LOG_MSG_HTTPD_UPLOAD, 0, 0);
+		uptr = FIRMWARE_UPLOAD_START;
+		verify_crc = 1;
+		max_upload = 1024576;
+	} else {
+		dbg_string("Configuration upload\n");
+		// The body is larger than the file, but bounds what is to be programmed
+		max_upload = r->content_length > CONFIG_RECORD_MAX ? CONFIG_RECORD_MAX : r->content_length;
+		uptr = config_reserve(CFG_RECORD_TEXT, max_upload);
+		verify_crc = 0;
+	}
+	flash_init(0); // Re-initialize flash for non-DIO operation, otherwise flashing fails
+	set_sys_led_state(SYS_LED_FAST);
+
+	crc_value = 0;
+	bindex = 0;
+	write_len = 0;
+	up_head = up_tail = up_full = 0;
+	// Sectors are erased ahead of uptr while the upload progresses, the
+	// configuration goes into space of the journal that is erased already
+	up_erased = verify_crc ? uptr : (uptr | (FLASH_SECTOR_SIZE - 1)) + 1;
+	up_end = uptr + max_upload;
+	up_room = max_upload;
+
+	up_state = uptr ? UPLOAD_RUNNING : UPLOAD_FAILED;
+	up_length = r->content_length;
+	up_received = up_written = 0;
+	up_start = ticks;
+}
+
+
+/*
+ * Handles a GET request once its header has been parsed
+ */
+void handle_get(__xdata struct http_req *r)
+{
+	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
+
+	dbg_string("GET request ");
+	dbg_string_x(r->buf);
+	dbg_char('\n');
+
+	s->tstate = TSTATE_NONE;
+	query = r->query ? r->buf + r->query : 0;
+	if_none_match = r->inm ? r->buf + r->inm : 0;
+	check_session(r);
+
+	entry = find_entry(r->buf);
+	dbg_string("Entry is: "); dbg_byte(entry); dbg_char('\n');
+	if (entry == 0xff) {
+		send_not_found();
+	} else if (f_data[entry].handler) {
+		if (!authenticated) {
+			dbg_string("Not authorized!\n");
+			send_unauthorized();
 			return;
 		}
-		// We skip the intial parts as part of the header
-		do {
-			p = skip_boundary(p);
-			if (!*p)
-				goto bad_request;
-			p = scan_header(p);
-			if (!*p)
-				goto bad_request;
-			if (!content_type) // We are waiting for the part with the octet stream
-				continue;
-		} while (!is_word(content_type, "application/octet-stream"));
-		dbg_string("Have content octets\n");
-		p += 4; // Skip \r\n\r\n sequence at end of preamble of part
-
-		if (is_word(request_path, "upload")) {
-			print_string("Firmware upload started.");
-			uptr = FIRMWARE_UPLOAD_START;
-			verify_crc = 1;
-			max_upload = 1024576;
-		} else {
-			dbg_string("Configuration upload, erasing config mem!\n");
-			uptr = CONFIG_START;
-			verify_crc = 0;
-			max_upload = 2048;
-			flash_region.addr = CONFIG_START;
-			flash_sector_erase();
+		f_data[entry].handler();
+	} else {
+		dbg_string("Have entry, authenticated: "); dbg_byte(authenticated); dbg_char('\n');
+		if (!authenticated && !(f_data[entry].start == FDATA_START_login_html 
+					|| f_data[entry].start == FDATA_START_port_svg 
+					|| f_data[entry].start == FDATA_START_sfp_svg
+					|| f_data[entry].start == FDATA_START_style_css)) {
+			send_to_login();
+			return;
+		}
+		// A web-page is actively accessed, we can reset session time-out
+		reg_read_m(RTL837X_REG_SEC_COUNTER);
+		timeptr = (uint8_t*)&last_session_use; // last_session_use is Little endian
+		timeptr[0] = sfr_data[3]; timeptr[1] = sfr_data[2]; timeptr[2] = sfr_data[1]; timeptr[3] = sfr_data[0];
+
+		// The browser already has this version of the file: only send the header
+		if (if_none_match && etag_matches(if_none_match, f_data[entry].etag)) {
+			dbg_string("ETag matches\n");
+			slen = strtox(outbuf, "HTTP/1.1 304 Not Modified\r\nETag: \"");
+			slen += strtox(outbuf + slen, f_data[entry].etag);
+			slen += strtox(outbuf + slen, "\"\r\nCache-Control: max-age=60, must-revalidate\r\n\r\n");
+			return;
 		}
-		flash_init(0); // Re-initialize flash for non-DIO operation, otherwise flashing fails
-		set_sys_led_state(SYS_LED_FAST);
 
-		crc_value = 0;
-		bindex = 0;
-		write_len = 0;
-		stream_upload(p - uip_appdata);
+		slen = strtox(outbuf, "HTTP/1.1 200 OK\r\nContent-Type: ");
+		slen += strtox(outbuf + slen, mime_strings[f_data[entry].mime]);
+		slen += strtox(outbuf + slen, "; charset=UTF-8\r\nETag: \"");
+		slen += strtox(outbuf + slen, f_data[entry].etag);
+		slen += strtox(outbuf + slen, "\"\r\nCache-Control: max-age=60, must-revalidate\r\nAccess-Control-Allow-Origin: *\r\n\r\n");
+
+		len_left = f_data[entry].len;
+		if (len_left > (TCP_OUTBUF_SIZE - slen)) {
+			cont_len = len_left - (TCP_OUTBUF_SIZE - slen);
+			len_left = TCP_OUTBUF_SIZE - slen;
+			cont_addr = f_data[entry].start + len_left;
+		}
+		dbg_string("MIME: "); dbg_string(mime_strings[f_data[entry].mime]); dbg_char('\n');
+		/*
+		 * Static files are read through the memory mapped window. A file
+		 * is read again only if its ETag changed, in the flash cache it
+		 * would only displace the blocks of the configuration
+		 */
+		cont_cached = 0;
+		flash_region.addr = f_data[entry].start;
+		flash_region.len = len_left;
+		flash_read_mmio(outbuf + slen);
+		slen += len_left;
+	}
+}
 
-		dbg_string("Done reading first fragment\n");
+
+/*
+ * Feeds the segment received to the request parser of the connection
+ * and handles the request as soon as enough of it has arrived
+ */
+void receive_request(void)
+{
+	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
+	__xdata struct http_req * __xdata r = &s->req;
+	__xdata uint8_t *p = uip_appdata;
+	uint16_t i = 0;
+
+	dbg_char('<'); dbg_short(uip_len); dbg_char('\n');
+	s->deadline = ((uint16_t)ticks) + REQUEST_TIMEOUT;
+	while (i < uip_len) {
+		switch (http_parse(r, p[i++])) {
+		case HP_MORE:
+			continue;
+		case HP_HEADER:
+			if (r->method == HTTP_GET) {
+				handle_get(r);
+				break;
+			}
+			if (r->method != HTTP_POST) {
+				send_bad_request();
+				break;
+			}
+			if (!handle_post(r)) {
+				if (s->tstate != TSTATE_FORM)
+					continue;
+				// The body of a /cmd request goes to txn_buf, outbuf is not needed
+				stream_form(i);
+				tx_conn = 0;
+				uip_len = 0;
+				return;
+			}
+			break;
+		case HP_BODY:
+			handle_form(r);
+			break;
+		case HP_DATA:
+			start_upload(r);
+			// The sector for the configuration could not be erased
+			if (up_state == UPLOAD_FAILED) {
+				upload_release();
+				uip_abort();
+				s->tstate = TSTATE_CLOSED;
+				tx_conn = 0;
+				uip_len = 0;
+				return;
+			}
+			stream_upload(i);
+			dbg_string("Done reading first fragment\n");
+			// The octet stream goes to the ring, outbuf is only needed for the response
+			tx_conn = 0;
+			uip_len = 0;
+			return;
+		default:
+			send_bad_request();
+			break;
+		}
+		// The upload did not get to its octet stream
+		if (up_conn == uip_conn)
+			upload_release();
+		// The handler parked the request, outbuf is not needed until it is answered
+		if (s->tstate == TSTATE_WAIT || s->tstate == TSTATE_CMD) {
+			tx_conn = 0;
+			uip_len = 0;
+			return;
+		}
+		send_response();
 		return;
+	}
+	// Wait for the rest of the request
+	uip_len = 0;
+}
+
+
+/*
+ * Starts sending the response in outbuf
+ */
+void send_response(void)
+{
+	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
 
+	dbg_string("slen: "); dbg_short(slen); dbg_char('\n');
+	tx_conn = uip_conn;
+	tx_start = ticks;
+	tx_bytes = slen + cont_len;
+	o_idx = 0;
+	if (slen > uip_mss()) {
+		dbg_string("Sending a: "); dbg_short(slen); dbg_char('\n');
+		uip_send(outbuf + o_idx, uip_mss());
+		dbg_string("Sending a done\n");
 	} else {
-		send_not_found();
+		dbg_string("Sending b: "); dbg_short(slen); dbg_char('\n');
+		uip_send(outbuf + o_idx, slen);
+		dbg_string("Sending b done\n");
+	}
+	s->tstate = TSTATE_TX;
+}
+
+
+/*
+ * Answers a request to /cmd with the output of its command, once idle()
+ * has run it. If it did not run in time, it is dropped and the client
+ * is asked to retry
+ */
+void send_cmd_output(void)
+{
+	if (cmd_available || cmd_capture) {
+		// The command is dropped, so that the retry does not run it twice
+		if (cmd_available == CMD_HTTP) {
+			cmd_available = 0;
+			cmd_buffer[0] = '\0';
+			if (cmd_conn_txn)
+				txn_cancel();
+		}
+		cmd_release();
+		slen = strtox(outbuf, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n\r\n");
 		return;
 	}
-	slen = strtox(outbuf, "HTTP/1.1 200 OK\r\n\r\n");
-	return;
-bad_request:
-	send_bad_request();
-	return;
+	cmd_conn = 0;
+	slen = strtox(outbuf, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n");
+	memcpy(outbuf + slen, cmd_out, cmd_out_len);
+	slen += cmd_out_len;
+	cmd_out_free();
+}
+
+
+/*
+ * Checks whether a request parked by httpd_wait() can be answered
+ */
+uint8_t wait_over(__xdata struct httpd_state * __xdata s)
+{
+	if (s->since != state_gen)
+		return 1;
+	return ((int16_t)(((uint16_t)ticks) - s->deadline)) >= 0;
 }
 
 
@@ -464,23 +1124,93 @@ void httpd_appcall(void)
 	__xdata struct httpd_state * __xdata s = &(uip_conn->appstate);
 
 	dbg_char('P');
-	if(uip_connected() && s->tstate == TSTATE_CLOSED) {
+	if (uip_connected()) {
 		dbg_string("Connected...\n");
 		s->tstate = TSTATE_NONE;
-	} else if (uip_closed()) {
+		// Hold back the request while another connection is served
+		if (tx_conn)
+			uip_stop();
+		// The first packet may already carry data
+		if (!uip_newdata())
+			return;
+	}
+
+	if (uip_closed() || uip_aborted() || uip_timedout()) {
 		dbg_string("Connection closed\n");
+		if (s->tstate == TSTATE_POST)
+			up_state = UPLOAD_FAILED;
+		if (up_conn == uip_conn)
+			upload_release();
+		// The output of a command still to be run is dropped
+		if (s->tstate == TSTATE_CMD)
+			cmd_release();
+		if (s->tstate == TSTATE_FORM)
+			form_release();
 		s->tstate = TSTATE_CLOSED;
-	} else if (uip_aborted()) {
-		dbg_string("Connection aborted\n");
-		uip_close();
-		s->tstate = TSTATE_CLOSED;
+		if (tx_conn == uip_conn)
+			tx_conn = 0;
 	} else if (uip_poll()) {
 		uip_len = 0;
-		if (s->tstate == TSTATE_ACKED) {
+		if (s->tstate == TSTATE_POST) {
+			if (((int16_t)(((uint16_t)ticks) - s->deadline)) >= 0) {
+				dbg_string("Upload timed out\n");
+				up_state = UPLOAD_FAILED;
+				upload_release();
+				uip_abort();
+				s->tstate = TSTATE_CLOSED;
+			} else {
+				upload_pump();
+				if (up_state == UPLOAD_FAILED) {
+					upload_release();
+					uip_abort();
+					s->tstate = TSTATE_CLOSED;
+				}
+			}
+		} else if (s->tstate == TSTATE_FORM) {
+			if (((int16_t)(((uint16_t)ticks) - s->deadline)) >= 0) {
+				dbg_string("Command body timed out\n");
+				form_release();
+				uip_abort();
+				s->tstate = TSTATE_CLOSED;
+			} else if (!s->req.content_length) {
+				// The body is complete, waiting for cmd_buffer
+				form_run();
+			}
+		} else if (s->tstate == TSTATE_ACKED) {
 			dbg_string("Closing because everything has been transmitted\n");
 			uip_close();
 			s->tstate = TSTATE_CLOSED;
+		} else if (uip_stopped(uip_conn) && !tx_conn) {
+			// Re-open the window, uIP sends a window update with the ACK
+			uip_restart();
+		} else if (s->tstate == TSTATE_WAIT && !tx_conn && wait_over(s)) {
+			dbg_string("Events ready\n");
+			tx_take();
+			events_to_html(state_changed_since(s->since), s->sel);
+			send_response();
+		} else if (s->tstate == TSTATE_CMD && !tx_conn
+			   && ((!cmd_available && !cmd_capture)
+			       || ((int16_t)(((uint16_t)ticks) - s->deadline)) >= 0)) {
+			tx_take();
+			cont_len = 0;
+			send_cmd_output();
+			send_response();
+		} else if (s->tstate == TSTATE_DONE && !tx_conn) {
+			tx_take();
+			cont_len = 0;
+			slen = strtox(outbuf, "HTTP/1.1 200 OK\r\n\r\n");
+			send_response();
+		} else if (s->tstate == TSTATE_REQ && ((int16_t)(((uint16_t)ticks) - s->deadline)) >= 0) {
+			// The client stopped sending in the middle of a request
+			dbg_string("Request timed out\n");
+			if (up_conn == uip_conn)
+				upload_release();
+			uip_abort();
+			s->tstate = TSTATE_CLOSED;
+			tx_conn = 0;
 		}
+	} else if (uip_acked() && s->tstate == TSTATE_BUSY) {
+		s->tstate = TSTATE_ACKED;
 	} else if (uip_acked() && s->tstate == TSTATE_TX) {
 		dbg_string("ACK\n");
 		if (slen > uip_mss()) {
@@ -508,149 +1238,86 @@ void httpd_appcall(void)
 				slen = TCP_OUTBUF_SIZE;
 			flash_region.addr = cont_addr;
 			flash_region.len = slen;
-			flash_read_bulk(outbuf);
+			if (cont_cached)
+				flash_read_bulk(outbuf);
+			else
+				flash_read_mmio(outbuf);
 			uip_send(outbuf, slen);
 			cont_len -= slen;
 			cont_addr += slen;
 			s->tstate = TSTATE_TX;
 		}
+		// Response complete, outbuf is free for the next request
+		if (s->tstate == TSTATE_ACKED) {
+			tx_conn = 0;
+			if (tx_bytes >= TX_RATE_MIN) {
+				tx_start = ticks - tx_start;
+				tx_rate = tx_bytes * SYS_TICK_HZ / (tx_start ? tx_start : 1);
+			}
+		}
 	} else if (uip_newdata() && s->tstate == TSTATE_POST) {
-		// Check here maxupload by subtracting uip_len and close socekt if fails!
-		if (max_upload - uip_len > 0) {
+		s->deadline = ((uint16_t)ticks) + REQUEST_TIMEOUT;
+		// Refuse data beyond the upload area, allowing for the closing boundary
+		if (uptr + up_full * FLASHMEM_PAGE_SIZE + write_len + uip_len > up_end + BOUNDARY_SIZE) {
+			dbg_string("Upload too large\n");
+			up_state = UPLOAD_FAILED;
+			upload_release();
+			uip_abort();
+			s->tstate = TSTATE_CLOSED;
+		} else {
 			stream_upload(0);
 			write_char('.');
-		} else {
-			send_bad_request();
-			goto do_send;
-		}
-	} else if (uip_newdata() && s->tstate != TSTATE_TX) {
-		cont_len = 0;
-		dbg_char('<'); dbg_short(uip_len); dbg_char('\n');
-		__xdata uint8_t *p = uip_appdata;
-		// Mark end of request header with \0
-		p[uip_len] = 0;
-#ifdef DEBUG
-		while (*p)
-			dbg_char(*p++);
-		dbg_char('\n');
-#endif
-		p = uip_appdata;
-		if (is_word(p, "POST")) {
-			handle_post();
-			// If this is an ongoing post stream, then wait for the next packet
-			if (s->tstate == TSTATE_POST) {
-				uip_len = 0;
-				return;
+			if (up_state == UPLOAD_FAILED) {
+				if (up_conn == uip_conn)
+					upload_release();
+				uip_abort();
+				s->tstate = TSTATE_CLOSED;
 			}
-			goto do_send;
+			// Close the window unless the ring can take another one before the next poll
+			if (s->tstate == TSTATE_POST && UPLOAD_PAGES - 1 - up_full < UPLOAD_WINDOW_PAGES)
+				uip_stop();
 		}
-
-		if (is_word(p, "GET"))
-			dbg_string("GET request ");
-		p += 4;
-		scan_header(p);
-		__xdata uint8_t *q = p;
-		while (!is_separator(*p))
-			p++;
-		*p = '\0';
-		dbg_string_x(q);
-		dbg_char('\n');
-
-		s->tstate = TSTATE_NONE;
-		entry = find_entry(q);
-		dbg_string("Entry is: "); dbg_byte(entry); dbg_char('\n');
-		if (entry == 0xff) {
-			if (!authenticated) {
-				dbg_string("Not authorized!\n");
-				send_unauthorized();
-				goto do_send;
-			}
-			dbg_string("Not file entry\n");
-			if (!strcmp(q, "/status.json")) {
-				send_status();
-			} else if (!strcmp(q, "/information.json")) {
-				send_basic_info();
-			} else if (!strcmp(q, "/vlan.json")) {
-				parse_short(q + 15);
-				send_vlan(short_parsed);
-			} else if (is_word(q, "/counters.json")) {
-				send_counters(q[20]-'0');
-			} else if (is_word(q, "/eee.json")) {
-				send_eee();
-			} else if (is_word(q, "/l2.json")) {
-				parse_short(q + 13); // e.g.: /l2.json?idx=10
-				send_l2(short_parsed);
-			} else if (is_word(q, "/l2_del.json")) {
-				parse_short(q + 17);
-				l2_delete(short_parsed);
-			} else if (is_word(q, "/mirror.json")) {
-				send_mirror();
-			} else if (is_word(q, "/mtu.json")) {
-				send_mtu();
-			} else if (is_word(q, "/lag.json")) {
-				send_lag();
-			} else if (is_word(q, "/config")) {
-				send_config();
-			} else if (is_word(q, "/cmd_log")) {
-				send_cmd_log();
-			} else {
-				send_not_found();
-			}
-		} else {
-			dbg_string("Have entry, authenticated: "); dbg_byte(authenticated); dbg_char('\n');
-			if (!authenticated && !(f_data[entry].start == FDATA_START_login_html 
-						|| f_data[entry].start == FDATA_START_port_svg 
-						|| f_data[entry].start == FDATA_START_sfp_svg
-						|| f_data[entry].start == FDATA_START_style_css)) {
-				send_to_login();
-				goto do_send;
-			}
-			// A web-page is actively accessed, we can reset session time-out
-			reg_read_m(RTL837X_REG_SEC_COUNTER);
-			timeptr = (uint8_t*)&last_session_use; // last_session_use is Little endian
-			timeptr[0] = sfr_data[3]; timeptr[1] = sfr_data[2]; timeptr[2] = sfr_data[1]; timeptr[3] = sfr_data[0];
-
-			slen = strtox(outbuf, "HTTP/1.1 200 OK\r\nContent-Type: ");
-			slen += strtox(outbuf + slen, mime_strings[f_data[entry].mime]);
-			slen += strtox(outbuf + slen, "; charset=UTF-8\r\nCache-Control: max-age=60, must-revalidate\r\nAccess-Control-Allow-Origin: *\r\n\r\n");
-
-			len_left = f_data[entry].len;
-			if (len_left > (TCP_OUTBUF_SIZE - slen)) {
-				cont_len = len_left - (TCP_OUTBUF_SIZE - slen);
-				len_left = TCP_OUTBUF_SIZE - slen;
-				cont_addr = f_data[entry].start + len_left;
-			}
-			dbg_string("MIME: "); dbg_string(mime_strings[f_data[entry].mime]); dbg_char('\n');
-			flash_region.addr = f_data[entry].start;
-			flash_region.len = len_left;
-			flash_read_bulk(outbuf + slen);
-			slen += len_left;
+	} else if (uip_newdata() && s->tstate == TSTATE_FORM) {
+		if (s->req.content_length) {
+			s->deadline = ((uint16_t)ticks) + REQUEST_TIMEOUT;
+			stream_form(0);
 		}
-do_send:
-		dbg_string("slen: "); dbg_short(slen); dbg_char('\n');
-		o_idx = 0;
-		if (slen > uip_mss()) {
-			dbg_string("Sending a: "); dbg_short(slen); dbg_char('\n');
-			uip_send(outbuf + o_idx, uip_mss());
-			dbg_string("Sending a done\n");
-		} else {
-			dbg_string("Sending b: "); dbg_short(slen); dbg_char('\n');
-			uip_send(outbuf + o_idx, slen);
-			dbg_string("Sending b done\n");
+		uip_len = 0;
+	} else if (uip_newdata() && s->tstate == TSTATE_DONE) {
+		// Whatever follows the closing boundary of an upload
+		uip_len = 0;
+	} else if (uip_newdata() && tx_conn && tx_conn != uip_conn) {
+		// Only possible if the request came with the handshake, before uip_stop()
+		dbg_string("Busy\n");
+		send_busy();
+		s->tstate = TSTATE_BUSY;
+	} else if (uip_newdata() && s->tstate != TSTATE_TX) {
+		// First segment of a new request
+		if (s->tstate != TSTATE_REQ) {
+			// A client giving up on its command sends the next request
+			if (cmd_conn == uip_conn)
+				cmd_release();
+			tx_take();
+			cont_len = 0;
+			http_init(&s->req);
+			s->tstate = TSTATE_REQ;
 		}
-		s->tstate = TSTATE_TX;
+		receive_request();
 	} else if (uip_rexmit()) { // Connection established, need to rexmit?
 		dbg_string("RETRANSMIT requested\n");
-		if (slen > uip_mss()) {
+		if (s->tstate == TSTATE_BUSY) {
+			send_busy();
+		} else if (slen > uip_mss()) {
 			dbg_string("Sending C: "); dbg_short(slen); dbg_char('\n');
 			uip_send(outbuf + o_idx, uip_mss());
 			dbg_string("Sending C done\n");
+			s->tstate = TSTATE_TX;
 		} else if (slen > 0) {
 			dbg_string("Sending D: "); dbg_short(slen); dbg_char('\n');
 			uip_send(outbuf + o_idx, slen);
 			dbg_string("Sending D done\n");
+			s->tstate = TSTATE_TX;
 		}
-		s->tstate = TSTATE_TX;
 		uip_len = 0;
 	} else {
 		uip_len = 0;
@@ -5,6 +5,7 @@
    here. But we might need to include uipopt.h if we need the u8_t and
    u16_t datatypes. */
 #include "uipopt.h"
+#include "http_parser.h"
 
 /* Next, we define the uip_tcp_appstate_t datatype. This is the state
    of our application, and the memory required for this state is
@@ -12,6 +13,10 @@
    for each TCP connection. */
 typedef struct httpd_state {
    uint8_t tstate;
+   uint8_t sel;		// Sections requested by a waiting /events.json
+   uint16_t since;	// State generation the waiting client knows about
+   uint16_t deadline;	// Tick at which a waiting request times out
+   struct http_req req;	// Request being received
 } uip_tcp_appstate_t;
 
 /* Finally we define the application function to be called by uIP. */
@@ -21,5 +26,6 @@ void httpd_appcall(void);
 #endif /* UIP_APPCALL */
 
 void httpd_init(void) __banked;
+void httpd_wait(uint16_t since, uint8_t sel, uint8_t timeout);
 
 #endif
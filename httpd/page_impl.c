@@ -5,6 +5,9 @@
 #include "rtl837x_regs.h"
 #include "rtl837x_port.h"
 #include "rtl837x_flash.h"
+#include "config_store.h"
+#include "log.h"
+#include "arena.h"
 #include "uip.h"
 #include "html_data.h"
 #include <stdint.h>
@@ -26,6 +29,8 @@ extern __xdata uint8_t outbuf[TCP_OUTBUF_SIZE];
 extern __xdata uint16_t slen;
 extern __xdata uint16_t cont_len;
 extern __xdata uint32_t cont_addr;
+extern __xdata uint8_t cont_cached;
+extern __xdata uint16_t short_parsed;
 extern __code uint8_t * __code hex;
 extern __xdata uip_ipaddr_t uip_hostaddr, uip_draddr, uip_netmask;
 extern __code struct uip_eth_addr uip_ethaddr;
@@ -43,6 +48,30 @@ extern __xdata char sfp_module_vendor[2][17];
 extern __xdata char sfp_module_model[2][17];
 extern __xdata char sfp_module_serial[2][17];
 extern __xdata uint8_t sfp_options[2];
+extern __xdata uint16_t state_gen;
+extern __xdata uint32_t tx_rate;
+extern __xdata uint16_t uip_split_segments;
+extern __xdata uint32_t flash_write_count;
+extern __xdata uint32_t flash_write_ticks;
+extern __xdata uint32_t flash_cache_hits;
+extern __xdata uint32_t flash_cache_misses;
+extern __code char * __xdata boot_phase_name[BOOT_PHASES_MAX];
+extern __xdata uint32_t boot_phase_tick[BOOT_PHASES_MAX];
+extern __xdata uint8_t boot_phases;
+extern __xdata uint32_t serial_dropped;
+extern __xdata uint8_t up_state;
+extern __xdata uint32_t up_length;
+extern __xdata uint32_t up_received;
+extern __xdata uint32_t up_written;
+extern __xdata uint32_t up_time;
+extern __xdata uint16_t state_section_gen[STATE_SECTIONS];
+extern __code struct task tasks[N_TASKS];
+extern __xdata struct task_stat task_stat[N_TASKS];
+extern __xdata uint32_t cpu_missed;
+extern __xdata uint32_t cpu_latency;
+extern __xdata uint32_t cpu_latency_max;
+extern __xdata uint16_t wait_timeouts[WAIT_SITES];
+extern __code char * __code wait_sites[WAIT_SITES];
 
 __code uint8_t * __code HTTP_RESPONCE_JSON = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n";
 __code uint8_t * __code HTTP_RESPONCE_TXT = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
@@ -97,6 +126,36 @@ void itoa_html(uint8_t v)
 }
 
 
+// Converts a uint32_t to a decimal string
+void long_to_html(__xdata uint32_t v)
+{
+	__xdata uint8_t d[10];
+	uint8_t i = 0;
+
+	do {
+		d[i++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (i)
+		char_to_html(d[--i]);
+}
+
+
+// Converts a uint16_t to a decimal string
+void short_to_html(uint16_t v)
+{
+	__xdata uint8_t d[5];
+	uint8_t i = 0;
+
+	do {
+		d[i++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (i)
+		char_to_html(d[--i]);
+}
+
+
 uint16_t stat_content(void)
 {
 	dbg_string("stat_content called\n");
@@ -187,9 +246,8 @@ void sfp_send_data(uint8_t slot, uint8_t reg, uint8_t len)
 	reg_bit_set(RTL837X_REG_I2C_CTRL, 0);
 
 	// Wait for execution to finish
-	do {
-		reg_read_m(RTL837X_REG_I2C_CTRL);
-	} while (sfr_data[3] & 0x1);
+	if (reg_wait(RTL837X_REG_I2C_CTRL, 3, 0x1, WAIT_I2C))
+		return;
 
 	for (uint8_t i = 0; i < len & 0xf; i++) {
 		if (!(i & 0x3))
@@ -240,12 +298,42 @@ void send_basic_info(void)
 		send_sfp_info(1);
 		char_to_html('"');
 	}
+	slen += strtox(outbuf + slen, ",\"http_tx_rate\":");
+	long_to_html(tx_rate);
+	slen += strtox(outbuf + slen, ",\"tcp_split\":");
+	short_to_html(uip_split_segments);
+	// Bytes/s of flash_write_bytes() since boot
+	slen += strtox(outbuf + slen, ",\"flash_write_rate\":");
+	long_to_html(flash_write_ticks ? flash_write_count * SYS_TICK_HZ / flash_write_ticks : 0);
+	// Blocks of flash found in the cache of flash_read_bulk() and read from flash
+	slen += strtox(outbuf + slen, ",\"flash_cache_hits\":");
+	long_to_html(flash_cache_hits);
+	slen += strtox(outbuf + slen, ",\"flash_cache_misses\":");
+	long_to_html(flash_cache_misses);
+	// Characters of console output dropped because the serial ring was full
+	slen += strtox(outbuf + slen, ",\"serial_dropped\":");
+	long_to_html(serial_dropped);
+	// Tick at which each phase of the boot started
+	slen += strtox(outbuf + slen, ",\"boot_phases\":{");
+	for (uint8_t i = 0; i < boot_phases; i++) {
+		if (i)
+			char_to_html(',');
+		char_to_html('"');
+		slen += strtox(outbuf + slen, boot_phase_name[i]);
+		slen += strtox(outbuf + slen, "\":");
+		long_to_html(boot_phase_tick[i]);
+	}
+	slen += strtox(outbuf + slen, "},\"tick_hz\":");
+	short_to_html(SYS_TICK_HZ);
 	char_to_html('}');
 }
 
 
-void send_vlan(uint16_t vlan)
+void send_vlan(void)
 {
+	query_short("vid");
+	__xdata uint16_t vlan = short_parsed;
+
 	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
 	dbg_string("sending VLAN\n");
 	//{"members":"0x00060011"}
@@ -264,8 +352,11 @@ void send_vlan(uint16_t vlan)
 }
 
 
-void send_counters(char port)
+void send_counters(void)
 {
+	query_short("port");
+	uint8_t port = short_parsed;
+
 	dbg_string("send_counters called: "); dbg_byte(port); dbg_char('\n');
 	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
 	dbg_string("sending counters\n");
@@ -285,16 +376,20 @@ void send_counters(char port)
 }
 
 
-void send_l2(uint16_t idx)
+void send_l2(void)
 {
+	query_short("idx");
+	__xdata uint16_t idx = short_parsed;
+
 	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
 	dbg_string("sending L2\n");
 	dbg_short(idx);
 	__xdata uint8_t entries_left = L2_MAX_TRANSFER;
 
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & TBL_EXECUTE);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL)) {
+		slen += strtox(outbuf + slen, "[]");
+		return;
+	}
 
 	/* The L2 table in the ASIC can hold up to 4096 (0x1000) entries, which
 	 * are accessed using an index. The index is the hash of the MAC address
@@ -318,9 +413,10 @@ void send_l2(uint16_t idx)
 		REG_WRITE(RTL837x_TBL_DATA_0, sfr_data[0], sfr_data[1] & 0xfc, sfr_data[2] | (TBL_LUTREAD_NEXT_L2UC << 6), sfr_data[3]);
 
 		REG_WRITE(RTL837X_TBL_CTRL, entry >> 8, entry, TBL_L2_UNICAST, TBL_EXECUTE);
-		do {
-			reg_read_m(RTL837X_TBL_CTRL);
-		} while (sfr_data[3] & TBL_EXECUTE);
+		if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL)) {
+			char_to_html(']');
+			break;
+		}
 
 		reg_read_m(RTL837x_L2_DATA_OUT_B);
 		if ((sfr_data[0] & 0x20)) {	// Check entry is valid
@@ -379,25 +475,26 @@ void send_l2(uint16_t idx)
 }
 
 
-void l2_delete(uint16_t idx)
+void l2_delete(void)
 {
+	query_short("idx");
+	__xdata uint16_t idx = short_parsed;
+
 	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
 	dbg_string("L2 DELETE\n");
 	dbg_short(idx);
 	__xdata uint8_t entries_left = L2_MAX_TRANSFER;
 
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & TBL_EXECUTE);
 	slen += strtox(outbuf + slen, "{\"result\":");
+	if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL))
+		goto failed;
 	// First, search for the entry based on the index
 	reg_read_m(RTL837x_TBL_DATA_0);
 	REG_WRITE(RTL837x_TBL_DATA_0, sfr_data[0], sfr_data[1] & 0xfc, sfr_data[2] | (TBL_LUTREAD_NEXT_L2UC << 6), sfr_data[3]);
 
 	REG_WRITE(RTL837X_TBL_CTRL, (idx >> 8) & 0xf, idx, TBL_L2_UNICAST, TBL_EXECUTE);
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & 0x1);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, 0x1, WAIT_TBL))
+		goto failed;
 	reg_read_m(RTL837x_L2_DATA_OUT_B);
 	if (!(sfr_data[0] & 0x20)) {
 		char_to_html('0');
@@ -418,21 +515,23 @@ void l2_delete(uint16_t idx)
 		REG_WRITE(RTL837x_TBL_DATA_0, sfr_data[0], sfr_data[1], TBL_L2_UNICAST, sfr_data[3]);
 
 		REG_WRITE(RTL837X_TBL_CTRL, idx >> 8, idx, TBL_L2_UNICAST, TBL_WRITE | TBL_EXECUTE);
-		do {
-			reg_read_m(RTL837X_TBL_CTRL);
-		} while (sfr_data[3] & TBL_EXECUTE);
+		if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL))
+			goto failed;
 
+		state_changed(STATE_L2);
 		char_to_html('1');
 	}
 	char_to_html('}');
+	return;
+
+failed:
+	char_to_html('0');
+	char_to_html('}');
 }
 
 
-void send_mirror(void)
+void mirror_to_html(void)
 {
-	dbg_string("send_mirror called\n");
-	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
-
 	reg_read_m(RTL837x_MIRROR_CTRL);
 	uint8_t mPort = sfr_data[3];
 	if (mPort & 1) {
@@ -462,11 +561,16 @@ void send_mirror(void)
 }
 
 
-void send_lag(void)
+void send_mirror(void)
 {
-	dbg_string("send_lag called\n");
+	dbg_string("send_mirror called\n");
 	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
+	mirror_to_html();
+}
 
+
+void lag_to_html(void)
+{
 	char_to_html('[');
 	for (uint8_t l=0; l < 4; l++) {
 		slen += strtox(outbuf + slen, "{\"lagNum\":");
@@ -488,6 +592,47 @@ void send_lag(void)
 }
 
 
+void send_lag(void)
+{
+	dbg_string("send_lag called\n");
+	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
+	lag_to_html();
+}
+
+
+/*
+ * Adds the EEE fields of a copper port to the JSON object of that port
+ * eee_ablty is the content of RTL8373_PHY_EEE_ABLTY, shared by all ports
+ */
+void eee_to_html(uint8_t i, uint8_t eee_ablty)
+{
+	uint16_t v;
+
+	slen += strtox(outbuf + slen, ",\"eee\":\"");
+	phy_read(i, PHY_MMD_AN, PHY_EEE_ADV2);
+	v = SFR_DATA_U16;
+	bool_to_html(v & PHY_EEE_BIT_2G5);
+
+	phy_read(i, PHY_MMD_AN, PHY_EEE_ADV);
+	v = SFR_DATA_U16;
+	bool_to_html(v & PHY_EEE_BIT_1G);
+	bool_to_html(v & PHY_EEE_BIT_100M);
+
+	phy_read(i, PHY_MMD_AN, PHY_EEE_LP_ABILITY2);
+	v = SFR_DATA_U16;
+	slen += strtox(outbuf + slen, "\",\"eee_lp\":\"");
+	bool_to_html (v & PHY_EEE_BIT_2G5);
+
+	phy_read(i, PHY_MMD_AN, PHY_EEE_LP_ABILITY);
+	v = SFR_DATA_U16;
+	bool_to_html(v & PHY_EEE_BIT_1G);
+	bool_to_html(v & PHY_EEE_BIT_100M);
+
+	slen += strtox(outbuf + slen, "\",\"active\":");
+	bool_to_html(eee_ablty & (1 << i));
+}
+
+
 void send_eee(void)
 {
 	dbg_string("send_eee called\nsending EEE status\n");
@@ -504,29 +649,8 @@ void send_eee(void)
 		if (machine.is_sfp[i]) {
 			slen += strtox(outbuf + slen, ",\"isSFP\":1");
 		} else {
-			slen += strtox(outbuf + slen, ",\"isSFP\":0,\"eee\":\"");
-			uint16_t v;
-			phy_read(i, PHY_MMD_AN, PHY_EEE_ADV2);
-			v = SFR_DATA_U16;
-			bool_to_html(v & PHY_EEE_BIT_2G5);
-
-			phy_read(i, PHY_MMD_AN, PHY_EEE_ADV);
-			v = SFR_DATA_U16;
-			bool_to_html(v & PHY_EEE_BIT_1G);
-			bool_to_html(v & PHY_EEE_BIT_100M);
-
-			phy_read(i, PHY_MMD_AN, PHY_EEE_LP_ABILITY2);
-			v = SFR_DATA_U16;
-			slen += strtox(outbuf + slen, "\",\"eee_lp\":\"");
-			bool_to_html (v & PHY_EEE_BIT_2G5);
-
-			phy_read(i, PHY_MMD_AN, PHY_EEE_LP_ABILITY);
-			v = SFR_DATA_U16;
-			bool_to_html(v & PHY_EEE_BIT_1G);
-			bool_to_html(v & PHY_EEE_BIT_100M);
-
-			slen += strtox(outbuf + slen, "\",\"active\":");
-			bool_to_html(eee_ablty & (1 << i));
+			slen += strtox(outbuf + slen, ",\"isSFP\":0");
+			eee_to_html(i, eee_ablty);
 		}
 		char_to_html('}');
 		if (i < machine.max_port)
@@ -536,6 +660,19 @@ void send_eee(void)
 	}
 }
 
+
+// Adds the MTU of a port to the JSON object of that port
+void mtu_to_html(uint8_t i)
+{
+	slen += strtox(outbuf + slen, ",\"mtu\":\"0x");
+	reg_read_m(RTL8373_REG_MAC_L2_PORT_MAX_LEN + ((uint16_t) i << 8));
+	uint16_t mtu = SFR_DATA_U16 & 0x3fff;
+	byte_to_html(mtu >> 8);
+	byte_to_html(mtu & 0xff);
+	char_to_html('"');
+}
+
+
 void send_mtu(void)
 {
 	dbg_string("send_mtu called\n");
@@ -544,12 +681,7 @@ void send_mtu(void)
 	for (uint8_t i = machine.min_port; i <= machine.max_port; i++) {
 		slen += strtox(outbuf + slen, "{\"portNum\":");
 		itoa_html(machine.log_to_phys_port[i]);
-		slen += strtox(outbuf + slen, ",\"mtu\":\"0x");
-		reg_read_m(RTL8373_REG_MAC_L2_PORT_MAX_LEN + ((uint16_t) i << 8));
-		uint16_t mtu = SFR_DATA_U16 & 0x3fff;
-		byte_to_html(mtu >> 8);
-		byte_to_html(mtu & 0xff);
-		char_to_html('"');
+		mtu_to_html(i);
 		char_to_html('}');
 		if (i < machine.max_port)
 			char_to_html(',');
@@ -559,130 +691,445 @@ void send_mtu(void)
 }
 
 
+// Change tracking of the port status for ?since= requests: for each group of
+// fields of a port the hash of its last JSON and the generation it changed in
+#define STATUS_INFO		0
+#define STATUS_LINK		1
+#define STATUS_COUNTERS		2
+#define STATUS_GROUPS		3
+__xdata uint16_t status_gen;
+__xdata uint16_t status_hash[9][STATUS_GROUPS];
+__xdata uint16_t status_port_gen[9][STATUS_GROUPS];
+
+/*
+ * Writes the configuration of port i: the logical port, whether it is
+ * enabled and the advertised speeds or the SFP module information
+ */
+void status_info_to_html(uint8_t i)
+{
+	slen += strtox(outbuf + slen, ",\"logPort\":");
+	itoa_html(i);
+
+	if (machine.is_sfp[i]) {
+		slen += strtox(outbuf + slen, ",\"isSFP\":1,\"enabled\":");
+		if (!(sfp_pins_last & (0x1 << ((machine.is_sfp[i] - 1) << 2)))) {
+			bool_to_html(1);
+			slen += strtox(outbuf + slen,",\"sfp_options\":\"0x");
+			byte_to_html(sfp_options[machine.is_sfp[i]-1]);
+			if (sfp_options[machine.is_sfp[i]-1] & 0x40) {
+				sfp_send_data(machine.is_sfp[i] - 1, 92, 1);
+				slen += strtox(outbuf + slen,"\",\"sfp_temp\":\"0x");
+				sfp_send_data(machine.is_sfp[i] - 1, 224, 2);
+				slen += strtox(outbuf + slen,"\",\"sfp_vcc\":\"0x");
+				sfp_send_data(machine.is_sfp[i] - 1, 226, 2);
+				slen += strtox(outbuf + slen,"\",\"sfp_txbias\":\"0x");
+				sfp_send_data(machine.is_sfp[i] - 1, 228, 2);
+				slen += strtox(outbuf + slen,"\",\"sfp_txpower\":\"0x");
+				sfp_send_data(machine.is_sfp[i] - 1, 230, 2);
+				slen += strtox(outbuf + slen,"\",\"sfp_rxpower\":\"0x");
+				sfp_send_data(machine.is_sfp[i] - 1, 232, 2);
+				slen += strtox(outbuf + slen,"\",\"sfp_state\":\"0x");
+				sfp_send_data(machine.is_sfp[i] - 1, 238, 1);
+			}
+			slen += strtox(outbuf + slen,"\",\"sfp_vendor\":\"");
+			for (register uint8_t s = 0; s < 16; s++)
+				outbuf[slen++] = sfp_module_vendor[machine.is_sfp[i]-1][s];
+			slen += strtox(outbuf + slen,"\",\"sfp_model\":\"");
+			for (register uint8_t s = 0; s < 16; s++)
+				outbuf[slen++] = sfp_module_model[machine.is_sfp[i]-1][s];
+			slen += strtox(outbuf + slen,"\",\"sfp_serial\":\"");
+			for (register uint8_t s = 0; s < 16; s++)
+				outbuf[slen++] = sfp_module_serial[machine.is_sfp[i]-1][s];
+			char_to_html('"');
+		} else {
+			bool_to_html(0);
+		}
+	} else {
+		slen += strtox(outbuf + slen, ",\"isSFP\":0,\"enabled\":");
+		phy_read(i, 0x1f, 0xa610);
+		bool_to_html(SFR_DATA_8 == 0x20);
+		slen += strtox(outbuf + slen, ",\"adv\":\"");
+		phy_read(i, PHY_MMD_AN, 0x20);
+		uint16_t w = SFR_DATA_U16;
+		bool_to_html(!!(w & 0x80));		// 2500BaseN-Full
+		phy_read(i, PHY_MMD_CTRL, 0xa412);
+		w = SFR_DATA_U16;
+		bool_to_html(!!(w & 0x0200));		// 1000Base-Full
+		phy_read(i, PHY_MMD_AN, 0x10);
+		w = SFR_DATA_U16;
+		bool_to_html(!!(w & 0x0100));		// 100Base-Full
+		bool_to_html(!!(w & 0x80));		// 100Base-Half
+		bool_to_html(!!(w & 0x40));		// 10Base-Full
+		bool_to_html(!!(w & 0x20));		// 10Base-Half
+		char_to_html('"');
+	}
+}
+
+
+void status_link_to_html(uint8_t i)
+{
+	slen += strtox(outbuf + slen, ",\"link\":");
+
+	if (i < 8)
+		reg_read_m(RTL837X_REG_LINKS);
+	else
+		reg_read_m(RTL837X_REG_LINKS_89);
+	uint8_t b = sfr_data[3 - ((i & 7) >> 1)];
+	b = (i & 1) ? b >> 4 : b & 0xf;
+	char_to_html('0' + b);
+}
+
+
+void status_counters_to_html(uint8_t i)
+{
+	STAT_GET(STAT_COUNTER_TX_PKTS, i);
+	slen += strtox(outbuf + slen, ",\"txG\":\"0x");
+	reg_to_html(RTL837X_STAT_V_HIGH);
+	reg_to_html(RTL837X_STAT_V_LOW);
+
+	slen += strtox(outbuf + slen, "\",\"txB\":\"0x");
+	STAT_GET(STAT_COUNTER_ERR_PKTS, i);
+	reg_to_html(RTL837X_STAT_V_LOW);	// 32 bit Tx Packet errors
+
+	slen += strtox(outbuf + slen, "\",\"rxG\":\"0x");
+	STAT_GET(STAT_COUNTER_RX_PKTS, i);
+	reg_to_html(RTL837X_STAT_V_HIGH);
+	reg_to_html(RTL837X_STAT_V_LOW);
+
+	slen += strtox(outbuf + slen, "\",\"rxB\":\"0x");
+	STAT_GET(STAT_COUNTER_ERR_PKTS, i);
+	reg_to_html(RTL837X_STAT_V_HIGH);	// 32bit RX packet errors
+	char_to_html('"');
+}
+
+
+// Writes all status fields of port i following portNum
+void status_to_html(uint8_t i)
+{
+	status_info_to_html(i);
+	status_link_to_html(i);
+	status_counters_to_html(i);
+}
+
+
+/*
+ * Writes the status fields of port i that changed after generation since,
+ * everything if since is 0. Each group of fields is rendered and hashed,
+ * a hash different from the last request starts a new status generation
+ * Returns the number of groups written
+ */
+uint8_t status_delta_to_html(uint8_t i, uint16_t since)
+{
+	uint8_t n = 0;
+
+	for (uint8_t g = 0; g < STATUS_GROUPS; g++) {
+		uint16_t start = slen;
+		uint16_t h = 0;
+
+		if (g == STATUS_INFO)
+			status_info_to_html(i);
+		else if (g == STATUS_LINK)
+			status_link_to_html(i);
+		else
+			status_counters_to_html(i);
+		for (uint16_t c = start; c < slen; c++)
+			h = ((h << 5) + h) ^ outbuf[c];
+		if (h != status_hash[i][g]) {
+			status_hash[i][g] = h;
+			if (!++status_gen)
+				status_gen = 1;
+			status_port_gen[i][g] = status_gen;
+		}
+		if (!since || ((int16_t)(status_port_gen[i][g] - since)) > 0)
+			n++;
+		else
+			slen = start;
+	}
+	return n;
+}
+
+
+/*
+ * Port status: /status.json sends all ports as an array, with ?since=<gen>
+ * only the ports and groups of fields changed after generation gen are sent
+ * in {"ports":[...],"gen":<new generation>}, since=0 requests all of them
+ */
 void send_status(void)
 {
 	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
 	dbg_string("sending status\n");
+	if (!query_short("since")) {
+		char_to_html('{');
+		dashboard_to_html(DASHBOARD_STATUS | DASHBOARD_DELTA, short_parsed);
+		return;
+	}
 	char_to_html('[');
 
 	for (uint8_t i = machine.min_port; i <= machine.max_port; i++) {
 		slen += strtox(outbuf + slen, "{\"portNum\":");
 		itoa_html(machine.log_to_phys_port[i]);
-		slen += strtox(outbuf + slen, ",\"logPort\":");
-		itoa_html(i);
+		status_to_html(i);
+		char_to_html('}');
+		if (i < machine.max_port)
+			char_to_html(',');
+		else
+			char_to_html(']');
+	}
+}
 
-		if (machine.is_sfp[i]) {
-			slen += strtox(outbuf + slen, ",\"isSFP\":1,\"enabled\":");
-			if (!(sfp_pins_last & (0x1 << ((machine.is_sfp[i] - 1) << 2)))) {
-				bool_to_html(1);
-				slen += strtox(outbuf + slen,",\"sfp_options\":\"0x");
-				byte_to_html(sfp_options[machine.is_sfp[i]-1]);
-				if (sfp_options[machine.is_sfp[i]-1] & 0x40) {
-					sfp_send_data(machine.is_sfp[i] - 1, 92, 1);
-					slen += strtox(outbuf + slen,"\",\"sfp_temp\":\"0x");
-					sfp_send_data(machine.is_sfp[i] - 1, 224, 2);
-					slen += strtox(outbuf + slen,"\",\"sfp_vcc\":\"0x");
-					sfp_send_data(machine.is_sfp[i] - 1, 226, 2);
-					slen += strtox(outbuf + slen,"\",\"sfp_txbias\":\"0x");
-					sfp_send_data(machine.is_sfp[i] - 1, 228, 2);
-					slen += strtox(outbuf + slen,"\",\"sfp_txpower\":\"0x");
-					sfp_send_data(machine.is_sfp[i] - 1, 230, 2);
-					slen += strtox(outbuf + slen,"\",\"sfp_rxpower\":\"0x");
-					sfp_send_data(machine.is_sfp[i] - 1, 232, 2);
-					slen += strtox(outbuf + slen,"\",\"sfp_state\":\"0x");
-					sfp_send_data(machine.is_sfp[i] - 1, 238, 1);
+
+/*
+ * Writes the members of the JSON object of /dashboard.json holding the
+ * selected sections, the caller opens the object.
+ * The per-port sections are merged into one object per port, so that
+ * status, MTU and EEE come out of a single pass over the ports
+ */
+void dashboard_to_html(uint8_t sel, uint16_t since)
+{
+	uint8_t eee_ablty = 0;
+	uint8_t in_ports = 0;
+
+	if (sel & DASHBOARD_PORTS) {
+		if (sel & DASHBOARD_EEE) {
+			reg_read_m(RTL8373_PHY_EEE_ABLTY);
+			eee_ablty = sfr_data[3];
+		}
+		slen += strtox(outbuf + slen, "\"ports\":[");
+		in_ports = 1;
+		for (uint8_t i = machine.min_port; i <= machine.max_port; i++) {
+			if (slen > TCP_OUTBUF_SIZE - DASHBOARD_PORT_MAX)
+				goto truncated;
+			uint16_t start = slen;
+			if (outbuf[slen - 1] == '}')
+				char_to_html(',');
+			slen += strtox(outbuf + slen, "{\"portNum\":");
+			itoa_html(machine.log_to_phys_port[i]);
+			if (sel & DASHBOARD_DELTA) {
+				// Leave out ports without changes unless other per-port sections are selected
+				if (!status_delta_to_html(i, since) && !(sel & (DASHBOARD_MTU | DASHBOARD_EEE))) {
+					slen = start;
+					continue;
 				}
-				slen += strtox(outbuf + slen,"\",\"sfp_vendor\":\"");
-				for (register uint8_t s = 0; s < 16; s++)
-					outbuf[slen++] = sfp_module_vendor[machine.is_sfp[i]-1][s];
-				slen += strtox(outbuf + slen,"\",\"sfp_model\":\"");
-				for (register uint8_t s = 0; s < 16; s++)
-					outbuf[slen++] = sfp_module_model[machine.is_sfp[i]-1][s];
-				slen += strtox(outbuf + slen,"\",\"sfp_serial\":\"");
-				for (register uint8_t s = 0; s < 16; s++)
-					outbuf[slen++] = sfp_module_serial[machine.is_sfp[i]-1][s];
-				char_to_html('"');
+			} else if (sel & DASHBOARD_STATUS) {
+				status_to_html(i);
 			} else {
-				bool_to_html(0);
+				slen += strtox(outbuf + slen, ",\"isSFP\":");
+				bool_to_html(!!machine.is_sfp[i]);
 			}
-		} else {
-			slen += strtox(outbuf + slen, ",\"isSFP\":0,\"enabled\":");
-			phy_read(i, 0x1f, 0xa610);
-			bool_to_html(SFR_DATA_8 == 0x20);
-			slen += strtox(outbuf + slen, ",\"adv\":\"");
-			phy_read(i, PHY_MMD_AN, 0x20);
-			uint16_t w = SFR_DATA_U16;
-			bool_to_html(!!(w & 0x80));		// 2500BaseN-Full
-			phy_read(i, PHY_MMD_CTRL, 0xa412);
-			w = SFR_DATA_U16;
-			bool_to_html(!!(w & 0x0200));		// 1000Base-Full
-			phy_read(i, PHY_MMD_AN, 0x10);
-			w = SFR_DATA_U16;
-			bool_to_html(!!(w & 0x0100));		// 100Base-Full
-			bool_to_html(!!(w & 0x80));		// 100Base-Half
-			bool_to_html(!!(w & 0x40));		// 10Base-Full
-			bool_to_html(!!(w & 0x20));		// 10Base-Half
-			char_to_html('"');
+			if (sel & DASHBOARD_MTU)
+				mtu_to_html(i);
+			if ((sel & DASHBOARD_EEE) && !machine.is_sfp[i])
+				eee_to_html(i, eee_ablty);
+			char_to_html('}');
 		}
+		char_to_html(']');
+		char_to_html(',');
+		in_ports = 0;
+		if (sel & DASHBOARD_DELTA) {
+			slen += strtox(outbuf + slen, "\"gen\":");
+			short_to_html(status_gen);
+			char_to_html(',');
+		}
+	}
+	if (sel & DASHBOARD_MIRROR) {
+		if (slen > TCP_OUTBUF_SIZE - DASHBOARD_SECTION_MAX)
+			goto truncated;
+		slen += strtox(outbuf + slen, "\"mirror\":");
+		mirror_to_html();
+		char_to_html(',');
+	}
+	if (sel & DASHBOARD_LAG) {
+		if (slen > TCP_OUTBUF_SIZE - DASHBOARD_SECTION_MAX)
+			goto truncated;
+		slen += strtox(outbuf + slen, "\"lag\":");
+		lag_to_html();
+		char_to_html(',');
+	}
+	slen += strtox(outbuf + slen, "\"truncated\":0}");
+	return;
+
+truncated:
+	// Out of buffer space: close the JSON and tell the client that data is missing
+	if (outbuf[slen - 1] == ',')
+		slen--;
+	if (in_ports)
+		char_to_html(']');
+	if (outbuf[slen - 1] != '{')
+		char_to_html(',');
+	slen += strtox(outbuf + slen, "\"truncated\":1}");
+}
 
-		slen += strtox(outbuf + slen, ",\"link\":");
 
-		if (i < 8)
-			reg_read_m(RTL837X_REG_LINKS);
-		else
-			reg_read_m(RTL837X_REG_LINKS_89);
-		uint8_t b = sfr_data[3 - ((i & 7) >> 1)];
-		b = (i & 1) ? b >> 4 : b & 0xf;
-		char_to_html('0' + b);
+// Names of the sections of /dashboard.json, in the order of the DASHBOARD_ bits
+__code char * __code dashboard_sections[] = {"status", "mtu", "eee", "mirror", "lag", 0};
 
-		STAT_GET(STAT_COUNTER_TX_PKTS, i);
-		slen += strtox(outbuf + slen, ",\"txG\":\"0x");
-		reg_to_html(RTL837X_STAT_V_HIGH);
-		reg_to_html(RTL837X_STAT_V_LOW);
+/*
+ * Parses a comma separated list of section names, e.g. status,mtu,eee
+ * Returns the bitmask of the sections selected
+ */
+uint8_t dashboard_select(__xdata uint8_t *p)
+{
+	uint8_t sel = 0;
+
+	while (p && *p && *p != '&') {
+		for (uint8_t s = 0; dashboard_sections[s]; s++) {
+			register uint8_t i = 0;
+			while (dashboard_sections[s][i] && dashboard_sections[s][i] == p[i])
+				i++;
+			if (!dashboard_sections[s][i] && (p[i] == ',' || p[i] == '&' || !p[i]))
+				sel |= 1 << s;
+		}
+		while (*p && *p != ',' && *p != '&')
+			p++;
+		if (*p == ',')
+			p++;
+	}
+	return sel;
+}
 
-		slen += strtox(outbuf + slen, "\",\"txB\":\"0x");
-		STAT_GET(STAT_COUNTER_ERR_PKTS, i);
-		reg_to_html(RTL837X_STAT_V_LOW);	// 32 bit Tx Packet errors
 
-		slen += strtox(outbuf + slen, "\",\"rxG\":\"0x");
-		STAT_GET(STAT_COUNTER_RX_PKTS, i);
-		reg_to_html(RTL837X_STAT_V_HIGH);
-		reg_to_html(RTL837X_STAT_V_LOW);
+/*
+ * Aggregated status for the web-interface: /dashboard.json?s=status,mtu,eee,mirror,lag
+ * Without a selection only the port status is sent. With since=<gen> the port
+ * status is sent as changes after that generation, as by /status.json
+ */
+void send_dashboard(void)
+{
+	uint8_t sel = dashboard_select(query_get("s"));
 
-		slen += strtox(outbuf + slen, "\",\"rxB\":\"0x");
-		STAT_GET(STAT_COUNTER_ERR_PKTS, i);
-		reg_to_html(RTL837X_STAT_V_HIGH);	// 32bit RX packet errors
-		slen += strtox(outbuf + slen, "\"}");
-		if (i < machine.max_port)
+	dbg_string("send_dashboard called: "); dbg_byte(sel); dbg_char('\n');
+	if (!sel)
+		sel = DASHBOARD_STATUS;
+	if ((sel & DASHBOARD_STATUS) && !query_short("since"))
+		sel |= DASHBOARD_DELTA;
+	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
+	char_to_html('{');
+	dashboard_to_html(sel, short_parsed);
+}
+
+
+// Names of the STATE_ sections in the order of their bits
+__code char * __code state_sections[] = {"link", "sfp", "config", "l2"};
+
+/*
+ * Returns the STATE_ sections changed after generation since
+ */
+uint8_t state_changed_since(uint16_t since)
+{
+	uint8_t changed = 0;
+
+	for (uint8_t i = 0; i < STATE_SECTIONS; i++) {
+		if (((int16_t)(state_section_gen[i] - since)) > 0)
+			changed |= 1 << i;
+	}
+	return changed;
+}
+
+
+/*
+ * Writes the response of /events.json: the current state generation, the
+ * names of the changed state sections and those of the dashboard sections
+ * in sel that are affected by the changes
+ */
+void events_to_html(uint8_t changed, uint8_t sel)
+{
+	uint8_t first = 1;
+
+	if (!(changed & (STATE_LINK | STATE_SFP | STATE_CONFIG)))
+		sel &= ~DASHBOARD_STATUS;
+	if (!(changed & STATE_CONFIG))
+		sel &= DASHBOARD_STATUS;
+
+	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
+	slen += strtox(outbuf + slen, "{\"gen\":");
+	short_to_html(state_gen);
+	slen += strtox(outbuf + slen, ",\"changed\":[");
+	for (uint8_t i = 0; i < STATE_SECTIONS; i++) {
+		if (!(changed & (1 << i)))
+			continue;
+		if (!first)
 			char_to_html(',');
-		else
-			char_to_html(']');
+		first = 0;
+		char_to_html('"');
+		slen += strtox(outbuf + slen, state_sections[i]);
+		char_to_html('"');
 	}
+	slen += strtox(outbuf + slen, "],");
+	dashboard_to_html(sel, 0);
 }
 
 
-void send_config(void)
+/*
+ * Change notification for the web-interface:
+ * /events.json?since=<gen>&t=<seconds>&s=status,mtu,eee,mirror,lag
+ * Answers immediately if the state changed after generation since, otherwise
+ * the request waits for a change for up to t seconds. The response carries
+ * the dashboard sections of s affected by the change. Without since all
+ * selected sections are sent right away
+ */
+void send_events(void)
 {
-	dbg_string("send_config called\n");
-	__xdata uint32_t pos = CONFIG_START; // 70000 , 6c000 / 0xc000 = 9
+	uint8_t sel = dashboard_select(query_get("s"));
+	uint8_t timeout = EVENTS_TIMEOUT;
 
-	extern __xdata uint16_t len_left = CONFIG_LEN;
-	slen = strtox(outbuf, HTTP_RESPONCE_TXT);
-	while (read_flash((CONFIG_START-CODE0_SIZE) / CODE_BANK_SIZE + 1,
-		(__code uint8_t *) (((CONFIG_START + len_left - CODE0_SIZE) % CODE_BANK_SIZE) + CODE0_SIZE + len_left)) == 0xff) {
-		dbg_short(len_left);
-		len_left--;
+	if (query_short("since")) {
+		events_to_html(0xff, sel);
+		return;
+	}
+	dbg_string("send_events called: "); dbg_short(short_parsed); dbg_char('\n');
+	if (short_parsed != state_gen) {
+		events_to_html(state_changed_since(short_parsed), sel);
+		return;
 	}
-	len_left++;
+	if (!query_short("t"))
+		timeout = short_parsed > 0xff ? 0xff : short_parsed;
+	httpd_wait(state_gen, sel, timeout);
+}
+
+
+__code char * __code upload_states[] = {"idle", "running", "done", "failed"};
 
+/*
+ * Progress of the current or last firmware or configuration upload. The
+ * length is that of the whole request body, rate is in KB/s
+ */
+void send_upload(void)
+{
+	__xdata uint32_t rate = 0;
+
+	if (up_time)
+		rate = up_received * SYS_TICK_HZ / up_time / 1024;
+	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
+	slen += strtox(outbuf + slen, "{\"state\":\"");
+	slen += strtox(outbuf + slen, upload_states[up_state]);
+	slen += strtox(outbuf + slen, "\",\"length\":");
+	long_to_html(up_length);
+	slen += strtox(outbuf + slen, ",\"received\":");
+	long_to_html(up_received);
+	slen += strtox(outbuf + slen, ",\"written\":");
+	long_to_html(up_written);
+	slen += strtox(outbuf + slen, ",\"rate\":");
+	long_to_html(rate);
+	char_to_html('}');
+}
+
+
+void send_config(void)
+{
+	__xdata uint16_t len_left = cfg_len;
+
+	dbg_string("send_config called\n");
+	slen = strtox(outbuf, HTTP_RESPONCE_TXT);
 	if (len_left > (TCP_OUTBUF_SIZE - slen)) {
 		cont_len = len_left - (TCP_OUTBUF_SIZE - slen);
 		len_left = TCP_OUTBUF_SIZE - slen;
-		cont_addr = len_left;
+		cont_addr = cfg_addr + len_left;
+		cont_cached = 1;
 	}
-	flash_region.addr = CONFIG_START;
+	flash_region.addr = cfg_addr;
 	flash_region.len = len_left;
-	flash_read_bulk(outbuf + slen);
+	if (len_left)
+		flash_read_bulk(outbuf + slen);
 	slen += len_left;
 }
 
@@ -702,3 +1149,87 @@ void send_cmd_log(void)
 		p = (p + 1) & CMD_HISTORY_MASK;
 	}
 }
+
+
+/*
+ * Sends the records of the log as text, one per line starting with its
+ * sequence number. With since, only the records from that number on are sent.
+ * The response ends once outbuf is full, the rest can be requested with since
+ */
+void send_log(void)
+{
+	__xdata uint16_t seq = log_seq - log_count;
+
+	slen = strtox(outbuf, HTTP_RESPONCE_TXT);
+	if (!query_short("since") && (uint16_t)(short_parsed - seq) <= log_count)
+		seq = short_parsed;
+	for (; seq != log_seq && slen < TCP_OUTBUF_SIZE - LOG_LINE_SIZE - 1; seq++) {
+		slen += log_format(seq, (__xdata char *)outbuf + slen);
+		outbuf[slen++] = '\n';
+	}
+}
+
+
+// Run counts and times in microseconds of the tasks of idle() and the CPU load
+void send_tasks(void)
+{
+	slen = strtox(outbuf, HTTP_RESPONCE_JSON);
+	slen += strtox(outbuf + slen, "{\"tasks\":[");
+	for (uint8_t i = 0; i < N_TASKS; i++) {
+		__xdata struct task_stat *s = &task_stat[i];
+		if (i)
+			char_to_html(',');
+		slen += strtox(outbuf + slen, "{\"name\":\"");
+		slen += strtox(outbuf + slen, tasks[i].name);
+		slen += strtox(outbuf + slen, "\",\"period\":");
+		itoa_html(tasks[i].period);
+		slen += strtox(outbuf + slen, ",\"prio\":");
+		itoa_html(tasks[i].prio);
+		slen += strtox(outbuf + slen, ",\"budget_us\":");
+		long_to_html(sched_us(tasks[i].budget));
+		slen += strtox(outbuf + slen, ",\"runs\":");
+		long_to_html(s->runs);
+		slen += strtox(outbuf + slen, ",\"avg_us\":");
+		long_to_html(s->runs ? sched_us(s->total / s->runs) : 0);
+		slen += strtox(outbuf + slen, ",\"max_us\":");
+		long_to_html(sched_us(s->max));
+		slen += strtox(outbuf + slen, ",\"over\":");
+		short_to_html(s->over);
+		slen += strtox(outbuf + slen, ",\"deferred\":");
+		short_to_html(s->deferred);
+		char_to_html('}');
+	}
+	// Busy percentages, the longest passes of idle() in microseconds
+	slen += strtox(outbuf + slen, "],\"cpu\":{\"load_1s\":");
+	itoa_html(cpu_load_avg(1));
+	slen += strtox(outbuf + slen, ",\"load_10s\":");
+	itoa_html(cpu_load_avg(10));
+	slen += strtox(outbuf + slen, ",\"load_60s\":");
+	itoa_html(cpu_load_avg(60));
+	slen += strtox(outbuf + slen, ",\"latency_us\":");
+	long_to_html(sched_us(cpu_latency));
+	slen += strtox(outbuf + slen, ",\"latency_max_us\":");
+	long_to_html(sched_us(cpu_latency_max));
+	slen += strtox(outbuf + slen, ",\"missed_ticks\":");
+	long_to_html(cpu_missed);
+	// Time-outs of the busy waits for the hardware by site
+	slen += strtox(outbuf + slen, "},\"waits\":{");
+	for (uint8_t i = 0; i < WAIT_SITES; i++) {
+		if (i)
+			char_to_html(',');
+		char_to_html('"');
+		slen += strtox(outbuf + slen, wait_sites[i]);
+		slen += strtox(outbuf + slen, "\":");
+		short_to_html(wait_timeouts[i]);
+	}
+	// Use of the arena in bytes, blocks refused for lack of room
+	slen += strtox(outbuf + slen, "},\"arena\":{\"size\":");
+	short_to_html(ARENA_SIZE);
+	slen += strtox(outbuf + slen, ",\"used\":");
+	short_to_html(arena_used);
+	slen += strtox(outbuf + slen, ",\"high\":");
+	short_to_html(arena_high);
+	slen += strtox(outbuf + slen, ",\"refused\":");
+	short_to_html(arena_fails);
+	slen += strtox(outbuf + slen, "}}");
+}
@@ -1,18 +1,55 @@
 #ifndef __PAGE_IMPL_H__
 #define __PAGE_IMPL_H__
 
-void send_counters(char port);
+/* Handlers of the dynamic endpoints listed in routes, arguments are
+   read from the query string of the request */
+void send_counters(void);
 void send_status(void);
-void send_vlan(uint16_t vlan);
+void send_vlan(void);
 void send_basic_info(void);
 void send_eee(void);
-void send_l2(uint16_t idx);
-void l2_delete(uint16_t idx);
+void send_l2(void);
+void l2_delete(void);
 void send_mirror(void);
 void send_mtu(void);
 void send_config(void);
 void send_cmd_log(void);
+void send_log(void);
 void send_lag(void);
+void send_dashboard(void);
+void send_events(void);
+void send_upload(void);
+void send_tasks(void);
+void dashboard_to_html(uint8_t sel, uint16_t since);
+void events_to_html(uint8_t changed, uint8_t sel);
+uint8_t state_changed_since(uint16_t since);
+
+// Sections of /dashboard.json
+#define DASHBOARD_STATUS	0x01
+#define DASHBOARD_MTU		0x02
+#define DASHBOARD_EEE		0x04
+#define DASHBOARD_MIRROR	0x08
+#define DASHBOARD_LAG		0x10
+#define DASHBOARD_PORTS		(DASHBOARD_STATUS | DASHBOARD_MTU | DASHBOARD_EEE)
+// Port status only as changes after a generation, not a section of its own
+#define DASHBOARD_DELTA		0x80
+
+// Upper bounds of the JSON of a port and of the mirror or LAG section
+#define DASHBOARD_PORT_MAX	420
+#define DASHBOARD_SECTION_MAX	300
+
+// Default time-out of a waiting /events.json request in seconds
+#define EVENTS_TIMEOUT		20
+
+// States of an upload in /upload.json
+#define UPLOAD_IDLE		0
+#define UPLOAD_RUNNING		1
+#define UPLOAD_DONE		2
+#define UPLOAD_FAILED		3
+
+// Query string access, provided by httpd.c
+__xdata uint8_t *query_get(__code char *name);
+uint8_t query_short(__code char *name);
 
 /*  Convert only the lower nibble to ascii HEX char.
     For convenience the upper nibble is masked out.
@@ -0,0 +1,249 @@
+/*
+ * Leveled logging into a ring of binary records in XMEM
+ *
+ * A message is recorded with the tick, its module and level, the number
+ * of its text and two arguments. Messages above the level of their module
+ * are suppressed by LOG() before any call is made. The text is only
+ * formatted when the records are read through the log command or /log,
+ * so that logging does not cost serial line time in the packet path.
+ */
+
+#include <stdint.h>
+#include "rtl837x_common.h"
+#include "log.h"
+
+#pragma codeseg BANK2
+#pragma constseg BANK2
+
+extern volatile __xdata uint32_t ticks;
+extern __code uint8_t * __code hex;
+
+__code char * __code log_modules[LOG_MODULES] = {
+	"stp", "igmp", "dhcp", "httpd", "sfp", "phy", "hw"
+};
+
+__code char * __code log_levels[LOG_LEVELS] = {
+	"off", "err", "warn", "info", "debug"
+};
+
+__code char * __code log_msgs[] = {
+	"BPDU dsap/ssap %x ctrl %b",			// LOG_MSG_STP_BPDU
+	"RSTP BPDU received",				// LOG_MSG_STP_RSTP
+	"New root bridge, priority %b",			// LOG_MSG_STP_ROOT
+	"Hello on port %d",				// LOG_MSG_STP_HELLO
+	"IGMP packet type %b",				// LOG_MSG_IGMP_TYPE
+	"Membership report, record type %b",		// LOG_MSG_IGMP_REPORT
+	"Entry found, portmask %x index %x",		// LOG_MSG_IGMP_FOUND
+	"Entry already deleted",			// LOG_MSG_IGMP_GONE
+	"Entry %x deleted",				// LOG_MSG_IGMP_DELETED
+	"Updating entry, portmask %x",			// LOG_MSG_IGMP_UPDATE
+	"Sending discover",				// LOG_MSG_DHCP_DISCOVER
+	"Sending request",				// LOG_MSG_DHCP_REQUEST
+	"Unknown option %d",				// LOG_MSG_DHCP_OPTION
+	"Offer received for %i",			// LOG_MSG_DHCP_OFFER
+	"ACK, our IP is %i",				// LOG_MSG_DHCP_ACK
+	"Netmask %i",					// LOG_MSG_DHCP_NETMASK
+	"Gateway %i",					// LOG_MSG_DHCP_GATEWAY
+	"Lease time %d s",				// LOG_MSG_DHCP_LEASE
+	"Cannot set up socket",				// LOG_MSG_DHCP_SOCKET
+	"Client started",				// LOG_MSG_DHCP_START
+	"Client stopped",				// LOG_MSG_DHCP_STOP
+	"Connection closed",				// LOG_MSG_DHCP_CLOSED
+	"Unknown state %b",				// LOG_MSG_DHCP_STATE
+	"Firmware upload started",			// LOG_MSG_HTTPD_UPLOAD
+	"Flash verification failed after %d bytes",	// LOG_MSG_HTTPD_VERIFY
+	"Saving configuration failed",			// LOG_MSG_HTTPD_SAVE
+	"Compiling configuration failed",		// LOG_MSG_HTTPD_COMPILE
+	"Module inserted in slot %d, rate/encoding %x",	// LOG_MSG_SFP_INSERTED
+	"Module removed from slot %d",			// LOG_MSG_SFP_REMOVED
+	"Slot %d RX OK",				// LOG_MSG_SFP_RX_OK
+	"Slot %d RX loss of signal",			// LOG_MSG_SFP_RX_LOS
+	"Links %l, ports 8/9 %b",			// LOG_MSG_PHY_LINK
+	"Wait for %x timed out, site %d",		// LOG_MSG_HW_TIMEOUT
+};
+
+__xdata struct log_record log_ring[LOG_RECORDS];
+__xdata uint8_t log_level[LOG_MODULES];
+__xdata uint16_t log_seq;	// Sequence number of the next record
+__xdata uint8_t log_count;	// Records kept in the ring
+
+// Line being formatted by log_format()
+__xdata char *log_line;
+__xdata uint8_t log_len;
+
+
+void log_clear(void) __banked
+{
+	log_seq = 0;
+	log_count = 0;
+}
+
+
+void log_init(void) __banked
+{
+	for (uint8_t i = 0; i < LOG_MODULES; i++)
+		log_level[i] = LOG_INFO;
+	log_clear();
+}
+
+
+void log_add(uint8_t level, uint8_t msg, uint32_t a, uint16_t b) __banked
+{
+	__xdata struct log_record *r = &log_ring[log_seq & (LOG_RECORDS - 1)];
+
+	r->tick = ticks;
+	r->level = level;
+	r->msg = msg;
+	r->a = a;
+	r->b = b;
+	log_seq++;
+	if (log_count < LOG_RECORDS)
+		log_count++;
+}
+
+
+static void log_char(char c)
+{
+	if (log_len < LOG_LINE_SIZE - 1)
+		log_line[log_len++] = c;
+}
+
+
+static void log_string(__code char *s)
+{
+	while (*s)
+		log_char(*s++);
+}
+
+
+static void log_hex(uint32_t v, uint8_t digits)
+{
+	while (digits--)
+		log_char(hex[(v >> (digits << 2)) & 0xf]);
+}
+
+
+static void log_dec(uint32_t v, uint8_t width)
+{
+	__xdata char d[10];
+	uint8_t n = 0;
+
+	do {
+		d[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (width-- > n)
+		log_char(' ');
+	while (n)
+		log_char(d[--n]);
+}
+
+
+/*
+ * Formats the record with sequence number seq into line
+ * Returns the length of the line, 0 if the record is no longer kept
+ */
+uint8_t log_format(uint16_t seq, __xdata char *line) __banked
+{
+	__xdata struct log_record *r;
+	__code char *s;
+	uint32_t v;
+	uint8_t arg = 0;
+
+	if ((uint16_t)(log_seq - seq) > log_count || seq == log_seq)
+		return 0;
+	r = &log_ring[seq & (LOG_RECORDS - 1)];
+	log_line = line;
+	log_len = 0;
+
+	log_dec(seq, 5);
+	log_dec(r->tick / SYS_TICK_HZ, 6);
+	log_char('.');
+	v = (r->tick % SYS_TICK_HZ) * (1000 / SYS_TICK_HZ);
+	log_char('0' + v / 100);
+	log_char('0' + (v / 10) % 10);
+	log_char('0' + v % 10);
+	log_char(' ');
+	log_string(log_modules[r->level >> 4]);
+	log_char(' ');
+	log_string(log_levels[r->level & 0xf]);
+	log_string(": ");
+
+	for (s = log_msgs[r->msg]; *s; s++) {
+		if (*s != '%' || !s[1]) {
+			log_char(*s);
+			continue;
+		}
+		v = arg++ ? r->b : r->a;
+		switch (*++s) {
+		case 'b':
+			log_hex(v, 2);
+			break;
+		case 'x':
+			log_hex(v, 4);
+			break;
+		case 'l':
+			log_hex(v, 8);
+			break;
+		case 'd':
+			log_dec(v, 0);
+			break;
+		case 'i':
+			for (int8_t i = 24; i >= 0; i -= 8) {
+				log_dec((v >> i) & 0xff, 0);
+				if (i)
+					log_char('.');
+			}
+			break;
+		default:
+			log_char(*s);
+		}
+	}
+	line[log_len] = 0;
+	return log_len;
+}
+
+
+// Prints the records kept in the ring, oldest first
+void log_print(void) __banked
+{
+	__xdata char line[LOG_LINE_SIZE];
+
+	for (uint16_t seq = log_seq - log_count; seq != log_seq; seq++) {
+		if (log_format(seq, line)) {
+			print_string_x(line);
+			write_char('\n');
+		}
+	}
+}
+
+
+void log_print_levels(void) __banked
+{
+	for (uint8_t i = 0; i < LOG_MODULES; i++) {
+		print_string(log_modules[i]);
+		print_string(": ");
+		print_string(log_levels[log_level[i]]);
+		write_char('\n');
+	}
+}
+
+
+/*
+ * Looks up the word at w among the names of the levels or of the modules
+ * Returns the index of the name, 0xff if not found
+ */
+uint8_t log_lookup(__xdata char *w, uint8_t levels) __banked
+{
+	uint8_t n = levels ? LOG_LEVELS : LOG_MODULES;
+
+	for (uint8_t i = 0; i < n; i++) {
+		__code char *s = levels ? log_levels[i] : log_modules[i];
+		uint8_t j = 0;
+		while (s[j] && s[j] == w[j])
+			j++;
+		if (!s[j] && (w[j] == ' ' || !w[j]))
+			return i;
+	}
+	return 0xff;
+}
@@ -0,0 +1,98 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdint.h>
+
+// Modules with a log level of their own
+#define LOG_STP		0
+#define LOG_IGMP	1
+#define LOG_DHCP	2
+#define LOG_HTTPD	3
+#define LOG_SFP		4
+#define LOG_PHY		5
+#define LOG_HW		6
+#define LOG_MODULES	7
+
+// A message is recorded if its level is at most the level of its module
+#define LOG_OFF		0
+#define LOG_ERR		1
+#define LOG_WARN	2
+#define LOG_INFO	3
+#define LOG_DEBUG	4
+#define LOG_LEVELS	5
+
+// Records kept in the ring, must be 2^n
+#define LOG_RECORDS	128
+// Longest line produced by log_format()
+#define LOG_LINE_SIZE	80
+
+/*
+ * Messages, their text is in log_msgs[] of log.c. The text may refer
+ * to the two arguments of the record in turn: %b byte in hex, %x short
+ * in hex, %l long in hex, %d decimal and %i an IP address from LOG_IP()
+ */
+#define LOG_MSG_STP_BPDU	0
+#define LOG_MSG_STP_RSTP	1
+#define LOG_MSG_STP_ROOT	2
+#define LOG_MSG_STP_HELLO	3
+#define LOG_MSG_IGMP_TYPE	4
+#define LOG_MSG_IGMP_REPORT	5
+#define LOG_MSG_IGMP_FOUND	6
+#define LOG_MSG_IGMP_GONE	7
+#define LOG_MSG_IGMP_DELETED	8
+#define LOG_MSG_IGMP_UPDATE	9
+#define LOG_MSG_DHCP_DISCOVER	10
+#define LOG_MSG_DHCP_REQUEST	11
+#define LOG_MSG_DHCP_OPTION	12
+#define LOG_MSG_DHCP_OFFER	13
+#define LOG_MSG_DHCP_ACK	14
+#define LOG_MSG_DHCP_NETMASK	15
+#define LOG_MSG_DHCP_GATEWAY	16
+#define LOG_MSG_DHCP_LEASE	17
+#define LOG_MSG_DHCP_SOCKET	18
+#define LOG_MSG_DHCP_START	19
+#define LOG_MSG_DHCP_STOP	20
+#define LOG_MSG_DHCP_CLOSED	21
+#define LOG_MSG_DHCP_STATE	22
+#define LOG_MSG_HTTPD_UPLOAD	23
+#define LOG_MSG_HTTPD_VERIFY	24
+#define LOG_MSG_HTTPD_SAVE	25
+#define LOG_MSG_HTTPD_COMPILE	26
+#define LOG_MSG_SFP_INSERTED	27
+#define LOG_MSG_SFP_REMOVED	28
+#define LOG_MSG_SFP_RX_OK	29
+#define LOG_MSG_SFP_RX_LOS	30
+#define LOG_MSG_PHY_LINK	31
+#define LOG_MSG_HW_TIMEOUT	32
+
+// A record of the ring, the text is only formatted when it is read
+struct log_record {
+	uint32_t tick;
+	uint8_t level;		// Module in bits 4-7, level in bits 0-3
+	uint8_t msg;
+	uint32_t a;
+	uint16_t b;
+};
+
+extern __xdata uint8_t log_level[LOG_MODULES];
+extern __xdata uint16_t log_seq;
+extern __xdata uint8_t log_count;
+
+// Packs an IP address for %i
+#define LOG_IP(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint16_t)(p)[2] << 8) | (p)[3])
+
+// Suppressed messages only cost the comparison with the level of the module
+#define LOG(m, l, msg, a, b) do { \
+	if ((l) <= log_level[m]) \
+		log_add(((m) << 4) | (l), msg, a, b); \
+} while (0)
+
+void log_init(void) __banked;
+void log_clear(void) __banked;
+void log_add(uint8_t level, uint8_t msg, uint32_t a, uint16_t b) __banked;
+uint8_t log_format(uint16_t seq, __xdata char *line) __banked;
+void log_print(void) __banked;
+void log_print_levels(void) __banked;
+uint8_t log_lookup(__xdata char *w, uint8_t levels) __banked;
+
+#endif
@@ -28,6 +28,10 @@
 // Must be 2^x and <= 128
 #define SBUF_SIZE 128
 
+// The ring of characters waiting for the serial transmitter
+// Must be 2^x and <= 256
+#define TBUF_SIZE 256
+
 // Size of the TCP Output buffer
 #define TCP_OUTBUF_SIZE 2500
 
@@ -64,13 +68,104 @@ struct vlan_tag {
 
 #define CONFIG_START 0x70000
 #define CONFIG_LEN 0x1000
+// Smallest unit of flash that can be erased
+#define FLASH_SECTOR_SIZE 0x1000
 #define CODE0_SIZE 0x4000
 #define CODE_BANK_SIZE 0xc000
 
+// Sections of the switch state tracked by state_changed(), the web-interface
+// is notified of changes through /events.json
+#define STATE_LINK	0x01
+#define STATE_SFP	0x02
+#define STATE_CONFIG	0x04
+#define STATE_L2	0x08
+#define STATE_SECTIONS	4
+
+// Number of boot phases recorded by boot_phase() for /information.json
+#define BOOT_PHASES_MAX	16
+
+// Tasks run by idle(), see tasks[] in rtlplayground.c
+#define N_TASKS		9
+// Tasks of the network path, they also run in a pass that is late
+#define SCHED_PRIO_NET	1
+
+struct task {
+	__code char *name;
+	void (*run)(void);
+	uint8_t period;		// Ticks between runs, 0 runs the task in every pass
+	uint8_t prio;
+	uint32_t budget;	// Timer 2 counts a run should take at most, 0 for none
+};
+
+/*
+ * Timer of the timer service. When it expires, fired is set and fn is
+ * called from idle(). fn must be in HOME, timers of banked code leave it
+ * 0 and check fired
+ */
+struct timer {
+	struct timer *next;
+	struct timer **pprev;	// Link pointing to this timer, 0 if not armed
+	uint32_t expires;	// Tick
+	void (*fn)(void);
+	uint8_t fired;
+};
+
+// Slots of the timing wheel, must be 2^n
+#define TIMER_SLOTS	128
+
+// Seconds of busy percentages kept by task_cpu() for cpu_load_avg()
+#define CPU_LOAD_SECONDS	60
+
+// Accounting of a task, times are in timer 2 counts, see sched_us()
+struct task_stat {
+	uint32_t due;		// Tick of the next run
+	uint32_t runs;
+	uint32_t total;
+	uint32_t max;
+	uint16_t over;		// Runs that took longer than the budget
+	uint16_t deferred;	// Runs put off because the pass was late
+};
+
+/*
+ * Sites of busy waits for the hardware. A wait gives up after its budget,
+ * counts the time-out in wait_timeouts[] of its site and reports it to
+ * its caller, see reg_wait()
+ */
+#define WAIT_SFR	0	// Register, SerDes and SMI commands
+#define WAIT_NIC	1	// NIC transfers
+#define WAIT_I2C	2	// SFP EEPROM reads
+#define WAIT_TBL	3	// VLAN, L2 and IGMP table operations
+#define WAIT_STAT	4	// Port counters
+#define WAIT_L2_FLUSH	5
+#define WAIT_FLASH	6	// Flash controller transfers
+#define WAIT_FLASH_BUSY	7	// Flash programming and erasing
+#define WAIT_PHY	8	// Internal commands of the RTL8224
+#define WAIT_RESET	9	// NIC reset
+#define WAIT_SITES	10
+
+// Polls of an SFR before a wait gives up, a command takes a few
+#define WAIT_SPINS	0x4000
+// Reads of a register by reg_wait() before it gives up while interrupts are off
+#define WAIT_POLLS	0x800
+// Reads of the flash status, well beyond the 400ms a sector erase may take
+#define WAIT_FLASH_POLLS	0x40000
+
+/*
+ * The timer 2 interrupt resets the switch if the main loop has not made a
+ * pass for this long. Comment out to disable the watchdog
+ */
+#define WATCHDOG_SECONDS	10
+
 // Constants for the circular command buffer, the size must be 2^n
 #define CMD_HISTORY_SIZE 0x400
 #define CMD_HISTORY_MASK (CMD_HISTORY_SIZE - 1)
 
+// Output of a command from /cmd kept for the HTTP response
+#define CMD_OUT_SIZE 0x400
+
+// Commands staged by an open transaction
+#define TXN_SIZE 0x400
+
 /**
  * Representation of a 48-bit Ethernet address.
  */
@@ -125,5 +220,16 @@ void read_reg_timer(uint32_t * tmr);
 void sfp_print_info(uint8_t sfp);
 bool gpio_pin_test(uint8_t pin);
 void set_sys_led_state(uint8_t state);
+void state_changed(uint8_t sections);
+void boot_phase(__code char *name);
+uint32_t ticks_now(void);
+uint32_t sched_us(uint32_t counts);
+uint8_t cpu_load_avg(uint8_t seconds);
+void timer_init(void);
+void timer_arm(__xdata struct timer *t, uint32_t delay);
+void timer_cancel(__xdata struct timer *t);
+uint32_t timer_left(__xdata struct timer *t);
+void wait_timeout(uint8_t site, uint16_t reg);
+uint8_t reg_wait(uint16_t reg, uint8_t b, uint8_t mask, uint8_t site);
 
 #endif
@@ -6,10 +6,45 @@
 #include <stdint.h>
 #include "rtl837x_common.h"
 #include "rtl837x_sfr.h"
+#include "rtl837x_flash.h"
 
 __xdata uint8_t dio_enabled;
 __xdata struct flash_region_t flash_region;
 
+// Bytes given to flash_write_bytes() and the ticks it took, for the write rate
+__xdata uint32_t flash_write_count;
+__xdata uint32_t flash_write_ticks;
+
+/*
+ * A time-out of the controller or the flash, as the site for wait_timeout()
+ * and the block of flash_region.addr. WAIT_SITES if there is none
+ */
+__xdata uint8_t flash_timeout_site;
+__xdata uint16_t flash_timeout_reg;
+
+// Read back buffer of flash_write_verify(), a multiple of 4 bytes
+__xdata uint8_t verify_buf[32];
+
+/*
+ * Cache of blocks of flash read by flash_read_bulk(), the least recently
+ * used line is replaced. A tag is the flash address of the block >> 8.
+ * Its users are the configuration store and /config, which read a record
+ * in small steps. Reading the journal at boot, 4 lines already hit about
+ * as often as 32 lines
+ */
+#define FLASH_CACHE_LINES	4
+#define FLASH_CACHE_INVALID	0xffff
+__xdata uint8_t flash_cache[FLASH_CACHE_LINES][FLASH_CACHE_LINE_SIZE];
+__xdata uint16_t flash_cache_tag[FLASH_CACHE_LINES];
+__xdata uint8_t flash_cache_used[FLASH_CACHE_LINES];
+__xdata uint8_t flash_cache_clock;
+__xdata uint32_t flash_cache_hits;
+__xdata uint32_t flash_cache_misses;
+
+extern volatile __xdata uint32_t ticks;
+extern __xdata uint16_t crc_value;
+void crc16_block(__xdata uint8_t *v, uint16_t len);
+
 
 // For the flash commands, see e.g. Windbond W25Q32JV datasheet
 #define CMD_WRITE_STATUS	0x01
@@ -25,22 +60,60 @@ __xdata struct flash_region_t flash_region;
 #define CMD_READ_JEDEC_ID	0x9f
 #define CMD_FREAD_DIO		0xbb
 
+/*
+ * Records a time-out for flash_configure_mmio(). Logging it now would run
+ * banked code, which cannot be fetched while the flash is busy
+ */
+static void flash_timeout(uint8_t site)
+{
+	flash_timeout_site = site;
+	flash_timeout_reg = flash_region.addr >> 8;
+}
+
+
+// Waits for the controller to finish a transfer, returns 1 on time-out
+static uint8_t flash_exec_wait(void)
+{
+	uint16_t n = WAIT_SPINS;
+
+	do {
+		if (!SFR_FLASH_EXEC_BUSY)
+			return 0;
+	} while (--n);
+	flash_timeout(WAIT_FLASH);
+	return 1;
+}
+
+
 /*
  * Configure Memory Managed IO
+ * Ends every operation on the flash. A time-out recorded during the operation
+ * is reported once the flash is idle and MMIO is set up again, otherwise it
+ * is kept for the next operation
  */
 void flash_configure_mmio(void)
 {
+	uint8_t site = flash_timeout_site;
+
+	// A status of FLASH_STATUS_TIMEOUT also has the busy bit set
+	if (site != WAIT_SITES && (flash_read_status() & 0x1))
+		site = WAIT_SITES;
+
 	// Set configuration for MMIO access by controller
 	if (dio_enabled) {
 		SFR_FLASH_MODEB = 0x18;
 		SFR_FLASH_CMD_R = CMD_FREAD_DIO;	// By default we read with Dual speed
 		SFR_FLASH_DUMMYCYCLES = 4;
-		return;
+	} else {
+		SFR_FLASH_MODEB = 0x0;
+		SFR_FLASH_CMD_R = CMD_FREAD; // Default is Single IO
+		SFR_FLASH_DUMMYCYCLES = 8;
 	}
 
-	SFR_FLASH_MODEB = 0x0;
-	SFR_FLASH_CMD_R = CMD_FREAD; // Default is Single IO
-	SFR_FLASH_DUMMYCYCLES = 8;
+	if (site != WAIT_SITES) {
+		flash_timeout_site = WAIT_SITES;
+		wait_timeout(site, flash_timeout_reg);
+	}
 }
 
 
@@ -53,6 +126,7 @@ void flash_configure_mmio(void)
  */
 void flash_init(uint8_t enable_dio)
 {
+	flash_timeout_site = WAIT_SITES;
 	if (enable_dio) {
 		SFR_FLASH_CONFIG = 9;  // There may be a chip-select in here
 		SFR_FLASH_CONF_RCMD = CMD_FREAD_DIO;
@@ -64,7 +138,7 @@ void flash_init(uint8_t enable_dio)
 		SFR_FLASH_CONF_DIV = 8;
 	}
 	// Test Controller Busy
-	while(SFR_FLASH_EXEC_BUSY);
+	flash_exec_wait();
 
 	// Write 0 to status register
 	SFR_FLASH_DUMMYCYCLES = 8;
@@ -73,17 +147,26 @@ void flash_init(uint8_t enable_dio)
 	SFR_FLASH_CMD = CMD_WRITE_STATUS;
 	SFR_FLASH_DATA0 = 0;
 	SFR_FLASH_EXEC_GO = 1;
-	while(SFR_FLASH_EXEC_BUSY);
+	flash_exec_wait();
 
 	dio_enabled = enable_dio;
 	flash_configure_mmio();
+
+	for (uint8_t l = 0; l < FLASH_CACHE_LINES; l++)
+		flash_cache_tag[l] = FLASH_CACHE_INVALID;
+	flash_cache_hits = flash_cache_misses = 0;
 }
 
 
+/*
+ * Returns the status register of the flash, FLASH_STATUS_TIMEOUT if the
+ * controller did not complete the read
+ */
 uint8_t flash_read_status(void)
 {
 	// Test Controller Busy (we might call this directly after executing a command)
-	while(SFR_FLASH_EXEC_BUSY);
+	if (flash_exec_wait())
+		return FLASH_STATUS_TIMEOUT;
 
 	// setup status read command
 	SFR_FLASH_TCONF = 0x11;
@@ -91,15 +174,37 @@ uint8_t flash_read_status(void)
 
 	// execute and wait for controller done
 	SFR_FLASH_EXEC_GO = 1;
-	while(SFR_FLASH_EXEC_BUSY);
+	if (flash_exec_wait())
+		return FLASH_STATUS_TIMEOUT;
 
 	return SFR_FLASH_DATA0;
 }
 
 
+/*
+ * Waits until the status bits of mask are clear, or set if set is 1
+ * Returns 1 if the flash or the controller timed out
+ */
+static uint8_t flash_status_wait(uint8_t mask, uint8_t set)
+{
+	uint32_t n = WAIT_FLASH_POLLS;
+	uint8_t status;
+
+	do {
+		status = flash_read_status();
+		if (status == FLASH_STATUS_TIMEOUT)
+			return 1;
+		if (((status & mask) != 0) == set)
+			return 0;
+	} while (--n);
+	flash_timeout(WAIT_FLASH_BUSY);
+	return 1;
+}
+
+
 void flash_read_uid(void)
 {
-	while (flash_read_status() & 0x1);
+	flash_status_wait(0x1, 0);
 
 	// Set slow read mode for UID
 	SFR_FLASH_MODEB = 0x0;
@@ -113,7 +218,7 @@ void flash_read_uid(void)
 	SFR_FLASH_ADDR0 = 0;
 
 	SFR_FLASH_EXEC_GO = 1;
-	while(SFR_FLASH_EXEC_BUSY);
+	flash_exec_wait();
 
 	print_byte(SFR_FLASH_DATA0);
 	print_byte(SFR_FLASH_DATA8);
@@ -122,7 +227,7 @@ void flash_read_uid(void)
 
 	SFR_FLASH_EXEC_GO = 1;
 	SFR_FLASH_DUMMYCYCLES = 24;
-	while(SFR_FLASH_EXEC_BUSY);
+	flash_exec_wait();
 
 	print_byte(SFR_FLASH_DATA0);
 	print_byte(SFR_FLASH_DATA8);
@@ -135,7 +240,7 @@ void flash_read_uid(void)
 
 void flash_read_jedecid(void)
 {
-	while (flash_read_status() & 0x1);
+	flash_status_wait(0x1, 0);
 
 	// Set read mode for JEDEC ID
 	SFR_FLASH_MODEB = 0x0;
@@ -146,7 +251,7 @@ void flash_read_jedecid(void)
 	SFR_FLASH_TCONF = 0x13;
 
 	SFR_FLASH_EXEC_GO = 1;
-	while(SFR_FLASH_EXEC_BUSY);
+	flash_exec_wait();
 
 	print_byte(SFR_FLASH_DATA0);
 	print_byte(SFR_FLASH_DATA8);
@@ -162,14 +267,15 @@ void flash_read_jedecid(void)
 }
 
 
-void flash_write_enable(void)
+/*
+ * Sets the write enable latch of the flash
+ * Returns 1 if the flash timed out
+ */
+uint8_t flash_write_enable(void)
 {
-	short status;
-
 	// Wait until busy bit clear
-	do {
-		status = flash_read_status();
-	} while (status & 0x1);
+	if (flash_status_wait(0x1, 0))
+		return 1;
 
 	SFR_FLASH_TCONF = 0x18;
 	SFR_FLASH_CMD = CMD_WRITE_ENABLE;
@@ -183,19 +289,14 @@ void flash_write_enable(void)
 
 	SFR_FLASH_EXEC_GO = 1;
 	// Wait for write status enabled
-	do {
-		status = flash_read_status();
-	} while (!(status & 0x2));
+	return flash_status_wait(0x2, 1);
 }
 
 
 void flash_dump(uint8_t len)
 {
-	short status;
-	do {
-		status = flash_read_status();
-		print_short(status);
-	} while (status & 0x1);
+	print_short(flash_read_status());
+	flash_status_wait(0x1, 0);
 
 	// Set fast read mode
 	if (dio_enabled) {
@@ -216,33 +317,31 @@ void flash_dump(uint8_t len)
 		flash_region.addr += 4;
 
 		SFR_FLASH_EXEC_GO = 1;
-		while(SFR_FLASH_EXEC_BUSY);
+		flash_exec_wait();
 
 		print_short(SFR_FLASH_DATA0);
 		if (len == 1)
-			return;
+			break;
 		print_short(SFR_FLASH_DATA8);
 		if (len == 2)
-			return;
+			break;
 		print_short(SFR_FLASH_DATA16);
 		if (len == 3)
-			return;
+			break;
 		print_short(SFR_FLASH_DATA24);
 
 		len -= 4;
 	}
+	flash_configure_mmio();
 }
 
 /*
- * Reads bulk data of length len from the flash memory starging at address src
- * and writes the data into a buffer pointed to by dst in XMEM
+ * Reads flash_region.len bytes starting at flash_region.addr into dst
+ * through the controller, bypassing the cache
  */
-void flash_read_bulk(__xdata uint8_t *dst)
+void flash_read_spi(__xdata uint8_t *dst)
 {
-	short status;
-	do {
-		status = flash_read_status();
-	} while (status & 0x1);
+	flash_status_wait(0x1, 0);
 
 	// Set fast read mode
 	if (dio_enabled) {
@@ -256,17 +355,16 @@ void flash_read_bulk(__xdata uint8_t *dst)
 	}
 
 
-	// Read 4 bytes
+	// Read 4 bytes, the most a transfer of the controller can return
+	SFR_FLASH_TCONF = 4;
 	while (1) {
 		SFR_FLASH_ADDR16 = flash_region.addr >> 16;
 		SFR_FLASH_ADDR8 = flash_region.addr >> 8;
 		SFR_FLASH_ADDR0 = flash_region.addr;
 		flash_region.addr += 4;
 
-		SFR_FLASH_TCONF = 4;
-
 		SFR_FLASH_EXEC_GO = 1;
-		while(SFR_FLASH_EXEC_BUSY);
+		flash_exec_wait();
 
 		*dst++ = SFR_FLASH_DATA0;
 		if (flash_region.len == 1)
@@ -282,12 +380,130 @@ void flash_read_bulk(__xdata uint8_t *dst)
 			break;
 		flash_region.len -= 4;
 	}
+	flash_configure_mmio();
+}
+
+
+
+/*
+ * Returns the cache line holding the block of flash at tag, the block is
+ * read into the least recently used line if not cached
+ */
+static uint8_t flash_cache_line(uint16_t tag)
+{
+	uint8_t l, victim = 0, age = 0;
+
+	flash_cache_clock++;
+	for (l = 0; l < FLASH_CACHE_LINES; l++) {
+		if (flash_cache_tag[l] == tag) {
+			flash_cache_hits++;
+			flash_cache_used[l] = flash_cache_clock;
+			return l;
+		}
+		// Unused lines are the oldest
+		if (flash_cache_tag[l] == FLASH_CACHE_INVALID) {
+			victim = l;
+			age = 0xff;
+		} else if ((uint8_t)(flash_cache_clock - flash_cache_used[l]) > age) {
+			victim = l;
+			age = flash_cache_clock - flash_cache_used[l];
+		}
+	}
+	flash_cache_misses++;
+	flash_region.addr = ((uint32_t)tag) << 8;
+	flash_region.len = FLASH_CACHE_LINE_SIZE;
+	flash_read_spi(flash_cache[victim]);
+	flash_cache_tag[victim] = tag;
+	flash_cache_used[victim] = flash_cache_clock;
+	return victim;
+}
+
+
+/*
+ * Drops the cached blocks overlapping len bytes at addr, called when
+ * flash is written or erased
+ */
+static void flash_cache_invalidate(__xdata uint32_t addr, __xdata uint16_t len)
+{
+	uint16_t first = addr >> 8;
+	uint16_t last = (addr + len - 1) >> 8;
+
+	for (uint8_t l = 0; l < FLASH_CACHE_LINES; l++) {
+		if (flash_cache_tag[l] >= first && flash_cache_tag[l] <= last)
+			flash_cache_tag[l] = FLASH_CACHE_INVALID;
+	}
+}
+
+
+/*
+ * Reads flash_region.len bytes starting at flash_region.addr into dst,
+ * blocks of flash are read through the cache
+ */
+void flash_read_bulk(__xdata uint8_t *dst)
+{
+	__xdata uint32_t addr = flash_region.addr;
+	__xdata uint16_t len = flash_region.len;
+	uint16_t o, n;
+	uint8_t l;
+
+	while (len) {
+		l = flash_cache_line(addr >> 8);
+		o = (uint8_t)addr;
+		n = FLASH_CACHE_LINE_SIZE - o;
+		if (n > len)
+			n = len;
+		memcpy(dst, flash_cache[l] + o, n);
+		dst += n;
+		addr += n;
+		len -= n;
+	}
+	flash_region.addr = addr;
+	flash_region.len = 0;
+}
+
+/*
+ * Reads flash_region.len bytes starting at flash_region.addr into dst through
+ * the memory mapped code window. The controller fetches sequential data in
+ * bursts using the read command of flash_configure_mmio(), DIO if enabled.
+ * The code cache is not invalidated by writes, use flash_read_bulk() for
+ * regions written at run-time
+ */
+void flash_read_mmio(__xdata uint8_t *dst)
+{
+	__code uint8_t *src;
+	__xdata uint32_t offset;
+	uint16_t n;
+	uint8_t current_bank = PSBANK;
+
+	flash_status_wait(0x1, 0);
+	flash_configure_mmio();
+
+	while (flash_region.len) {
+		// The first CODE0_SIZE bytes are always mapped, the rest through banks of CODE_BANK_SIZE
+		if (flash_region.addr < CODE0_SIZE) {
+			src = (__code uint8_t *)flash_region.addr;
+			n = CODE0_SIZE - flash_region.addr;
+		} else {
+			offset = flash_region.addr - CODE0_SIZE;
+			PSBANK = offset / CODE_BANK_SIZE + 1;
+			offset %= CODE_BANK_SIZE;
+			src = (__code uint8_t *)(offset + CODE0_SIZE);
+			n = CODE_BANK_SIZE - offset;
+		}
+		if (n > flash_region.len)
+			n = flash_region.len;
+		flash_region.addr += n;
+		flash_region.len -= n;
+		while (n--)
+			*dst++ = *src++;
+	}
+	PSBANK = current_bank;
 }
 
 
 void flash_read_security(void)
 {
-	while (flash_read_status() & 0x1);
+	flash_status_wait(0x1, 0);
 
 	// Set slow read mode
 	SFR_FLASH_MODEB = 0x0;
@@ -303,7 +519,7 @@ void flash_read_security(void)
 		flash_region.addr += 4;
 
 		SFR_FLASH_EXEC_GO = 1;
-		while(SFR_FLASH_EXEC_BUSY);
+		flash_exec_wait();
 
 		print_byte(SFR_FLASH_DATA0);
 		if (flash_region.len == 1)
@@ -323,9 +539,19 @@ void flash_read_security(void)
 }
 
 
-void flash_sector_erase(void)
+/*
+ * Erases the sector of flash_region.addr
+ * Returns 1 if the flash timed out
+ */
+uint8_t flash_sector_erase(void)
 {
-	flash_write_enable();
+	uint8_t err;
+
+	flash_cache_invalidate(flash_region.addr & ~(FLASH_SECTOR_SIZE - 1), FLASH_SECTOR_SIZE);
+	if (flash_write_enable()) {
+		flash_configure_mmio();
+		return 1;
+	}
 	SFR_FLASH_TCONF = 8;
 	SFR_FLASH_CMD = CMD_SECTOR_ERASE;
 
@@ -334,41 +560,90 @@ void flash_sector_erase(void)
 	SFR_FLASH_ADDR0 = flash_region.addr;
 
 	SFR_FLASH_EXEC_GO = 1;
-	while (flash_read_status() & 0x1);
+	err = flash_status_wait(0x1, 0);
 
 	flash_configure_mmio();
+	return err;
 }
 
 
+/*
+ * Programs flash_region.len bytes from ptr at flash_region.addr. A page
+ * program command of the controller transfers at most 4 bytes. Transfers
+ * are split at page boundaries, because the flash wraps around to the start
+ * of the page. Words that are all 0xff are skipped, as this is the erased state
+ */
 void flash_write_bytes(__xdata uint8_t *ptr)
 {
-	// write_char('\n'); write_char('>'); print_long(flash_region.addr); write_char(':'); print_short(flash_region.len); write_char('-'); print_byte(*ptr); // write_char('\n');
-	while(1) {
-		flash_write_enable();
-		SFR_FLASH_CMD = CMD_PAGE_PROGRAM;
-		SFR_FLASH_TCONF = 0x40 | 8 | 4; // Bytes written is 4, 8 enables write, 0x40 is unknown
-		// Last transfer?
-		if (flash_region.len < 5) {
-			SFR_FLASH_TCONF = 8 | flash_region.len;
+	__xdata uint32_t start = ticks;
+	uint8_t n, i;
+
+	flash_cache_invalidate(flash_region.addr, flash_region.len);
+	flash_write_count += flash_region.len;
+	while (flash_region.len) {
+		n = flash_region.len < 4 ? flash_region.len : 4;
+		// Bytes up to the end of the page
+		if (n > 0x100 - (uint8_t)flash_region.addr)
+			n = 0x100 - (uint8_t)flash_region.addr;
+
+		for (i = 0; i < n && ptr[i] == 0xff; i++);
+		if (i < n) {
+			// Give up, flash_write_verify() then finds the data differing
+			if (flash_write_enable())
+				break;
+			SFR_FLASH_CMD = CMD_PAGE_PROGRAM;
+			// Bytes written is n, 8 enables write, 0x40 is unknown and not used for the last transfer
+			SFR_FLASH_TCONF = flash_region.len > n ? 0x40 | 8 | n : 8 | n;
+
+			SFR_FLASH_ADDR16 = flash_region.addr >> 16;
+			SFR_FLASH_ADDR8 = flash_region.addr >> 8;
+			SFR_FLASH_ADDR0 = flash_region.addr;
+			SFR_FLASH_DATA0 = ptr[0];
+			SFR_FLASH_DATA8 = ptr[1];
+			SFR_FLASH_DATA16 = ptr[2];
+			SFR_FLASH_DATA24 = ptr[3];
+
+			// Execute transfer, we wait for completion in the next flash_write_enable()
+			SFR_FLASH_EXEC_GO = 1;
 		}
+		ptr += n;
+		flash_region.addr += n;
+		flash_region.len -= n;
+	}
+	flash_status_wait(0x1, 0);
+	flash_configure_mmio();
+	flash_write_ticks += ticks - start;
+}
 
-		SFR_FLASH_ADDR16 = flash_region.addr >> 16;
-		SFR_FLASH_ADDR8 = flash_region.addr >> 8;
-		SFR_FLASH_ADDR0 = flash_region.addr;
-		SFR_FLASH_DATA0 = *ptr++;
-		SFR_FLASH_DATA8 = *ptr++;
-		SFR_FLASH_DATA16 = *ptr++;
-		SFR_FLASH_DATA24 = *ptr++;
-
-		// Execute transfer, we wait for completion at top of loop
-		SFR_FLASH_EXEC_GO = 1;
-
-		if (flash_region.len < 5)
-			break;
 
-		flash_region.len -= 4;
-		flash_region.addr += 4;
-	};
-	while (flash_read_status() & 0x1);
-	flash_configure_mmio();
+/*
+ * Programs flash_region as flash_write_bytes() and reads it back
+ * Returns 1 if the CRC16 of the flash matches that of the data,
+ * crc_value is left unchanged
+ */
+uint8_t flash_write_verify(__xdata uint8_t *ptr)
+{
+	__xdata uint32_t addr = flash_region.addr;
+	__xdata uint16_t len = flash_region.len;
+	__xdata uint16_t saved = crc_value;
+	__xdata uint16_t expected;
+	uint8_t n;
+
+	flash_write_bytes(ptr);
+
+	crc_value = 0;
+	crc16_block(ptr, len);
+	expected = crc_value;
+	crc_value = 0;
+	flash_region.addr = addr;
+	while (len) {
+		n = len < sizeof(verify_buf) ? len : sizeof(verify_buf);
+		flash_region.len = n;
+		flash_read_spi(verify_buf);
+		crc16_block(verify_buf, n);
+		len -= n;
+	}
+	n = crc_value == expected;
+	crc_value = saved;
+	return n;
 }
@@ -1,13 +1,23 @@
 #ifndef _RTL837X_FLASH_H_
 #define _RTL837X_FLASH_H_
 
+// Size of a block of flash in the cache of flash_read_bulk()
+#define FLASH_CACHE_LINE_SIZE 0x100
+
+// Returned by flash_read_status() when the controller times out
+#define FLASH_STATUS_TIMEOUT 0xff
+
 void flash_init(uint8_t enable_dio);
+uint8_t flash_read_status(void);
 void flash_read_uid(void);
-void flash_write_enable(void);
+uint8_t flash_write_enable(void);
 void flash_dump(uint8_t len);
 void flash_read_jedecid(void);
 void flash_read_security(void);
-void flash_sector_erase(void);
+uint8_t flash_sector_erase(void);
+void flash_read_spi(__xdata uint8_t *dst);
 void flash_read_bulk(__xdata uint8_t *dst);
+void flash_read_mmio(__xdata uint8_t *dst);
 void flash_write_bytes(__xdata uint8_t *ptr);
+uint8_t flash_write_verify(__xdata uint8_t *ptr);
 #endif
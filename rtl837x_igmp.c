@@ -13,6 +13,7 @@
 #include "rtl837x_sfr.h"
 #include "rtl837x_regs.h"
 #include "rtl837x_igmp.h"
+#include "log.h"
 #include "machine.h"
 
 extern __code struct machine machine;
@@ -215,15 +216,11 @@ void igmp_packet_handler(void) __banked
 #endif
 	if (IGMP_I->protocol != 2)
 		return;
-#ifdef DEBUG
-	print_string("Found IGMP, type: "); print_byte(IGMP_I->igmp_type); write_char('\n');
-#endif
+	LOG(LOG_IGMP, LOG_DEBUG, LOG_MSG_IGMP_TYPE, IGMP_I->igmp_type, 0);
 	// We react to IGMPv1/v2 and v3 membership reports
 	if (!(IGMP_I->igmp_type == 0x12 || IGMP_I->igmp_type == 0x16 || IGMP_I->igmp_type == 0x22))
 		return;
-#ifdef DEBUG
-	print_string("IGMP membership report, type "); print_byte(IGMP_I->igmp_rtype); write_char('\n');
-#endif
+	LOG(LOG_IGMP, LOG_DEBUG, LOG_MSG_IGMP_REPORT, IGMP_I->igmp_rtype, 0);
 
 #ifdef IPMC_USES_L3MC
 	memset(&entry, 0, sizeof(struct ipmc_table_entry));
@@ -245,9 +242,8 @@ void igmp_packet_handler(void) __banked
 	entry_to_ipmc();
 #endif
 	// Wait for any pending Table operations to end
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & 1);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, 1, WAIT_TBL))
+		return;
 
 	reg_read_m(RTL837x_TBL_DATA_0);
 #ifdef DEBUG
@@ -262,9 +258,8 @@ void igmp_packet_handler(void) __banked
 #endif
 	// First try to find entry to see whether it needs to be updated
 	REG_WRITE(RTL837X_TBL_CTRL, 0x00, 0x00, TBL_L2_UNICAST, TBL_EXECUTE);
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & 0x1);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, 0x1, WAIT_TBL))
+		return;
 #ifdef DEBUG
 	print_string("\nsearch done\n");
 	print_string("Table data searched:\n");
@@ -290,34 +285,27 @@ void igmp_packet_handler(void) __banked
 	idx = ((sfr_data[2] & 0xf) << 8) | sfr_data[3];
 	if (IGMP_I->igmp_rtype == 0x4) {// Join group
 		if (sfr_data[2] & 0x10) {
-			print_string("\nIGMP-Entry FOUND\n");
 			reg_read_m(RTL837x_L2_DATA_OUT_B);
 			entry.pmask = sfr_data[0] >> 6;
 			reg_read_m(RTL837x_L2_DATA_OUT_C);
 			entry.pmask |= ((uint16_t)sfr_data[3]) << 2;
+			LOG(LOG_IGMP, LOG_DEBUG, LOG_MSG_IGMP_FOUND, entry.pmask, idx);
 		}
 		// Update (found) entry with portmask from trapped Packet
 		entry.pmask |= (1L << (IGMP_I->rtl_tag.pmask >> 8));  // Swap bytes from network order, only 4 LSB count
 //		print_string("\nPort-Mask: "); print_short(entry.pmask); write_char('\n');
 	} else if (IGMP_I->igmp_rtype == 0x3){  // Leave group
 		if (sfr_data[2] & 0x10) {
-			print_string("\nIGMP_Entry FOUND\n");
 			reg_read_m(RTL837x_L2_DATA_OUT_B);
 			entry.pmask = sfr_data[0] >> 6;
 			reg_read_m(RTL837x_L2_DATA_OUT_C);
 			entry.pmask |= ((uint16_t)sfr_data[3]) << 2;
-#ifdef DEBUG
-			print_string("Portmask: ");
-			print_short(entry.pmask);
-			print_string("Index: ");
-			print_short(idx);
-			write_char('\n');
-#endif
+			LOG(LOG_IGMP, LOG_DEBUG, LOG_MSG_IGMP_FOUND, entry.pmask, idx);
 			// Remove portmask of IGMP packet from entry
 			entry.pmask &= ~(1L << (IGMP_I->rtl_tag.pmask >> 8));  // Swap bytes from network order, only 4 LSB count
 //			print_string("\nPort-Mask: "); print_short(entry.pmask); write_char('\n');
 		} else {
-			print_string("IGMP Entry already deleted\n");
+			LOG(LOG_IGMP, LOG_INFO, LOG_MSG_IGMP_GONE, 0, 0);
 			return;
 		}
 		if (!entry.pmask && idx) { // No more ports in that group and an actual entry?
@@ -326,10 +314,9 @@ void igmp_packet_handler(void) __banked
 			sfr_data[1] |= 0x04;	// Clear entry
 			reg_write_m(RTL837x_TBL_DATA_0);
 			REG_WRITE(RTL837X_TBL_CTRL, idx >> 8, idx & 0xff, TBL_L2_UNICAST, TBL_WRITE | TBL_EXECUTE);
-			do {
-				reg_read_m(RTL837X_TBL_CTRL);
-			} while (sfr_data[3] & 0x1);
-			print_string("IGMP Entry deleted\n");
+			if (reg_wait(RTL837X_TBL_CTRL, 3, 0x1, WAIT_TBL))
+				return;
+			LOG(LOG_IGMP, LOG_INFO, LOG_MSG_IGMP_DELETED, idx, 0);
 			return;
 		}
 	} else {  // Unknown message: ignore.
@@ -338,7 +325,7 @@ void igmp_packet_handler(void) __banked
 
 	if (!entry.pmask)
 		return;
-	print_string("Updating IGMP entry\n");
+	LOG(LOG_IGMP, LOG_INFO, LOG_MSG_IGMP_UPDATE, entry.pmask, 0);
 	// Write the updated entry
 #ifdef IPMC_USES_L3MC
 	entry_to_l3mc();
@@ -358,9 +345,8 @@ void igmp_packet_handler(void) __banked
 #endif
 	reg_read_m(RTL837X_TBL_CTRL);
 	REG_WRITE(RTL837X_TBL_CTRL, sfr_data[0], sfr_data[1], TBL_L2_UNICAST, TBL_WRITE | TBL_EXECUTE);
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & 0x1);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, 0x1, WAIT_TBL))
+		return;
 #ifdef DEBUG
 	print_string("\nupdate done\n");
 	print_string("Table data written:\n");
@@ -167,14 +167,20 @@ void phy_config_8224(void) __banked
 	phy_write(RTL8224_PHY_ID, 0x1e, 0x7b20, pval);
 
 	uint8_t i = 0;
+	uint16_t n;
 	while (rtl8224_ca[i]) {
 		phy_write(RTL8224_PHY_ID, 0x1e, 0x400, rtl8224_ca[i]);
 		i++;
 		phy_write(RTL8224_PHY_ID, 0x1e, 0x3f8, rtl8224_ca[i]);
 		i++;
+		n = WAIT_POLLS;
 		do {
 			phy_read(RTL8224_PHY_ID, 0x1e, 0x3f8);
-		} while (SFR_DATA_8 & 0x80);
+		} while ((SFR_DATA_8 & 0x80) && --n);
+		if (!n) {
+			wait_timeout(WAIT_PHY, 0x3f8);
+			return;
+		}
 	}
 
 	print_string("\r\nphy_config_8224 done\r\n");
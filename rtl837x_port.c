@@ -14,6 +14,7 @@
 #include "rtl837x_phy.h"
 #include "phy.h"
 #include "machine.h"
+#include "debug.h"
 
 #pragma codeseg BANK1
 #pragma constseg BANK1
@@ -29,9 +30,9 @@ __xdata	uint32_t l2_head;
 
 void port_mirror_set(register uint8_t port, __xdata uint16_t rx_pmask, __xdata uint16_t tx_pmask) __banked
 {
-	print_string("\nport_mirror_set called \n");
-	print_string("Mirroring port: "); print_byte(port); print_string(" with rx-mask: ");
-	print_short(rx_pmask); print_string(", tx mask: "); print_short(tx_pmask);
+	dbg_string("\nport_mirror_set called \n");
+	dbg_string("Mirroring port: "); dbg_byte(port); dbg_string(" with rx-mask: ");
+	dbg_short(rx_pmask); dbg_string(", tx mask: "); dbg_short(tx_pmask);
 
 	REG_WRITE(RTL837x_MIRROR_CONF, rx_pmask >> 8, rx_pmask, tx_pmask >> 8, tx_pmask);
 	REG_WRITE(RTL837x_MIRROR_CTRL, 0, 0, 0, (port << 1) | 0x1);
@@ -40,7 +41,7 @@ void port_mirror_set(register uint8_t port, __xdata uint16_t rx_pmask, __xdata u
 
 void port_mirror_del(void) __banked
 {
-	print_string("\nport_mirror_del called \n");
+	dbg_string("\nport_mirror_del called \n");
 	REG_SET(RTL837x_MIRROR_CTRL, 0);
 }
 
@@ -64,7 +65,7 @@ void port_ingress_filter(register uint8_t port, uint8_t type) __banked
 void port_pvid_set(uint8_t port, __xdata uint16_t pvid) __banked
 {
 	// r4e1c:00001001 R4e1c-000017d0 r6738:00000000 R6738-00000000 (no filtering)
-	print_string("\nport_pvid_set called \n");
+	dbg_string("\nport_pvid_set called \n");
 	uint16_t reg = RTL837x_PVID_BASE_REG + ((port >> 1) << 2);
 
 	reg_read_m(reg);
@@ -86,7 +87,7 @@ void vlan_delete(uint16_t vlan) __banked
 
 /*
  * Reads VLAN information from VLAN table
- * Returns data in sfr_data
+ * Returns data in sfr_data, -1 if the VLAN is invalid or the table timed out
  */
 int8_t vlan_get(register uint16_t vlan) __banked
 {
@@ -94,9 +95,8 @@ int8_t vlan_get(register uint16_t vlan) __banked
 		return -1;
 
 	REG_WRITE(RTL837X_TBL_CTRL, vlan >> 8, vlan, TBL_VLAN, TBL_EXECUTE);
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & TBL_EXECUTE);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL))
+		return -1;
 	reg_read_m(RTL837x_L2_DATA_OUT_A);
 
 	return 0;
@@ -127,9 +127,9 @@ void vlan_create(register uint16_t vlan, register uint16_t members, register uin
 	// For now, the CPU-port is always a tagged member:
 	members |= 0x0200; // Set 10th bit
 	tagged |= 0x0200;
-	print_string("\nvlan_create called\nvlan: "); print_short(vlan);
-	print_string(", members: "); print_short(members);
-	print_string(", tagged: "); print_short(tagged); write_char('\n');
+	dbg_string("\nvlan_create called\nvlan: "); dbg_short(vlan);
+	dbg_string(", members: "); dbg_short(members);
+	dbg_string(", tagged: "); dbg_short(tagged); dbg_char('\n');
 
 	uint16_t a = (~members) ^ tagged ^ members;
 	// On RTL8372, port-bits 0-2 must be 0, although they are not members
@@ -141,10 +141,9 @@ void vlan_create(register uint16_t vlan, register uint16_t members, register uin
 	// Initialize VLAN table with VLAN 1
 	REG_WRITE(RTL837x_TBL_DATA_IN_A, 0x02, (a >> 6) & 0x0f, (a << 2) | (members >> 8), members);
 	REG_WRITE(RTL837X_TBL_CTRL, vlan >> 8, vlan, TBL_VLAN, TBL_WRITE | TBL_EXECUTE);
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & TBL_EXECUTE);
-	print_string("vlan_create done \n");
+	if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL))
+		return;
+	dbg_string("vlan_create done \n");
 }
 
 
@@ -167,9 +166,10 @@ void vlan_setup(void) __banked
 	REG_SET(RTL837x_TBL_DATA_IN_A, machine.isRTL8373? 0x0007ffff : 0x0007e3f8);
 
 	REG_SET(RTL837X_TBL_CTRL, 0x00010303);
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & TBL_EXECUTE);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL)) {
+		print_string("vlan_setup: VLAN table timed out\n");
+		return;
+	}
 
 	// Set PVID 1 for every port. TODO: Skip unused ports!
 	for (uint8_t i = machine.min_port; i <= machine.max_port + 1; i++) {  // Do this also for the CPU port (+1)
@@ -211,9 +211,10 @@ void vlan_setup(void) __banked
 	REG_SET(RTL837x_TBL_DATA_IN_A, machine.isRTL8373? 0x0207ffff : 0x0207e3f8);	// 02: Entry valid, 7...: membership
 
 	REG_SET(RTL837X_TBL_CTRL, 0x00010303);	// Write VLAN 1
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & TBL_EXECUTE);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL)) {
+		print_string("vlan_setup: VLAN 1 timed out\n");
+		return;
+	}
 
 #ifdef DEBUG
 	print_string("\nvlan_setup, REG 0x6738: "); print_reg(0x6738);
@@ -231,6 +232,7 @@ void vlan_setup(void) __banked
 
 /*
  * Forget all dynamic L2 learned entries
+ * Returns 1 if the flush timed out
  */
 uint8_t port_l2_forget(void) __banked
 {
@@ -243,10 +245,10 @@ uint8_t port_l2_forget(void) __banked
 	REG_SET(RTL837x_L2_TBL_FLUSH_CTRL, L2_TBL_FLUSH_EXEC | (machine.isRTL8373 ? PMASK_9 : PMASK_6));
 
 	// Wait for flush completed
-	do {
-		reg_read_m(RTL837x_L2_TBL_FLUSH_CTRL);
-	} while (sfr_data[1]);
+	if (reg_wait(RTL837x_L2_TBL_FLUSH_CTRL, 1, 0xff, WAIT_L2_FLUSH))
+		return 1;
 
+	state_changed(STATE_L2);
 	print_string("port_l2_forget done\n");
 	return 0;
 }
@@ -255,9 +257,8 @@ uint8_t port_l2_forget(void) __banked
 void port_l2_learned(void) __banked
 {
 	// Whait for any table action to be finished
-	do {
-		reg_read_m(RTL837X_TBL_CTRL);
-	} while (sfr_data[3] & 0x01);
+	if (reg_wait(RTL837X_TBL_CTRL, 3, 0x01, WAIT_TBL))
+		return;
 	print_string("\n\tMAC\t\tVLAN\ttype\tport\n");
 	__xdata uint16_t entry = 0x0000;
 	__xdata uint16_t first_entry = 0xffff; // Table does not have that many entries
@@ -268,9 +269,8 @@ void port_l2_learned(void) __banked
 		REG_WRITE(RTL837x_TBL_DATA_0, sfr_data[0], sfr_data[1],sfr_data[2] | 0xc0, sfr_data[3]);
 
 		REG_WRITE(RTL837X_TBL_CTRL, (entry >> 8) & 0xf, entry, TBL_L2_UNICAST, TBL_EXECUTE);
-		do {
-			reg_read_m(RTL837X_TBL_CTRL);
-		} while (sfr_data[3] & TBL_EXECUTE);
+		if (reg_wait(RTL837X_TBL_CTRL, 3, TBL_EXECUTE, WAIT_TBL))
+			break;
 
 		reg_read_m(RTL837x_TBL_DATA_0);
 		entry = (((uint16_t)sfr_data[2] & 0x0f) << 8) | sfr_data[3];
@@ -450,7 +450,7 @@ void port_eee_disable(uint8_t port) __banked
 	if (machine.is_sfp[port])
 		return;
 
-	print_string("EEE off for "); print_byte(port); write_char('\n');
+	dbg_string("EEE off for "); dbg_byte(port); dbg_char('\n');
 	REG_SET(RTL8373_EEE_CTRL_BASE + (port << 2), 0);
 	// Disable EEE advertisement for 100/1000BASE-T via EEE Advertisement Reg
 	phy_write(port, PHY_MMD_AN, PHY_EEE_ADV, 0);
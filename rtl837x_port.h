@@ -9,9 +9,7 @@
 
 #define STAT_GET(cnt, port) \
 	REG_WRITE(RTL837X_STAT_GET, 0x00, 0x00, cnt >> 3, (cnt << 5) | (port << 1) | 1); \
-	do { \
-		reg_read_m(RTL837X_STAT_GET); \
-	} while (sfr_data[3] & 0x1);
+	reg_wait(RTL837X_STAT_GET, 3, 0x1, WAIT_STAT);
 
 uint8_t port_l2_forget(void) __banked;
 void port_l2_learned(void) __banked;
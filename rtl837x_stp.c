@@ -11,6 +11,7 @@
 #include "rtl837x_sfr.h"
 #include "rtl837x_regs.h"
 #include "rtl837x_stp.h"
+#include "log.h"
 #include "uip.h"
 #include "machine.h"
 
@@ -32,7 +33,7 @@ __xdata uint32_t root_bridge_cost;
 
 __xdata uint8_t port_types[10];
 __xdata uint16_t port_timers[10];
-__xdata uint16_t port_hello[10];
+__xdata struct timer stp_hello_timer;
 
 
 struct stp_pkt {
@@ -109,21 +110,11 @@ void stp_in(void) __banked
 	// MSTPSTP_I_STATES 0x5310
 	// reg_read_m(RTL837X_MSTP_STATES);
 
-	print_string("Check BPDU... \n");
-	for (uint8_t i = 0; i < 80; i++) {
-		print_byte(uip_buf[i]);
-		write_char(' ');
-	}
-	write_char('\n');
-	print_byte(STP_I->dsap);
-	print_byte(STP_I->ssap);
-	print_byte(STP_I->ctrl);
-	
-	write_char('\n');
+	LOG(LOG_STP, LOG_DEBUG, LOG_MSG_STP_BPDU, ((uint16_t)STP_I->dsap << 8) | STP_I->ssap, STP_I->ctrl);
 	// Make sure this is the type of RSTP packet we are interested in:
 	if (!(STP_I->dsap == 0x42 && STP_I->ssap == 0x42 && STP_I->ctrl == 0x03))
 		return;
-	print_string("Checking RSTP\n");
+	LOG(LOG_STP, LOG_DEBUG, LOG_MSG_STP_RSTP, 0, 0);
 	if (STP_I->proto)
 		return;
 //	write_char('A'); print_byte(STP_I->version); write_char('\n');
@@ -134,10 +125,9 @@ void stp_in(void) __banked
 		return;
 //	write_char('\n');
 //	print_string("Flags: "); print_byte(STP_I->flags); write_char('\n');
-	print_string("Check new Root\n");
 	if (STP_I->root.prio < root_bridge.prio
 		|| ((STP_I->root.prio == root_bridge.prio) && cmpMAC(STP_I->root.mac, STP_I->root.mac) < 0)) {
-		print_string("Updating Root bridge\n");
+		LOG(LOG_STP, LOG_INFO, LOG_MSG_STP_ROOT, STP_I->root.prio, 0);
 			root_bridge.prio = STP_I->root.prio;
 			memcpy(root_bridge.mac, STP_I->root.mac, 6);
 	}
@@ -188,17 +178,14 @@ void stp_cnf_send(uint8_t port)
 }
 
 
-void stp_timers(void) __banked
+// Sends the hello BPDUs on all ports, called by the timer service
+static void stp_hello(void)
 {
 	for (uint8_t i = machine.min_port; i <= machine.max_port; i++) {
-		port_hello[i]--;
-		if (!port_hello[i]) {
-			port_hello[i] = TIME_HELLO;
-			print_string("STP_HELLO port ");
-			print_byte(i); write_char('\n');
-			stp_cnf_send(i);
-		}
+		LOG(LOG_STP, LOG_DEBUG, LOG_MSG_STP_HELLO, i, 0);
+		stp_cnf_send(i);
 	}
+	timer_arm(&stp_hello_timer, TIME_HELLO);
 }
 
 
@@ -211,7 +198,6 @@ void stp_setup(void) __banked
 		// States are: 00 disable, 01 blocking, 10 learning, 11 forwarding
 		uint8_t bit_mask = 0b01 << ( (i << 1) & 0x7);
 		sfr_data[3 - (i >> 2)] |= bit_mask;
-		port_hello[i] = TIME_HELLO;
 		port_timers[i] = 0xa00;	// 10 sec in blocking state
 	}
 	sfr_data[1] |= 0x0f; // Do not block CPU-Port
@@ -219,6 +205,9 @@ void stp_setup(void) __banked
 
 	print_reg(RTL837X_MSTP_STATES); write_char('\n');
 
+	stp_hello_timer.fn = stp_hello;
+	timer_arm(&stp_hello_timer, TIME_HELLO);
+
 	root_bridge.prio = 0x80; // This corresponds to 32768
 	root_bridge.ext	= 0x00;
 	memcpyc(root_bridge.mac, uip_ethaddr.addr, 6);
@@ -227,6 +216,7 @@ void stp_setup(void) __banked
 
 void stp_off(void) __banked
 {
+	timer_cancel(&stp_hello_timer);
 	sfr_data[0] = sfr_data[1] = sfr_data[2] = sfr_data[3] = 0;
 	for (uint8_t i = machine.min_port; i <= machine.max_port; i++) {
 		// Set STP port state to forwarding
@@ -4,9 +4,8 @@
 #include <stdint.h>
 void stp_in(void) __banked;
 void stp_setup(void) __banked;
-void stp_timers(void) __banked;
 void stp_off(void) __banked;
 
-#define TIME_HELLO 0x200 // 2 sec
+#define TIME_HELLO (2 * SYS_TICK_HZ)
 
 #endif
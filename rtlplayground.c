@@ -14,9 +14,12 @@
 #include "rtl837x_igmp.h"
 #include "dhcp.h"
 #include "cmd_parser.h"
+#include "log.h"
+#include "arena.h"
 #include "uip/uipopt.h"
 #include "uip/uip.h"
 #include "uip/uip_arp.h"
+#include "uip/uip-split.h"
 #include "machine.h"
 
 
@@ -24,7 +27,8 @@ extern __code const struct machine machine;
 
 extern __xdata uint16_t crc_value;
 __xdata uint8_t crc_testbytes[10];
-void crc16(__xdata uint8_t *v) __naked;
+void crc16_block(__xdata uint8_t *v, uint16_t len);
+void boot_deferred(void);
 
 // Upload Firmware to 1M
 #define FIRMWARE_UPLOAD_START 0x100000
@@ -70,6 +74,11 @@ void crc16(__xdata uint8_t *v) __naked;
 #endif
 #define SYSTICK_TIMER2_VALUE (0x10000 - TIMER2_DIV)
 
+// Converts microseconds to counts of timer 2 for the budgets of tasks[]
+#define SCHED_COUNTS(us) ((uint32_t)(us) * (CLOCK_HZ / 12 / 1000) / 1000)
+// Time after which a pass of idle() only runs the tasks of the network path
+#define SCHED_PASS_BUDGET (TIMER2_DIV / 2)
+
 __xdata uint8_t idle_ready;
 
 __code uint8_t ownIP[] = { 192, 168, 2, 2 };
@@ -80,10 +89,15 @@ __code uint8_t netmask[] = { 255, 255, 255, 0};
 volatile __xdata uint32_t ticks;
 volatile __xdata uint8_t sec_counter;
 volatile __xdata uint16_t sleep_ticks;
-__xdata uint8_t stp_clock;
+#ifdef WATCHDOG_SECONDS
+// Ticks since the last pass of the main loop, counted once it has started
+volatile __xdata uint16_t watchdog_ticks;
+__xdata uint8_t watchdog_armed;
+#endif
 extern __xdata struct dhcp_state dhcp_state;
 
-#define STP_TICK_DIVIDER 3
+// Aging of the ARP table, see uip_arp_timer()
+#define ARP_AGE_TICKS (10 * SYS_TICK_HZ)
 
 
 // Buffer for serial input, SBUF_SIZE must be power of 2 < 256
@@ -95,6 +109,9 @@ extern __xdata uint8_t gpio_last_value[8];
 
 extern __xdata struct flash_region_t flash_region;
 
+// The request to /cmd waiting for the output of its command, see httpd.c
+extern __xdata struct uip_conn *cmd_conn;
+
 __code uint8_t * __code greeting = "\nA minimal prompt to explore the RTL8372:\n";
 __code uint8_t * __code hex = "0123456789abcdef";
 
@@ -123,7 +140,37 @@ __xdata char sfp_module_vendor[2][17];
 __xdata char sfp_module_model[2][17];
 __xdata char sfp_module_serial[2][17];
 __xdata uint8_t sfp_options[2];
+
+// Generation of the switch state and of the last change of each section
+__xdata uint16_t state_gen;
+__xdata uint16_t state_section_gen[STATE_SECTIONS];
+
+// Boot phases reached so far and the tick at which each of them started
+__code char * __xdata boot_phase_name[BOOT_PHASES_MAX];
+__xdata uint32_t boot_phase_tick[BOOT_PHASES_MAX];
+__xdata uint8_t boot_phases;
+
+/*
+ * The PHYs and SerDes are given BOOT_SETTLE_TICKS after their setup before
+ * the configuration is applied. Initialization not needed for forwarding
+ * is done in steps from idle(), once the switch forwards and answers HTTP
+ */
+#define BOOT_SETTLE_TICKS	1000
+#define BOOT_STEP_LED		0
+#define BOOT_STEP_SFP		1
+#define BOOT_STEP_REPORT	2
+#define BOOT_STEP_DONE		3
+__xdata uint8_t boot_step;
+
+// The transmitter is idle, the next character is written directly to SBUF
 __sbit tx_buf_empty;
+// Ring of characters sent by isr_serial() as the transmitter becomes idle
+__xdata uint8_t tbuf[TBUF_SIZE];
+__xdata uint8_t tbuf_head;
+volatile __xdata uint8_t tbuf_tail;
+// When set, output waits for room in a full ring, otherwise it is dropped
+__xdata uint8_t serial_wait;
+__xdata uint32_t serial_dropped;
 
 #define ETHERTYPE_OFFSET (12 + VLAN_TAG_SIZE + RTL_TAG_SIZE)
 
@@ -139,12 +186,42 @@ void isr_timer2(void) __interrupt(5)
 	if (sleep_ticks > 0)
 		sleep_ticks--;
 	sec_counter++;
+#ifdef WATCHDOG_SECONDS
+	/*
+	 * The main loop is stuck: reset the switch. The SFRs are written
+	 * directly, the functions for the registers are not reentrant
+	 */
+	if (watchdog_armed && ++watchdog_ticks >= WATCHDOG_SECONDS * SYS_TICK_HZ) {
+		SFR_DATA_24 = 0;
+		SFR_DATA_16 = 0;
+		SFR_DATA_8 = 0;
+		SFR_DATA_0 = 1;
+		SFR_REG_ADDR_U16 = RTL837X_REG_RESET;
+		SFR_EXEC_GO = SFR_EXEC_WRITE_REG;
+		while (1);
+	}
+#endif
 
 	// Clear TF2 & EXF2 by software
 	T2CON &= ~0xC0;
 }
 
 
+/*
+ * Returns ticks. The timer 2 interrupt updates it, and a read of its
+ * four bytes may see a carry half done unless interrupts are off
+ */
+uint32_t ticks_now(void)
+{
+	uint32_t t;
+
+	__critical {
+		t = ticks;
+	}
+	return t;
+}
+
+
 void isr_serial(void) __interrupt(4)
 {
 	if (RI == 1) {
@@ -154,23 +231,76 @@ void isr_serial(void) __interrupt(4)
 	}
 	if (TI == 1) {
 		TI = 0;
+		if (tbuf_tail != tbuf_head) {
+			SBUF = tbuf[tbuf_tail];
+			tbuf_tail = (tbuf_tail + 1) & (TBUF_SIZE - 1);
+		} else {
+			tx_buf_empty = 1;
+		}
+	}
+}
+
+
+/*
+ * Serves the transmitter like isr_serial() does, for when interrupts are off.
+ * Must be called with interrupts disabled
+ */
+static void serial_tx_poll(void)
+{
+	if (!TI)
+		return;
+	TI = 0;
+	if (tbuf_tail != tbuf_head) {
+		SBUF = tbuf[tbuf_tail];
+		tbuf_tail = (tbuf_tail + 1) & (TBUF_SIZE - 1);
+	} else {
 		tx_buf_empty = 1;
 	}
 }
 
 
+/*
+ * Queues a character for the serial transmitter. If the ring is full,
+ * the character is dropped unless serial_wait is set for interactive output.
+ * We may be called from the external ISRs, so the test and the enqueue
+ * are done in one critical section
+ */
+static void serial_put(char c)
+{
+	uint8_t done = 0;
+
+	while (!done) {
+		__critical {
+			if (tx_buf_empty) {
+				tx_buf_empty = 0;
+				SBUF = c;
+				done = 1;
+			} else if (((tbuf_head + 1) & (TBUF_SIZE - 1)) != tbuf_tail) {
+				tbuf[tbuf_head] = c;
+				tbuf_head = (tbuf_head + 1) & (TBUF_SIZE - 1);
+				done = 1;
+			} else if (!serial_wait) {
+				serial_dropped++;
+				done = 1;
+			} else {
+				// Interrupts may have been off already, serve the transmitter ourselves
+				serial_tx_poll();
+			}
+		}
+	}
+}
+
+
 void write_char(char c)
 {
-	do {
-	} while (tx_buf_empty == 0);
-	if (c =='\n') {
-		tx_buf_empty = 0;
-		SBUF = '\r';
-		do {
-		} while (tx_buf_empty == 0);
+	if (cmd_capture) {
+		if (cmd_out_len < CMD_OUT_SIZE)
+			cmd_out[cmd_out_len++] = c;
+		return;
 	}
-	tx_buf_empty = 0;
-	SBUF = c;
+	if (c =='\n')
+		serial_put('\r');
+	serial_put(c);
 }
 
 
@@ -344,12 +474,105 @@ void setup_timer2(void)
 }
 
 
+// Time-outs of the busy waits for the hardware, by site
+__xdata uint16_t wait_timeouts[WAIT_SITES];
+__xdata uint8_t wait_last_site;
+__xdata uint16_t wait_last_reg;
+__xdata uint32_t wait_last_tick;
+
+__code char * __code wait_sites[WAIT_SITES] = {
+	"sfr", "nic", "i2c", "table", "stat", "l2flush", "flash", "flashbusy", "phy", "reset"
+};
+
+/*
+ * Ticks reg_wait() waits at a site before it gives up. The flush of the L2
+ * table and the reset of the NIC have not been timed on hardware and get
+ * well beyond what they should need. Sites that spin on an SFR have none
+ */
+__code uint8_t wait_budget[WAIT_SITES] = {
+	0, 0,
+	SYS_TICK_HZ / 20,	// I2C: a byte of the SFP EEPROM at 100 kHz takes < 1 ms
+	SYS_TICK_HZ / 50,	// Table operations
+	SYS_TICK_HZ / 50,	// Port counters
+	SYS_TICK_HZ,		// L2 flush of all ports
+	0, 0,
+	SYS_TICK_HZ / 10,	// RTL8224 commands
+	SYS_TICK_HZ / 2		// NIC reset
+};
+
+
+// Accounts for a wait of site that gave up on register or address reg
+void wait_timeout(uint8_t site, uint16_t reg)
+{
+	if (wait_timeouts[site] != 0xffff)
+		wait_timeouts[site]++;
+	wait_last_site = site;
+	wait_last_reg = reg;
+	wait_last_tick = ticks;
+	LOG(LOG_HW, LOG_ERR, LOG_MSG_HW_TIMEOUT, reg, site);
+}
+
+
+// Waits for the command given through SFR_EXEC_GO, returns 1 on time-out
+static uint8_t sfr_exec_wait(uint16_t reg)
+{
+	uint16_t n = WAIT_SPINS;
+
+	do {
+		if (!SFR_EXEC_STATUS)
+			return 0;
+	} while (--n);
+	wait_timeout(WAIT_SFR, reg);
+	return 1;
+}
+
+
+// Waits for the transfer given through SFR_NIC_CTRL, returns 1 on time-out
+static uint8_t nic_wait(uint16_t ring_ptr)
+{
+	uint16_t n = WAIT_SPINS;
+
+	do {
+		if (!SFR_NIC_CTRL)
+			return 0;
+	} while (--n);
+	wait_timeout(WAIT_NIC, ring_ptr);
+	return 1;
+}
+
+
+/*
+ * Reads register reg until the bits of mask are clear in sfr_data[b]
+ * Returns 0 once they are, 1 once the wait_budget of site has passed, which
+ * counts as a time-out of site. Before interrupts are enabled ticks does not
+ * advance, the wait then gives up after WAIT_POLLS reads
+ */
+uint8_t reg_wait(uint16_t reg, uint8_t b, uint8_t mask, uint8_t site)
+{
+	__xdata uint32_t deadline = ticks_now() + wait_budget[site];
+	uint16_t n = WAIT_POLLS;
+
+	while (1) {
+		reg_read_m(reg);
+		if (!(sfr_data[b] & mask))
+			return 0;
+		if (EA) {
+			if ((int32_t)(ticks_now() - deadline) > 0)
+				break;
+		} else if (!--n) {
+			break;
+		}
+	}
+	wait_timeout(site, reg);
+	return 1;
+}
+
+
 void reg_read(uint16_t reg_addr)
 {
 	SFR_REG_ADDR_U16 = reg_addr;
 	SFR_EXEC_GO = SFR_EXEC_READ_REG;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg_addr);
 	/* The result is now in SFR A4, A5, A6, A7 */
 }
 
@@ -361,8 +584,7 @@ void reg_read_m(uint16_t reg_addr)
 #endif
 	SFR_REG_ADDR_U16 = reg_addr;
 	SFR_EXEC_GO = SFR_EXEC_READ_REG;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg_addr);
 	sfr_data[0] = SFR_DATA_24;
 	sfr_data[1] = SFR_DATA_16;
 	sfr_data[2] = SFR_DATA_8;
@@ -378,8 +600,7 @@ void reg_write(uint16_t reg_addr)
 	/* Data to write must be in SFR A4, A5, A6, A7 */
 	SFR_REG_ADDR_U16 = reg_addr;
 	SFR_EXEC_GO = SFR_EXEC_WRITE_REG;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg_addr);
 }
 
 
@@ -398,8 +619,7 @@ void reg_write_m(uint16_t reg_addr)
 	SFR_DATA_0 = sfr_data[3];
 
 	SFR_EXEC_GO = SFR_EXEC_WRITE_REG;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg_addr);
 }
 
 
@@ -469,14 +689,15 @@ void get_random_32(void)
  * Transfer Network Interface RX data from the ASIC to the 8051 XMEM
  * data will be stored in the rx_header structure
  * len is the length of data to be transferred
+ * Returns 1 if the transfer timed out
  */
-void nic_rx_header(uint16_t ring_ptr)
+uint8_t nic_rx_header(uint16_t ring_ptr)
 {
 	uint16_t buffer = (uint16_t) &rx_headers[0];
 	SFR_NIC_DATA_U16LE = buffer;
 	SFR_NIC_RING_U16LE = ring_ptr;
 	SFR_NIC_CTRL = 1;
-	do { } while (SFR_NIC_CTRL != 0);
+	return nic_wait(ring_ptr);
 }
 
 
@@ -485,8 +706,9 @@ void nic_rx_header(uint16_t ring_ptr)
  * the description of the packet must be in the rx_headers data structure
  * data will be returned in the xmem buffer points to
  * ring_ptr is the current position of the RX Ring on the ASIC side
+ * Returns 1 if the transfer timed out
  */
-void nic_rx_packet(register uint16_t buffer, register uint16_t ring_ptr)
+uint8_t nic_rx_packet(register uint16_t buffer, register uint16_t ring_ptr)
 {
 	SFR_NIC_DATA_U16LE = buffer;
 	SFR_NIC_RING_U16LE = ring_ptr;
@@ -499,14 +721,15 @@ void nic_rx_packet(register uint16_t buffer, register uint16_t ring_ptr)
 	print_short(len);
 #endif
 	SFR_NIC_CTRL = len;
-	do { } while (SFR_NIC_CTRL != 0);
+	return nic_wait(ring_ptr);
 }
 
 
 /*
  * Transfers data in XMEM to the ASIC for transmission by the nic
+ * Returns 1 if the transfer timed out
  */
-void nic_tx_packet(uint16_t ring_ptr)
+uint8_t nic_tx_packet(uint16_t ring_ptr)
 {
 //	uint16_t buffer = (uint16_t) tx_buf;
 	uint16_t buffer = (uint16_t) uip_buf + VLAN_TAG_SIZE;
@@ -520,7 +743,7 @@ void nic_tx_packet(uint16_t ring_ptr)
 	len += 0xf;
 	len >>= 3;
 	SFR_NIC_CTRL = len;
-	do { } while (SFR_NIC_CTRL != 0);
+	return nic_wait(ring_ptr);
 }
 
 
@@ -564,8 +787,7 @@ void sds_read(uint8_t sds_id, uint8_t page, uint8_t reg)
 	SFR_93 = reg;			// 93
 	SFR_94 = page << 1 | sds_id;	// 94
 	SFR_EXEC_GO = SFR_EXEC_READ_SDS;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg);
 
 #ifdef REGDBG
 	write_char(':'); print_byte(SFR_DATA_8); print_byte(SFR_DATA_0); write_char(' ');
@@ -588,8 +810,7 @@ void sds_write_v(uint8_t sds_id, uint8_t page, uint8_t reg, uint16_t v)
 	SFR_93 = reg;
 	SFR_94 = page << 1 | sds_id;
 	SFR_EXEC_GO = SFR_EXEC_WRITE_SDS;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg);
 }
 
 
@@ -658,8 +879,7 @@ void read_reg_timer(uint32_t * tmr)
 	uint8_t * val = (uint8_t *)tmr;
 	SFR_REG_ADDR_U16 = RTL837X_REG_SEC_COUNTER;
 	SFR_EXEC_GO = SFR_EXEC_READ_REG;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(RTL837X_REG_SEC_COUNTER);
 	*val++ = SFR_DATA_0;
 	*val++ = SFR_DATA_8;
 	*val++ = SFR_DATA_16;
@@ -813,10 +1033,9 @@ uint8_t sfp_read_reg(uint8_t slot, uint8_t reg)
 	// Execute I2C Read
 	reg_bit_set(RTL837X_REG_I2C_CTRL, 0);
 
-	// Wait for execution to finish
-	do {
-		reg_read_m(RTL837X_REG_I2C_CTRL);
-	} while (sfr_data[3] & 0x1);
+	// Wait for execution to finish, a missing module reads as erased EEPROM
+	if (reg_wait(RTL837X_REG_I2C_CTRL, 3, 0x1, WAIT_I2C))
+		return 0xff;
 
 	reg_read_m(RTL837X_REG_I2C_OUT);
 	return sfr_data[3];
@@ -850,8 +1069,9 @@ void tcpip_output(void)
 	write_char('\n');
 #endif
 
-	// Move data over from xmem buffer to ASIC side using DMA
-	nic_tx_packet(ring_ptr);
+	// Move data over from xmem buffer to ASIC side using DMA, drop the packet if that fails
+	if (nic_tx_packet(ring_ptr))
+		return;
 
 	// New position of the ring-pointer on the NIC-side indicates number of bytes transmitted
 	reg_read_m(RTL837X_REG_NIC_TX_CURR_PKT);
@@ -870,7 +1090,11 @@ void handle_rx(void)
 		uint16_t ring_ptr = ((uint16_t)sfr_data[2]) << 8;
 		ring_ptr |= sfr_data[3];
 		ring_ptr <<= 3;
-		nic_rx_header(ring_ptr);
+		// Drop what the DMA did not transfer
+		if (nic_rx_header(ring_ptr)) {
+			REG_SET(RTL837X_REG_NIC_RXCMD, 1);
+			return;
+		}
 #ifdef RXTXDBG
 		__xdata uint8_t *ptr = rx_headers;
 		print_string("RX on port "); print_byte(rx_headers[3] & 0xf);
@@ -880,7 +1104,10 @@ void handle_rx(void)
 			write_char(' ');
 		}
 #endif
-		nic_rx_packet((uint16_t) &uip_buf[0], ring_ptr + 8);
+		if (nic_rx_packet((uint16_t) &uip_buf[0], ring_ptr + 8)) {
+			REG_SET(RTL837X_REG_NIC_RXCMD, 1);
+			return;
+		}
 
 #ifdef RXTXDBG
 		print_string("\n<< ");
@@ -925,9 +1152,9 @@ void handle_rx(void)
 				uip_arp_ipin();	// Learn MAC addresses in TCP packets
 				uip_input();
 				if (uip_len) {
-					// Add ethernet frame
+					// Add ethernet frame, larger TCP segments go out as two halves
 					uip_arp_out();
-					tcpip_output();
+					uip_split_output();
 				}
 			}
 		} else {
@@ -948,7 +1175,7 @@ void handle_tx(void)
 			write_char('.'); print_short(i);
 #endif
 			uip_arp_out();
-			tcpip_output();
+			uip_split_output();
 		}
 	}
 	for(uint8_t i = 0; i < UIP_UDP_CONNS; i++) {
@@ -1008,98 +1235,137 @@ bool gpio_pin_test(uint8_t pin)
 }
 
 
+/*
+ * Records a change of the switch state in the given STATE_ sections
+ * Each change starts a new generation of the state, clients waiting
+ * on /events.json compare generations to find out what changed
+ */
+void state_changed(uint8_t sections)
+{
+	state_gen++;
+	for (uint8_t i = 0; i < STATE_SECTIONS; i++) {
+		if (sections & (1 << i))
+			state_section_gen[i] = state_gen;
+	}
+}
+
+
+// Marks the start of a boot phase
+void boot_phase(__code char *name)
+{
+	if (boot_phases >= BOOT_PHASES_MAX)
+		return;
+	boot_phase_name[boot_phases] = name;
+	boot_phase_tick[boot_phases++] = ticks;
+}
+
+
+// Prints the boot phases with the tick at which they started and their duration
+void boot_phase_print(void)
+{
+	print_string("\nBoot phase    Start       Ticks\n");
+	for (uint8_t i = 0; i < boot_phases; i++) {
+		print_string(boot_phase_name[i]);
+		for (uint8_t l = strlen(boot_phase_name[i]); l < 14; l++)
+			write_char(' ');
+		print_long(boot_phase_tick[i]);
+		if (i + 1 < boot_phases) {
+			write_char(' ');
+			print_long(boot_phase_tick[i + 1] - boot_phase_tick[i]);
+		}
+		write_char('\n');
+	}
+}
+
+
 void handle_sfp(void)
 {
 	for (uint8_t sfp = 0; sfp < machine.n_sfp; sfp++) {
 		if (!gpio_pin_test(machine.sfp_port[sfp].pin_detect)) {
 			if (sfp_pins_last & (0x1 << (sfp << 2))) {
 				sfp_pins_last &= ~(0x01 << (sfp << 2));
-				print_string("\n<MODULE INSERTED>  Slot: "); write_char('1' + sfp);
 				// Read Reg 11: Encoding, see SFF-8472 and SFF-8024
 				// Read Reg 12: Signalling rate (including overhead) in 100Mbit: 0xd: 1Gbit, 0x67:10Gbit
 				delay(100); // Delay, because some modules need time to wake up
-				uint8_t rate = sfp_read_reg(sfp, 12);
-				print_string("  Rate: "); print_byte(rate);  // Normally 1, but 0 for DAC, can be ignored?
-				print_string("  Encoding: "); print_byte(sfp_read_reg(sfp, 11));
-				print_string("  Module: "); sfp_print_info(sfp);
-				print_string("\n");
+				uint8_t rate = sfp_read_reg(sfp, 12);  // Normally 1, but 0 for DAC, can be ignored?
+				LOG(LOG_SFP, LOG_INFO, LOG_MSG_SFP_INSERTED, sfp + 1, ((uint16_t)rate << 8) | sfp_read_reg(sfp, 11));
 				sfp_options[sfp] = sfp_read_reg(sfp, 92);
 				sfp_get_info(sfp);
 				sds_config(machine.sfp_port[sfp].sds, sfp_rate_to_sds_config(rate));
+				state_changed(STATE_SFP);
 			}
 		} else {
 			if (!(sfp_pins_last & (0x1 << (sfp << 2)))) {
 				sfp_pins_last |= 0x01 << (sfp << 2);
-				print_string("\n<MODULE REMOVED>  Slot: "); write_char('1' + sfp); write_char('\n');
+				LOG(LOG_SFP, LOG_INFO, LOG_MSG_SFP_REMOVED, sfp + 1, 0);
+				state_changed(STATE_SFP);
 			}
 		}
 
 		if (!gpio_pin_test(machine.sfp_port[sfp].pin_los)) {
 			if (sfp_pins_last & (0x2 << (sfp << 2))) { // 0x2 0x08
 				sfp_pins_last &= ~(0x02 << (sfp << 2));
-				print_string("\n<SFP-RX OK>  Slot: "); write_char('1' + sfp); write_char('\n');
+				LOG(LOG_SFP, LOG_INFO, LOG_MSG_SFP_RX_OK, sfp + 1, 0);
+				state_changed(STATE_SFP);
 			}
 		} else {
 			if (!(sfp_pins_last & 0x2 << (sfp << 2))) {
 				sfp_pins_last |= 0x02 << (sfp << 2);
-				print_string("\n<SFP-RX LOS>  Slot: "); write_char('1' + sfp); write_char('\n');
+				LOG(LOG_SFP, LOG_WARN, LOG_MSG_SFP_RX_LOS, sfp + 1, 0);
+				state_changed(STATE_SFP);
 			}
 		}
 	}
 }
 
-//
-// An idle function that sleeps for 1 tick and does all the house-keeping
-//
-void idle(void)
+// Moves the second counter of the switch on once a second has passed
+static void task_seconds(void)
 {
-	PCON |= 1;
-	if (sec_counter >= SYS_TICK_HZ) {
-		sec_counter -= SYS_TICK_HZ;
-		reg_read_m(RTL837X_REG_SEC_COUNTER);
-		uint8_t v = sfr_data[3];
+	if (sec_counter < SYS_TICK_HZ)
+		return;
+	sec_counter -= SYS_TICK_HZ;
+	reg_read_m(RTL837X_REG_SEC_COUNTER);
+	uint8_t v = sfr_data[3];
 #ifdef DEBUG
-		print_string("  Tick counter: "); print_long(ticks); write_char('\n');
+	print_string("  Tick counter: "); print_long(ticks); write_char('\n');
 #endif
+	v++;
+	sfr_data[3] = v;
+	if (!v) {
+		v = sfr_data[2];
 		v++;
-		sfr_data[3] = v;
+		sfr_data[2] = v;
 		if (!v) {
-			v = sfr_data[2];
+			v = sfr_data[1];
 			v++;
-			sfr_data[2] = v;
+			sfr_data[1] = v;
 			if (!v) {
-				v = sfr_data[1];
+				v = sfr_data[0];
 				v++;
-				sfr_data[1] = v;
-				if (!v) {
-					v = sfr_data[0];
-					v++;
-					sfr_data[0] = v;
-				}
+				sfr_data[0] = v;
 			}
 		}
-		reg_write_m(RTL837X_REG_SEC_COUNTER);
-		reg_read_m(RTL837X_REG_SEC_COUNTER);
+	}
+	reg_write_m(RTL837X_REG_SEC_COUNTER);
+	reg_read_m(RTL837X_REG_SEC_COUNTER);
 #ifdef DEBUG
-		print_sfr_data();
-		write_char('\n');
+	print_sfr_data();
+	write_char('\n');
 #endif
-	}
+}
+
 
-	// Check for Link changes
+// Checks for link changes
+static void task_links(void)
+{
 	reg_read_m(RTL837X_REG_LINKS_89);
 	__xdata uint8_t linkbits_p89 = sfr_data[3];
 
 	reg_read_m(RTL837X_REG_LINKS);
 	if (cmp_4(sfr_data, linkbits_last) || (linkbits_p89 != linkbits_last_p89)) {
-		print_string("\n<new link: ");
-		print_byte(linkbits_p89); print_byte(sfr_data[0]); print_byte(sfr_data[1]);
-		print_byte(sfr_data[2]); print_byte(sfr_data[3]);
-		print_string(", was ");
-		print_byte(linkbits_last_p89); print_byte(linkbits_last[0]); print_byte(linkbits_last[1]);
-		print_byte(linkbits_last[2]); print_byte(linkbits_last[3]);
-		print_string(">\n");
+		LOG(LOG_PHY, LOG_INFO, LOG_MSG_PHY_LINK, SFR_DATA_U32, linkbits_p89);
 		linkbits_last_p89 = linkbits_p89;
+		state_changed(STATE_LINK);
 		if (!machine.isRTL8373 && machine.n_sfp != 2) {
 			uint8_t p5 = sfr_data[2] >> 4;
 			uint8_t p5_last = linkbits_last[2] >> 4;
@@ -1115,35 +1381,326 @@ void idle(void)
 			cpy_4(linkbits_last, sfr_data);
 		}
 	}
-
-	// Check for changes with SFP modules
-	handle_sfp();
-
 	/* Button pressed on KL-8xhm-x2:
 	reg_read(RTL837X_REG_GPIO_32_63_INPUT);
 	if (!(sfr_data[2] & 0x40))
 		print_string("Button pressed\n");
 	*/
-	// Check new Packets RX
-	handle_rx();
-	// Check UIP for packets to transmit
-	handle_tx();
-	// If STP protocol enabled, decrease STP timers to trigger actions
-	if (stpEnabled) {
-		if (!stp_clock) {
-			stp_clock = STP_TICK_DIVIDER;
-			stp_timers();
-		} else {
-			stp_clock--;
+}
+
+
+// Checks for changes with SFP modules, once I2C is set up
+static void task_sfp(void)
+{
+	if (boot_step > BOOT_STEP_SFP)
+		handle_sfp();
+}
+
+
+// Executes a command waiting in the cmd_buffer
+static void task_cmd(void)
+{
+	if (!cmd_available)
+		return;
+	serial_wait = 1;
+	// Output of a command from /cmd goes into the response instead
+	cmd_out_len = 0;
+	cmd_capture = cmd_available == CMD_HTTP && cmd_out;
+	cmd_source = cmd_available;
+	cmd_available = 0;
+	if (!cmd_tokenize())
+		cmd_parser();
+	// The request gave up while the command was running
+	if (cmd_capture && !cmd_conn)
+		cmd_out_free();
+	cmd_capture = 0;
+	print_string("\n> ");
+	serial_wait = 0;
+}
+
+
+static void task_cpu(void);
+static void timer_run(void);
+
+/*
+ * The tasks of idle() in the order of their priority. Tasks of the network
+ * path come first and always run. The others are put off to the next pass
+ * once a pass has taken more than SCHED_PASS_BUDGET
+ */
+__code struct task tasks[N_TASKS] = {
+	{ "rx",		handle_rx,	0, 0, SCHED_COUNTS(2000) },
+	{ "tx",		handle_tx,	0, 0, SCHED_COUNTS(1000) },
+	{ "links",	task_links,	1, 1, SCHED_COUNTS(200) },
+	{ "timers",	timer_run,	0, 1, SCHED_COUNTS(500) },
+	{ "seconds",	task_seconds,	1, 2, SCHED_COUNTS(200) },
+	{ "cpu",	task_cpu,	SYS_TICK_HZ, 2, SCHED_COUNTS(200) },
+	{ "cmd",	task_cmd,	0, 2, 0 },
+	{ "sfp",	task_sfp,	SYS_TICK_HZ / 10, 3, SCHED_COUNTS(2000) },
+	{ "boot",	boot_deferred,	1, 3, 0 },
+};
+
+__xdata struct task_stat task_stat[N_TASKS];
+
+/*
+ * Timer service: a hashed timing wheel with a slot per tick. Arming and
+ * cancelling a timer are O(1), each tick only the timers in its slot are
+ * looked at, those that are more than a turn of the wheel ahead stay
+ */
+__xdata struct timer *timer_wheel[TIMER_SLOTS];
+__xdata uint32_t timer_tick;	// Tick up to which the wheel has been served
+__xdata struct timer arp_timer;
+extern __xdata struct timer stp_hello_timer;
+extern __xdata struct timer dhcp_timer;
+
+
+/*
+ * Empties the wheel and disarms the timers, XMEM is not cleared by a
+ * reset. Must be called once ticks has been set
+ */
+void timer_init(void)
+{
+	for (uint8_t i = 0; i < TIMER_SLOTS; i++)
+		timer_wheel[i] = 0;
+	timer_tick = ticks_now();
+	memset((__xdata uint8_t *)&arp_timer, 0, sizeof(struct timer));
+	memset((__xdata uint8_t *)&stp_hello_timer, 0, sizeof(struct timer));
+	memset((__xdata uint8_t *)&dhcp_timer, 0, sizeof(struct timer));
+}
+
+
+// Arms timer t to expire delay ticks from now, re-arming an armed timer
+void timer_arm(__xdata struct timer *t, uint32_t delay)
+{
+	__xdata struct timer **slot;
+
+	timer_cancel(t);
+	if (!delay)
+		delay = 1;
+	t->expires = ticks_now() + delay;
+	t->fired = 0;
+	// Timers due in a tick already served go into the next one
+	if ((int32_t)(t->expires - timer_tick) <= 0)
+		t->expires = timer_tick + 1;
+	slot = &timer_wheel[t->expires & (TIMER_SLOTS - 1)];
+	t->next = *slot;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = slot;
+	*slot = t;
+}
+
+
+void timer_cancel(__xdata struct timer *t)
+{
+	if (!t->pprev)
+		return;
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->pprev = 0;
+}
+
+
+// Returns the ticks until timer t expires, 0 if it is not armed
+uint32_t timer_left(__xdata struct timer *t)
+{
+	uint32_t left = t->expires - ticks_now();
+
+	if (!t->pprev || (int32_t)left <= 0)
+		return 0;
+	return left;
+}
+
+
+// Serves the slots of the ticks that passed since the last run
+static void timer_run(void)
+{
+	__xdata struct timer *t, *next;
+	__xdata uint32_t now = ticks_now();
+
+	while ((int32_t)(now - timer_tick) > 0) {
+		timer_tick++;
+		for (t = timer_wheel[timer_tick & (TIMER_SLOTS - 1)]; t; t = next) {
+			next = t->next;
+			// Skips timers a callback has cancelled and those a turn ahead
+			if (!t->pprev || t->expires != timer_tick)
+				continue;
+			timer_cancel(t);
+			t->fired = 1;
+			// The callback may arm the timer again
+			if (t->fn)
+				t->fn();
 		}
 	}
-	// Check whether a command is waiting in the cmd_buffer and execute
-	if (cmd_available) {
-		cmd_available = 0;
-		if (!cmd_tokenize())
-			cmd_parser();
-		print_string("\n> ");
+}
+
+
+static void arp_age(void)
+{
+	uip_arp_timer();
+	timer_arm(&arp_timer, ARP_AGE_TICKS);
+}
+
+
+/*
+ * CPU load: the time idle() sleeps is counted as idle, everything else,
+ * including delay(), as busy. task_cpu() turns it into the busy
+ * percentage of each second
+ */
+__xdata uint32_t cpu_idle;		// Counts of timer 2 spent sleeping in idle()
+__xdata uint32_t cpu_idle_last;
+__xdata uint32_t cpu_clock_last;
+__xdata uint8_t cpu_load[CPU_LOAD_SECONDS];
+__xdata uint8_t cpu_load_idx;
+__xdata uint8_t cpu_load_seconds;	// Entries of cpu_load recorded so far
+__xdata uint32_t cpu_missed;		// Ticks that passed without a pass of idle()
+__xdata uint32_t cpu_pass_tick;		// Tick of the last pass
+__xdata uint32_t cpu_latency;		// Longest pass in the last second
+__xdata uint32_t cpu_latency_max;	// Longest pass since boot
+__xdata uint32_t cpu_latency_cur;
+
+
+/*
+ * Returns the time since boot in counts of timer 2, which runs at
+ * CLOCK_HZ / 12 and overflows with each tick
+ */
+static uint32_t sched_clock(void)
+{
+	uint32_t t;
+	uint16_t c;
+	uint8_t h;
+
+	__critical {
+		do {
+			h = TH2;
+			c = TL2 | (TH2 << 8);
+		} while (h != (c >> 8));
+		t = ticks;
+		// The overflow may be waiting for the interrupt to count it
+		if ((T2CON & 0x80) && c - SYSTICK_TIMER2_VALUE < TIMER2_DIV / 2)
+			t++;
 	}
+	return t * TIMER2_DIV + (uint16_t)(c - SYSTICK_TIMER2_VALUE);
+}
+
+
+// Converts counts of timer 2 to microseconds
+uint32_t sched_us(uint32_t counts)
+{
+	return counts * 12 / (CLOCK_HZ / 1000000);
+}
+
+
+// Records the busy percentage of the second that has passed
+static void task_cpu(void)
+{
+	__xdata uint32_t now = sched_clock();
+	__xdata uint32_t elapsed = now - cpu_clock_last;
+	__xdata uint32_t idle = cpu_idle - cpu_idle_last;
+
+	cpu_clock_last = now;
+	cpu_idle_last = cpu_idle;
+	cpu_load_idx = (cpu_load_idx + 1) % CPU_LOAD_SECONDS;
+	cpu_load[cpu_load_idx] = elapsed >= 100 && idle < elapsed ? (elapsed - idle) / (elapsed / 100) : 0;
+	if (cpu_load_seconds < CPU_LOAD_SECONDS)
+		cpu_load_seconds++;
+	cpu_latency = cpu_latency_cur;
+	cpu_latency_cur = 0;
+}
+
+
+/*
+ * Returns the average busy percentage of the last seconds, at most
+ * CPU_LOAD_SECONDS. After boot only the seconds recorded so far count
+ */
+uint8_t cpu_load_avg(uint8_t seconds)
+{
+	uint16_t sum = 0;
+	uint8_t i = cpu_load_idx;
+
+	if (seconds > cpu_load_seconds)
+		seconds = cpu_load_seconds;
+	if (!seconds)
+		return 0;
+	for (uint8_t n = 0; n < seconds; n++) {
+		sum += cpu_load[i];
+		i = i ? i - 1 : CPU_LOAD_SECONDS - 1;
+	}
+	return sum / seconds;
+}
+
+
+// Clears the CPU load accounting, XMEM is not cleared by a reset
+static void cpu_load_init(void)
+{
+	cpu_idle = cpu_idle_last = cpu_clock_last = 0;
+	cpu_load_idx = cpu_load_seconds = 0;
+	cpu_missed = cpu_pass_tick = 0;
+	cpu_latency = cpu_latency_max = cpu_latency_cur = 0;
+}
+
+
+// Runs the tasks that are due and accounts for the time they take
+static void sched_run(void)
+{
+	__xdata uint32_t start = sched_clock();
+	__xdata uint32_t t0, t, now;
+
+#ifdef WATCHDOG_SECONDS
+	/*
+	 * Kick the watchdog. There is no documented hardware watchdog, so
+	 * the timer 2 interrupt watches the passes
+	 */
+	watchdog_ticks = 0;
+#endif
+
+	// A pass is due with every tick
+	now = ticks_now();
+	t = now;
+	if (cpu_pass_tick && (int32_t)(t - cpu_pass_tick) > 1)
+		cpu_missed += t - cpu_pass_tick - 1;
+	cpu_pass_tick = t;
+
+	for (uint8_t i = 0; i < N_TASKS; i++) {
+		__code struct task *k = &tasks[i];
+		__xdata struct task_stat *s = &task_stat[i];
+
+		if (k->period && (int32_t)(now - s->due) < 0)
+			continue;
+		t0 = sched_clock();
+		if (k->prio > SCHED_PRIO_NET && t0 - start > SCHED_PASS_BUDGET) {
+			s->deferred++;
+			continue;
+		}
+		if (k->period)
+			s->due = now + k->period;
+		k->run();
+		t = sched_clock() - t0;
+		s->runs++;
+		s->total += t;
+		if (t > s->max)
+			s->max = t;
+		if (k->budget && t > k->budget)
+			s->over++;
+	}
+	t = sched_clock() - start;
+	if (t > cpu_latency_cur)
+		cpu_latency_cur = t;
+	if (t > cpu_latency_max)
+		cpu_latency_max = t;
+}
+
+
+//
+// An idle function that sleeps for 1 tick and runs the tasks that are due
+//
+void idle(void)
+{
+	__xdata uint32_t t = sched_clock();
+
+	PCON |= 1;
+	cpu_idle += sched_clock() - t;
+	sched_run();
 }
 
 
@@ -1162,6 +1719,14 @@ void sleep(uint16_t t)
 
 void reset_chip(void)
 {
+	// A reset from /cmd: what is left goes to the serial console
+	cmd_capture = 0;
+	// Let the transmitter send what is left in the ring, interrupts may be off
+	while (!tx_buf_empty) {
+		__critical {
+			serial_tx_poll();
+		}
+	}
 	REG_SET(RTL837X_REG_RESET, 1);
 	while(1);
 }
@@ -1233,8 +1798,7 @@ void phy_write_mask(uint16_t phy_mask, uint8_t dev_id, uint16_t reg, uint16_t v)
 	SFR_SMI_REG_U16 = reg;			// SFR_C2, SFR_C3
 	SFR_SMI_DEV = (phy_mask >> 8) | dev_id  << 3 | 2; // SFR_C4: bit 2 can also be set for some option
 	SFR_EXEC_GO = SFR_EXEC_WRITE_SMI;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg);
 }
 
 /*
@@ -1253,8 +1817,7 @@ void phy_write(uint8_t phy_id, uint8_t dev_id, uint16_t reg, uint16_t v)
 	SFR_SMI_REG_U16 = reg;			// SFR_C2, SFR_C3
 	SFR_SMI_DEV = (phy_mask >> 8) | dev_id  << 3 | 2; // SFR_C4: bit 2 can also be set for some option
 	SFR_EXEC_GO = SFR_EXEC_WRITE_SMI;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg);
 }
 
 
@@ -1274,8 +1837,7 @@ void phy_read(uint8_t phy_id, uint8_t dev_id, uint16_t reg)
 	SFR_SMI_DEV = dev_id << 3 | 2;	// c4
 
 	SFR_EXEC_GO = SFR_EXEC_READ_SMI;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg);
 #ifdef REGDBG
 	print_byte(SFR_DATA_8); print_byte(SFR_DATA_0); write_char(' ');
 #endif
@@ -1298,8 +1860,7 @@ void phy_modify(uint8_t phy_id, uint8_t dev_id, uint16_t reg, uint16_t mask, uin
 	SFR_SMI_PHY = phy_id;		// a5
 	SFR_SMI_DEV = smi_phy;		// c4
 	SFR_EXEC_GO = SFR_EXEC_READ_SMI;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg);
 
 	// Modify the reed data.
 	// TODO: Check if we directly can modify SFR register directly.
@@ -1314,8 +1875,7 @@ void phy_modify(uint8_t phy_id, uint8_t dev_id, uint16_t reg, uint16_t mask, uin
 	SFR_SMI_PHYMASK = phy_mask;		// SFR_C5
 	SFR_SMI_DEV = smi_phy | (phy_mask >> 8);
 	SFR_EXEC_GO = SFR_EXEC_WRITE_SMI;
-	do {
-	} while (SFR_EXEC_STATUS != 0);
+	sfr_exec_wait(reg);
 }
 
 void nic_setup(void)
@@ -1522,7 +2082,7 @@ void rtl8373_init(void)
 {
 	print_string("\nrtl8373_init called\n");
 
-	led_config_9xh();
+	// The LEDs are configured by boot_deferred()
 	sds_init();
 	// Disable all SERDES for configuration
 	REG_SET(RTL837X_REG_SDS_MODES, 0x000037ff);
@@ -1605,8 +2165,7 @@ void rtl8372_init(void)
 {
 	print_string("\nrtl8372_init called\n");
 
-	led_config();
-
+	// The LEDs are configured by boot_deferred()
 	sds_init();
 	phy_config(8);	// PHY configuration: External 8221B?
 	phy_config(3);	// PHY configuration: all internal PHYs?
@@ -1753,6 +2312,7 @@ void setup_serial_timer1(void)
 	RI = 0; // Clear RI-interrupt flag
 
 	tx_buf_empty = 1; // Set tx `serial buffer is empty`-software flag.
+	tbuf_head = tbuf_tail = 0;
 
 	ES = 1; // Enable serial IRQ
 }
@@ -1775,10 +2335,64 @@ void setup_i2c(void)
 }
 
 
+// Performs the next step of the deferred initialization
+void boot_deferred(void)
+{
+	switch (boot_step) {
+	case BOOT_STEP_LED:
+		boot_phase("leds");
+		if (machine.isRTL8373)
+			led_config_9xh();
+		else
+			led_config();
+		// The LED mode register also holds the state of the system LED
+		set_sys_led_state(SYS_LED_ON);
+		break;
+	case BOOT_STEP_SFP:
+		// SFP modules are detected by handle_sfp() from now on
+		boot_phase("sfp");
+		setup_i2c();
+		break;
+	case BOOT_STEP_REPORT:
+		boot_phase("report");
+		serial_wait = 1;
+		print_string("\nClock register: ");
+		print_reg(0x6040);
+		print_string("\nRegister 0x7b20/RTL837X_REG_SDS_MODES: ");
+		print_reg(0x7b20);
+
+		print_string("\nVerifying PHY settings:\n");
+//	p031f.a610:2058 p041f.a610:2058  p051f.a610:2058  r4f3c:00000000 p061f.a610:2058 p071f.a610:2058 
+		port_stats_print();
+		boot_phase("done");
+		boot_phase_print();
+		print_string("\n> ");
+		serial_wait = 0;
+		break;
+	default:
+		return;
+	}
+	boot_step++;
+}
+
+
 void bootloader(void)
 {
 	ticks = 0;
-	stp_clock = STP_TICK_DIVIDER;
+	timer_init();
+	cpu_load_init();
+#ifdef WATCHDOG_SECONDS
+	// XMEM is not cleared by a reset, the watchdog must not fire while booting
+	watchdog_armed = 0;
+	watchdog_ticks = 0;
+#endif
+	// Nothing of the boot log is dropped
+	serial_wait = 1;
+	// The console is not captured for /cmd, XMEM is not cleared by a reset
+	cmd_capture = 0;
+	cmd_out_len = 0;
+	boot_phases = 0;
+	boot_step = BOOT_STEP_LED;
 	dhcp_state.state = DHCP_OFF;
 	sbuf_ptr = 0;
 
@@ -1804,14 +2418,20 @@ void bootloader(void)
 
 	// Flash controller should be initialized before any code in other banks is being fetched
 	// See this issue: https://github.com/logicog/RTLPlayground/issues/70
+	boot_phase("flash");
 	print_string("\nInitializing Flash controller\n");
 	flash_init(1);
+	log_init();
+	arena_init();
+	// No transaction survives a reset
+	txn_cancel();
 
 	// Set default for SFP pins so we can start up a module already inserted
 	sfp_pins_last = 0x33; // signal LOS and no module inserted (for both slots, even if only 1 present)
 	// We have not detected any link
 	linkbits_last[0] = linkbits_last[1] = linkbits_last[2] = linkbits_last[3] = linkbits_last_p89 = 0;
 
+	boot_phase("cpu");
 	print_string("Detecting CPU: ");
 	reg_read_m(0x4);
 	if (sfr_data[1] == 0x73) { // Register was 0x83730000
@@ -1829,36 +2449,39 @@ void bootloader(void)
 	print_sw_version();
 
 	// Reset NIC
+	boot_phase("nic");
 	reg_bit_set(RTL837X_REG_RESET, RESET_NIC_BIT);
-	do {
-		reg_read(RTL837X_REG_RESET);
-	} while (SFR_DATA_0 & (1 << RESET_NIC_BIT));
-	print_string("NIC reset\n");
+	if (reg_wait(RTL837X_REG_RESET, 3, 1 << RESET_NIC_BIT, WAIT_RESET))
+		print_string("NIC reset timed out\n");
+	else
+		print_string("NIC reset\n");
 
 	uip_ipaddr(&uip_hostaddr, ownIP[0], ownIP[1], ownIP[2], ownIP[3]);
 	uip_ipaddr(&uip_draddr, gatewayIP[0], gatewayIP[1], gatewayIP[2], gatewayIP[3]);
 	uip_ipaddr(&uip_netmask, netmask[0], netmask[1], netmask[2], netmask[3]);
 
 	REG_SET(RTL837X_PIN_MUX_2, 0x0); // Disable pins for ACL
+	boot_phase("smi");
 	init_smi();
 	rtl8373_revision();
+	boot_phase("asic");
 	if (machine.isRTL8373)
 		rtl8373_init();
 	else
 		rtl8372_init();
-	delay(1000);
+	// Instead of waiting here, the boot up to the configuration overlaps with the PHYs settling
+	__xdata uint32_t settled = ticks_now() + BOOT_SETTLE_TICKS;
 
 	// Check update in progress and move blocks
+	boot_phase("update");
 	flash_region.addr = FIRMWARE_UPLOAD_START;
 	flash_region.len = 0x100;
-	flash_read_bulk(flash_buf);
+	flash_read_spi(flash_buf);
 
 	if (flash_buf[0] == 0x00 && flash_buf[1] == 0x40) {
 		__xdata uint32_t dest = 0x0;
 		__xdata uint32_t source = FIRMWARE_UPLOAD_START;
 		__xdata uint16_t i = 0;
-		__xdata uint16_t j = 0;
-		__xdata uint8_t * __xdata bptr;
 		print_string("Identified update image. Checking integrity...");
 
 		flash_init(0); // Re-initialize flash for non-DIO operation, otherwise flashing will fail
@@ -1868,13 +2491,8 @@ void bootloader(void)
 		for (i = 0; i < 1024; i++) {
 			flash_region.addr = source;
 			flash_region.len = 0x200;
-			flash_read_bulk(flash_buf);
-			bptr = flash_buf;
-			for (j = 0; j < 0x200; j++) {
-			//	print_byte(*bptr); write_char(' ');
-				crc16(bptr++);
-			//	print_short(crc_value); write_char(':');
-			}
+			flash_read_spi(flash_buf);
+			crc16_block(flash_buf, 0x200);
 			source += 0x200;
 			// write_char('\n'); print_short(crc_value); write_char(' ');
 			if (i%16 == 0)
@@ -1891,7 +2509,7 @@ void bootloader(void)
 				// print_short(dest);
 				flash_region.addr = source;
 				flash_region.len = 0x200;
-				flash_read_bulk(flash_buf);
+				flash_read_spi(flash_buf);
 				if (!(i & 0x7)) {
 					flash_region.addr = dest;
 					flash_sector_erase();
@@ -1944,32 +2562,33 @@ void bootloader(void)
 	print_reg(RTL837X_REG_SEC_COUNTER);
 #endif
 	stpEnabled = 0;
+	boot_phase("switch");
 	nic_setup();
 	vlan_setup();
 	port_l2_setup();
 	igmp_setup();
+	boot_phase("network");
 	uip_init();
 	uip_arp_init();
+	arp_timer.fn = arp_age;
+	timer_arm(&arp_timer, ARP_AGE_TICKS);
 	httpd_init();
 
 	management_vlan = 0; // Disabled
 
-	setup_i2c();
-
 	print_string(greeting);
 
-	print_string("\nClock register: ");
-	print_reg(0x6040);
-	print_string("\nRegister 0x7b20/RTL837X_REG_SDS_MODES: ");
-	print_reg(0x7b20);
-
-	print_string("\nVerifying PHY settings:\n");
-//	p031f.a610:2058 p041f.a610:2058  p051f.a610:2058  r4f3c:00000000 p061f.a610:2058 p071f.a610:2058 
-	port_stats_print();
-
+	// The configuration programs the PHYs and SerDes, they must have settled
+	boot_phase("settle");
+	__xdata int32_t settle = settled - ticks_now();
+	if (settle > 0)
+		delay(settle);
+	boot_phase("config");
 	execute_config();
+	boot_phase("ready");
 	print_string("\n> ");
 	idle_ready = 1;
+	serial_wait = 0;
 
 	set_sys_led_state(SYS_LED_ON);
 
@@ -1979,11 +2598,17 @@ void bootloader(void)
 	__xdata uint8_t l = sbuf_ptr; // We have printed out entered characters until l
 	__xdata uint8_t line_start = sbuf_ptr; // This is where the current line starts
 	cmd_available = 0;
+#ifdef WATCHDOG_SECONDS
+	// From now on, every pass of the main loop kicks the watchdog
+	watchdog_ticks = 0;
+	watchdog_armed = 1;
+#endif
 	while (1) {
 		while (l != sbuf_ptr) {
 			// If the command buffer is currently in use, we cannot copy to it
 			if (cmd_available)
 				break;
+			serial_wait = 1;
 			write_char(sbuf[l]);
 			// Check whether there is a full line:
 			if (sbuf[l] == '\n' || sbuf[l] == '\r') {
@@ -1999,10 +2624,11 @@ void bootloader(void)
 				// If there is a command we print the prompt after execution
 				// otherwise immediately because there is nothing to execute
 				if (i)
-					cmd_available = 1;
+					cmd_available = CMD_SERIAL;
 				else
 					print_string("\n> ");
 			}
+			serial_wait = 0;
 			l++;
 			l &= (SBUF_SIZE - 1);
 		}
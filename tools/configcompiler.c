@@ -0,0 +1,350 @@
+/*
+ * Creates the first sector of the configuration journal from a text
+ * configuration: the text as it is and its compiled form, which the
+ * firmware applies at boot without parsing the text.
+ * The compiler follows config_compile() in config_store.c
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <argp.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "../config_format.h"
+
+#define SECTOR_SIZE 0x1000
+#define LINE_SIZE 128
+
+uint8_t sector[SECTOR_SIZE];
+uint8_t text[SECTOR_SIZE];
+uint8_t binary[SECTOR_SIZE];
+
+struct arguments {
+	char *output_file;
+	bool verbose;
+};
+
+const char *argp_program_version = "configcompiler 0.1";
+const char *argp_program_bug_address = "https://github.com/logicog/RTLPlayground/issues";
+static char doc[] = "Create the configuration journal sector from a text configuration";
+static char args_doc[] = "configcompiler [options] CONFIG_FILE";
+static struct argp_option options[] = {
+    { "output", 'o', "FILE", 0, "Output file name, default is config.bin"},
+    { "verbose", 'v', 0, OPTION_ARG_OPTIONAL, "Print the entries compiled"},
+    { 0 }
+};
+
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct arguments *arguments = state->input;
+	switch (key) {
+	case 'o':
+		arguments->output_file = arg;
+		break;
+	case 'v':
+		arguments->verbose = true;
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = {
+	options, parse_opt, args_doc, doc, 0, 0, 0
+};
+
+
+uint16_t crc16_update(uint16_t crc, uint8_t a)
+{
+    crc ^= a;
+    for (int i = 0; i < 8; ++i)
+	    crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+
+    return crc;
+}
+
+
+uint16_t crc16(const uint8_t *v, int len)
+{
+	uint16_t crc = 0;
+
+	while (len--)
+		crc = crc16_update(crc, *v++);
+	return crc;
+}
+
+
+static bool is_word(const char *w, const char *s)
+{
+	int l = strlen(s);
+
+	return !strncmp(w, s, l) && (w[l] == ' ' || !w[l]);
+}
+
+
+static bool end_of_word(const char *w)
+{
+	return *w == ' ' || !*w;
+}
+
+
+static const char *next_word(const char *w)
+{
+	while (*w && *w != ' ')
+		w++;
+	while (*w == ' ')
+		w++;
+	return w;
+}
+
+
+static bool number(const char **w, uint16_t *v)
+{
+	if (!isdigit(**w))
+		return false;
+	*v = 0;
+	while (isdigit(**w))
+		*v = *v * 10 + *(*w)++ - '0';
+	return true;
+}
+
+
+static bool ip(const char *w, uint8_t *e)
+{
+	uint16_t v;
+
+	for (int b = 0; b < 4; b++) {
+		if (!number(&w, &v) || v > 255)
+			return false;
+		e[b] = v;
+		if (b < 3 && *w++ != '.')
+			return false;
+	}
+	return end_of_word(w) && !*next_word(w);
+}
+
+
+static bool ports(const char *w, uint8_t *e, char a, char b, bool both)
+{
+	uint16_t p, m1 = 0, m2 = 0;
+
+	while (*w) {
+		if (!number(&w, &p) || !p || p > 16)
+			return false;
+		p = 1 << (p - 1);
+		if (*w == a) {
+			m1 |= p;
+			w++;
+		} else if (*w == b) {
+			m2 |= p;
+			w++;
+		} else {
+			m1 |= p;
+			if (both)
+				m2 |= p;
+		}
+		if (!end_of_word(w))
+			return false;
+		w = next_word(w);
+	}
+	e[0] = m1; e[1] = m1 >> 8;
+	e[2] = m2; e[3] = m2 >> 8;
+	return true;
+}
+
+
+/*
+ * Compiles a command line into an entry at e
+ * Returns the length of the entry
+ */
+static int compile_line(uint8_t *e, const char *line, int n)
+{
+	const char *w = line;
+	const char *w1, *w2;
+	uint16_t v;
+	int i;
+
+	while (*w == ' ')
+		w++;
+	w1 = next_word(w);
+	w2 = next_word(w1);
+	e[1] = 0;
+
+	if (is_word(w, "ip") && is_word(w1, "dhcp") && !*w2) {
+		e[0] = CFG_OP_DHCP;
+		return 2;
+	}
+	if ((is_word(w, "ip") || is_word(w, "gw") || is_word(w, "netmask")) && ip(w1, e + 2)) {
+		e[0] = w[0] == 'i' ? CFG_OP_IP : (w[0] == 'g' ? CFG_OP_GW : CFG_OP_NETMASK);
+		e[1] = 4;
+		return 6;
+	}
+	if (is_word(w, "vlan") && number(&w1, &v) && end_of_word(w1) && *w2) {
+		e[2] = v; e[3] = v >> 8;
+		if (is_word(w2, "mgmt") && !*next_word(w2)) {
+			e[0] = CFG_OP_VLAN_MGMT;
+			e[1] = 2;
+			return 4;
+		}
+		if (ports(w2, e + 4, 'u', 't', false)) {
+			e[4] |= e[6];
+			e[5] |= e[7];
+			e[0] = CFG_OP_VLAN;
+			e[1] = 6;
+			return 8;
+		}
+	}
+	if (is_word(w, "pvid") && isdigit(w1[0]) && w1[0] != '0' && w1[1] == ' '
+	    && number(&w2, &v) && !*next_word(w2)) {
+		e[0] = CFG_OP_PVID;
+		e[1] = 3;
+		e[2] = w1[0] - '0';
+		e[3] = v; e[4] = v >> 8;
+		return 5;
+	}
+	if (is_word(w, "mirror") && is_word(w1, "off") && !*w2) {
+		e[0] = CFG_OP_MIRROR_OFF;
+		return 2;
+	}
+	if (is_word(w, "mirror") && number(&w1, &v) && v && v <= 16 && end_of_word(w1)
+	    && ports(w2, e + 3, 'r', 't', true)) {
+		e[0] = CFG_OP_MIRROR;
+		e[1] = 5;
+		e[2] = v;
+		return 7;
+	}
+	if (is_word(w, "eee") && (is_word(w1, "on") || is_word(w1, "off"))) {
+		e[3] = w1[1] == 'n';
+		if (!*w2) {
+			e[2] = 0;
+		} else if (isdigit(w2[0]) && w2[0] != '0' && end_of_word(w2 + 1) && !*next_word(w2)) {
+			e[2] = w2[0] - '0';
+		} else {
+			goto text;
+		}
+		e[0] = CFG_OP_EEE;
+		e[1] = 2;
+		return 4;
+	}
+	if (is_word(w, "passwd") && *w1 && !*next_word(w1)) {
+		for (i = 0; !end_of_word(w1 + i); i++)
+			e[i + 2] = w1[i];
+		if (i <= 20) {
+			e[0] = CFG_OP_PASSWD;
+			e[1] = i;
+			return i + 2;
+		}
+	}
+text:
+	e[0] = CFG_OP_TEXT;
+	e[1] = n;
+	memcpy(e + 2, line, n);
+	return n + 2;
+}
+
+
+static int compile(const uint8_t *t, int len, uint8_t *b, bool verbose)
+{
+	char line[LINE_SIZE];
+	int l = 0, o = 0;
+
+	for (int i = 0; i <= len; i++) {
+		uint8_t c = i < len ? t[i] : 0;
+		if (c && c != '\n' && c != '\r') {
+			if (l < LINE_SIZE - 1)
+				line[l++] = c;
+			continue;
+		}
+		line[l] = 0;
+		if (l && strspn(line, " ") != l) {
+			int n = compile_line(b + o, line, l);
+			if (verbose) {
+				printf("%-40s ->", line);
+				for (int j = 0; j < n; j++)
+					printf(" %02x", b[o + j]);
+				printf("\n");
+			}
+			o += n;
+		}
+		l = 0;
+		if (!c)
+			break;
+	}
+	return o;
+}
+
+
+/*
+ * Appends a committed record at offset p of the sector
+ * Returns the offset following it
+ */
+static int add_record(int p, uint8_t type, const uint8_t *data, int len, uint16_t src)
+{
+	struct cfg_record r;
+
+	r.magic = type;
+	r.state = CFG_COMMITTED;
+	r.len = len;
+	r.crc = crc16(data, len);
+	r.src = src;
+	memcpy(sector + p, &r, sizeof(r));
+	memcpy(sector + p + sizeof(r), data, len);
+	return p + sizeof(r) + ((len + 3) & ~3);
+}
+
+
+int main(int argc, char **argv)
+{
+	struct arguments arguments;
+	struct cfg_sector s;
+	int arg_index;
+	FILE *f;
+
+	arguments.output_file = "config.bin";
+	arguments.verbose = false;
+
+	argp_parse(&argp, argc, argv, 0, &arg_index, &arguments);
+	if (!argv[arg_index])
+		argp_usage (0);
+
+	f = fopen(argv[arg_index], "rb");
+	if (!f) {
+		printf("Cannot open input file %s\n", argv[arg_index]);
+		return 5;
+	}
+	int text_len = fread(text, 1, sizeof(text), f);
+	fclose(f);
+	// The firmware stops at a 0 as well
+	text_len = strnlen((char *)text, text_len);
+
+	int bin_len = compile(text, text_len, binary, arguments.verbose);
+	if (2 * sizeof(struct cfg_record) + sizeof(s) + text_len + bin_len + 6 > SECTOR_SIZE) {
+		printf("Configuration too large\n");
+		return 5;
+	}
+
+	// Everything not written stays erased flash
+	memset(sector, 0xff, sizeof(sector));
+	memcpy(s.magic, CFG_SECTOR_MAGIC, sizeof(s.magic));
+	s.seq = 1;
+	memcpy(sector, &s, sizeof(s));
+	int p = add_record(sizeof(s), CFG_RECORD_TEXT, text, text_len, 0xffff);
+	p = add_record(p, CFG_RECORD_BINARY, binary, bin_len, crc16(text, text_len));
+	printf("Text: %d bytes, compiled: %d bytes, journal: %d bytes\n", text_len, bin_len, p);
+
+	f = fopen(arguments.output_file, "wb");
+	if (!f) {
+		printf("Cannot open output file %s\n", arguments.output_file);
+		return 5;
+	}
+	if (fwrite(sector, 1, sizeof(sector), f) != sizeof(sector)) {
+		printf("Error writing output file\n");
+		return 5;
+	}
+	fclose(f);
+	return 0;
+}
@@ -25,6 +25,8 @@ struct arguments {
 	char *output_file;
 	bool update;
 	bool verify;
+	bool check;
+	bool tables;
 };
 
 const char *argp_program_version = "crc_calculator 0.1";
@@ -35,6 +37,8 @@ static struct argp_option options[] = {
     { "output", 'o', "FILE", 0, "Output image file name instead of overwriting input image"},
     { "update", 'u', 0, OPTION_ARG_OPTIONAL, "Update the image with the CRC"},
     { "verify", 'v', 0, OPTION_ARG_OPTIONAL, "Verify the CRC of the file"},
+    { "check", 'c', 0, OPTION_ARG_OPTIONAL, "Cross-check the table driven block CRC of crc16.asm against the bitwise CRC"},
+    { "tables", 't', 0, OPTION_ARG_OPTIONAL, "Print the CRC tables in the format of crc16.asm"},
     { 0 }
 };
 
@@ -49,6 +53,57 @@ uint16_t crc16_update(uint16_t crc, uint8_t a)
 }
 
 
+/*
+ * The CRC tables of crc16.asm, split into low and high bytes
+ */
+uint8_t crc16_table_l[256];
+uint8_t crc16_table_h[256];
+
+void crc16_tables(void)
+{
+	for (int i = 0; i < 256; i++) {
+		uint16_t t = crc16_update(0, i);
+		crc16_table_l[i] = t;
+		crc16_table_h[i] = t >> 8;
+	}
+}
+
+
+/*
+ * Same algorithm as crc16_block() in crc16.asm: an odd byte first,
+ * then pairs of bytes with the CRC split into low and high byte
+ */
+uint16_t crc16_block(uint16_t crc, const uint8_t *v, uint16_t len)
+{
+	uint8_t lo = crc, hi = crc >> 8, idx;
+	uint16_t pairs = len >> 1;
+
+	if (len & 1) {
+		idx = *v++ ^ lo;
+		lo = crc16_table_l[idx] ^ hi;
+		hi = crc16_table_h[idx];
+	}
+	while (pairs--) {
+		idx = *v++ ^ lo;
+		lo = crc16_table_l[idx] ^ hi;
+		hi = crc16_table_h[idx];
+		idx = *v++ ^ lo;
+		lo = crc16_table_l[idx] ^ hi;
+		hi = crc16_table_h[idx];
+	}
+	return hi << 8 | lo;
+}
+
+
+void print_table(const char *name, uint8_t *t)
+{
+	printf("%s:\n", name);
+	for (int i = 0; i < 256; i++)
+		printf("%s#0x%02x%s", i % 8 ? " " : "\t.byte ", t[i], i % 8 == 7 ? "\n" : ",");
+	printf("\n");
+}
+
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state)
 {
 	struct arguments *arguments = state->input;
@@ -59,6 +114,12 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 	case 'v':
 		arguments->verify = true;
 		break;
+	case 'c':
+		arguments->check = true;
+		break;
+	case 't':
+		arguments->tables = true;
+		break;
 	case 'o':
 		arguments->output_file = arg;
 		break;
@@ -88,8 +149,17 @@ int main(int argc, char **argv)
 	arguments.output_file = NULL;
 	arguments.update = false;
 	arguments.verify = false;
+	arguments.check = false;
+	arguments.tables = false;
 
 	argp_parse(&argp, argc, argv, 0, &arg_index, &arguments);
+
+	crc16_tables();
+	if (arguments.tables) {
+		print_table("crc16_table_l", crc16_table_l);
+		print_table("crc16_table_h", crc16_table_h);
+		return 0;
+	}
 	if (!arg_index)
 		argp_usage (0);
 
@@ -136,6 +206,24 @@ int main(int argc, char **argv)
 
 	printf("CRC16 is: 0x%04x\n", crc);
 
+	if (arguments.check) {
+		// Blocks of different length, odd and even, as the upload and boot code call it
+		uint16_t block_crc = 0;
+		int block = 1;
+		for (int i = 0; i < range; i += block, block = block % 600 + 1) {
+			if (block > range - i)
+				block = range - i;
+			block_crc = crc16_block(block_crc, (uint8_t *)buffer + i, block);
+		}
+		printf("Block CRC16 is: 0x%04x\n", block_crc);
+		if (block_crc != crc) {
+			printf("Block CRC differs\n");
+			return 5;
+		}
+		if (!arguments.verify)
+			return 0;
+	}
+
 	if (arguments.verify) {
 		if (crc == 0xb001) {
 			printf("Checksum OK\n");
@@ -34,6 +34,25 @@ int xbuf_p;
 bool addsDir = false;
 int callNum = 0;
 
+/*
+ * Entries of the routing table of the web-server: static files placed into
+ * the image and dynamic endpoints served by a handler function
+ */
+#define MAX_ENTRIES 255
+struct entry {
+	char path[256];
+	char def[256];		// Name used in the FDATA_ defines, static files only
+	const char *mime;
+	char handler[128];	// Handler function, dynamic endpoints only
+	unsigned int hash;
+};
+struct entry entries[MAX_ENTRIES];
+int n_entries;
+int slots[MAX_ENTRIES];
+unsigned char disp[MAX_ENTRIES];
+int n_buckets;
+unsigned int hash_seed;
+
 const char *argp_program_version = "fileadder 0.1";
 const char *argp_program_bug_address = "<git@logicog.de>";
 static char doc[] = "Adds a file or a directory of files into an image";
@@ -45,6 +64,7 @@ static struct argp_option options[] = {
     { "address", 'a', "SIZE", 0, "Address where data is placed, default is 0x1000000 if option is used, otherwise 0x1fd000"},
     { "prefix", 'p', "FILE", 0, "Prefix for header and index file generation"},
     { "bank", 'b', "BANKNAME", 0, "Generate #pragma with given bank-name"},
+    { "routes", 'r', "FILE", 0, "File listing dynamic endpoints and their handlers, added to the index"},
     { 0 }
 };
 
@@ -55,6 +75,7 @@ struct arguments {
 	char *data_file;
 	char *prefix;
 	char *bank;
+	char *routes;
 	bool overwrite;
 	bool add_zero;
 };
@@ -86,6 +107,9 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 	case 'b':
 		arguments->bank = arg? arg : "BANK1";
 		break;
+	case 'r':
+		arguments->routes = arg;
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
     }
@@ -151,10 +175,167 @@ char *getMime(const char *name)
 }
 
 
+/*
+ * FNV-1a hash over the data of a file as it is placed in the image. It is
+ * used as the entity tag of the file, so it changes whenever the content does
+ */
+unsigned int etag_hash(int addr, int len)
+{
+	unsigned int h = 0x811c9dc5;
+
+	for (int i = 0; i < len; i++) {
+		h ^= (unsigned char)buffer[addr + i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+
+/*
+ * Adds an entry to the routing table. A dynamic endpoint replaces a static
+ * file of the same path
+ */
+void add_entry(const char *path, const char *def, const char *mime, const char *handler)
+{
+	int i;
+
+	for (i = 0; i < n_entries; i++) {
+		if (strcmp(entries[i].path, path))
+			continue;
+		if (!handler) {
+			fprintf(stderr, "Duplicate entry %s\n", path);
+			exit(5);
+		}
+		printf("Endpoint %s replaces static file\n", path);
+		break;
+	}
+	if (i == n_entries) {
+		if (n_entries >= MAX_ENTRIES) {
+			fprintf(stderr, "Too many entries\n");
+			exit(5);
+		}
+		n_entries++;
+	}
+	snprintf(entries[i].path, sizeof(entries[i].path), "%s", path);
+	snprintf(entries[i].def, sizeof(entries[i].def), "%s", def ? def : "");
+	snprintf(entries[i].handler, sizeof(entries[i].handler), "%s", handler ? handler : "");
+	entries[i].mime = mime ? mime : "mime_TXT";
+}
+
+
+/*
+ * Reads the dynamic endpoints from a file with lines of the form
+ * "/path handler", empty lines and lines starting with # are ignored
+ */
+int read_routes(const char *name)
+{
+	char line[512], path[256], handler[128];
+	FILE *f = fopen(name, "r");
+
+	if (!f) {
+		fprintf(stderr, "%s: ", name);
+		perror("Cannot open routes file");
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%255s %127s", path, handler) != 2)
+			continue;
+		add_entry(path, NULL, NULL, handler);
+	}
+	fclose(f);
+	return 0;
+}
+
+
+/*
+ * Hash of a request path, this must be kept identical to find_entry() in httpd.c
+ */
+unsigned int route_hash(const char *s, unsigned int seed)
+{
+	unsigned int h = seed;
+
+	while (*s)
+		h = (((h << 5) + h) ^ (unsigned char)*s++) & 0xffff;
+	return h;
+}
+
+
+/*
+ * Tries to build a minimal perfect hash with the given seed using hash and
+ * displace: the high byte of the hash selects a bucket, the low byte plus
+ * the displacement of that bucket the slot in the table. Buckets are placed
+ * largest first, which makes finding displacements for the rest easy
+ */
+bool try_seed(unsigned int seed)
+{
+	int bucket_size[MAX_ENTRIES];
+	int order[MAX_ENTRIES];
+	int i, j, k, d;
+
+	memset(bucket_size, 0, sizeof(bucket_size));
+	for (i = 0; i < n_entries; i++) {
+		entries[i].hash = route_hash(entries[i].path, seed);
+		bucket_size[(entries[i].hash >> 8) % n_buckets]++;
+		slots[i] = -1;
+	}
+	for (i = 0; i < n_buckets; i++)
+		order[i] = i;
+	for (i = 0; i < n_buckets; i++) {
+		for (j = i + 1; j < n_buckets; j++) {
+			if (bucket_size[order[j]] > bucket_size[order[i]]) {
+				k = order[i]; order[i] = order[j]; order[j] = k;
+			}
+		}
+	}
+
+	for (i = 0; i < n_buckets; i++) {
+		int b = order[i];
+		disp[b] = 0;
+		if (!bucket_size[b])
+			continue;
+		for (d = 0; d < 256; d++) {
+			int placed[MAX_ENTRIES], n_placed = 0;
+			for (k = 0; k < n_entries; k++) {
+				if ((entries[k].hash >> 8) % n_buckets != b)
+					continue;
+				int slot = ((entries[k].hash + d) & 0xff) % n_entries;
+				if (slots[slot] >= 0)
+					break;
+				slots[slot] = k;
+				placed[n_placed++] = slot;
+			}
+			if (k == n_entries)
+				break;
+			while (n_placed)
+				slots[placed[--n_placed]] = -1;
+		}
+		if (d == 256)
+			return false;
+		disp[b] = d;
+	}
+	return true;
+}
+
+
+int build_hash(void)
+{
+	n_buckets = n_entries / 2 + 1;
+	for (hash_seed = 0; hash_seed < 0x10000; hash_seed++) {
+		if (try_seed(hash_seed))
+			return 0;
+	}
+	fprintf(stderr, "Cannot find a perfect hash for the index\n");
+	return -1;
+}
+
+
 int addidx(const char *name, int addr, int len)
 {
 	char s[256];
 	int i = 0;
+	unsigned int etag = etag_hash(addr, len);
 
 	while (name[i]) {
 		s[i] = name[i] == '.'? '_' : name[i];
@@ -164,9 +345,11 @@ int addidx(const char *name, int addr, int len)
 
 	defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "#define FDATA_START_%s 0x%x\n", s, addr);
 	defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "#define FDATA_SIZE_%s %d\n", s, len);
-	ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "  {\"/%s\", FDATA_START_%s, FDATA_SIZE_%s, %s},\n", name, s, s, getMime(name));
+	defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "#define FDATA_ETAG_%s \"%08x\"\n", s, etag);
+	snprintf(pathbuffer, PATH_SIZE, "/%s", name);
+	add_entry(pathbuffer, s, getMime(name), NULL);
 	if (!strcmp(name, "index.html"))
-		ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "  {\"/\", FDATA_START_%s, FDATA_SIZE_%s, mime_HTML},\n", s, s);
+		add_entry("/", s, "mime_HTML", NULL);
 	return 0;
 }
 
@@ -227,6 +410,7 @@ int main(int argc, char **argv)
 	arguments.overwrite = true;
 	arguments.prefix = 0;
 	arguments.bank = NULL;
+	arguments.routes = NULL;
 
 	argp_parse(&argp, argc, argv, 0, &arg_index, &arguments);
 	if (!arg_index)
@@ -269,7 +453,7 @@ int main(int argc, char **argv)
 	defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "#include <stdint.h>\n\n");
 	defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p,
 			     "typedef enum mime_type_e {\n  mime_HTML = 0,\n  mime_SVG,\n  mime_ICO,\n  mime_PNG,\n  mime_JS,\n  mime_CSS,\n  mime_TXT\n} mime_type_t;\n\n");
-	defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "struct f_data {\n  __code char *file;\n  uint32_t start;\n  uint16_t len;\n  mime_type_t mime;\n};\n\n");
+	defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "struct f_data {\n  __code char *file;\n  uint32_t start;\n  uint16_t len;\n  mime_type_t mime;\n  __code char *etag;\n  void (*handler)(void);\n};\n\n");
 	// defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "typedef uint16_t (* fcall_ptr)(void);\n\n");
 
 	ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "// This file is automatically generated, do not edit!\n\n");
@@ -279,7 +463,6 @@ int main(int argc, char **argv)
 		ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "#pragma codeseg %s\n#pragma constseg %s\n\n", arguments.bank, arguments.bank);
 	ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, " __code char * __code mime_strings[] = {\n  \"text/html\",\n  \"image/svg+xml\",\n"
 		"  \"image/svg+xml\",\n  \"image/png\",\n  \"text/javascript\",\n  \"text/css\",\n  \"text/plain\"};\n\n");
-	ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "__code struct f_data f_data[] = {\n");
 	// fbuf_p += snprintf(&fbuf[fbuf_p], DEF_SIZE - fbuf_p, "\n__code fcall_ptr f_calls[] = {\n");
 
 	// Now that the beginning of the buffer is filled with out image, optionally resize the image
@@ -334,7 +517,36 @@ int main(int argc, char **argv)
 		}
 	}
 
-	ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "  {0, 0, 0}\n};\n");
+	if (addsDir && arguments.routes && read_routes(arguments.routes))
+		return 5;
+
+	// The index is a table ordered by the slots of a perfect hash over the paths
+	if (addsDir && n_entries) {
+		if (build_hash())
+			return 5;
+		for (int i = 0; i < n_entries; i++) {
+			if (entries[i].handler[0])
+				ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "void %s(void);\n", entries[i].handler);
+		}
+		ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "\n__code struct f_data f_data[FDATA_ENTRIES] = {\n");
+		for (int i = 0; i < n_entries; i++) {
+			struct entry *e = &entries[slots[i]];
+			if (e->handler[0])
+				ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "  {\"%s\", 0, 0, %s, 0, %s},\n", e->path, e->mime, e->handler);
+			else
+				ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "  {\"%s\", FDATA_START_%s, FDATA_SIZE_%s, %s, FDATA_ETAG_%s, 0},\n",
+						   e->path, e->def, e->def, e->mime, e->def);
+		}
+		ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "};\n\n__code uint8_t f_disp[FDATA_BUCKETS] = {");
+		for (int i = 0; i < n_buckets; i++)
+			ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "%s%d", i ? ", " : "", disp[i]);
+		ibuf_p += snprintf(&ibuf[ibuf_p], INDEX_SIZE - ibuf_p, "};\n");
+
+		defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "\n#define FDATA_ENTRIES %d\n", n_entries);
+		defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "#define FDATA_BUCKETS %d\n", n_buckets);
+		defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "#define FDATA_SEED 0x%04x\n", hash_seed);
+		printf("Index of %d entries, hash seed 0x%04x\n", n_entries, hash_seed);
+	}
 	// fbuf_p += snprintf(&fbuf[fbuf_p], DEF_SIZE - fbuf_p, "};\n");
 	defbuf_p += snprintf(&dbuf[defbuf_p], DEF_SIZE - defbuf_p, "#endif\n");
 
@@ -0,0 +1,178 @@
+/*
+ * Feeds random requests to the HTTP request parser of the firmware on the
+ * host. Request lines, headers and bodies are built from pieces the parser
+ * looks for and from random bytes, then passed byte by byte like the
+ * segments from uIP. The state of the request is followed by a guard area,
+ * writing beyond buf or leaving an offset outside of it is reported.
+ * Build with -fsanitize=address,undefined to also catch reads.
+ *
+ * Usage: http_fuzz [requests] [seed]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define __xdata
+#define __code
+#define __banked
+
+// The firmware has its own versions of these
+#define memcpy fw_memcpy
+#define memset fw_memset
+#define strlen fw_strlen
+#include "../httpd/http_parser.c"
+#undef memcpy
+#undef memset
+#undef strlen
+
+#include <string.h>
+
+#define GUARD_SIZE	32
+#define GUARD_BYTE	0xa5
+#define REQ_MAX		4096
+
+char session_id[SESSION_ID_LENGTH + 1] = "0123456789ab";
+uint8_t boundary_buf[BOUNDARY_SIZE] = "\r\n--XyZ";
+uint8_t *boundary = boundary_buf;
+
+struct guarded_req {
+	struct http_req r;
+	uint8_t guard[GUARD_SIZE];
+} g;
+
+uint8_t req[REQ_MAX];
+uint16_t req_len;
+
+static const char *methods[] = { "GET", "POST", "PUT", "POSTX", "G", "" };
+static const char *paths[] = { "/cmd", "/login", "/upload", "/config", "/status.json?x=1", "/" };
+static const char *names[] = { "Content-Type", "content-length", "COOKIE", "If-None-Match", "Host", "X-Very-Long-Header-Name-Beyond-Max" };
+static const char *ctypes[] = { "multipart/form-data; boundary=XyZ", "application/octet-stream", "text/plain" };
+
+
+static void add(const char *s, uint16_t len)
+{
+	while (len-- && req_len < REQ_MAX)
+		req[req_len++] = *s++;
+}
+
+
+static void add_s(const char *s)
+{
+	add(s, strlen(s));
+}
+
+
+static void add_random(uint16_t len)
+{
+	while (len-- && req_len < REQ_MAX) {
+		uint8_t c = rand();
+		// Mostly printable, so that values grow rather than end at once
+		req[req_len++] = rand() % 8 ? ' ' + c % 95 : c;
+	}
+}
+
+
+static void add_eol(void)
+{
+	add_s(rand() % 4 ? "\r\n" : "\n");
+}
+
+
+static void make_request(void)
+{
+	uint16_t body = rand() % 300;
+	char n[16];
+
+	req_len = 0;
+	add_s(methods[rand() % 6]);
+	add_s(" ");
+	add_s(paths[rand() % 6]);
+	add_random(rand() % 4 ? rand() % 8 : rand() % 250);
+	add_s(" HTTP/1.1");
+	add_eol();
+	for (int h = rand() % 10; h; h--) {
+		const char *name = names[rand() % 6];
+		add_s(name);
+		add_s(": ");
+		if (!strcmp(name, "content-length")) {
+			snprintf(n, sizeof(n), "%u", body);
+			add_s(n);
+		} else if (!strcmp(name, "Content-Type") && rand() % 2) {
+			add_s(ctypes[rand() % 3]);
+		} else if (!strcmp(name, "COOKIE") && rand() % 2) {
+			add_s("a=b; session=");
+			add_s(session_id);
+		}
+		add_random(rand() % 3 ? rand() % 20 : rand() % 250);
+		add_eol();
+	}
+	add_eol();
+	// A multipart body with the octet stream, or random bytes
+	if (rand() % 4 == 0) {
+		add_s("--XyZ\r\nContent-Type: application/octet-stream\r\n\r\n");
+		add_random(body);
+		add_s("\r\n--XyZ--\r\n");
+	} else {
+		add_random(body);
+	}
+}
+
+
+static void check(uint32_t n)
+{
+	struct http_req *r = &g.r;
+	const char *what = 0;
+
+	for (int i = 0; i < GUARD_SIZE; i++) {
+		if (g.guard[i] != GUARD_BYTE)
+			what = "write beyond buf";
+	}
+	if (r->len >= HTTP_BUF_SIZE)
+		what = "len beyond buf";
+	if (r->query >= HTTP_BUF_SIZE || r->ctype >= HTTP_BUF_SIZE || r->inm >= HTTP_BUF_SIZE
+	    || r->body >= HTTP_BUF_SIZE)
+		what = "offset beyond buf";
+	if (!what)
+		return;
+	printf("Request %u: %s, state %d len %d\n", n, what, r->state, r->len);
+	fwrite(req, 1, req_len, stdout);
+	printf("\n");
+	exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+	uint32_t requests = argc > 1 ? strtoul(argv[1], 0, 0) : 100000;
+	uint32_t results[HP_ERROR + 1] = { 0 };
+
+	srand(argc > 2 ? strtoul(argv[2], 0, 0) : 1);
+
+	for (uint32_t n = 0; n < requests; n++) {
+		uint8_t res = HP_MORE;
+
+		make_request();
+		memset(g.guard, GUARD_BYTE, GUARD_SIZE);
+		http_init(&g.r);
+		for (uint16_t i = 0; i < req_len && (res == HP_MORE || res == HP_HEADER); i++) {
+			res = http_parse(&g.r, req[i]);
+			check(n);
+			if (res != HP_HEADER)
+				continue;
+			// A GET is handled once its header is complete
+			if (g.r.method != HTTP_POST)
+				break;
+			// What handle_post() does with the header
+			if (rand() % 2)
+				res = http_collect(&g.r);
+			else
+				http_multipart(&g.r);
+			check(n);
+		}
+		results[res]++;
+	}
+	printf("%u requests: %u incomplete, %u header, %u body, %u data, %u error\n", requests,
+	       results[HP_MORE], results[HP_HEADER], results[HP_BODY], results[HP_DATA], results[HP_ERROR]);
+	return 0;
+}
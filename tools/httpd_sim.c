@@ -52,6 +52,7 @@ const struct l2_entry l2_entries[12] = {
 };
 
 time_t last_called;
+int state_gen; // Bumped by every command, like the configuration changes on the device
 time_t last_session_use;
 
 uint64_t txG[PORTS], txB[PORTS], rxG[PORTS], rxB[PORTS];
@@ -125,6 +126,14 @@ void send_basic_info(int socket)
 	write(socket, response, strlen(response));
 }
 
+void send_upload(int socket)
+{
+	char *response = "HTTP/1.1 200 OK\r\n"
+		    "Content-Type: application/json; charset=UTF-8\r\n\r\n"
+			"{\"state\":\"idle\",\"length\":0,\"received\":0,\"written\":0,\"rate\":0}";
+	write(socket, response, strlen(response));
+}
+
 void send_vlan(int s, int vlan)
 {
 	struct json_object *v;
@@ -145,6 +154,68 @@ void send_vlan(int s, int vlan)
 }
 
 
+/*
+ * Adds the status fields of port i to the port object v
+ */
+void status_port(struct json_object *v, int i, time_t now)
+{
+	json_object_object_add(v, "logPort", json_object_new_int(physToLogPort[i-1]));
+	json_object_object_add(v, "isSFP", json_object_new_int(i <= PORTS - NSFP ? 0 : 1));
+	json_object_object_add(v, "enabled", json_object_new_int((i % 4) ? 1 : 0));
+	json_object_object_add(v, "link", json_object_new_int(i % 2 ? ((i == 1)? 5 : 2) : 0));
+	if (i % 2) {
+		uint64_t rate = (i == 1) ? 2400000000 : 950000000;
+		txG[i-1] += rate * (now - last_called);
+		rxG[i-1] += rate * (now - last_called);
+		txB[i-1] += rate * (now - last_called) / 10000000;
+		rxB[i-1] += rate * (now - last_called) / 10000000;
+	}
+	sprintf(txG_buff, "0x%016lx", txG[i-1]);
+	sprintf(txB_buff, "0x%016lx", txB[i-1]);
+	sprintf(rxG_buff, "0x%016lx", rxG[i-1]);
+	sprintf(rxB_buff, "0x%016lx", rxB[i-1]);
+	json_object_object_add(v, "txG", json_object_new_string(txG_buff));
+	json_object_object_add(v, "txB", json_object_new_string(txB_buff));
+	json_object_object_add(v, "rxG", json_object_new_string(rxG_buff));
+	json_object_object_add(v, "rxB", json_object_new_string(rxB_buff));
+	if (i >= PORTS - NSFP) {
+		uint16_t temp = 0x28fb + rand() / (RAND_MAX / 100);
+		uint16_t vcc = 0x7eda + rand() / (RAND_MAX / 100);
+		uint16_t txbias = 0x0d24 +rand() / (RAND_MAX / 100);
+		uint16_t txpower = 0x14bd + rand() / (RAND_MAX / 100);
+		uint16_t rxpower = 0;
+		uint16_t laser = 0;
+		uint16_t options = 0x68;
+		
+		sprintf(sfp_options, "0x%02x", options);
+		sprintf(sfp_temp, "0x%04x", temp);
+		sprintf(sfp_vcc, "0x%04x", vcc);
+		sprintf(sfp_txbias, "0x%04x", txbias);
+		sprintf(sfp_txpower, "0x%04x", txpower);
+		sprintf(sfp_rxpower, "0x%04x", rxpower);
+		sprintf(sfp_laser, "0x%04x", laser);
+		json_object_object_add(v, "sfp_vendor", json_object_new_string("OEM"));
+		json_object_object_add(v, "sfp_model", json_object_new_string("10G-SFP+"));
+		json_object_object_add(v, "sfp_serial", json_object_new_string("12345678"));
+		json_object_object_add(v, "sfp_options", json_object_new_string(sfp_options));
+		json_object_object_add(v, "sfp_temp", json_object_new_string(sfp_temp));
+		json_object_object_add(v, "sfp_vcc", json_object_new_string(sfp_vcc));
+		json_object_object_add(v, "sfp_txbias", json_object_new_string(sfp_txbias));
+		json_object_object_add(v, "sfp_txpower", json_object_new_string(sfp_txpower));
+		json_object_object_add(v, "sfp_rxpower", json_object_new_string(sfp_rxpower));
+		json_object_object_add(v, "sfp_laser", json_object_new_string(sfp_laser));
+	} else {
+		if (i == 1)
+			json_object_object_add(v, "adv", json_object_new_string("100000"));
+		else if (i==2)
+			json_object_object_add(v, "adv", json_object_new_string("000011"));
+		else
+			json_object_object_add(v, "adv", json_object_new_string("000100"));
+		
+	}
+}
+
+
 void send_status(int s)
 {
 	struct json_object *ports, *v;
@@ -161,60 +232,7 @@ void send_status(int s)
 	for (int i = 1; i <= PORTS; i++) {
 		v = json_object_new_object();
 		json_object_object_add(v, "portNum", json_object_new_int(i));
-		json_object_object_add(v, "logPort", json_object_new_int(physToLogPort[i-1]));
-		json_object_object_add(v, "isSFP", json_object_new_int(i <= PORTS - NSFP ? 0 : 1));
-		json_object_object_add(v, "enabled", json_object_new_int((i % 4) ? 1 : 0));
-		json_object_object_add(v, "link", json_object_new_int(i % 2 ? ((i == 1)? 5 : 2) : 0));
-		if (i % 2) {
-			uint64_t rate = (i == 1) ? 2400000000 : 950000000;
-			txG[i-1] += rate * (now - last_called);
-			rxG[i-1] += rate * (now - last_called);
-			txB[i-1] += rate * (now - last_called) / 10000000;
-			rxB[i-1] += rate * (now - last_called) / 10000000;
-		}
-		sprintf(txG_buff, "0x%016lx", txG[i-1]);
-		sprintf(txB_buff, "0x%016lx", txB[i-1]);
-		sprintf(rxG_buff, "0x%016lx", rxG[i-1]);
-		sprintf(rxB_buff, "0x%016lx", rxB[i-1]);
-		json_object_object_add(v, "txG", json_object_new_string(txG_buff));
-		json_object_object_add(v, "txB", json_object_new_string(txB_buff));
-		json_object_object_add(v, "rxG", json_object_new_string(rxG_buff));
-		json_object_object_add(v, "rxB", json_object_new_string(rxB_buff));
-		if (i >= PORTS - NSFP) {
-			uint16_t temp = 0x28fb + rand() / (RAND_MAX / 100);
-			uint16_t vcc = 0x7eda + rand() / (RAND_MAX / 100);
-			uint16_t txbias = 0x0d24 +rand() / (RAND_MAX / 100);
-			uint16_t txpower = 0x14bd + rand() / (RAND_MAX / 100);
-			uint16_t rxpower = 0;
-			uint16_t laser = 0;
-			uint16_t options = 0x68;
-			
-			sprintf(sfp_options, "0x%02x", options);
-			sprintf(sfp_temp, "0x%04x", temp);
-			sprintf(sfp_vcc, "0x%04x", vcc);
-			sprintf(sfp_txbias, "0x%04x", txbias);
-			sprintf(sfp_txpower, "0x%04x", txpower);
-			sprintf(sfp_rxpower, "0x%04x", rxpower);
-			sprintf(sfp_laser, "0x%04x", laser);
-			json_object_object_add(v, "sfp_vendor", json_object_new_string("OEM"));
-			json_object_object_add(v, "sfp_model", json_object_new_string("10G-SFP+"));
-			json_object_object_add(v, "sfp_serial", json_object_new_string("12345678"));
-			json_object_object_add(v, "sfp_options", json_object_new_string(sfp_options));
-			json_object_object_add(v, "sfp_temp", json_object_new_string(sfp_temp));
-			json_object_object_add(v, "sfp_vcc", json_object_new_string(sfp_vcc));
-			json_object_object_add(v, "sfp_txbias", json_object_new_string(sfp_txbias));
-			json_object_object_add(v, "sfp_txpower", json_object_new_string(sfp_txpower));
-			json_object_object_add(v, "sfp_rxpower", json_object_new_string(sfp_rxpower));
-			json_object_object_add(v, "sfp_laser", json_object_new_string(sfp_laser));
-		} else {
-			if (i == 1)
-				json_object_object_add(v, "adv", json_object_new_string("100000"));
-			else if (i==2)
-				json_object_object_add(v, "adv", json_object_new_string("000011"));
-			else
-				json_object_object_add(v, "adv", json_object_new_string("000100"));
-			
-		}
+		status_port(v, i, now);
 		json_object_array_add(ports, v);
 	}
 	last_called = now;
@@ -250,6 +268,21 @@ void send_counters(int s, int port)
 }
 
 
+void eee_port(struct json_object *v, int i)
+{
+	uint8_t eee = 0;
+	eee |= 0x02;
+	char eee_buf[20];
+	sprintf(eee_buf, "%08b", eee);
+	json_object_object_add(v, "eee", json_object_new_string(eee_buf));
+	uint8_t eee_lp = 0;
+	eee_lp |= 0x04;
+	sprintf(eee_buf, "%08b", eee_lp);
+	json_object_object_add(v, "eee_lp", json_object_new_string(eee_buf));
+	json_object_object_add(v, "active", json_object_new_int((i % 2) ? 1 : 0));
+}
+
+
 void send_eee(int s)
 {
 	struct json_object *ports, *v;
@@ -262,16 +295,7 @@ void send_eee(int s)
 		v = json_object_new_object();
 		json_object_object_add(v, "portNum", json_object_new_int(i));
 		json_object_object_add(v, "isSFP", json_object_new_int(i < 5 ? 0 : 1));
-		uint8_t eee = 0;
-		eee |= 0x02;
-		char eee_buf[20];
-		sprintf(eee_buf, "%08b", eee);
-		json_object_object_add(v, "eee", json_object_new_string(eee_buf));
-		uint8_t eee_lp = 0;
-		eee_lp |= 0x04;
-		sprintf(eee_buf, "%08b", eee_lp);
-		json_object_object_add(v, "eee_lp", json_object_new_string(eee_buf));
-		json_object_object_add(v, "active", json_object_new_int((i % 2) ? 1 : 0));
+		eee_port(v, i);
 		json_object_array_add(ports, v);
 	}
 
@@ -283,15 +307,12 @@ void send_eee(int s)
 }
 
 
-void send_mirror(int s)
+struct json_object *mirror_json(void)
 {
 	uint16_t mirror_tx, mirror_rx = 0;
 	char mirror_tx_buf[20];
 	char mirror_rx_buf[20];
 	struct json_object *mirror;
-	const char *jstring;
-        char *header = "HTTP/1.1 200 OK\r\n"
-                         "Content-Type: application/json; charset=UTF-8\r\n\r\n";
 
 	mirror = json_object_new_object();
 	json_object_object_add(mirror, "mPort", json_object_new_int(1));
@@ -303,6 +324,16 @@ void send_mirror(int s)
 	sprintf(mirror_rx_buf, "%016b", mirror_rx);
 	json_object_object_add(mirror, "mirror_tx", json_object_new_string(mirror_tx_buf));
 	json_object_object_add(mirror, "mirror_rx", json_object_new_string(mirror_rx_buf));
+	return mirror;
+}
+
+
+void send_mirror(int s)
+{
+	struct json_object *mirror = mirror_json();
+	const char *jstring;
+        char *header = "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: application/json; charset=UTF-8\r\n\r\n";
 
         write(s, header, strlen(header));
 
@@ -357,14 +388,11 @@ void send_l2(int s, int idx)
 }
 
 
-void send_lag(int s)
+struct json_object *lag_json(void)
 {
 	char lag_buf[20];
 	struct json_object *lags = json_object_new_array_ext(4);
 	struct json_object *v;
-	const char *jstring;
-        char *header = "HTTP/1.1 200 OK\r\n"
-                         "Content-Type: application/json; charset=UTF-8\r\n\r\n";
 
 	for (int i = 0; i < 4; i++) {
 		v = json_object_new_object();
@@ -374,6 +402,17 @@ void send_lag(int s)
 		json_object_object_add(v, "hash", json_object_new_string("0x7e"));
 		json_object_array_add(lags, v);
 	}
+	return lags;
+}
+
+
+void send_lag(int s)
+{
+	struct json_object *lags = lag_json();
+	const char *jstring;
+        char *header = "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: application/json; charset=UTF-8\r\n\r\n";
+
         write(s, header, strlen(header));
 	
 	jstring = json_object_to_json_string_ext(lags, JSON_C_TO_STRING_PLAIN);
@@ -382,6 +421,15 @@ void send_lag(int s)
 }
 
 
+void mtu_port(struct json_object *v, int i)
+{
+	char mtu[8];
+
+	sprintf(mtu, "0x%04x", i % 2 ? 16383 : 1522);
+	json_object_object_add(v, "mtu", json_object_new_string(mtu));
+}
+
+
 void send_mtu(int s)
 {
 	struct json_object *mtus, *v;
@@ -390,12 +438,10 @@ void send_mtu(int s)
                          "Content-Type: application/json; charset=UTF-8\r\n\r\n";
 
 	mtus = json_object_new_array_ext(PORTS);
-	char mtu[8];
 	for (int i = 1; i <= PORTS; i++) {
 		v = json_object_new_object();
 		json_object_object_add(v, "portNum", json_object_new_int(i));
-		sprintf(mtu, "0x%04x", i % 2 ? 16383 : 1522);
-		json_object_object_add(v, "mtu", json_object_new_string(mtu));
+		mtu_port(v, i);
 		json_object_array_add(mtus, v);
 	}
         write(s, header, strlen(header));
@@ -406,6 +452,93 @@ void send_mtu(int s)
 }
 
 
+/*
+ * Aggregated status as sent by the device: the per-port sections status, mtu and eee
+ * are merged into one object per port, mirror and lag are sent as they are
+ */
+void send_dashboard(int s, char *sections)
+{
+	struct json_object *d, *ports, *v;
+	const char *jstring;
+        char *header = "HTTP/1.1 200 OK\r\n"
+		       "Cache-Control: no-cache\r\n"
+		       "Content-Type: application/json; charset=UTF-8\r\n\r\n";
+	bool status = strstr(sections, "status");
+	bool mtu = strstr(sections, "mtu");
+	bool eee = strstr(sections, "eee");
+
+	printf("Sending dashboard: %s\n", sections);
+	if (!status && !mtu && !eee && !strstr(sections, "mirror") && !strstr(sections, "lag"))
+		status = true;
+	time_t now = time(NULL);
+	now = last_called ? last_called + 1 : now;
+
+	d = json_object_new_object();
+	if (status || mtu || eee) {
+		ports = json_object_new_array_ext(PORTS);
+		for (int i = 1; i <= PORTS; i++) {
+			v = json_object_new_object();
+			json_object_object_add(v, "portNum", json_object_new_int(i));
+			if (status)
+				status_port(v, i, now);
+			else
+				json_object_object_add(v, "isSFP", json_object_new_int(i <= PORTS - NSFP ? 0 : 1));
+			if (mtu)
+				mtu_port(v, i);
+			if (eee && i <= PORTS - NSFP)
+				eee_port(v, i);
+			json_object_array_add(ports, v);
+		}
+		json_object_object_add(d, "ports", ports);
+	}
+	if (status)
+		last_called = now;
+	if (strstr(sections, "mirror"))
+		json_object_object_add(d, "mirror", mirror_json());
+	if (strstr(sections, "lag"))
+		json_object_object_add(d, "lag", lag_json());
+	json_object_object_add(d, "truncated", json_object_new_int(0));
+
+        write(s, header, strlen(header));
+	jstring = json_object_to_json_string_ext(d, JSON_C_TO_STRING_PLAIN);
+        write(s, jstring, strlen(jstring));
+	json_object_put(d);
+}
+
+
+/*
+ * Change notification as sent by the device. The simulator serves one request at a
+ * time and cannot hold a request until a change, so it asks the client to retry instead
+ */
+void send_events(int s, char *query)
+{
+	struct json_object *d, *changed;
+	const char *jstring;
+        char *header = "HTTP/1.1 200 OK\r\n"
+		       "Cache-Control: no-cache\r\n"
+		       "Content-Type: application/json; charset=UTF-8\r\n\r\n";
+	char *since = strstr(query, "since=");
+
+	printf("Events request: %s\n", query);
+	if (since && atoi(since + 6) == state_gen) {
+		char *response = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n\r\n";
+		write(s, response, strlen(response));
+		return;
+	}
+	d = json_object_new_object();
+	json_object_object_add(d, "gen", json_object_new_int(state_gen));
+	changed = json_object_new_array();
+	json_object_array_add(changed, json_object_new_string("config"));
+	json_object_object_add(d, "changed", changed);
+	json_object_object_add(d, "truncated", json_object_new_int(0));
+
+        write(s, header, strlen(header));
+	jstring = json_object_to_json_string_ext(d, JSON_C_TO_STRING_PLAIN);
+        write(s, jstring, strlen(jstring));
+	json_object_put(d);
+}
+
+
 void send_cmd_log(int s)
 {
         char *header = "HTTP/1.1 200 OK\r\n"
@@ -579,7 +712,30 @@ void launch(struct Server *server)
 
 			if (is_word(buffer, "GET")) {
 				scan_header(buffer);
-				if (!strncmp(&buffer[4], "/status.json", 12)) {
+				if (!strncmp(&buffer[4], "/dashboard.json", 15)) {
+					char *sections = &buffer[19];
+					int i = 0;
+					while (!isspace(sections[i]))
+						i++;
+					sections[i] = '\0';
+					printf("Dashboard request\n");
+					if (!authenticated)
+						send_unauthorized(new_socket);
+					else
+						send_dashboard(new_socket, sections);
+					goto done;
+				} else if (!strncmp(&buffer[4], "/events.json", 12)) {
+					char *query = &buffer[16];
+					int i = 0;
+					while (!isspace(query[i]))
+						i++;
+					query[i] = '\0';
+					if (!authenticated)
+						send_unauthorized(new_socket);
+					else
+						send_events(new_socket, query);
+					goto done;
+				} else if (!strncmp(&buffer[4], "/status.json", 12)) {
 					printf("Status request\n");
 					if (!authenticated)
 						send_unauthorized(new_socket);
@@ -600,6 +756,12 @@ void launch(struct Server *server)
 					else
 						send_basic_info(new_socket);
 					goto done;
+				} else if (!strncmp(&buffer[4], "/upload.json", 12)) {
+					if (!authenticated)
+						send_unauthorized(new_socket);
+					else
+						send_upload(new_socket);
+					goto done;
 				} else if (!strncmp(&buffer[4], "/mirror.json", 12)) {
 					printf("Mirror request\n");
 					if (!authenticated)
@@ -727,6 +889,7 @@ void launch(struct Server *server)
 					printf("CMD: %s\n", p + 4);
 					strcpy(cmd_history[cmd_ptr], p + 4);
 					cmd_ptr++;
+					state_gen++;
 					print_cmd_history();
 					char *response = "HTTP/1.1 200 OK\r\n"
 							"Content-Type: text/html\r\n\r\n"
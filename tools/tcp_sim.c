@@ -0,0 +1,453 @@
+/*
+ * Runs the uIP stack and uip-split of the firmware on the host against a
+ * modelled client, to measure the throughput of a bulk response. The server
+ * sends its response like the httpd in TSTATE_TX: one segment of uip_mss()
+ * and the next once it is acknowledged. The client acknowledges as a TCP
+ * with delayed ACK does: at once when more than the largest segment seen is
+ * unacknowledged or on a duplicate, otherwise when the delayed ACK timer
+ * fires. Linux also acknowledges at once at the start of a connection
+ * (quickack), this is not modelled.
+ *
+ * Time is simulated. The main loop of the firmware makes a pass every
+ * pass_us, handle_tx() then calls uip_periodic(), and sending a frame takes
+ * FRAME_US. Each response is sent once without and once with uip-split.
+ * The frames of both runs are written to a pcap file if one is given,
+ * with IPv4 packets as the link type.
+ *
+ * Usage: tcp_sim [bytes] [delack_ms] [pass_us] [pcap]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define __xdata
+#define __code
+#define __banked
+#define __critical
+
+// The applications of uIP are those of the simulation
+void sim_appcall(void);
+void sim_udp_appcall(void);
+#define UIP_APPCALL sim_appcall
+#define UIP_UDP_APPCALL sim_udp_appcall
+
+// From endian.h of the host, uip-conf.h means the little endian of uipopt.h
+#undef LITTLE_ENDIAN
+
+// The firmware has its own versions of these
+#define memcpy fw_memcpy
+#define memset fw_memset
+#define strlen fw_strlen
+#include "../uip/uip.c"
+#include "../uip/uip-split.c"
+#undef memcpy
+#undef memset
+#undef strlen
+
+#include <string.h>
+
+#define RTT_US		200
+#define FRAME_US	100
+#define CLIENT_WINDOW	64240
+#define CLIENT_MSS	1460
+#define FRAMES		64
+#define FRAME_SIZE	1600
+
+#define IPH_LEN		20
+#define TCPH_LEN	20
+
+__xdata uint8_t uip_buf[UIP_CONF_BUFFER_SIZE + 2];
+
+struct frame {
+	uint64_t t;		// Arrival at the other end
+	uint8_t to_server;
+	uint16_t len;
+	uint8_t data[FRAME_SIZE];
+};
+
+struct frame frames[FRAMES];
+uint8_t n_frames;
+
+uint64_t now;
+uint64_t server_free;
+uint8_t split;
+FILE *pcap;
+
+// The response of the server
+uint8_t response[0x10000];
+uint32_t resp_len, resp_sent, resp_acked, resp_inflight;
+uint64_t resp_start, resp_end;
+uint16_t segments;
+
+// The client
+uint16_t client_port;
+uint32_t cl_seq, cl_rcv_nxt, cl_unacked, cl_rcv_mss;
+uint64_t cl_delack_at;
+uint32_t delack_us;
+uint16_t delayed_acks, quick_acks;
+
+static const uint8_t server_ip[4] = { 192, 168, 2, 1 };
+static const uint8_t client_ip[4] = { 192, 168, 2, 2 };
+static const char request[] = "GET /main.js HTTP/1.1\r\nHost: 192.168.2.1\r\n\r\n";
+
+
+void fw_memcpy(void *dst, const void *src, uint16_t len)
+{
+	memmove(dst, src, len);
+}
+
+
+void fw_memset(uint8_t *dst, uint8_t v, uint8_t len)
+{
+	memset(dst, v, len);
+}
+
+
+static uint16_t chksum(uint32_t sum, const uint8_t *p, uint16_t len)
+{
+	for (uint16_t i = 0; i + 1 < len; i += 2)
+		sum += (p[i] << 8) | p[i + 1];
+	if (len & 1)
+		sum += p[len - 1] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+
+// The NIC of the firmware fills in the checksums, do so for the capture
+static void pcap_write(uint8_t *p, uint16_t len)
+{
+	uint32_t hdr[4] = { now / 1000000, now % 1000000, len, len };
+	uint16_t tcplen = len - IPH_LEN;
+	uint32_t sum;
+	uint16_t c;
+
+	if (!pcap)
+		return;
+	p[10] = p[11] = 0;
+	c = chksum(0, p, IPH_LEN);
+	p[10] = c >> 8;
+	p[11] = c;
+	p[IPH_LEN + 16] = p[IPH_LEN + 17] = 0;
+	sum = (p[12] << 8 | p[13]) + (p[14] << 8 | p[15]) + (p[16] << 8 | p[17]) + (p[18] << 8 | p[19]);
+	sum += UIP_PROTO_TCP + tcplen;
+	c = chksum(sum, p + IPH_LEN, tcplen);
+	p[IPH_LEN + 16] = c >> 8;
+	p[IPH_LEN + 17] = c;
+	fwrite(hdr, sizeof(hdr), 1, pcap);
+	fwrite(p, len, 1, pcap);
+}
+
+
+static void queue(uint64_t t, uint8_t to_server, uint8_t *p, uint16_t len)
+{
+	struct frame *f;
+
+	if (n_frames == FRAMES) {
+		printf("Too many frames in flight\n");
+		exit(1);
+	}
+	f = &frames[n_frames++];
+	f->t = t;
+	f->to_server = to_server;
+	f->len = len;
+	memcpy(f->data, p, len);
+	pcap_write(f->data, len);
+}
+
+
+// Called by uip_split_output(), the frame holds the Ethernet header of uip_arp_out()
+void tcpip_output(void)
+{
+	uint16_t len = uip_len - sizeof(struct uip_eth_hdr);
+
+	if (server_free < now)
+		server_free = now;
+	server_free += FRAME_US;
+	queue(server_free + RTT_US / 2, 0, &uip_buf[UIP_LLH_LEN], len);
+}
+
+
+// What uip_arp_out() and the callers of uip_split_output() in rtlplayground.c do
+static void server_output(void)
+{
+	if (!uip_len)
+		return;
+	uip_buf[UIP_LLH_LEN - 2] = 0x08;
+	uip_buf[UIP_LLH_LEN - 1] = 0x00;
+	uip_len += sizeof(struct uip_eth_hdr);
+	if (split)
+		uip_split_output();
+	else
+		tcpip_output();
+}
+
+
+static void server_send(void)
+{
+	resp_inflight = resp_len - resp_sent > uip_mss() ? uip_mss() : resp_len - resp_sent;
+	if (!resp_inflight)
+		return;
+	if (!resp_sent)
+		resp_start = now;
+	uip_send(response + resp_sent, resp_inflight);
+	segments++;
+}
+
+
+// The httpd, as in TSTATE_TX
+void sim_appcall(void)
+{
+	if (uip_acked() && resp_inflight) {
+		resp_sent += resp_inflight;
+		resp_acked = resp_sent;
+		resp_inflight = 0;
+		if (resp_acked == resp_len) {
+			resp_end = now;
+			uip_close();
+			return;
+		}
+		server_send();
+	} else if (uip_rexmit() && resp_inflight) {
+		uip_send(response + resp_sent, resp_inflight);
+	} else if (uip_newdata() && !resp_sent && !resp_inflight) {
+		server_send();
+	}
+}
+
+
+void sim_udp_appcall(void)
+{
+}
+
+
+void print_string(__code char *s)
+{
+	fputs(s, stdout);
+}
+
+
+static void client_send(uint8_t flags, const uint8_t *data, uint16_t len)
+{
+	uint8_t p[IPH_LEN + TCPH_LEN + 4 + sizeof(request)];
+	uint8_t *tcp = p + IPH_LEN;
+	uint8_t opt = flags & TCP_SYN ? 4 : 0;
+	uint16_t total = IPH_LEN + TCPH_LEN + opt + len;
+
+	memset(p, 0, sizeof(p));
+	p[0] = 0x45;
+	p[2] = total >> 8;
+	p[3] = total;
+	p[8] = 64;
+	p[9] = UIP_PROTO_TCP;
+	memcpy(p + 12, client_ip, 4);
+	memcpy(p + 16, server_ip, 4);
+	tcp[0] = client_port >> 8;
+	tcp[1] = client_port;
+	tcp[3] = 80;
+	tcp[4] = cl_seq >> 24;
+	tcp[5] = cl_seq >> 16;
+	tcp[6] = cl_seq >> 8;
+	tcp[7] = cl_seq;
+	tcp[8] = cl_rcv_nxt >> 24;
+	tcp[9] = cl_rcv_nxt >> 16;
+	tcp[10] = cl_rcv_nxt >> 8;
+	tcp[11] = cl_rcv_nxt;
+	tcp[12] = (TCPH_LEN + opt) << 2;
+	tcp[13] = flags;
+	tcp[14] = CLIENT_WINDOW >> 8;
+	tcp[15] = CLIENT_WINDOW & 0xff;
+	if (opt) {
+		tcp[20] = TCP_OPT_MSS;
+		tcp[21] = TCP_OPT_MSS_LEN;
+		tcp[22] = CLIENT_MSS >> 8;
+		tcp[23] = CLIENT_MSS & 0xff;
+	}
+	if (len)
+		memcpy(tcp + TCPH_LEN + opt, data, len);
+	cl_seq += len + (flags & (TCP_SYN | TCP_FIN) ? 1 : 0);
+	if (flags & TCP_ACK) {
+		cl_unacked = 0;
+		cl_delack_at = 0;
+	}
+	queue(now + RTT_US / 2, 1, p, total);
+}
+
+
+static void client_input(uint8_t *p, uint16_t len)
+{
+	uint8_t *tcp = p + IPH_LEN;
+	uint8_t flags = tcp[13];
+	uint32_t seq = tcp[4] << 24 | tcp[5] << 16 | tcp[6] << 8 | tcp[7];
+	uint16_t dlen = len - IPH_LEN - (tcp[12] >> 4) * 4;
+
+	if (flags & TCP_SYN) {
+		cl_rcv_nxt = seq + 1;
+		client_send(TCP_ACK | TCP_PSH, (const uint8_t *)request, sizeof(request) - 1);
+		return;
+	}
+	if (flags & TCP_FIN) {
+		cl_rcv_nxt = seq + dlen + 1;
+		client_send(TCP_ACK | TCP_FIN, 0, 0);
+		return;
+	}
+	if (!dlen)
+		return;
+	if (seq != cl_rcv_nxt) {
+		// A retransmission of what we have, acknowledge at once
+		quick_acks++;
+		client_send(TCP_ACK, 0, 0);
+		return;
+	}
+	cl_rcv_nxt += dlen;
+	cl_unacked += dlen;
+	if (dlen > cl_rcv_mss)
+		cl_rcv_mss = dlen;
+	if (cl_unacked > cl_rcv_mss) {
+		quick_acks++;
+		client_send(TCP_ACK, 0, 0);
+	} else if (!cl_delack_at) {
+		cl_delack_at = now + delack_us;
+	}
+}
+
+
+static void server_input(uint8_t *p, uint16_t len)
+{
+	memcpy(&uip_buf[UIP_LLH_LEN], p, len);
+	uip_len = len;
+	uip_input();
+	server_output();
+}
+
+
+// handle_tx() of a pass of the main loop
+static void server_pass(void)
+{
+	for (uint8_t i = 0; i < UIP_CONNS; i++) {
+		uip_periodic(i);
+		server_output();
+	}
+}
+
+
+static void run(uint8_t with_split, uint32_t pass_us)
+{
+	uint64_t next_pass = now;
+	uint16_t rexmit = uip_stat.tcp.rexmit;
+	uint16_t splits = uip_split_segments;
+
+	split = with_split;
+	resp_sent = resp_acked = resp_inflight = 0;
+	resp_start = resp_end = 0;
+	segments = delayed_acks = quick_acks = 0;
+	cl_seq = 1000;
+	cl_rcv_nxt = cl_unacked = cl_rcv_mss = 0;
+	cl_delack_at = 0;
+	client_port++;
+	client_send(TCP_SYN, 0, 0);
+
+	// Until the response is acknowledged or 10 minutes have passed
+	while (!resp_end && now < 600000000ULL) {
+		uint64_t t = next_pass;
+		int8_t f = -1;
+
+		for (uint8_t i = 0; i < n_frames; i++) {
+			if (frames[i].t < t) {
+				t = frames[i].t;
+				f = i;
+			}
+		}
+		if (cl_delack_at && cl_delack_at < t) {
+			t = cl_delack_at;
+			f = -2;
+		}
+		now = t;
+		if (f >= 0) {
+			struct frame fr = frames[f];
+
+			frames[f] = frames[--n_frames];
+			if (fr.to_server)
+				server_input(fr.data, fr.len);
+			else
+				client_input(fr.data, fr.len);
+		} else if (f == -2) {
+			delayed_acks++;
+			client_send(TCP_ACK, 0, 0);
+		} else {
+			server_pass();
+			next_pass += pass_us;
+		}
+	}
+
+	// Let the connection close
+	for (uint64_t end = now + 100000; now < end; now += pass_us) {
+		for (uint8_t i = 0; i < n_frames; i++) {
+			if (frames[i].t <= now) {
+				struct frame fr = frames[i];
+
+				frames[i--] = frames[--n_frames];
+				if (fr.to_server)
+					server_input(fr.data, fr.len);
+				else
+					client_input(fr.data, fr.len);
+			}
+		}
+		server_pass();
+	}
+	n_frames = 0;
+
+	if (!resp_end) {
+		printf("%-8s response of %u bytes not acknowledged\n", with_split ? "split:" : "single:", resp_len);
+		return;
+	}
+	printf("%-8s %u bytes in %.3f s, %.1f KB/s, %u segments, %u split, %u retransmitted, "
+	       "%u ACKs at once, %u delayed\n", with_split ? "split:" : "single:", resp_len,
+	       (resp_end - resp_start) / 1e6, resp_len / 1.024 / (resp_end - resp_start) * 1000,
+	       segments, uip_split_segments - splits, uip_stat.tcp.rexmit - rexmit, quick_acks, delayed_acks);
+}
+
+
+int main(int argc, char **argv)
+{
+	uint32_t pass_us;
+	uip_ipaddr_t addr;
+
+	resp_len = argc > 1 ? strtoul(argv[1], 0, 0) : 30000;
+	delack_us = (argc > 2 ? strtoul(argv[2], 0, 0) : 200) * 1000;
+	pass_us = argc > 3 ? strtoul(argv[3], 0, 0) : 1000;
+	if (argc > 4) {
+		uint32_t hdr[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 0xffff, 101 };
+
+		pcap = fopen(argv[4], "wb");
+		if (!pcap) {
+			perror(argv[4]);
+			return 1;
+		}
+		fwrite(hdr, sizeof(hdr), 1, pcap);
+	}
+	if (resp_len > sizeof(response) || !pass_us) {
+		printf("Usage: %s [bytes] [delack_ms] [pass_us] [pcap], at most %zu bytes\n", argv[0], sizeof(response));
+		return 1;
+	}
+	for (uint32_t i = 0; i < resp_len; i++)
+		response[i] = ' ' + i % 95;
+
+	uip_init();
+	uip_ipaddr(&addr, server_ip[0], server_ip[1], server_ip[2], server_ip[3]);
+	uip_sethostaddr(&addr);
+	uip_ipaddr(&addr, 255, 255, 255, 0);
+	uip_setnetmask(&addr);
+	uip_listen(HTONS(80));
+	client_port = 40000;
+
+	printf("Delayed ACK %u ms, a pass every %u us, %u us per frame, RTT %u us\n",
+	       delack_us / 1000, pass_us, FRAME_US, RTT_US);
+	run(0, pass_us);
+	run(1, pass_us);
+	if (pcap)
+		fclose(pcap);
+	return 0;
+}
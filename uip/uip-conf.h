@@ -90,11 +90,12 @@ typedef uint16_t u16_t;
 typedef unsigned short uip_stats_t;
 
 /**
- * Maximum number of TCP connections. TODO: Increase this, but also make the socket state/buffer per-connection.
+ * Maximum number of TCP connections. The httpd serves one request at a time
+ * from its output buffer, a second connection holds a waiting /events.json
  *
  * \hideinitializer
  */
-#define UIP_CONF_MAX_CONNECTIONS 1
+#define UIP_CONF_MAX_CONNECTIONS 2
 
 /**
  * Maximum number of listening TCP ports. TODO: increase this!
@@ -40,23 +40,33 @@
 #include "uip.h"
 #include "uip-fw.h"
 #include "uip_arch.h"
+#include "uip_arp.h"
 
 #pragma codeseg BANK1
 #pragma constseg BANK1
 
+/* Number of segments split, for the statistics of the web-server */
+__xdata u16_t uip_split_segments;
+
 #define BUF ((__xdata struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
 
+/* The frame handed over by uip_arp_out() holds the Ethernet header
+   in front of the IP packet, uip_len includes it */
+#define ETH_HLEN (sizeof(struct uip_eth_hdr))
+
 /*-----------------------------------------------------------------------------*/
 void
-uip_split_output(void)
+uip_split_output(void) __banked
 {
   u16_t tcplen, len1, len2;
 
-  /* We only try to split maximum sized TCP segments. */
-  if(BUF->proto == UIP_PROTO_TCP &&
-     uip_len == UIP_BUFSIZE - UIP_LLH_LEN) {
+  /* We only split TCP segments carrying enough data to be worth it.
+     uip_arp_out() may have replaced the packet with an ARP request. */
+  if(uip_buf[UIP_LLH_LEN - 2] == 0x08 && uip_buf[UIP_LLH_LEN - 1] == 0x00 &&
+     BUF->proto == UIP_PROTO_TCP &&
+     uip_len >= ETH_HLEN + UIP_TCPIP_HLEN + UIP_SPLIT_MIN) {
 
-    tcplen = uip_len - UIP_TCPIP_HLEN;
+    tcplen = uip_len - ETH_HLEN - UIP_TCPIP_HLEN;
     /* Split the segment in two. If the original packet length was
        odd, we make the second packet one byte larger. */
     len1 = len2 = tcplen / 2;
@@ -65,74 +75,42 @@ uip_split_output(void)
     }
 
     /* Create the first packet. This is done by altering the length
-       field of the IP header and updating the checksums. */
+       field of the IP header. The checksums are calculated by the
+       ASIC on transmission. */
     uip_len = len1 + UIP_TCPIP_HLEN;
-#if UIP_CONF_IPV6
-    /* For IPv6, the IP length field does not include the IPv6 IP header
-       length. */
-    BUF->len[0] = ((uip_len - UIP_IPH_LEN) >> 8);
-    BUF->len[1] = ((uip_len - UIP_IPH_LEN) & 0xff);
-#else /* UIP_CONF_IPV6 */
     BUF->len[0] = uip_len >> 8;
     BUF->len[1] = uip_len & 0xff;
-#endif /* UIP_CONF_IPV6 */
-    
-    /* Recalculate the TCP checksum. */
     BUF->tcpchksum = 0;
-//    BUF->tcpchksum = ~(uip_tcpchksum());
-
-#if !UIP_CONF_IPV6
-    /* Recalculate the IP checksum. */
     BUF->ipchksum = 0;
-//    BUF->ipchksum = ~(uip_ipchksum());
-#endif /* UIP_CONF_IPV6 */
-    
+    uip_len += ETH_HLEN;
+
     /* Transmit the first packet. */
-    /*    uip_fw_output();*/
     tcpip_output();
+    uip_split_segments++;
 
     /* Now, create the second packet. To do this, it is not enough to
        just alter the length field, but we must also update the TCP
-       sequence number and point the uip_appdata to a new place in
-       memory. This place is detemined by the length of the first
-       packet (len1). */
+       sequence number and move the second half of the data behind
+       the headers. */
     uip_len = len2 + UIP_TCPIP_HLEN;
-#if UIP_CONF_IPV6
-    /* For IPv6, the IP length field does not include the IPv6 IP header
-       length. */
-    BUF->len[0] = ((uip_len - UIP_IPH_LEN) >> 8);
-    BUF->len[1] = ((uip_len - UIP_IPH_LEN) & 0xff);
-#else /* UIP_CONF_IPV6 */
     BUF->len[0] = uip_len >> 8;
     BUF->len[1] = uip_len & 0xff;
-#endif /* UIP_CONF_IPV6 */
-    
-    /*    uip_appdata += len1;*/
-    memcpy(uip_appdata, (__xdata u8_t *)uip_appdata + len1, len2);
+    uip_len += ETH_HLEN;
+
+    memcpy(&uip_buf[UIP_LLH_LEN + UIP_TCPIP_HLEN], &uip_buf[UIP_LLH_LEN + UIP_TCPIP_HLEN + len1], len2);
 
     uip_add32(BUF->seqno, len1);
     BUF->seqno[0] = uip_acc32[0];
     BUF->seqno[1] = uip_acc32[1];
     BUF->seqno[2] = uip_acc32[2];
     BUF->seqno[3] = uip_acc32[3];
-    
-    /* Recalculate the TCP checksum. */
     BUF->tcpchksum = 0;
-//    BUF->tcpchksum = ~(uip_tcpchksum());
-
-#if !UIP_CONF_IPV6
-    /* Recalculate the IP checksum. */
     BUF->ipchksum = 0;
-//    BUF->ipchksum = ~(uip_ipchksum());
-#endif /* UIP_CONF_IPV6 */
 
     /* Transmit the second packet. */
-    /*    uip_fw_output();*/
     tcpip_output();
   } else {
-    /*    uip_fw_output();*/
     tcpip_output();
   }
-     
 }
 /*-----------------------------------------------------------------------------*/
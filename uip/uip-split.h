@@ -72,23 +72,35 @@
 #ifndef __UIP_SPLIT_H__
 #define __UIP_SPLIT_H__
 
+/**
+ * Minimum payload of a TCP segment to be split. Peers with delayed
+ * ACK acknowledge every second segment at once, a segment sent as
+ * two halves is therefore acknowledged without waiting for the
+ * delayed ACK timer.
+ */
+#ifndef UIP_SPLIT_MIN
+#define UIP_SPLIT_MIN 256
+#endif
+
 /**
  * Handle outgoing packets.
  *
- * This function inspects an outgoing packet in the uip_buf buffer and
- * sends it out using the uip_fw_output() function. If the packet is a
- * full-sized TCP segment it will be split into two segments and
- * transmitted separately. This function should be called instead of
- * the actual device driver output function, or the uip_fw_output()
- * function.
+ * This function inspects an outgoing frame in the uip_buf buffer and
+ * sends it out using the tcpip_output() function. If the frame holds
+ * a TCP segment of at least UIP_SPLIT_MIN bytes of data it will be
+ * split into two segments and transmitted separately. This function
+ * should be called instead of tcpip_output() after uip_arp_out() has
+ * added the Ethernet header.
  *
- * The headers of the outgoing packet is assumed to be in the uip_buf
- * buffer and the payload is assumed to be wherever uip_appdata
- * points. The length of the outgoing packet is assumed to be in the
- * uip_len variable.
+ * The headers and the payload of the outgoing packet are assumed to
+ * be in the uip_buf buffer. The length of the outgoing frame
+ * including the Ethernet header is assumed to be in the uip_len
+ * variable.
  *
  */
-void uip_split_output(void);
+void uip_split_output(void) __banked;
+
+extern __xdata u16_t uip_split_segments;
 
 #endif /* __UIP_SPLIT_H__ */
 
@@ -0,0 +1,4 @@
+#ifndef VERSION_H
+#define VERSION_H
+#define VERSION_SW "v2.0.0"
+#endif